@@ -0,0 +1,267 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "async_sync.h"
+
+#include <list>
+#include <mutex>
+
+namespace sev::impl::as {
+
+// Continuations of one primitive, under Mutex
+class Waiters
+{
+public:
+	Waiters(EventLoop *el) noexcept : Loop(el)
+	{
+
+	}
+
+protected:
+	errno_t add(std::list<EventFunctor> &to, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		try
+		{
+			to.emplace_back((const EventFunctorVt *)vt, ptr, forwardConstructor);
+		}
+		catch (const std::bad_alloc &)
+		{
+			return ENOMEM;
+		}
+		catch (...)
+		{
+			return EOTHER;
+		}
+		return SEV_ESUCCESS;
+	}
+
+	// Post the granted continuations in order, called without Mutex. A grant can't be taken back, so one that fails to post runs here
+	errno_t flush(std::list<EventFunctor> &ready) noexcept
+	{
+		errno_t res = SEV_ESUCCESS;
+		for (EventFunctor &f : ready)
+		{
+			if (!SEV_EventLoop_postFunctorUnbounded(Loop, f.vt()->get(), f.ptr(), f.vt()->get()->MoveConstructor))
+				continue;
+			ExceptionHandle eh;
+			errno_t eno = f(eh, *Loop);
+			if (eh.raised()) eno = eh.rethrow(std::nothrow);
+			if (!res) res = eno;
+		}
+		ready.clear();
+		return res; // The first error of a waiter that ran here
+	}
+
+	// Post a continuation granted right away, nothing is committed when that fails
+	errno_t post(const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		return SEV_EventLoop_postFunctorUnbounded(Loop, vt, ptr, forwardConstructor);
+	}
+
+	EventLoop *Loop;
+	std::mutex Mutex; // Only held for bookkeeping, never while posting or while a continuation runs
+	std::list<EventFunctor> Waiting; // List, so granting moves entries without allocating
+
+};
+
+class Semaphore : public Waiters
+{
+public:
+	Semaphore(EventLoop *el, ptrdiff_t count) noexcept : Waiters(el), Count(count)
+	{
+
+	}
+
+	errno_t acquire(const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			if (Count <= 0 || !Waiting.empty())
+				return add(Waiting, vt, ptr, forwardConstructor);
+			--Count;
+		}
+		errno_t eno = post(vt, ptr, forwardConstructor);
+		if (eno) release(1); // Give the unit back, possibly to a waiter that queued meanwhile
+		return eno;
+	}
+
+	bool tryAcquire() noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		if (Count <= 0 || !Waiting.empty())
+			return false;
+		--Count;
+		return true;
+	}
+
+	errno_t release(ptrdiff_t count) noexcept
+	{
+		std::list<EventFunctor> ready;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Count += count;
+			while (Count > 0 && !Waiting.empty())
+			{
+				ready.splice(ready.end(), Waiting, Waiting.begin());
+				--Count;
+			}
+		}
+		return flush(ready);
+	}
+	ptrdiff_t available() noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		return Count;
+	}
+
+	ptrdiff_t waiters() noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		return (ptrdiff_t)Waiting.size();
+	}
+
+private:
+	ptrdiff_t Count; // Free units
+
+};
+
+class Latch : public Waiters
+{
+public:
+	Latch(EventLoop *el, ptrdiff_t count) noexcept : Waiters(el), Count(count)
+	{
+
+	}
+
+	errno_t countDown(ptrdiff_t count) noexcept
+	{
+		std::list<EventFunctor> ready;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			if (count > Count)
+				return EINVAL;
+			Count -= count;
+			if (!Count)
+				ready.splice(ready.end(), Waiting);
+		}
+		return flush(ready);
+	}
+
+	errno_t wait(const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			if (Count)
+				return add(Waiting, vt, ptr, forwardConstructor);
+		}
+		return post(vt, ptr, forwardConstructor); // Zero stays zero
+	}
+
+	ptrdiff_t count() noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		return Count;
+	}
+
+private:
+	ptrdiff_t Count;
+
+};
+
+}
+
+SEV_AsyncSemaphore *SEV_AsyncSemaphore_create(SEV_EventLoop *el, ptrdiff_t count)
+{
+	if (!el || count < 0)
+		return null;
+	return new (std::nothrow) sev::impl::as::Semaphore(el, count);
+}
+
+void SEV_AsyncSemaphore_destroy(SEV_AsyncSemaphore *sem)
+{
+	delete sem;
+}
+
+errno_t SEV_AsyncSemaphore_acquireFunctor(SEV_AsyncSemaphore *sem, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return sem->acquire(vt, ptr, forwardConstructor);
+}
+
+bool SEV_AsyncSemaphore_tryAcquire(SEV_AsyncSemaphore *sem)
+{
+	return sem->tryAcquire();
+}
+
+errno_t SEV_AsyncSemaphore_release(SEV_AsyncSemaphore *sem, ptrdiff_t count)
+{
+	if (count < 0)
+		return EINVAL;
+	return sem->release(count);
+}
+
+ptrdiff_t SEV_AsyncSemaphore_available(SEV_AsyncSemaphore *sem)
+{
+	return sem->available();
+}
+
+ptrdiff_t SEV_AsyncSemaphore_waiters(SEV_AsyncSemaphore *sem)
+{
+	return sem->waiters();
+}
+
+SEV_Latch *SEV_Latch_create(SEV_EventLoop *el, ptrdiff_t count)
+{
+	if (!el || count < 0)
+		return null;
+	return new (std::nothrow) sev::impl::as::Latch(el, count);
+}
+
+void SEV_Latch_destroy(SEV_Latch *latch)
+{
+	delete latch;
+}
+
+errno_t SEV_Latch_countDown(SEV_Latch *latch, ptrdiff_t count)
+{
+	if (count < 0)
+		return EINVAL;
+	return latch->countDown(count);
+}
+
+errno_t SEV_Latch_waitFunctor(SEV_Latch *latch, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return latch->wait(vt, ptr, forwardConstructor);
+}
+
+ptrdiff_t SEV_Latch_count(SEV_Latch *latch)
+{
+	return latch->count();
+}
+
+/* end of file */
@@ -0,0 +1,234 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Asynchronous synchronization for loop tasks. Instead of blocking a worker, a waiter is a continuation functor,
+which is posted to the loop of the primitive once it may proceed. Waiters are resumed in the order they arrived.
+AsyncMutex is a semaphore with a single unit. Latch resumes all waiters once counted down to zero.
+
+*/
+
+#pragma once
+#ifndef SEV_ASYNC_SYNC_H
+#define SEV_ASYNC_SYNC_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+namespace sev::impl::as {
+class Semaphore;
+class Latch;
+}
+typedef sev::impl::as::Semaphore SEV_AsyncSemaphore;
+typedef sev::impl::as::Latch SEV_Latch;
+#else
+typedef struct SEV_AsyncSemaphore SEV_AsyncSemaphore;
+typedef struct SEV_Latch SEV_Latch;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SEV_LIB SEV_AsyncSemaphore *SEV_AsyncSemaphore_create(SEV_EventLoop *el, ptrdiff_t count); // Continuations are posted to el. Returns null when out of memory or for a negative count
+SEV_LIB void SEV_AsyncSemaphore_destroy(SEV_AsyncSemaphore *sem); // Waiters which were not resumed yet are discarded
+SEV_LIB errno_t SEV_AsyncSemaphore_acquireFunctor(SEV_AsyncSemaphore *sem, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el). Posted to the loop holding one unit, which it must release. When posting fails, the unit is given back and nothing is queued
+SEV_LIB bool SEV_AsyncSemaphore_tryAcquire(SEV_AsyncSemaphore *sem); // Take a unit right away, false when none is free or others are waiting
+SEV_LIB errno_t SEV_AsyncSemaphore_release(SEV_AsyncSemaphore *sem, ptrdiff_t count); // Hand the units to the first waiters, the rest become free. A granted waiter that fails to post runs on the calling thread
+SEV_LIB ptrdiff_t SEV_AsyncSemaphore_available(SEV_AsyncSemaphore *sem);
+SEV_LIB ptrdiff_t SEV_AsyncSemaphore_waiters(SEV_AsyncSemaphore *sem);
+
+SEV_LIB SEV_Latch *SEV_Latch_create(SEV_EventLoop *el, ptrdiff_t count); // Continuations are posted to el. Returns null when out of memory or for a negative count
+SEV_LIB void SEV_Latch_destroy(SEV_Latch *latch); // Waiters which were not resumed yet are discarded
+SEV_LIB errno_t SEV_Latch_countDown(SEV_Latch *latch, ptrdiff_t count); // Resumes the waiters when reaching zero, a waiter that fails to post runs on the calling thread. Returns EINVAL when counting past zero
+SEV_LIB errno_t SEV_Latch_waitFunctor(SEV_Latch *latch, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el). Posted to the loop once the count is zero, right away when it already is
+SEV_LIB ptrdiff_t SEV_Latch_count(SEV_Latch *latch);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+class AsyncSemaphore
+{
+public:
+	explicit AsyncSemaphore(EventLoop &el, ptrdiff_t count) : m(SEV_AsyncSemaphore_create(&el, count))
+	{
+		if (!m) throw std::bad_alloc();
+	}
+
+	~AsyncSemaphore() noexcept
+	{
+		SEV_AsyncSemaphore_destroy(m);
+	}
+
+	// Run f on the loop once a unit is held, f must release it
+	template<typename TFn>
+	void acquire(TFn &&f)
+	{
+		typedef std::decay_t<TFn> TFunc;
+		static const EventFunctorVt vt((const TFunc &)f);
+		TFunc &fr = f;
+		errno_t eno = SEV_AsyncSemaphore_acquireFunctor(m, vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	bool tryAcquire() noexcept
+	{
+		return SEV_AsyncSemaphore_tryAcquire(m);
+	}
+
+	void release(ptrdiff_t count = 1)
+	{
+		errno_t eno = SEV_AsyncSemaphore_release(m, count);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	ptrdiff_t available() const noexcept
+	{
+		return SEV_AsyncSemaphore_available(m);
+	}
+
+	ptrdiff_t waiters() const noexcept
+	{
+		return SEV_AsyncSemaphore_waiters(m);
+	}
+
+	SEV_AsyncSemaphore *get() const noexcept
+	{
+		return m;
+	}
+
+private:
+	AsyncSemaphore(const AsyncSemaphore &) = delete;
+	AsyncSemaphore &operator=(const AsyncSemaphore &) = delete;
+
+	SEV_AsyncSemaphore *m;
+
+};
+
+class AsyncMutex
+{
+public:
+	explicit AsyncMutex(EventLoop &el) : m(el, 1)
+	{
+
+	}
+
+	// Run f on the loop holding the lock, f must unlock
+	template<typename TFn>
+	void lock(TFn &&f)
+	{
+		m.acquire(std::forward<TFn>(f));
+	}
+
+	bool tryLock() noexcept
+	{
+		return m.tryAcquire();
+	}
+
+	void unlock()
+	{
+		m.release(1);
+	}
+
+	bool locked() const noexcept
+	{
+		return !m.available();
+	}
+
+private:
+	AsyncSemaphore m;
+
+};
+
+class Latch
+{
+public:
+	explicit Latch(EventLoop &el, ptrdiff_t count) : m(SEV_Latch_create(&el, count))
+	{
+		if (!m) throw std::bad_alloc();
+	}
+
+	~Latch() noexcept
+	{
+		SEV_Latch_destroy(m);
+	}
+
+	void countDown(ptrdiff_t count = 1)
+	{
+		errno_t eno = SEV_Latch_countDown(m, count);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	// Run f on the loop once the count is zero
+	template<typename TFn>
+	void wait(TFn &&f)
+	{
+		typedef std::decay_t<TFn> TFunc;
+		static const EventFunctorVt vt((const TFunc &)f);
+		TFunc &fr = f;
+		errno_t eno = SEV_Latch_waitFunctor(m, vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	ptrdiff_t count() const noexcept
+	{
+		return SEV_Latch_count(m);
+	}
+
+	SEV_Latch *get() const noexcept
+	{
+		return m;
+	}
+
+private:
+	Latch(const Latch &) = delete;
+	Latch &operator=(const Latch &) = delete;
+
+	SEV_Latch *m;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_ASYNC_SYNC_H */
+
+/* end of file */
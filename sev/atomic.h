@@ -36,15 +36,23 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifdef __cplusplus
 #include <atomic>
 #include <thread>
+#elif !defined(_WIN32)
+#include <sched.h>
 #endif
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+#ifdef _WIN32
 typedef volatile LONG SEV_AtomicInt32;
 typedef volatile ptrdiff_t SEV_AtomicPtrDiff;
 typedef volatile PVOID SEV_AtomicPtr;
+#else
+typedef volatile int32_t SEV_AtomicInt32;
+typedef volatile ptrdiff_t SEV_AtomicPtrDiff;
+typedef void *volatile SEV_AtomicPtr;
+#endif
 
 static_assert(sizeof(int32_t) == sizeof(SEV_AtomicInt32));
 static_assert(sizeof(ptrdiff_t) == sizeof(SEV_AtomicPtrDiff));
@@ -66,6 +74,8 @@ static SEV_FORCE_INLINE int32_t SEV_AtomicInt32_load(SEV_AtomicInt32 *src)
 	return ((std::atomic_int32_t *)src)->load();
 #elif defined(_WIN32)
 	return InterlockedCompareExchange(src, 0, 0);
+#elif defined(__GNUC__)
+	return __atomic_load_n(src, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -77,6 +87,8 @@ static SEV_FORCE_INLINE void SEV_AtomicInt32_store(SEV_AtomicInt32 *dst, int32_t
 	((std::atomic_int32_t *)dst)->store(val);
 #elif defined(_WIN32)
 	InterlockedExchange(dst, val);
+#elif defined(__GNUC__)
+	__atomic_store_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -86,6 +98,8 @@ static SEV_FORCE_INLINE int32_t SEV_AtomicInt32_exchange(SEV_AtomicInt32 *dst, i
 {
 #ifdef _WIN32
 	return InterlockedExchange(dst, val);
+#elif defined(__GNUC__)
+	return __atomic_exchange_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -95,6 +109,9 @@ static SEV_FORCE_INLINE int32_t SEV_AtomicInt32_compareExchange(SEV_AtomicInt32
 {
 #ifdef _WIN32
 	return InterlockedCompareExchange(dst, exch, comp);
+#elif defined(__GNUC__)
+	__atomic_compare_exchange_n(dst, &comp, exch, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comp; // Initial value, same as Interlocked
 #else
 	static_assert(false);
 #endif
@@ -104,6 +121,8 @@ static SEV_FORCE_INLINE int32_t SEV_AtomicInt32_increment(SEV_AtomicInt32 *var)
 {
 #ifdef _WIN32
 	return InterlockedIncrement(var);
+#elif defined(__GNUC__)
+	return __atomic_add_fetch(var, 1, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -113,6 +132,8 @@ static SEV_FORCE_INLINE int32_t SEV_AtomicInt32_decrement(SEV_AtomicInt32 *var)
 {
 #ifdef _WIN32
 	return InterlockedDecrement(var);
+#elif defined(__GNUC__)
+	return __atomic_sub_fetch(var, 1, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -124,6 +145,8 @@ static SEV_FORCE_INLINE ptrdiff_t SEV_AtomicPtrDiff_load(SEV_AtomicPtrDiff *src)
 	return ((std::atomic_ptrdiff_t *)src)->load();
 #elif defined(_WIN32)
 	return (ptrdiff_t)InterlockedCompareExchangePointer((volatile PVOID *)src, null,null);
+#elif defined(__GNUC__)
+	return __atomic_load_n(src, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -135,6 +158,8 @@ static SEV_FORCE_INLINE void SEV_AtomicPtrDiff_store(SEV_AtomicPtrDiff *dst, ptr
 	((std::atomic_ptrdiff_t *)dst)->store(val);
 #elif defined(_WIN32)
 	InterlockedExchangePointer((volatile PVOID *)dst, (PVOID)val);
+#elif defined(__GNUC__)
+	__atomic_store_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -144,6 +169,8 @@ static SEV_FORCE_INLINE ptrdiff_t SEV_AtomicPtrDiff_exchange(SEV_AtomicPtrDiff *
 {
 #ifdef _WIN32
 	return (ptrdiff_t)InterlockedExchangePointer((volatile PVOID *)dst, (PVOID)val);
+#elif defined(__GNUC__)
+	return __atomic_exchange_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -153,6 +180,9 @@ static SEV_FORCE_INLINE ptrdiff_t SEV_AtomicPtrDiff_compareExchange(SEV_AtomicPt
 {
 #ifdef _WIN32
 	return (ptrdiff_t)InterlockedCompareExchangePointer((volatile PVOID *)dst, (PVOID)exch, (PVOID)comp);
+#elif defined(__GNUC__)
+	__atomic_compare_exchange_n(dst, &comp, exch, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comp;
 #else
 	static_assert(false);
 #endif
@@ -162,6 +192,8 @@ static SEV_FORCE_INLINE ptrdiff_t SEV_AtomicPtrDiff_increment(SEV_AtomicPtrDiff
 {
 #ifdef _WIN32
 	return InterlockedIncrementSizeT(var);
+#elif defined(__GNUC__)
+	return __atomic_add_fetch(var, 1, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -171,6 +203,8 @@ static SEV_FORCE_INLINE ptrdiff_t SEV_AtomicPtrDiff_decrement(SEV_AtomicPtrDiff
 {
 #ifdef _WIN32
 	return InterlockedDecrementSizeT(var);
+#elif defined(__GNUC__)
+	return __atomic_sub_fetch(var, 1, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -182,6 +216,8 @@ static SEV_FORCE_INLINE void *SEV_AtomicPtr_load(SEV_AtomicPtr *src)
 	return (void *)((std::atomic_ptrdiff_t *)src)->load();
 #elif defined(_WIN32)
 	return (void *)InterlockedCompareExchangePointer(src, null,null);
+#elif defined(__GNUC__)
+	return __atomic_load_n(src, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -193,6 +229,8 @@ static SEV_FORCE_INLINE void SEV_AtomicPtr_store(SEV_AtomicPtr *dst, void *val)
 	((std::atomic_ptrdiff_t *)dst)->store((ptrdiff_t)val);
 #elif defined(_WIN32)
 	InterlockedExchangePointer(dst, val);
+#elif defined(__GNUC__)
+	__atomic_store_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -202,6 +240,8 @@ static SEV_FORCE_INLINE void *SEV_AtomicPtr_exchange(SEV_AtomicPtr *dst, void *v
 {
 #ifdef _WIN32
 	return InterlockedExchangePointer(dst, val);
+#elif defined(__GNUC__)
+	return __atomic_exchange_n(dst, val, __ATOMIC_SEQ_CST);
 #else
 	static_assert(false);
 #endif
@@ -211,6 +251,9 @@ static SEV_FORCE_INLINE void *SEV_AtomicPtr_compareExchange(SEV_AtomicPtr *dst,
 {
 #ifdef _WIN32
 	return InterlockedCompareExchangePointer(dst, exch, comp);
+#elif defined(__GNUC__)
+	__atomic_compare_exchange_n(dst, &comp, exch, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+	return comp;
 #else
 	static_assert(false);
 #endif
@@ -222,11 +265,26 @@ static SEV_FORCE_INLINE void SEV_Thread_yield()
 	std::this_thread::yield();
 #elif defined(_WIN32)
 	SwitchToThread();
+#elif defined(__GNUC__)
+	sched_yield();
 #else
 	static_assert(false);
 #endif
 }
 
+static SEV_FORCE_INLINE void SEV_Thread_pause() // Spin-wait hint to the CPU
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	_mm_pause();
+#elif defined(_MSC_VER) && (defined(_M_ARM) || defined(_M_ARM64))
+	__yield();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__arm__) || defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
 #endif /* #ifndef SEV_ATOMIC_H */
 
 /* end of file */
@@ -0,0 +1,284 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "blocking_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+namespace sev::impl::bp {
+
+struct Job
+{
+	EventLoop *Loop;
+	BlockingFunctor F;
+	IoFunctor Callback;
+
+};
+
+struct Thread
+{
+	std::thread Thread;
+	bool Done = false; // Under the pool mutex, left and ready to join
+
+};
+
+class Pool
+{
+public:
+	Pool(const SEV_BlockingPoolOptions &options) noexcept
+		: MaxThreads(options.MaxThreads ? options.MaxThreads : 64)
+		, MaxQueued(options.MaxQueued)
+		, IdleMs(options.IdleMs ? options.IdleMs : 10000)
+	{
+
+	}
+
+	~Pool() noexcept
+	{
+		std::vector<std::unique_ptr<Thread>> threads;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Stop = true;
+			Condition.notify_all();
+			threads.swap(Threads);
+		}
+		for (std::unique_ptr<Thread> &t : threads)
+			t->Thread.join();
+	}
+
+	errno_t offload(Job &&job) noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		if (MaxQueued && (int)Jobs.size() >= MaxQueued)
+		{
+			++Rejected;
+			return EAGAIN;
+		}
+		try
+		{
+			Jobs.push_back(std::move(job));
+		}
+		catch (const std::bad_alloc &)
+		{
+			return ENOMEM;
+		}
+		PeakQueued = std::max(PeakQueued, (int)Jobs.size());
+		if (Idle >= (int)Jobs.size() || Running >= MaxThreads || start())
+			Condition.notify_one(); // An idle thread takes it, or it waits for one to finish
+		return SEV_ESUCCESS;
+	}
+
+	void stats(SEV_BlockingPoolStats &stats) noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		stats.Threads = Running;
+		stats.Busy = Busy;
+		stats.Queued = (int)Jobs.size();
+		stats.PeakQueued = PeakQueued;
+		stats.Completed = Completed;
+		stats.Rejected = Rejected;
+	}
+
+private:
+	// Start a thread, under the mutex. Returns an error when none could be started, the job then waits for a running one
+	errno_t start() noexcept
+	{
+		for (size_t i = 0; i < Threads.size();)
+		{
+			if (Threads[i]->Done)
+			{
+				Threads[i]->Thread.join();
+				Threads.erase(Threads.begin() + i);
+				continue;
+			}
+			++i;
+		}
+		try
+		{
+			Threads.push_back(std::make_unique<Thread>());
+			Thread *t = Threads.back().get();
+			t->Thread = std::thread(&Pool::work, this, t);
+		}
+		catch (const std::bad_alloc &)
+		{
+			Threads.pop_back();
+			return ENOMEM;
+		}
+		catch (const std::system_error &)
+		{
+			Threads.pop_back();
+			return EAGAIN;
+		}
+		++Running;
+		return SEV_ESUCCESS;
+	}
+
+	void work(Thread *t) noexcept
+	{
+		std::unique_lock<std::mutex> lock(Mutex);
+		for (;;)
+		{
+			if (Jobs.empty())
+			{
+				if (Stop)
+					break;
+				++Idle;
+				const bool timeout = Condition.wait_for(lock, std::chrono::milliseconds(IdleMs)) == std::cv_status::timeout;
+				--Idle;
+				if (timeout && Jobs.empty() && !Stop)
+					break;
+				continue;
+			}
+			std::optional<Job> job;
+			job.emplace(std::move(Jobs.front()));
+			Jobs.pop_front();
+			++Busy;
+			lock.unlock();
+			run(*job);
+			job.reset(); // Destroy the functors outside the lock
+			lock.lock();
+			--Busy;
+			++Completed;
+		}
+		--Running;
+		t->Done = true;
+	}
+
+	static void run(Job &job) noexcept
+	{
+		EventLoop &el = *job.Loop;
+		sev::ExceptionHandle eh;
+		ptrdiff_t res = eh.capture<ptrdiff_t>([&]() -> ptrdiff_t { return job.F(); });
+		if (eh.raised())
+		{
+			// Raise it on the loop, like an exception from a task
+			SEV_ExceptionHandle e = *(SEV_ExceptionHandle *)&eh;
+			*(SEV_ExceptionHandle *)&eh = null;
+			auto raise = [e](sev::EventLoop &) -> errno_t {
+				sev::ExceptionHandle eh(e);
+				eh.rethrow();
+				return SEV_ESUCCESS;
+			};
+			static const EventFunctorVt raiseVt(raise);
+			if (SEV_EventLoop_postFunctorUnbounded(&el, raiseVt.get(), &raise, raiseVt.get()->MoveConstructor))
+				SEV_Exception_discardEx(e); // Out of memory, nowhere to put it
+			return;
+		}
+		auto complete = [cb = std::move(job.Callback), res](sev::EventLoop &el) mutable -> errno_t {
+			return cb(el, res);
+		};
+		static const EventFunctorVt completeVt(complete);
+		SEV_EventLoop_postFunctorUnbounded(&el, completeVt.get(), &complete, completeVt.get()->MoveConstructor); // Past the loop capacity, the call was accepted when it was offloaded. Out of memory drops the completion, there's no caller left to tell
+	}
+
+	std::mutex Mutex;
+	std::condition_variable Condition;
+	std::deque<Job> Jobs;
+	std::vector<std::unique_ptr<Thread>> Threads;
+	const int MaxThreads;
+	const int MaxQueued;
+	const int IdleMs;
+	int Running = 0; // Threads started and not yet left
+	int Idle = 0;
+	int Busy = 0;
+	int PeakQueued = 0;
+	int64_t Completed = 0;
+	int64_t Rejected = 0;
+	bool Stop = false;
+
+};
+
+}
+
+SEV_BlockingPool *SEV_BlockingPool_create(const SEV_BlockingPoolOptions *options)
+{
+	SEV_BlockingPoolOptions defaults = {};
+	if (!options) options = &defaults;
+	if (options->MaxThreads < 0 || options->MaxQueued < 0 || options->IdleMs < 0)
+		return null;
+	return new (std::nothrow) sev::impl::bp::Pool(*options);
+}
+
+void SEV_BlockingPool_destroy(SEV_BlockingPool *pool)
+{
+	delete pool;
+}
+
+SEV_BlockingPool *SEV_BlockingPool_default()
+{
+	static SEV_BlockingPool *s_Default = SEV_BlockingPool_create(null); // Leaked, loops may still offload while statics are destroyed
+	return s_Default;
+}
+
+errno_t SEV_BlockingPool_offloadFunctor(SEV_BlockingPool *pool, SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *cbVt, void *cbPtr, void(*cbForwardConstructor)(void *ptr, void *other))
+{
+	if (!pool || !el)
+		return EINVAL;
+	try
+	{
+		return pool->offload({ el,
+			sev::BlockingFunctor((const sev::BlockingFunctorVt *)vt, ptr, forwardConstructor),
+			sev::IoFunctor((const sev::IoFunctorVt *)cbVt, cbPtr, cbForwardConstructor) });
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+}
+
+errno_t SEV_BlockingPool_stats(SEV_BlockingPool *pool, SEV_BlockingPoolStats *stats)
+{
+	if (!pool || !stats)
+		return EINVAL;
+	pool->stats(*stats);
+	return SEV_ESUCCESS;
+}
+
+errno_t SEV_EventLoop_offloadFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *cbVt, void *cbPtr, void(*cbForwardConstructor)(void *ptr, void *other))
+{
+	SEV_BlockingPool *pool = SEV_BlockingPool_default();
+	if (!pool)
+		return ENOMEM;
+	return SEV_BlockingPool_offloadFunctor(pool, el, vt, ptr, forwardConstructor, cbVt, cbPtr, cbForwardConstructor);
+}
+
+/* end of file */
@@ -0,0 +1,178 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Blocking pool. Threads for calls which block, such as file I/O, name lookups, or compression, so they don't hold up a loop worker.
+The call runs on a pool thread, and its result is posted to the event loop it came from as a completion callback.
+Threads are started on demand up to the concurrency limit, and leave again after idling. The queue of waiting calls can be bounded.
+
+*/
+
+#pragma once
+#ifndef SEV_BLOCKING_POOL_H
+#define SEV_BLOCKING_POOL_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+namespace sev::impl::bp {
+class Pool;
+}
+typedef sev::impl::bp::Pool SEV_BlockingPool;
+#else
+typedef struct SEV_BlockingPool SEV_BlockingPool;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SEV_BlockingPoolOptions
+{
+	int MaxThreads; // Calls running at once, 0 for 64
+	int MaxQueued; // Calls waiting for a thread before offloading fails with EAGAIN, 0 for no limit
+	int IdleMs; // Threads leave after idling this long, 0 for 10 seconds
+
+};
+
+struct SEV_BlockingPoolStats
+{
+	int Threads; // Started and not yet left
+	int Busy; // Running a call
+	int Queued; // Waiting for a thread
+	int PeakQueued; // Highest Queued so far
+	int64_t Completed;
+	int64_t Rejected; // Offloads refused because the queue was full
+
+};
+
+SEV_LIB SEV_BlockingPool *SEV_BlockingPool_create(const SEV_BlockingPoolOptions *options); // Options may be null for the defaults. Returns null when out of memory or for invalid options
+SEV_LIB void SEV_BlockingPool_destroy(SEV_BlockingPool *pool); // Blocks until the running and queued calls are done, their completions are still posted
+SEV_LIB SEV_BlockingPool *SEV_BlockingPool_default(); // Shared pool with the default options, created on first use and never destroyed. Returns null when out of memory
+
+SEV_LIB errno_t SEV_BlockingPool_offloadFunctor(SEV_BlockingPool *pool, SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *cbVt, void *cbPtr, void(*cbForwardConstructor)(void *ptr, void *other)); // Call ptrdiff_t() on a pool thread, then post errno_t(EventLoop &el, ptrdiff_t result) to el with what it returned. An exception from the call is raised on el instead of calling back. Returns EAGAIN when the queue is full
+SEV_LIB errno_t SEV_BlockingPool_stats(SEV_BlockingPool *pool, SEV_BlockingPoolStats *stats);
+
+SEV_LIB errno_t SEV_EventLoop_offloadFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *cbVt, void *cbPtr, void(*cbForwardConstructor)(void *ptr, void *other)); // Offload to the default pool
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+typedef FunctorVt<ptrdiff_t()> BlockingFunctorVt;
+typedef Functor<ptrdiff_t()> BlockingFunctor;
+typedef SEV_BlockingPoolOptions BlockingPoolOptions;
+typedef SEV_BlockingPoolStats BlockingPoolStats;
+
+namespace impl::bp {
+
+template<typename TFn, typename TCb>
+errno_t offload(SEV_BlockingPool *pool, EventLoop &el, TFn &&f, TCb &&cb)
+{
+	typedef std::decay_t<TFn> TFunc;
+	typedef std::decay_t<TCb> TCallback;
+	static const BlockingFunctorVt vt((const TFunc &)f);
+	static const IoFunctorVt cbVt((const TCallback &)cb);
+	TFunc &fr = f;
+	TCallback &cbr = cb;
+	return SEV_BlockingPool_offloadFunctor(pool, &el,
+		vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor,
+		cbVt.get(), &cbr, std::is_rvalue_reference_v<TCb &&> ? cbVt.get()->MoveConstructor : cbVt.get()->CopyConstructor);
+}
+
+}
+
+class BlockingPool
+{
+public:
+	explicit BlockingPool(int maxThreads = 0, int maxQueued = 0, int idleMs = 0)
+	{
+		SEV_BlockingPoolOptions options{ maxThreads, maxQueued, idleMs };
+		m = SEV_BlockingPool_create(&options);
+		if (!m) throw std::bad_alloc();
+	}
+
+	~BlockingPool() noexcept
+	{
+		SEV_BlockingPool_destroy(m);
+	}
+
+	// ptrdiff_t f() runs on a pool thread, errno_t cb(EventLoop &el, ptrdiff_t result) on el
+	template<typename TFn, typename TCb>
+	void offload(EventLoop &el, TFn &&f, TCb &&cb)
+	{
+		errno_t eno = impl::bp::offload(m, el, std::forward<TFn>(f), std::forward<TCb>(cb));
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	BlockingPoolStats stats() const noexcept
+	{
+		BlockingPoolStats res;
+		SEV_BlockingPool_stats(m, &res);
+		return res;
+	}
+
+	SEV_BlockingPool *get() const noexcept
+	{
+		return m;
+	}
+
+private:
+	BlockingPool(const BlockingPool &) = delete;
+	BlockingPool &operator=(const BlockingPool &) = delete;
+
+	SEV_BlockingPool *m;
+
+};
+
+// Offload to the default pool
+template<typename TFn, typename TCb>
+void offload(EventLoop &el, TFn &&f, TCb &&cb)
+{
+	SEV_BlockingPool *pool = SEV_BlockingPool_default();
+	if (!pool) throw std::bad_alloc();
+	errno_t eno = impl::bp::offload(pool, el, std::forward<TFn>(f), std::forward<TCb>(cb));
+	if (eno == ENOMEM) throw std::bad_alloc();
+	ExceptionHandle::rethrow(eno);
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_BLOCKING_POOL_H */
+
+/* end of file */
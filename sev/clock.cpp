@@ -0,0 +1,133 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "clock.h"
+
+#include <chrono>
+#include <thread>
+
+#ifndef _WIN32
+#include <time.h>
+#endif
+
+int64_t SEV_Clock_steadyNs()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+namespace sev::impl::clk {
+
+namespace {
+
+// Tick rate, and a pair of readings to line the ticks up with the steady clock
+struct Calibration
+{
+	double NsPerTick;
+	int64_t BaseNs;
+	int64_t BaseTicks;
+};
+
+const Calibration &calibration()
+{
+	static const Calibration calibration = []() -> Calibration {
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__) || defined(__aarch64__)
+		int64_t ns = SEV_Clock_steadyNs();
+		int64_t ticks = SEV_Clock_ticks();
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		int64_t endNs = SEV_Clock_steadyNs();
+		int64_t endTicks = SEV_Clock_ticks();
+		int64_t dns = endNs - ns;
+		int64_t dticks = endTicks - ticks;
+		return { dticks > 0 ? (double)dns / (double)dticks : 1.0, endNs, endTicks };
+#else
+		return { 1.0, 0, 0 };
+#endif
+	}();
+	return calibration;
+}
+
+}
+
+}
+
+double SEV_Clock_nsPerTick()
+{
+	return sev::impl::clk::calibration().NsPerTick;
+}
+
+int64_t SEV_Clock_fastNs()
+{
+	const sev::impl::clk::Calibration &c = sev::impl::clk::calibration();
+	return c.BaseNs + (int64_t)((double)(SEV_Clock_ticks() - c.BaseTicks) * c.NsPerTick);
+}
+
+int64_t SEV_Clock_coarseNs()
+{
+#if defined(__linux__)
+	timespec ts;
+	if (clock_gettime(CLOCK_MONOTONIC_COARSE, &ts))
+		return SEV_Clock_steadyNs();
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif defined(_WIN32)
+	return (int64_t)GetTickCount64() * 1000000;
+#else
+	return SEV_Clock_steadyNs();
+#endif
+}
+
+int64_t SEV_Clock_coarseResolutionNs()
+{
+#if defined(__linux__)
+	timespec ts;
+	if (clock_getres(CLOCK_MONOTONIC_COARSE, &ts))
+		return 1;
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#elif defined(_WIN32)
+	return 15625000; // Default timer interrupt period
+#else
+	return 1;
+#endif
+}
+
+int64_t SEV_Clock_threadCpuNs()
+{
+#ifdef _WIN32
+	FILETIME creation, exit, kernel, user;
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+		return 0;
+	return ((((int64_t)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) + (((int64_t)user.dwHighDateTime << 32) | user.dwLowDateTime)) * 100;
+#else
+	timespec ts;
+	if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts))
+		return 0;
+	return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+/* end of file */
@@ -0,0 +1,80 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Cheap monotonic tick counter for instrumentation. Reads the CPU timestamp counter where available, which is assumed to be invariant across cores.
+Convert tick differences to nanoseconds with SEV_Clock_nsPerTick, which is calibrated once against the steady clock.
+Code running on an event loop can read the time the loop cached for the current iteration with SEV_EventLoop_now instead.
+
+*/
+
+#pragma once
+#ifndef SEV_CLOCK_H
+#define SEV_CLOCK_H
+
+#include "platform.h"
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SEV_LIB int64_t SEV_Clock_steadyNs(); // Steady clock in nanoseconds, fallback for platforms without a readable counter
+SEV_LIB double SEV_Clock_nsPerTick(); // First call calibrates for about 10ms
+SEV_LIB int64_t SEV_Clock_threadCpuNs(); // CPU time used by the calling thread. A system call, too slow to read for every task
+SEV_LIB int64_t SEV_Clock_fastNs(); // Ticks scaled to nanoseconds, lined up with SEV_Clock_steadyNs at calibration. May drift from it by a few parts per million
+SEV_LIB int64_t SEV_Clock_coarseNs(); // Clock of the last scheduler tick, on the same base as SEV_Clock_steadyNs on Linux. Cheapest to read, only accurate to SEV_Clock_coarseResolutionNs
+SEV_LIB int64_t SEV_Clock_coarseResolutionNs();
+
+static SEV_FORCE_INLINE int64_t SEV_Clock_ticks()
+{
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+	return (int64_t)__rdtsc();
+#elif defined(__i386__) || defined(__x86_64__)
+	return (int64_t)__builtin_ia32_rdtsc();
+#elif defined(__aarch64__)
+	int64_t ticks;
+	__asm__ __volatile__("mrs %0, cntvct_el0" : "=r"(ticks));
+	return ticks;
+#else
+	return SEV_Clock_steadyNs();
+#endif
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* #ifndef SEV_CLOCK_H */
+
+/* end of file */
@@ -32,10 +32,14 @@ Doesn't work yet for multiple reads...
 */
 
 #include "concurrent_functor_queue.h"
+#include "functor.h"
+#include "trace.h"
 
 #include <thread>
 #include <mutex>
 #include <shared_mutex>
+#include <condition_variable>
+#include <vector>
 
 #define SEV_FUNCTOR_ALIGN_MODMASK ((ptrdiff_t)(SEV_FUNCTOR_ALIGN - 1))
 #define SEV_FUNCTOR_ALIGN_MASK (~(ptrdiff_t)(SEV_FUNCTOR_ALIGN - 1))
@@ -59,11 +63,15 @@ struct BlockPreamble
 #endif
 };
 
+const ptrdiff_t c_Ready = 1;
+const ptrdiff_t c_ReadyCounted = 2; // Taken from the capacity when pushed, given back when popped
+
 struct FunctorPreamble
 {
-	SEV_AtomicPtrDiff Ready;
+	SEV_AtomicPtrDiff Ready; // 0 until written, then c_Ready or c_ReadyCounted
 	const SEV_FunctorVt *Vt;
 	ptrdiff_t Size;
+	int64_t Ticks; // When pushed, if timestamped
 };
 
 #define SEV_BLOCK_PREAMBLE_SIZE (SEV_FUNCTOR_ALIGNED(sizeof(sev::BlockPreamble) + sizeof(sev::FunctorPreamble)))
@@ -80,7 +88,6 @@ struct FunctorPreamble
 
 void wipeBlockOnly(void *block)
 {
-	uint8_t *b = (uint8_t *)block;
 	BlockPreamble *blockPreamble = (BlockPreamble *)block;
 	blockPreamble->NextBlock = null;
 	blockPreamble->ReadIdx = blockPreamble->StartIdx;
@@ -105,7 +112,6 @@ void wipeBlock(void *block, const ptrdiff_t blockSize)
 void initBlock(void *block, const ptrdiff_t blockSize)
 {
 	const ptrdiff_t preambleSize = SEV_BLOCK_PREAMBLE_SIZE;
-	const ptrdiff_t unpadSize = SEV_BLOCK_UNPAD; // Spacing for allocator
 	const ptrdiff_t startAddr = SEV_FUNCTOR_ALIGNED((ptrdiff_t)block + preambleSize) - sizeof(sev::FunctorPreamble);
 	const ptrdiff_t startIdx = startAddr - (ptrdiff_t)block;
 	SEV_ASSERT(startIdx >= SEV_BLOCK_PREAMBLE_SIZE - sizeof(sev::FunctorPreamble));
@@ -114,6 +120,75 @@ void initBlock(void *block, const ptrdiff_t blockSize)
 	wipeBlock(block, blockSize);
 }
 
+// Bound on a queue, both units are counted once it exists, only the chosen one is enforced
+struct Capacity
+{
+	std::atomic<ptrdiff_t> Limit = 0; // 0 for no limit
+	std::atomic<bool> Bytes = false;
+	std::atomic<ptrdiff_t> Entries = 0;
+	std::atomic<ptrdiff_t> Size = 0;
+
+	std::atomic<int> Waiting = 0; // Blocked pushers and registered callbacks, checked by readers before taking the mutex
+	std::mutex Mutex;
+	std::condition_variable Space;
+	std::vector<Functor<void()>> OnSpace;
+
+	bool hasSpace() const noexcept
+	{
+		const ptrdiff_t limit = Limit.load();
+		return limit <= 0 || (Bytes.load() ? Size.load() : Entries.load()) < limit;
+	}
+
+	// Take units for a range, false when it does not fit
+	bool reserve(ptrdiff_t count, ptrdiff_t size, bool bounded) noexcept
+	{
+		const ptrdiff_t prevEntries = Entries.fetch_add(count);
+		const ptrdiff_t prevSize = Size.fetch_add(size);
+		const ptrdiff_t limit = Limit.load();
+		if (!bounded || limit <= 0)
+			return true;
+		const ptrdiff_t prev = Bytes.load() ? prevSize : prevEntries;
+		if (!prev || prev + (Bytes.load() ? size : count) <= limit)
+			return true;
+		Entries -= count;
+		Size -= size;
+		return false;
+	}
+
+	// Give units back, only for entries which took them, so entries queued before the capacity existed don't offset later ones
+	void release(ptrdiff_t count, ptrdiff_t size) noexcept
+	{
+		Entries -= count;
+		Size -= size;
+		if (Waiting.load() && hasSpace())
+			notify();
+	}
+
+	// Wake blocked pushers, and call the registered callbacks outside the mutex
+	void notify() noexcept
+	{
+		std::vector<Functor<void()>> onSpace;
+		{
+			std::unique_lock<std::mutex> lock(Mutex);
+			Space.notify_all();
+			onSpace.swap(OnSpace);
+			Waiting -= (int)onSpace.size();
+		}
+		for (Functor<void()> &f : onSpace)
+		{
+			try
+			{
+				f();
+			}
+			catch (...)
+			{
+				SEV_DEBUG_BREAK(); // Not allowed, and nowhere to pass it to
+			}
+		}
+	}
+
+};
+
 } /* anonymous namespace */
 } /* namespace sev */
 
@@ -149,6 +224,8 @@ errno_t SEV_ConcurrentFunctorQueue_init(SEV_ConcurrentFunctorQueue *me, ptrdiff_
 	me->AtomicWriteSwap = { 0, 0 };
 	me->DeleteLock = { 0, 0 };
 	me->BlockSize = blockSize;
+	me->Flags = 0;
+	me->Capacity = null;
 	me->ReadBlock = (uint8_t *)malloc(blockLimit);
 	if (!me->ReadBlock)
 	{
@@ -202,12 +279,116 @@ void SEV_ConcurrentFunctorQueue_release(SEV_ConcurrentFunctorQueue *me)
 			sev::FunctorPreamble *functorPreamble = (sev::FunctorPreamble *)(&block[i]);
 			if (!functorPreamble->Ready)
 				break; // No more remaining functors
-			functorPreamble->Vt->Destroy((void *)&block[ptrIdx]);
+			if (functorPreamble->Vt)
+				functorPreamble->Vt->Destroy((void *)&block[ptrIdx]);
 		}
 		uint8_t *nextBlock = (uint8_t *)blockPreamble->NextBlock;
 		free((void *)block);
 		block = nextBlock;
 	}
+
+	delete (sev::Capacity *)me->Capacity;
+#ifdef SEV_DEBUG
+	me->Capacity = null;
+#endif
+}
+
+void SEV_ConcurrentFunctorQueue_setFlags(SEV_ConcurrentFunctorQueue *me, int32_t flags)
+{
+	SEV_AtomicInt32_store(&me->Flags, flags);
+}
+
+int64_t SEV_ConcurrentFunctorQueue_pushTicks(const void *ptr)
+{
+	return ((const sev::FunctorPreamble *)ptr)[-1].Ticks; // Preamble is right in front of the functor
+}
+
+errno_t SEV_ConcurrentFunctorQueue_setCapacity(SEV_ConcurrentFunctorQueue *me, ptrdiff_t capacity, bool bytes)
+{
+	if (capacity < 0)
+		return EINVAL;
+	sev::Capacity *cap = (sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity);
+	if (!cap)
+	{
+		if (!capacity)
+			return 0;
+		sev::Capacity *alloc = new (std::nothrow) sev::Capacity();
+		if (!alloc)
+			return ENOMEM;
+		cap = (sev::Capacity *)SEV_AtomicPtr_compareExchange(&me->Capacity, alloc, null);
+		if (cap) delete alloc;
+		else cap = alloc;
+	}
+	cap->Bytes = bytes;
+	cap->Limit = capacity;
+	if (cap->Waiting.load() && cap->hasSpace())
+		cap->notify(); // May have been raised
+	return 0;
+}
+
+ptrdiff_t SEV_ConcurrentFunctorQueue_used(SEV_ConcurrentFunctorQueue *me, bool bytes)
+{
+	sev::Capacity *cap = (sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity);
+	if (!cap)
+		return 0;
+	return bytes ? cap->Size.load() : cap->Entries.load();
+}
+
+errno_t SEV_ConcurrentFunctorQueue_waitSpace(SEV_ConcurrentFunctorQueue *me, int timeoutMs)
+{
+	sev::Capacity *cap = (sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity);
+	if (!cap || cap->hasSpace())
+		return 0;
+	std::unique_lock<std::mutex> lock(cap->Mutex);
+	++cap->Waiting; // Before checking again, so a reader making space now either sees it, or we see the space
+	auto fin = gsl::finally([cap]() -> void { --cap->Waiting; });
+	auto hasSpace = [cap]() -> bool { return cap->hasSpace(); };
+	if (timeoutMs < 0)
+	{
+		cap->Space.wait(lock, hasSpace);
+		return 0;
+	}
+	return cap->Space.wait_for(lock, std::chrono::milliseconds(timeoutMs), hasSpace) ? 0 : ETIMEDOUT;
+}
+
+errno_t SEV_ConcurrentFunctorQueue_notifySpaceFunctor(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::Capacity *cap = (sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity);
+	if (!cap || cap->hasSpace())
+	{
+		try
+		{
+			sev::Functor<void()>((const sev::FunctorVt<void()> *)vt, ptr, forwardConstructor)();
+		}
+		catch (const std::bad_alloc &)
+		{
+			return ENOMEM;
+		}
+		catch (...)
+		{
+			return EOTHER;
+		}
+		return 0;
+	}
+	{
+		std::unique_lock<std::mutex> lock(cap->Mutex);
+		try
+		{
+			cap->OnSpace.emplace_back((const sev::FunctorVt<void()> *)vt, ptr, forwardConstructor);
+		}
+		catch (const std::bad_alloc &)
+		{
+			return ENOMEM;
+		}
+		catch (...)
+		{
+			return EOTHER;
+		}
+		++cap->Waiting;
+	}
+	if (cap->hasSpace())
+		cap->notify(); // Space was made before we were registered
+	return 0;
 }
 
 errno_t SEV_ConcurrentFunctorQueue_push(SEV_ConcurrentFunctorQueue *me, void(*f)(void *ptr, void *args), void *ptr, ptrdiff_t size) // Does a memcpy of the data ptr
@@ -227,7 +408,7 @@ errno_t SEV_ConcurrentFunctorQueue_push(SEV_ConcurrentFunctorQueue *me, void(*f)
 		// Call function from t
 		void *ptr = (void *)&d;
 		sev::FunctorPreamble *functorPreamble = &((sev::FunctorPreamble *)ptr)[-1];
-		TFn f = (TFn)((uint8_t *)ptr)[functorPreamble->Size - sizeof(TFn)];
+		TFn f = *(TFn *)(&((uint8_t *)ptr)[functorPreamble->Size - sizeof(sev::FunctorPreamble) - sizeof(TFn)]); // Size includes the preamble
 		f(ptr, args);
 	});
 	const ptrdiff_t totalSize = SEV_FUNCTOR_ALIGNED(sizeof(sev::FunctorPreamble) + size + sizeof(TFn)) - sizeof(sev::FunctorPreamble);
@@ -253,19 +434,57 @@ errno_t SEV_ConcurrentFunctorQueue_pushFunctor(SEV_ConcurrentFunctorQueue *me, c
 	}
 }
 
+errno_t SEV_ConcurrentFunctorQueue_pushFunctorWait(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs)
+{
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(max(timeoutMs, 0));
+	for (; ; )
+	{
+		errno_t eno = SEV_ConcurrentFunctorQueue_pushFunctor(me, vt, ptr, forwardConstructor);
+		if (eno != EAGAIN)
+			return eno;
+		int remainingMs = -1;
+		if (timeoutMs >= 0)
+		{
+			remainingMs = (int)std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remainingMs <= 0)
+				return ETIMEDOUT;
+		}
+		if (errno_t res = SEV_ConcurrentFunctorQueue_waitSpace(me, remainingMs))
+			return res;
+	}
+}
+
 std::unique_ptr<std::shared_mutex> m(std::make_unique<std::shared_mutex>());
 
-errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, ptrdiff_t size, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+namespace {
+
+// Reserve space for a range of entries at once, and construct them in order. The range must fit in one block. Sizes may be null to use the size from the vtables. Throws only if a forwardConstructor throws, the failed entry and the rest of the range are then skipped by readers
+errno_t pushRange(SEV_ConcurrentFunctorQueue *me, ptrdiff_t count, const SEV_FunctorVt *const *vts, const ptrdiff_t *sizes, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *pushed, bool bounded = true)
 {
 
 	// This function only locks while flipping to the next buffer
-	static_assert(sizeof(sev::BlockPreamble) + sizeof(sev::FunctorPreamble) < SEV_BLOCK_PREAMBLE_SIZE);
-	const ptrdiff_t sz = SEV_FUNCTOR_ALIGNED(size + sizeof(sev::FunctorPreamble)); // Pad
+	static_assert(sizeof(sev::BlockPreamble) + sizeof(sev::FunctorPreamble) <= SEV_BLOCK_PREAMBLE_SIZE);
+	auto entrySize = [&](ptrdiff_t i) -> ptrdiff_t {
+		return SEV_FUNCTOR_ALIGNED((sizes ? sizes[i] : vts[i]->Size) + sizeof(sev::FunctorPreamble)); // Pad
+	};
+	ptrdiff_t sz = 0;
+	for (ptrdiff_t i = 0; i < count; ++i)
+		sz += entrySize(i);
 	const ptrdiff_t blockSize = me->BlockSize;
 	const ptrdiff_t blockLimit = blockSize - SEV_BLOCK_UNPAD;
-	if (sz + SEV_BLOCK_PREAMBLE_SIZE > blockLimit)
+	if (sz + 2 * SEV_BLOCK_PREAMBLE_SIZE > blockLimit) // Start index of a block is less than twice the preamble size, depending on the alignment of the allocation
 		return ENOMEM;
 
+	// Count against the capacity up front, readers give it back per entry, including entries skipped after a throw
+	sev::Capacity *cap = (sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity);
+	if (cap && !cap->reserve(count, sz, bounded))
+		return EAGAIN;
+	bool reserved = cap;
+	const ptrdiff_t ready = cap ? sev::c_ReadyCounted : sev::c_Ready;
+	auto fin3 = gsl::finally([&]() -> void {
+		if (reserved) cap->release(count, sz); // Nothing was written
+	});
+
 	// Allocate a spare when done, allows us to malloc outside of the lock
 	bool outOfSpare = false;
 	auto fin2 = gsl::finally([me, blockSize, blockLimit, &outOfSpare]() -> void {
@@ -314,11 +533,13 @@ errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me,
 	bool debugLockedWriteSwap = false;
 	bool debugCanceledWriteSwap = false;
 	bool debugProcessedWriteSwap = false;
+	(void)debugEnteredAnyWhile, (void)debugLockedWriteSwap, (void)debugCanceledWriteSwap, (void)debugProcessedWriteSwap; // Only inspected in the debugger
 	do
 	{
 		++debugIterations;
 		bool debugEnteredWhile = false;
-		while (!locked && (idxMasked + sz > blockLimit || SEV_AtomicSharedMutex_isLocked(&me->AtomicWriteSwap)))
+		(void)debugEnteredWhile;
+		while (!locked && (idxMasked + sz >= blockLimit || SEV_AtomicSharedMutex_isLocked(&me->AtomicWriteSwap))) // Never fill up to the block size exactly, the next index would wrap into the same block
 		{
 			debugEnteredAnyWhile = true;
 			debugEnteredWhile = true;
@@ -406,6 +627,7 @@ errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me,
 				// Done
 				SEV_ASSERT(allocNextIdx == SEV_AtomicPtrDiff_load(&me->PreWriteIdx)); // Can not change during lock
 				SEV_AtomicSharedMutex_downgradeLock(&me->AtomicWriteSwap);
+				if (sev::impl::tr::enabled()) SEV_Trace_instant("block flip", null);
 				idx = allocIdx;
 				idxMasked = allocIdxMasked;
 				block.ptr = allocBlock.ptr;
@@ -454,30 +676,94 @@ errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me,
 	SEV_ASSERT(me->WriteBlock == block.ptr);
 #endif
 
-	ptrdiff_t ptrIdx = idxMasked + sizeof(sev::FunctorPreamble);
-	sev::FunctorPreamble *functorPreamble = (sev::FunctorPreamble *)&block.data[idxMasked];
-	SEV_ASSERT(!SEV_AtomicPtrDiff_load(&functorPreamble->Ready)); // Check against duplicate allocation
-	functorPreamble->Vt = vt;
-	functorPreamble->Size = sz; // Size including preamble and post-padding
-	SEV_ASSERT(((ptrdiff_t)&block.data[ptrIdx] & SEV_FUNCTOR_ALIGN_MASK) == (ptrdiff_t)&block.data[ptrIdx]); // Check alignment
-	SEV_ASSERT(SEV_FUNCTOR_ALIGNED((ptrdiff_t)block.ptr + ptrIdx) == (ptrdiff_t)block.ptr + ptrIdx);
-
-	// Prepare commit, just in case write throws
+	reserved = false;
+	const int64_t ticks = (SEV_AtomicInt32_load(&me->Flags) & SEV_CONCURRENT_FUNCTOR_QUEUE_TIMESTAMP) ? SEV_Clock_ticks() : 0;
+	ptrdiff_t i = 0;
 	auto fin = gsl::finally([&]() -> void {
+		// Commit what remains of the range as skipped entries when a write throws, readers must not block on them
+		for (; i < count; ++i)
+		{
+			sev::FunctorPreamble *functorPreamble = (sev::FunctorPreamble *)&block.data[idxMasked];
+			functorPreamble->Vt = null;
+			functorPreamble->Size = entrySize(i);
+			if (SEV_AtomicPtrDiff_exchange(&functorPreamble->Ready, ready))
+				SEV_DEBUG_BREAK(); // Duplicate allocation!
+			idxMasked += functorPreamble->Size;
+		}
+	});
+	for (; i < count; ++i)
+	{
+		ptrdiff_t ptrIdx = idxMasked + sizeof(sev::FunctorPreamble);
+		sev::FunctorPreamble *functorPreamble = (sev::FunctorPreamble *)&block.data[idxMasked];
+		SEV_ASSERT(!SEV_AtomicPtrDiff_load(&functorPreamble->Ready)); // Check against duplicate allocation
+		functorPreamble->Vt = vts[i];
+		functorPreamble->Size = entrySize(i); // Size including preamble and post-padding
+		functorPreamble->Ticks = ticks;
+		SEV_ASSERT(((ptrdiff_t)&block.data[ptrIdx] & SEV_FUNCTOR_ALIGN_MASK) == (ptrdiff_t)&block.data[ptrIdx]); // Check alignment
+		SEV_ASSERT(SEV_FUNCTOR_ALIGNED((ptrdiff_t)block.ptr + ptrIdx) == (ptrdiff_t)block.ptr + ptrIdx);
+
+		// Really write
+		forwardConstructors[i]((void *)&block.data[ptrIdx], ptrs[i]);
+
 		// Commit
-		if (SEV_AtomicPtrDiff_exchange(&functorPreamble->Ready, 1))
+		if (SEV_AtomicPtrDiff_exchange(&functorPreamble->Ready, ready))
 			SEV_DEBUG_BREAK(); // Duplicate allocation!
 		SEV_ASSERT(me->WriteBlock == block.ptr);
-	});
+		idxMasked += functorPreamble->Size;
+		if (pushed) ++*pushed;
+	}
+
+	return 0;
+}
 
-	// Really write
-	forwardConstructor((void *)&block.data[ptrIdx], ptr);
+}
 
+errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, ptrdiff_t size, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return pushRange(me, 1, &vt, &size, &ptr, &forwardConstructor, null);
+}
+
+errno_t SEV_ConcurrentFunctorQueue_pushFunctorUnboundedEx(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, ptrdiff_t size, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return pushRange(me, 1, &vt, &size, &ptr, &forwardConstructor, null, false);
+}
+
+errno_t SEV_ConcurrentFunctorQueue_pushFunctors(SEV_ConcurrentFunctorQueue *me, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *pushed)
+{
+	ptrdiff_t done = 0;
+	auto fin = gsl::finally([&]() -> void {
+		if (pushed) *pushed = done;
+	});
+	const ptrdiff_t rangeLimit = me->BlockSize - SEV_BLOCK_UNPAD - 2 * SEV_BLOCK_PREAMBLE_SIZE;
+	try
+	{
+		while (done < count)
+		{
+			// Take as many entries as fit in one block
+			ptrdiff_t n = 0;
+			ptrdiff_t sz = 0;
+			while (done + n < count)
+			{
+				const ptrdiff_t entrySz = SEV_FUNCTOR_ALIGNED(vts[done + n]->Size + sizeof(sev::FunctorPreamble));
+				if (n && sz + entrySz > rangeLimit)
+					break;
+				sz += entrySz;
+				++n;
+			}
+			if (errno_t res = pushRange(me, n, vts + done, null, ptrs + done, forwardConstructors + done, &done))
+				return res;
+		}
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
 	return 0;
 }
 
 errno_t SEV_ConcurrentFunctorQueue_tryCallAndPop(SEV_ConcurrentFunctorQueue *me, void *args)
 {
+	(void)me, (void)args;
 	/*
 	void *err;
 	const SEV_FunctorVt *vt;
@@ -561,6 +847,7 @@ SEV_LIB errno_t SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(SEV_Concurrent
 	});
 
 	bool debugTriedAgain = false;
+	(void)debugTriedAgain; // Only inspected in the debugger
 
 	for (; ; )
 	{
@@ -641,6 +928,14 @@ SEV_LIB errno_t SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(SEV_Concurrent
 				// Other thread already attempted to pop this entry
 				continue; // Check for the next entry
 			}
+			if (SEV_AtomicPtrDiff_load(&functorPreamble->Ready) == sev::c_ReadyCounted)
+				((sev::Capacity *)SEV_AtomicPtr_load(&me->Capacity))->release(1, functorPreamble->Size);
+			if (!functorPreamble->Vt)
+			{
+				// Skipped entry of a range that failed to construct
+				readIdx = nextReadIdx;
+				continue;
+			}
 
 			// We have a reading!
 			break;
@@ -40,6 +40,7 @@ Concurrent queue for arbitrary-sized functors with a fixed-size block allocator.
 #include "platform.h"
 #include "functor_view.h"
 #include "atomic_shared_mutex.h"
+#include "clock.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,28 +85,44 @@ struct SEV_ConcurrentFunctorQueue
 
 	SEV_AtomicPtrDiff PreWriteIdx; // 6* void*
 
-	ptrdiff_t ReservedPtr[2]; // Fix structure size to multiples of 32 for ABI stability
+	SEV_AtomicPtr Capacity; // Null until a capacity is first set
+	ptrdiff_t ReservedPtr[1]; // Fix structure size to multiples of 32 for ABI stability
 
 	SEV_AtomicSharedMutex AtomicWriteSwap;
 	SEV_AtomicSharedMutex DeleteLock; // 4* int
 
-	int32_t ReservedInt[4]; // Fix structure size to multiples of 32 for ABI stability
+	SEV_AtomicInt32 Flags; // SEV_CONCURRENT_FUNCTOR_QUEUE_*
+	int32_t ReservedInt[3]; // Fix structure size to multiples of 32 for ABI stability
 	// TODO: Add some malloc/free counters for perf
 	// SEV_AtomicInt32 PerfMAllocCounter;
 	// SEV_AtomicInt32 PerfFreeCounter;
 
 };
 
+// Record SEV_Clock_ticks in each entry when it is pushed
+#define SEV_CONCURRENT_FUNCTOR_QUEUE_TIMESTAMP 0x01
+
 SEV_LIB SEV_ConcurrentFunctorQueue *SEV_ConcurrentFunctorQueue_create(ptrdiff_t blockSize);
 SEV_LIB void SEV_ConcurrentFunctorQueue_destroy(SEV_ConcurrentFunctorQueue *concurrentFunctorQueue);
 
 SEV_LIB errno_t SEV_ConcurrentFunctorQueue_init(SEV_ConcurrentFunctorQueue *me, ptrdiff_t blockSize);
 SEV_LIB void SEV_ConcurrentFunctorQueue_release(SEV_ConcurrentFunctorQueue *me);
 
+SEV_LIB void SEV_ConcurrentFunctorQueue_setFlags(SEV_ConcurrentFunctorQueue *me, int32_t flags); // Applies to entries pushed after this call
+SEV_LIB int64_t SEV_ConcurrentFunctorQueue_pushTicks(const void *ptr); // Ticks when the entry at ptr was pushed, 0 if it was pushed without SEV_CONCURRENT_FUNCTOR_QUEUE_TIMESTAMP. Only valid for the ptr passed to the caller of tryCallAndPopFunctorEx
+
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_setCapacity(SEV_ConcurrentFunctorQueue *me, ptrdiff_t capacity, bool bytes); // Bound the queued entries, or the bytes they take in the blocks. Pushes past it return EAGAIN, a range larger than the capacity still goes into an empty queue. 0 for no limit, the default. May be set on a non-empty queue, entries queued before the first call are not counted
+SEV_LIB ptrdiff_t SEV_ConcurrentFunctorQueue_used(SEV_ConcurrentFunctorQueue *me, bool bytes); // Entries or bytes counted against the capacity, 0 if no capacity was ever set
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_waitSpace(SEV_ConcurrentFunctorQueue *me, int timeoutMs); // Block until the queue is below its capacity, -1 to wait indefinitely. Returns ETIMEDOUT
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_notifySpaceFunctor(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Call void() once, when the queue is below its capacity. Called right away on this thread if it is already, otherwise on the thread that pops the entry making space, before that entry runs. Must not throw or block
+
 SEV_LIB errno_t SEV_ConcurrentFunctorQueue_push(SEV_ConcurrentFunctorQueue *me, void(*f)(void *ptr, void *args), void *ptr, ptrdiff_t size); // Does a memcpy of the data ptr // TODO: errno_t return value on f
 SEV_LIB errno_t SEV_ConcurrentFunctorQueue_pushFunctor(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Returns EOTHER if forwardConstructor throws, returns ENOMEM in case of memory allocation failure, 0 if OK
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_pushFunctorWait(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs); // Like pushFunctor, but waits up to timeoutMs for space when full, -1 to wait indefinitely. Returns ETIMEDOUT
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_pushFunctors(SEV_ConcurrentFunctorQueue *me, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *pushed); // Push in order, reserving space for as many entries as fit in a block at once. Stops at the first error, same errors as pushFunctor. pushed receives the number of entries pushed, may be null
 #ifdef __cplusplus
 SEV_LIB errno_t SEV_ConcurrentFunctorQueue_pushFunctorEx(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, ptrdiff_t size, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Throws only if forwardConstructor throws
+SEV_LIB errno_t SEV_ConcurrentFunctorQueue_pushFunctorUnboundedEx(SEV_ConcurrentFunctorQueue *me, const SEV_FunctorVt *vt, ptrdiff_t size, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Push past the capacity, the entry is still counted. For work which was already accepted and must not be refused
 #endif
 
 // SEV_LIB errno_t SEV_ConcurrentFunctorQueue_tryCallAndPop(SEV_ConcurrentFunctorQueue *me, void *args); // Returns ENODATA if nothing to pop, EOTHER if function threw an exception; ENOMEM, 0 if OK
@@ -186,6 +203,22 @@ public:
 		return SEV_ConcurrentFunctorQueue_pushFunctorEx(&m, vt->get(), vt->size(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
 	}
 
+	inline errno_t pushUnbounded(std::nothrow_t, FunctorView<TRes(TArgs...)> &&fv) noexcept
+	{
+		const FunctorVt<TRes(TArgs...)> *vt;
+		void *ptr;
+		bool movable;
+		fv.extract(vt, ptr, movable, true);
+		return SEV_ConcurrentFunctorQueue_pushFunctorUnboundedEx(&m, vt->get(), vt->size(), ptr, movable ? vt->get()->MoveConstructor : vt->get()->CopyConstructor);
+	}
+
+	inline void setCapacity(ptrdiff_t capacity, bool bytes = false)
+	{
+		errno_t eno = SEV_ConcurrentFunctorQueue_setCapacity(&m, capacity, bytes);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
 	inline SEV_ConcurrentFunctorQueue *get() noexcept { return &m; }
 
 protected:
@@ -214,18 +247,45 @@ public:
 
 	inline TRes tryCallAndPop(ExceptionHandle &eh, bool &success, TArgs... args) noexcept
 	{
-		TRes res;
+		TRes res{}; // Returned as is when nothing was popped
 		const SEV_FunctorVt *rvt = null;
 		auto invokeData = [&](void *ptr, const SEV_FunctorVt *vt) -> errno_t {
-			typedef FunctorVt<TRes(TArgs...)>::TTryInvoke TFn; // typedef TRes(*TFn)(void *ptr, void **err, TArgs...);
+			typedef typename FunctorVt<TRes(TArgs...)>::TTryInvoke TFn; // typedef TRes(*TFn)(void *ptr, void **err, TArgs...);
+			rvt = vt;
+			res = ((TFn)vt->TryInvoke)(ptr, eh, args...);
+			return eh.raised() ? eh.errNo() : SEV_ESUCCESS;
+		};
+		static const FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)> wrapvt(invokeData);
+		typedef FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)>::TInvoke TInvoke;
+		static const TInvoke invokeCall = (TInvoke)wrapvt.get()->Invoke;
+		errno_t ec = SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(&this->m, invokeCall, (void *)(&invokeData));
+		success = rvt;
+		if (!eh.raised() && ec)
+		{
+			if (success) eh.capture(ec);
+			else if (ec != ENODATA) eh.capture(ec);
+		}
+		return res;
+	}
+
+	template<typename TStart>
+	inline TRes tryCallAndPop(ExceptionHandle &eh, bool &success, const SEV_FunctorVt *&rvt, int64_t &pushed, int64_t &started, const TStart &onStart, TArgs... args) noexcept // Also returns the vtable and the push ticks of the entry, and the ticks right before it was called. onStart(vt, started) runs right before the call
+	{
+		TRes res{};
+		rvt = null;
+		auto invokeData = [&](void *ptr, const SEV_FunctorVt *vt) -> errno_t {
+			typedef typename FunctorVt<TRes(TArgs...)>::TTryInvoke TFn;
 			rvt = vt;
+			pushed = SEV_ConcurrentFunctorQueue_pushTicks(ptr);
+			started = SEV_Clock_ticks();
+			onStart(vt, started);
 			res = ((TFn)vt->TryInvoke)(ptr, eh, args...);
 			return eh.raised() ? eh.errNo() : SEV_ESUCCESS;
 		};
 		static const FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)> wrapvt(invokeData);
 		typedef FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)>::TInvoke TInvoke;
 		static const TInvoke invokeCall = (TInvoke)wrapvt.get()->Invoke;
-		errno_t ec = SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(&m, invokeCall, (void *)(&invokeData));
+		errno_t ec = SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(&this->m, invokeCall, (void *)(&invokeData));
 		success = rvt;
 		if (!eh.raised() && ec)
 		{
@@ -264,7 +324,7 @@ public:
 	{
 		const SEV_FunctorVt *rvt = null;
 		auto invokeData = [&](void *ptr, const SEV_FunctorVt *vt) -> errno_t {
-			typedef FunctorVt<void(TArgs...)>::TTryInvoke TFn; // typedef TRes(*TFn)(void *ptr, void **err, TArgs...);
+			typedef typename FunctorVt<void(TArgs...)>::TTryInvoke TFn; // typedef TRes(*TFn)(void *ptr, void **err, TArgs...);
 			rvt = vt;
 			((TFn)vt->TryInvoke)(ptr, eh, args...);
 			return eh.raised() ? eh.errNo() : SEV_ESUCCESS;
@@ -272,7 +332,7 @@ public:
 		static const FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)> wrapvt(invokeData);
 		typedef FunctorVt<errno_t(void *, const SEV_FunctorVt *vt)>::TInvoke TInvoke;
 		static const TInvoke invokeCall = (TInvoke)wrapvt.get()->Invoke;
-		errno_t ec = SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(&m, invokeCall, (void *)(&invokeData));
+		errno_t ec = SEV_ConcurrentFunctorQueue_tryCallAndPopFunctorEx(&this->m, invokeCall, (void *)(&invokeData));
 		success = rvt;
 		if (!eh.raised() && ec)
 		{
@@ -32,6 +32,17 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <atomic>
 #include <condition_variable>
 
+#if defined(SEV_EVENT_FLAG_FUTEX)
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(SEV_EVENT_FLAG_EVENTFD)
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
 void SEV_terminate()
 {
 	SEV_DEBUG_BREAK();
@@ -131,6 +142,255 @@ void SEV_EventFlag_reset(SEV_EventFlag *ef)
 		SEV_terminate();
 }
 
+int SEV_EventFlag_fd(SEV_EventFlag *ef)
+{
+	(void)ef;
+	return -1;
+}
+
+#elif defined(SEV_EVENT_FLAG_FUTEX) || defined(SEV_EVENT_FLAG_EVENTFD)
+
+namespace {
+
+// State word layout, a single word so that set touches nothing but the word after publishing the flag
+const int32_t c_Set = 1; // The flag
+const int32_t c_Waiter = 2; // One waiting thread
+
+#if defined(SEV_EVENT_FLAG_FUTEX)
+
+// Sleep while the word equals val, or until the timeout expires. Negative timeout for infinite
+void futexWait(SEV_AtomicInt32 *word, int32_t val, int timeoutMs)
+{
+	timespec ts;
+	ts.tv_sec = timeoutMs / 1000;
+	ts.tv_nsec = (timeoutMs % 1000) * 1000000L;
+	syscall(SYS_futex, (int32_t *)word, FUTEX_WAIT_PRIVATE, val, timeoutMs >= 0 ? &ts : null, null, 0); // Returns early on EAGAIN, EINTR, ETIMEDOUT, caller checks the state
+}
+
+// Safe to call after the flag is gone, a stray wake is a spurious wake for whoever reuses the address
+void futexWake(SEV_AtomicInt32 *word, int count)
+{
+	syscall(SYS_futex, (int32_t *)word, FUTEX_WAKE_PRIVATE, count, null, null, 0);
+}
+
+SEV_FORCE_INLINE bool manualReset(SEV_EventFlag *ef)
+{
+	return ef->ManualReset;
+}
+
+#else
+
+SEV_FORCE_INLINE int descriptor(SEV_EventFlag *ef)
+{
+	return (int)(ef->Fd >> 2);
+}
+
+SEV_FORCE_INLINE bool manualReset(SEV_EventFlag *ef)
+{
+	return ef->Fd & 1;
+}
+
+SEV_FORCE_INLINE bool polled(SEV_EventFlag *ef)
+{
+	return ef->Fd & 2;
+}
+
+void signal(int fd)
+{
+	uint64_t one = 1;
+	ssize_t res = write(fd, &one, sizeof(one));
+	(void)res;
+}
+
+void drain(SEV_EventFlag *ef)
+{
+	uint64_t value;
+	ssize_t res = read(descriptor(ef), &value, sizeof(value)); // Non-blocking, EAGAIN when already drained
+	(void)res;
+}
+
+#endif
+
+// Take the flag if it's set
+SEV_FORCE_INLINE bool take(SEV_EventFlag *ef)
+{
+	int32_t state = SEV_AtomicInt32_load(&ef->Set);
+	if (!(state & c_Set))
+		return false;
+	if (manualReset(ef))
+		return true;
+#if defined(SEV_EVENT_FLAG_EVENTFD)
+	if (polled(ef))
+		drain(ef); // Before taking, so a set in between leaves the descriptor readable
+#endif
+	for (;;)
+	{
+		int32_t prev = SEV_AtomicInt32_compareExchange(&ef->Set, state & ~c_Set, state);
+		if (prev == state)
+			return true;
+		if (!(prev & c_Set))
+			return false;
+		state = prev; // Waiter count changed
+	}
+}
+
+SEV_FORCE_INLINE void addWaiters(SEV_EventFlag *ef, int32_t delta)
+{
+	int32_t state = SEV_AtomicInt32_load(&ef->Set);
+	for (;;)
+	{
+		int32_t prev = SEV_AtomicInt32_compareExchange(&ef->Set, state + delta, state);
+		if (prev == state)
+			return;
+		state = prev;
+	}
+}
+
+// Set the flag, returns true if there are waiters to wake
+SEV_FORCE_INLINE bool publish(SEV_EventFlag *ef)
+{
+	int32_t state = SEV_AtomicInt32_load(&ef->Set);
+	for (;;)
+	{
+		if (state & c_Set)
+			return false; // Already set, any waiter will take it
+		int32_t prev = SEV_AtomicInt32_compareExchange(&ef->Set, state | c_Set, state);
+		if (prev == state)
+			return state; // Nobody to wake when zero, no system call
+		state = prev;
+	}
+}
+
+bool waitFor(SEV_EventFlag *ef, int timeoutMs)
+{
+	if (take(ef))
+		return true;
+	if (!timeoutMs)
+		return false;
+	addWaiters(ef, c_Waiter); // Setter checks the waiter count in the same word as the flag
+	const std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+	bool res;
+	for (;;)
+	{
+		if (take(ef))
+		{
+			res = true;
+			break;
+		}
+		int remainingMs = -1;
+		if (timeoutMs >= 0)
+		{
+			remainingMs = (int)std::chrono::ceil<std::chrono::milliseconds>(until - std::chrono::steady_clock::now()).count(); // Rounded up, so the wait doesn't end short of the timeout
+			if (remainingMs <= 0)
+			{
+				res = take(ef);
+				break;
+			}
+		}
+#if defined(SEV_EVENT_FLAG_FUTEX)
+		int32_t state = SEV_AtomicInt32_load(&ef->Set);
+		if (!(state & c_Set))
+			futexWait(&ef->Set, state, remainingMs);
+#else
+		pollfd pfd = { descriptor(ef), POLLIN };
+		poll(&pfd, 1, remainingMs);
+		if (!manualReset(ef) && !polled(ef))
+			drain(ef); // Manual reset keeps the descriptor readable until reset, for every waiter
+#endif
+	}
+	addWaiters(ef, -c_Waiter);
+	return res;
+}
+
+}
+
+errno_t SEV_EventFlag_init(SEV_EventFlag *ef, bool manualReset, bool initialState)
+{
+	SEV_AtomicInt32_store(&ef->Waiting, 0);
+	SEV_AtomicInt32_store(&ef->Set, initialState ? c_Set : 0);
+#if defined(SEV_EVENT_FLAG_FUTEX)
+	ef->ManualReset = manualReset;
+#else
+	int fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (fd < 0) return errno;
+	ef->Fd = ((ptrdiff_t)fd << 2) | (manualReset ? 1 : 0);
+#endif
+	return 0;
+}
+
+void SEV_EventFlag_release(SEV_EventFlag *ef)
+{
+#if defined(SEV_EVENT_FLAG_FUTEX)
+	if (SEV_AtomicInt32_load(&ef->Set) & ~c_Set)
+		SEV_terminate();
+#else
+	if ((SEV_AtomicInt32_load(&ef->Set) & ~c_Set) != (polled(ef) ? c_Waiter : 0))
+		SEV_terminate();
+	while (SEV_AtomicInt32_load(&ef->Waiting))
+		SEV_Thread_yield(); // A set call may still be about to write the descriptor
+	close(descriptor(ef));
+#endif
+}
+
+void SEV_EventFlag_wait(SEV_EventFlag *ef)
+{
+	waitFor(ef, -1);
+}
+
+bool SEV_EventFlag_waitFor(SEV_EventFlag *ef, int timeoutMs)
+{
+	return waitFor(ef, timeoutMs);
+}
+
+void SEV_EventFlag_set(SEV_EventFlag *ef)
+{
+	// The waiter may return and release the flag as soon as it sees the flag, read everything up front
+#if defined(SEV_EVENT_FLAG_FUTEX)
+	int count = manualReset(ef) ? INT_MAX : 1;
+	if (publish(ef))
+		futexWake(&ef->Set, count);
+#else
+	int fd = descriptor(ef);
+	SEV_AtomicInt32_increment(&ef->Waiting); // Keep the descriptor open until written
+	if (publish(ef))
+		signal(fd);
+	SEV_AtomicInt32_decrement(&ef->Waiting);
+#endif
+}
+
+void SEV_EventFlag_reset(SEV_EventFlag *ef)
+{
+#if defined(SEV_EVENT_FLAG_EVENTFD)
+	if (manualReset(ef) || polled(ef))
+		drain(ef); // Before clearing, so a set in between leaves the descriptor readable
+#endif
+	int32_t state = SEV_AtomicInt32_load(&ef->Set);
+	while (state & c_Set)
+	{
+		int32_t prev = SEV_AtomicInt32_compareExchange(&ef->Set, state & ~c_Set, state);
+		if (prev == state)
+			break;
+		state = prev;
+	}
+}
+
+int SEV_EventFlag_fd(SEV_EventFlag *ef)
+{
+#if defined(SEV_EVENT_FLAG_EVENTFD)
+	if (!polled(ef))
+	{
+		ef->Fd |= 2;
+		addWaiters(ef, c_Waiter); // Count the poller as a permanent waiter, so set always signals
+		if (SEV_AtomicInt32_load(&ef->Set) & c_Set)
+			signal(descriptor(ef));
+	}
+	return descriptor(ef);
+#else
+	(void)ef;
+	return -1;
+#endif
+}
+
 #else
 
 namespace sev::impl {
@@ -216,11 +476,17 @@ bool SEV_EventFlag_waitFor(SEV_EventFlag *ef, int timeoutMs)
 		++m->Waiting;
 		if (m->Reset) // Reset cannot keep an already-waiting thread blocking
 			m->Flag = false;
+		const std::chrono::steady_clock::time_point until = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
 		while (!m->Flag)
 		{
-			res = m->CondVar.wait_for(lock, std::chrono::milliseconds(timeoutMs)) != std::cv_status::timeout; // Mutex is unlocked while waiting, relocked when back
+			if (m->CondVar.wait_until(lock, until) == std::cv_status::timeout) // Mutex is unlocked while waiting, relocked when back
+			{
+				res = m->Flag;
+				break;
+			}
 		}
-		m->Flag = m->ResetValue;
+		if (res)
+			m->Flag = m->ResetValue;
 		--m->Waiting;
 		exc = m->Delete;
 		del = !m->Waiting && exc; // Delete on last thread exit
@@ -248,6 +514,12 @@ void SEV_EventFlag_reset(SEV_EventFlag *ef)
 	m->Reset = true;
 }
 
+int SEV_EventFlag_fd(SEV_EventFlag *ef)
+{
+	(void)ef;
+	return -1;
+}
+
 #endif 
 
 /* end of file */
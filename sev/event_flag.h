@@ -33,7 +33,12 @@ Event flag. Thread waits if flag is false, one thread continues when the flag is
 Setting the flag multiple times has no effect, only one thread will continue.
 Only one thread is supposed to wait for this flag.
 
-TODO: Support eventfd
+Backends:
+- Win32: Event handle.
+- Futex (Linux default): State is inline, no allocation.
+- EventFd (Linux, define SEV_EVENT_FLAG_EVENTFD): Descriptor can be polled together with sockets.
+- STL: Mutex and condition variable, for other platforms.
+Futex and EventFd set the flag without a system call when no thread is waiting.
 
 */
 
@@ -47,14 +52,20 @@ TODO: Support eventfd
 // #define SEV_EVENT_FLAG_STL
 #define SEV_EVENT_FLAG_OPTIMIZE
 
-#if !defined(SEV_EVENT_FLAG_WIN32) && !defined(SEV_EVENT_FLAG_EVENTFD) && !defined(SEV_EVENT_FLAG_STL)
-#ifdef _WIN32
+#if !defined(SEV_EVENT_FLAG_WIN32) && !defined(SEV_EVENT_FLAG_FUTEX) && !defined(SEV_EVENT_FLAG_EVENTFD) && !defined(SEV_EVENT_FLAG_STL)
+#if defined(_WIN32)
 #define SEV_EVENT_FLAG_WIN32
+#elif defined(__linux__)
+#define SEV_EVENT_FLAG_FUTEX
 #else
 #define SEV_EVENT_FLAG_STL
 #endif
 #endif
 
+#if defined(SEV_EVENT_FLAG_FUTEX) || defined(SEV_EVENT_FLAG_EVENTFD)
+#define SEV_EVENT_FLAG_INLINE // Waiting and Set are the state of the flag
+#endif
+
 #ifdef SEV_EVENT_FLAG_STL
 #ifdef __cplusplus
 namespace sev::impl {
@@ -71,15 +82,19 @@ struct SEV_EventFlag
 {
 #if defined(SEV_EVENT_FLAG_WIN32)
 	HANDLE Event;
+#elif defined(SEV_EVENT_FLAG_FUTEX)
+	ptrdiff_t ManualReset;
+#elif defined(SEV_EVENT_FLAG_EVENTFD)
+	ptrdiff_t Fd; // Descriptor shifted left by 2, bit 0 is manual reset, bit 1 is set once the descriptor is polled
 #elif defined(__cplusplus)
 	sev::impl::EventFlag *Impl;
 #else
 	void *Impl;
 #endif
 
-#if defined(SEV_EVENT_FLAG_OPTIMIZE)
-	SEV_AtomicInt32 Waiting;
-	SEV_AtomicInt32 Set;
+#if defined(SEV_EVENT_FLAG_OPTIMIZE) || defined(SEV_EVENT_FLAG_INLINE)
+	SEV_AtomicInt32 Waiting; // EventFd: number of set calls in progress
+	SEV_AtomicInt32 Set; // Futex and EventFd: bit 0 is the flag, the rest counts waiting threads
 #else
 	int ReservedInt[2];
 #endif
@@ -95,6 +110,7 @@ SEV_LIB void SEV_EventFlag_wait(SEV_EventFlag *ef);
 SEV_LIB bool SEV_EventFlag_waitFor(SEV_EventFlag *ef, int timeoutMs);
 SEV_LIB void SEV_EventFlag_set(SEV_EventFlag *ef);
 SEV_LIB void SEV_EventFlag_reset(SEV_EventFlag *ef);
+SEV_LIB int SEV_EventFlag_fd(SEV_EventFlag *ef); // Descriptor which is readable while the flag is set, for polling with epoll. Call wait once it's readable to take the flag. From then on set always signals the descriptor. Returns -1 if the backend has no descriptor
 
 SEV_LIB void SEV_terminate();
 
@@ -121,7 +137,7 @@ public:
 
 	SEV_FORCE_INLINE EventFlag(std::nothrow_t, bool manualReset = false, bool initialState = false) noexcept
 	{
-		errno_t err = SEV_EventFlag_init(&m, manualReset, initialState); // FIXME: ERrror
+		SEV_EventFlag_init(&m, manualReset, initialState); // FIXME: ERrror
 	}
 
 	SEV_FORCE_INLINE ~EventFlag() noexcept
@@ -155,6 +171,11 @@ public:
 		SEV_EventFlag_reset(&m);
 	}
 
+	SEV_FORCE_INLINE int fd() noexcept
+	{
+		return SEV_EventFlag_fd(&m);
+	}
+
 private:
 	SEV_EventFlag m;
 	
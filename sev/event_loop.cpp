@@ -30,6 +30,25 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "event_loop.h"
 #include "event_loop_impl.h"
 
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+#ifdef __linux__
+#include <sched.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <climits>
+#include <system_error>
+#endif
+
 void SEV_EventLoop_destroy(SEV_EventLoop *el)
 {
 	el->Vt->Destroy(el);
@@ -95,79 +114,1216 @@ void SEV_EventLoop_stop(SEV_EventLoop *el)
 	el->Vt->Stop(el);
 }
 
+errno_t SEV_EventLoop_runEx(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_EventLoopRunOptions *options)
+{
+	return el->Vt->ThreadVt->RunEx(el, onError, ptr, forwardConstructor, options);
+}
+
+errno_t SEV_EventLoop_threadAffinity(SEV_EventLoop *el, int thread, int *cpus, int *cpuCount)
+{
+	return el->Vt->ThreadVt->ThreadAffinity(el, thread, cpus, cpuCount);
+}
+
+errno_t SEV_EventLoop_setIdlePolicy(SEV_EventLoop *el, const SEV_EventLoopIdlePolicy *policy)
+{
+	return el->Vt->ThreadVt->SetIdlePolicy(el, policy);
+}
+
+errno_t SEV_EventLoop_watchReadFunctor(SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->IoVt->WatchFunctor(el, fd, SEV_EVENT_LOOP_READ, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_watchWriteFunctor(SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->IoVt->WatchFunctor(el, fd, SEV_EVENT_LOOP_WRITE, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_unwatch(SEV_EventLoop *el, int fd)
+{
+	return el->Vt->IoVt->Unwatch(el, fd);
+}
+
+errno_t SEV_EventLoop_ioFunctor(SEV_EventLoop *el, const SEV_EventLoopIo *io, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->IoVt->IoFunctor(el, io, vt, ptr, forwardConstructor);
+}
+
+void SEV_EventLoop_parallelForFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, const SEV_FunctorVt *vt, void *ptr)
+{
+	el->Vt->WorkVt->ParallelForFunctor(el, eh, from, to, grain, vt, ptr);
+}
+
+errno_t SEV_EventLoop_resume(SEV_EventLoop *el, void(*resume)(void *frame), void *frame)
+{
+	return el->Vt->WorkVt->Resume(el, resume, frame);
+}
+
+errno_t SEV_EventLoop_setLatencyStats(SEV_EventLoop *el, bool enabled)
+{
+	return el->Vt->StatsVt->SetLatencyStats(el, enabled);
+}
+
+errno_t SEV_EventLoop_latencyStats(SEV_EventLoop *el, int worker, SEV_EventLoopLatency *wait, SEV_EventLoopLatency *run)
+{
+	return el->Vt->StatsVt->LatencyStats(el, worker, wait, run);
+}
+
+errno_t SEV_EventLoop_setProfiling(SEV_EventLoop *el, int sampleEvery)
+{
+	return el->Vt->StatsVt->SetProfiling(el, sampleEvery);
+}
+
+errno_t SEV_EventLoop_profile(SEV_EventLoop *el, SEV_EventLoopProfileEntry *entries, int *count)
+{
+	return el->Vt->StatsVt->Profile(el, entries, count);
+}
+
+errno_t SEV_EventLoop_setWatchdog(SEV_EventLoop *el, const SEV_EventLoopWatchdog *watchdog, const SEV_FunctorVt *onStall, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->StatsVt->SetWatchdog(el, watchdog, onStall, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_counters(SEV_EventLoop *el, SEV_EventLoopCounters *counters)
+{
+	return el->Vt->StatsVt->Counters(el, counters);
+}
+
+errno_t SEV_EventLoop_setBudget(SEV_EventLoop *el, const SEV_EventLoopBudget *budget)
+{
+	return el->Vt->ThreadVt->SetBudget(el, budget);
+}
+
+errno_t SEV_EventLoop_postBatch(SEV_EventLoop *el, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *posted)
+{
+	return el->Vt->WorkVt->PostBatch(el, count, vts, ptrs, forwardConstructors, posted);
+}
+
+errno_t SEV_EventLoop_setElastic(SEV_EventLoop *el, const SEV_EventLoopElastic *elastic, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->ThreadVt->SetElastic(el, elastic, onError, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_postWithDeadlineFunctor(SEV_EventLoop *el, int64_t deadlineNs, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *expiredVt, void *expiredPtr, void(*expiredForwardConstructor)(void *ptr, void *other))
+{
+	return el->Vt->WorkVt->PostWithDeadlineFunctor(el, deadlineNs, vt, ptr, forwardConstructor, expiredVt, expiredPtr, expiredForwardConstructor);
+}
+
+errno_t SEV_EventLoop_setQueueCapacity(SEV_EventLoop *el, ptrdiff_t capacity, bool bytes)
+{
+	if (!el->Vt->QueueVt) return ENOTSUP;
+	return el->Vt->QueueVt->SetCapacity(el, capacity, bytes);
+}
+
+ptrdiff_t SEV_EventLoop_queueUsed(SEV_EventLoop *el, bool bytes)
+{
+	if (!el->Vt->QueueVt) return 0;
+	return el->Vt->QueueVt->Used(el, bytes);
+}
+
+errno_t SEV_EventLoop_postFunctorWait(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs)
+{
+	if (!el->Vt->QueueVt) return el->Vt->PostFunctor(el, vt, ptr, forwardConstructor); // Never full
+	return el->Vt->QueueVt->PostFunctorWait(el, vt, ptr, forwardConstructor, timeoutMs);
+}
+
+errno_t SEV_EventLoop_notifySpaceFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	if (!el->Vt->QueueVt) return ENOTSUP;
+	return el->Vt->QueueVt->NotifySpaceFunctor(el, vt, ptr, forwardConstructor);
+}
+
+errno_t SEV_EventLoop_postFunctorUnbounded(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	if (!el->Vt->QueueVt) return el->Vt->PostFunctor(el, vt, ptr, forwardConstructor);
+	return el->Vt->QueueVt->PostFunctorUnbounded(el, vt, ptr, forwardConstructor);
+}
+
+int64_t SEV_EventLoop_now(SEV_EventLoop *el)
+{
+	return sev::impl::el::loopNs((sev::impl::el::EventLoopBase *)el);
+}
+
+int SEV_Thread_currentCpu()
+{
+#if defined(__linux__)
+	return sched_getcpu();
+#elif defined(_WIN32)
+	return (int)GetCurrentProcessorNumber();
+#else
+	return -1;
+#endif
+}
+
+namespace sev::impl::el {
+namespace {
+
+typedef errno_t(*TCall)(void *ptr, SEV_EventLoop *el);
+
+// C function with a copy of its data, small enough to be stored inline in a functor
+struct CallInline
+{
+	alignas(std::max_align_t) uint8_t Data[40]; // Aligned like malloc, C data may hold any type
+	TCall F;
+
+	errno_t operator()(sev::EventLoop &el) { return F(Data, &el); }
+
+};
+
+static_assert(offsetof(CallInline, Data) == 0 && alignof(CallInline) >= alignof(std::max_align_t));
+static_assert(sizeof(CallInline) <= sizeof(void *) * 7); // Inline capacity of a functor
+
+// C function followed by a copy of its data, constructed directly in queue or functor memory
+struct CallData
+{
+	TCall F;
+	ptrdiff_t Size;
+
+	CallData(TCall f, ptrdiff_t size) noexcept : F(f), Size(size) { }
+	CallData(const CallData &other) noexcept : F(other.F), Size(other.Size) { memcpy((void *)(this + 1), (const void *)(&other + 1), Size); } // Destination must have room for the data
+
+	errno_t operator()(sev::EventLoop &el) { return F(this + 1, &el); }
+
+};
+
+static_assert(sizeof(CallData) % alignof(std::max_align_t) == 0);
+
+const ptrdiff_t c_SizeClassLinear = 4096; // Size classes every SEV_FUNCTOR_ALIGN bytes up to here, doubling after
+const int c_SizeClasses = c_SizeClassLinear / SEV_FUNCTOR_ALIGN + 1 + 4; // Up to 64 KiB, the size of a queue block
+const ptrdiff_t c_CallDataMax = 32 * 1024; // Larger data is copied to the heap, an entry must fit in a queue block
+
+int sizeClass(ptrdiff_t size) noexcept
+{
+	if (size <= c_SizeClassLinear)
+		return (int)((size + SEV_FUNCTOR_ALIGN - 1) / SEV_FUNCTOR_ALIGN);
+	int i = c_SizeClassLinear / SEV_FUNCTOR_ALIGN + 1;
+	for (ptrdiff_t bytes = c_SizeClassLinear * 2; bytes < size; bytes *= 2)
+		++i;
+	return i;
+}
+
+ptrdiff_t sizeClassBytes(int i) noexcept
+{
+	const int linear = c_SizeClassLinear / SEV_FUNCTOR_ALIGN;
+	return i <= linear ? i * SEV_FUNCTOR_ALIGN : c_SizeClassLinear << (i - linear);
+}
+
+// Vtable with the size of the header and the data rounded up to its class, so moving the entry off a worker or between queues copies all of it
+const SEV_FunctorVt *callDataVt(ptrdiff_t size) noexcept
+{
+	static const std::array<SEV_FunctorVt, c_SizeClasses> s_Vts = []() -> std::array<SEV_FunctorVt, c_SizeClasses> {
+		static const sev::EventFunctorVt vt(CallData(null, 0));
+		std::array<SEV_FunctorVt, c_SizeClasses> vts;
+		for (int i = 0; i < c_SizeClasses; ++i)
+		{
+			vts[i] = *vt.get();
+			vts[i].Size = sizeof(CallData) + sizeClassBytes(i);
+		}
+		return vts;
+	}();
+	return &s_Vts[sizeClass(size)];
+}
+
+struct CallArgs
+{
+	TCall F;
+	void *Ptr;
+	ptrdiff_t Size;
+
+};
+
+void constructCallData(void *ptr, void *other) noexcept
+{
+	CallArgs *args = (CallArgs *)other;
+	CallData *call = new (ptr) CallData(args->F, args->Size);
+	memcpy((void *)(call + 1), args->Ptr, args->Size);
+}
+
+// C function with a copy of its data, for data too large for a queue entry
+struct CallCopy
+{
+	TCall F;
+	std::vector<uint8_t> Data;
+
+	errno_t operator()(sev::EventLoop &el) { return F(Data.data(), &el); }
+
+};
+
+// Wrap a C function and a copy of its data into a functor, and pass it to push. Small data stays inline, larger data shares the size classes of the queue entries
+template<class TPush>
+errno_t pushCall(TCall f, void *ptr, ptrdiff_t size, const TPush &push)
+{
+	if (!f || size < 0 || (size && !ptr))
+		return EINVAL;
+	if (size <= (ptrdiff_t)sizeof(CallInline::Data))
+	{
+		CallInline call;
+		call.F = f;
+		memcpy(call.Data, ptr, size);
+		static const sev::EventFunctorVt vt(call);
+		return push(vt.get(), &call, vt.get()->CopyConstructor);
+	}
+	if (size <= c_CallDataMax)
+	{
+		CallArgs args{ f, ptr, size };
+		return push(callDataVt(size), &args, constructCallData);
+	}
+	try
+	{
+		CallCopy call{ f, std::vector<uint8_t>((uint8_t *)ptr, (uint8_t *)ptr + size) };
+		static const sev::EventFunctorVt vt(call);
+		return push(vt.get(), &call, vt.get()->MoveConstructor);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+}
+
+}
+}
+
 errno_t SEV_IMPL_EventLoopBase_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size)
 {
-	// Generic unoptimized wrapper
+	return sev::impl::el::pushCall(f, ptr, size, [el](const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) -> errno_t {
+		return el->Vt->PostFunctor(el, vt, ptr, forwardConstructor);
+	});
+}
+
+void SEV_IMPL_EventLoopBase_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr)
+{
+	auto call = [f, ptr](sev::EventLoop &el) -> errno_t {
+		return f(ptr, &el);
+	};
+	static const sev::EventFunctorVt vt(call);
+	el->Vt->InvokeFunctor(el, eh, vt.get(), &call);
+}
+
+errno_t SEV_IMPL_EventLoopBase_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int timeoutMs)
+{
+	return sev::impl::el::pushCall(f, ptr, size, [el, timeoutMs](const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) -> errno_t {
+		return el->Vt->TimeoutFunctor(el, vt, ptr, forwardConstructor, timeoutMs);
+	});
+}
+
+errno_t SEV_IMPL_EventLoopBase_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs)
+{
+	return sev::impl::el::pushCall(f, ptr, size, [el, intervalMs](const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) -> errno_t {
+		return el->Vt->IntervalFunctor(el, vt, ptr, forwardConstructor, intervalMs);
+	});
+}
+
+namespace sev::impl::el {
+
+SEV_EventLoopQueueVt EventLoopQueueVt = {
+	SEV_IMPL_EventLoop_setQueueCapacity, // SetCapacity
+	SEV_IMPL_EventLoop_queueUsed, // Used
+	SEV_IMPL_EventLoop_postFunctorWait, // PostFunctorWait
+	SEV_IMPL_EventLoop_notifySpaceFunctor, // NotifySpaceFunctor
+	SEV_IMPL_EventLoop_postFunctorUnbounded, // PostFunctorUnbounded
+	{ }, // Reserved
+};
+
+SEV_EventLoopThreadVt EventLoopThreadVt = {
+	SEV_IMPL_EventLoop_runEx, // RunEx
+	SEV_IMPL_EventLoop_threadAffinity, // ThreadAffinity
+	SEV_IMPL_EventLoop_setIdlePolicy, // SetIdlePolicy
+	SEV_IMPL_EventLoop_setBudget, // SetBudget
+	SEV_IMPL_EventLoop_setElastic, // SetElastic
+	{ }, // Reserved
+};
+
+SEV_EventLoopIoVt EventLoopIoVt = {
+	SEV_IMPL_EventLoop_watchFunctor, // WatchFunctor
+	SEV_IMPL_EventLoop_unwatch, // Unwatch
+	SEV_IMPL_EventLoop_ioFunctor, // IoFunctor
+	{ }, // Reserved
+};
+
+SEV_EventLoopWorkVt EventLoopWorkVt = {
+	SEV_IMPL_EventLoop_parallelForFunctor, // ParallelForFunctor
+	SEV_IMPL_EventLoop_resume, // Resume
+	SEV_IMPL_EventLoop_postBatch, // PostBatch
+	SEV_IMPL_EventLoop_postWithDeadlineFunctor, // PostWithDeadlineFunctor
+	{ }, // Reserved
+};
+
+SEV_EventLoopStatsVt EventLoopStatsVt = {
+	SEV_IMPL_EventLoop_setLatencyStats, // SetLatencyStats
+	SEV_IMPL_EventLoop_latencyStats, // LatencyStats
+	SEV_IMPL_EventLoop_setProfiling, // SetProfiling
+	SEV_IMPL_EventLoop_profile, // Profile
+	SEV_IMPL_EventLoop_setWatchdog, // SetWatchdog
+	SEV_IMPL_EventLoop_counters, // Counters
+	{ }, // Reserved
+};
+
+SEV_EventLoopVt EventLoopVt = {
+	SEV_IMPL_EventLoop_destroy,
+
+	SEV_IMPL_EventLoop_post,
+	SEV_IMPL_EventLoopBase_invoke,
+	SEV_IMPL_EventLoopBase_timeout,
+	SEV_IMPL_EventLoopBase_interval,
+
+	SEV_IMPL_EventLoop_postFunctor,
+	SEV_IMPL_EventLoop_invokeFunctor,
+	SEV_IMPL_EventLoop_timeoutFunctor,
+	SEV_IMPL_EventLoop_intervalFunctor,
+
+	null, // Join
+
+	SEV_IMPL_EventLoop_run, // Run
+	SEV_IMPL_EventLoop_loop, // Loop
+	SEV_IMPL_EventLoop_stop, // Stop
+
+	&EventLoopQueueVt, // QueueVt
+	&EventLoopThreadVt, // ThreadVt
+	&EventLoopIoVt, // IoVt
+	&EventLoopWorkVt, // WorkVt
+	&EventLoopStatsVt, // StatsVt
+
+	{ }, // Reserved
+
+};
+
+namespace /* anonymous */ {
+
+// Process-wide CPU isolation state, shared by all loops
+std::mutex s_AffinityMutex;
+std::vector<int> s_IsolatedCpus;
+std::vector<int> s_FloatingCpus; // Affinity of floating threads, empty when unrestricted
+std::vector<ManagedThread::NativeHandle> s_FloatingThreads;
+ptrdiff_t s_FloatingReserved = 0; // Floating threads being started, s_FloatingThreads has room for them so registering can't fail
+int64_t s_FloatingSeq = 0; // Bumped when the floating CPU set changes, so a thread started in between catches up when registered
+
+#if defined(__linux__)
+
+errno_t getProcessCpus(std::vector<int> &cpus)
+{
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	if (sched_getaffinity(0, sizeof(set), &set))
+		return errno;
+	cpus.clear();
+	for (int i = 0; i < CPU_SETSIZE; ++i)
+		if (CPU_ISSET(i, &set))
+			cpus.push_back(i);
+	return 0;
+}
+
+errno_t toCpuSet(cpu_set_t &set, const std::vector<int> &cpus)
+{
+	CPU_ZERO(&set);
+	for (int cpu : cpus)
+	{
+		if (cpu < 0 || cpu >= CPU_SETSIZE)
+			return EINVAL;
+		CPU_SET(cpu, &set);
+	}
+	return 0;
+}
+
+errno_t setThreadCpus(ManagedThread::NativeHandle handle, const std::vector<int> &cpus)
+{
+	std::vector<int> all;
+	const std::vector<int> *use = &cpus;
+	if (cpus.empty())
+	{
+		errno_t eno = getProcessCpus(all);
+		if (eno) return eno;
+		use = &all;
+	}
+	cpu_set_t set;
+	errno_t eno = toCpuSet(set, *use);
+	if (eno) return eno;
+	return pthread_setaffinity_np(handle, sizeof(set), &set);
+}
+
+#elif defined(_WIN32)
+
+errno_t getProcessCpus(std::vector<int> &cpus)
+{
+	DWORD_PTR processMask, systemMask;
+	if (!GetProcessAffinityMask(GetCurrentProcess(), &processMask, &systemMask))
+		return EOTHER;
+	cpus.clear();
+	for (int i = 0; i < (int)(sizeof(DWORD_PTR) * 8); ++i)
+		if (processMask & ((DWORD_PTR)1 << i))
+			cpus.push_back(i);
+	return 0;
+}
+
+errno_t toCpuMask(DWORD_PTR &mask, const std::vector<int> &cpus)
+{
+	mask = 0;
+	for (int cpu : cpus)
+	{
+		if (cpu < 0 || cpu >= (int)(sizeof(DWORD_PTR) * 8))
+			return EINVAL; // Only the first processor group is supported
+		mask |= (DWORD_PTR)1 << cpu;
+	}
+	return 0;
+}
+
+errno_t setThreadCpus(ManagedThread::NativeHandle handle, const std::vector<int> &cpus)
+{
+	std::vector<int> all;
+	const std::vector<int> *use = &cpus;
+	if (cpus.empty())
+	{
+		errno_t eno = getProcessCpus(all);
+		if (eno) return eno;
+		use = &all;
+	}
+	DWORD_PTR mask;
+	errno_t eno = toCpuMask(mask, *use);
+	if (eno) return eno;
+	if (!SetThreadAffinityMask(handle, mask))
+		return EINVAL;
+	return 0;
+}
+
+#else
+
+errno_t getProcessCpus(std::vector<int> &cpus)
+{
+	return ENOTSUP;
+}
+
+errno_t setThreadCpus(ManagedThread::NativeHandle handle, const std::vector<int> &cpus)
+{
+	return cpus.empty() ? 0 : ENOTSUP;
+}
+
+#endif
+
+void setCurrentThreadName(const char *name)
+{
+#if defined(__linux__)
+	char buffer[16];
+	strncpy(buffer, name, sizeof(buffer) - 1);
+	buffer[sizeof(buffer) - 1] = 0;
+	pthread_setname_np(pthread_self(), buffer);
+#elif defined(_WIN32)
+	typedef HRESULT(WINAPI *TSetThreadDescription)(HANDLE hThread, PCWSTR lpThreadDescription);
+	static const TSetThreadDescription setThreadDescription = (TSetThreadDescription)GetProcAddress(GetModuleHandleW(L"kernel32.dll"), "SetThreadDescription"); // Windows 10 1607 and up
+	if (!setThreadDescription)
+		return;
+	wchar_t buffer[64];
+	if (!MultiByteToWideChar(CP_UTF8, 0, name, -1, buffer, 64))
+		return;
+	buffer[63] = 0;
+	setThreadDescription(GetCurrentThread(), buffer);
+#endif
+}
+
+// Recalculate the floating CPU set and move all floating threads onto it, under s_AffinityMutex
+void updateFloatingCpus()
+{
+	++s_FloatingSeq;
+	s_FloatingCpus.clear();
+	if (!s_IsolatedCpus.empty())
+	{
+		if (getProcessCpus(s_FloatingCpus))
+			s_FloatingCpus.clear();
+		s_FloatingCpus.erase(std::remove_if(s_FloatingCpus.begin(), s_FloatingCpus.end(), [](int cpu) -> bool {
+			return std::find(s_IsolatedCpus.begin(), s_IsolatedCpus.end(), cpu) != s_IsolatedCpus.end();
+		}), s_FloatingCpus.end());
+		// If everything is isolated, floating threads may still run anywhere
+	}
+	for (ManagedThread::NativeHandle handle : s_FloatingThreads)
+		setThreadCpus(handle, s_FloatingCpus);
+}
+
+// Claim CPUs for isolation, returns EBUSY if any of them are claimed by another loop. Newly claimed CPUs are added to claimed
+errno_t claimCpus(EventLoopBase *elp, const std::vector<int> &cpus, std::vector<int> &claimed)
+{
+	std::unique_lock<std::mutex> lock(s_AffinityMutex);
+	for (int cpu : cpus)
+	{
+		if (std::find(s_IsolatedCpus.begin(), s_IsolatedCpus.end(), cpu) != s_IsolatedCpus.end()
+			&& std::find(elp->IsolatedCpus.begin(), elp->IsolatedCpus.end(), cpu) == elp->IsolatedCpus.end())
+			return EBUSY;
+	}
+	bool changed = false;
+	for (int cpu : cpus)
+	{
+		if (std::find(elp->IsolatedCpus.begin(), elp->IsolatedCpus.end(), cpu) == elp->IsolatedCpus.end())
+		{
+			elp->IsolatedCpus.push_back(cpu);
+			s_IsolatedCpus.push_back(cpu);
+			claimed.push_back(cpu);
+			changed = true;
+		}
+	}
+	if (changed)
+		updateFloatingCpus();
+	return 0;
+}
+
+// Release claimed CPUs, or all CPUs claimed by the loop
+void releaseCpus(EventLoopBase *elp, const std::vector<int> *claimed = null)
+{
+	std::unique_lock<std::mutex> lock(s_AffinityMutex);
+	const std::vector<int> cpus = claimed ? *claimed : elp->IsolatedCpus;
+	if (cpus.empty())
+		return;
+	for (int cpu : cpus)
+	{
+		s_IsolatedCpus.erase(std::find(s_IsolatedCpus.begin(), s_IsolatedCpus.end(), cpu));
+		elp->IsolatedCpus.erase(std::find(elp->IsolatedCpus.begin(), elp->IsolatedCpus.end(), cpu));
+	}
+	updateFloatingCpus();
+}
+
+}
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+
+// Break the poller out of epoll_wait
+void wakePoller(EventLoopBase *elp)
+{
+	if (elp->PollerBlocked && !elp->PollerWoken.exchange(true))
+	{
+		uint64_t one = 1;
+		ssize_t res = write(elp->WakeFd, &one, sizeof(one));
+		(void)res; // Only fails when the counter is saturated, the poller wakes either way
+	}
+}
+
+#endif
+
+thread_local EventLoopBase *t_Loop = null;
+thread_local Worker *t_Worker = null;
+thread_local const std::atomic_bool *t_Cover = null;
+thread_local ElasticWorker *t_Elastic = null;
+thread_local int64_t t_LoopNs = 0;
+
+// Run the functor kept on the worker by postLocal
+errno_t runLocal(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh) noexcept
+{
+	const SEV_FunctorVt *vt = worker.LocalVt;
+	void *ptr = worker.Local[worker.LocalIndex];
+	worker.LocalVt = null;
+	worker.LocalIndex ^= 1; // The task may post its own follow-up into the other slot
+	++worker.LocalChain;
+	--elp->LocalItems;
+	--elp->QueueItems;
+	const bool watched = elp->WatchdogTicks.load(std::memory_order_relaxed);
+	const int64_t started = watched || tr::enabled() ? SEV_Clock_ticks() : 0;
+	if (watched)
+	{
+		worker.TaskVt.store(vt, std::memory_order_relaxed);
+		worker.TaskStart.store(started, std::memory_order_release);
+	}
+	errno_t eno = ((sev::EventFunctorVt::TTryInvoke)vt->TryInvoke)(ptr, *(sev::ExceptionHandle *)eh, *(sev::EventLoop *)elp);
+	if (watched) worker.TaskStart.store(0, std::memory_order_relaxed);
+	if (started && tr::enabled()) SEV_Trace_complete("task", vt, started, SEV_Clock_ticks());
+	vt->Destroy(ptr);
+	return eno;
+}
+
+// Pop and call one functor from the shared queue
+errno_t callShared(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, bool &success) noexcept
+{
+	errno_t eno = worker.Stats
+		? callAndRecord(elp, worker, eh, success)
+		: elp->Queue.tryCallAndPop(*(sev::ExceptionHandle *)eh, success, *elp);
+	if (success) --elp->QueueItems;
+	return eno;
+}
+
+// Move the functor kept on the worker to the shared queue
+void flushLocal(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh) noexcept
+{
+	const SEV_FunctorVt *vt = worker.LocalVt;
+	void *ptr = worker.Local[worker.LocalIndex];
+	errno_t res;
 	try
 	{
-		std::vector<uint8_t> v(size);
-		memcpy(&v[0], ptr, size);
-		sev::EventFunctorView fv = std::move([f, v](sev::EventLoop &el) -> errno_t {
-			errno_t err = f((void *)&v[0], &el);
-			if (!err) return 0;
-			if (err == ENOMEM) throw std::bad_alloc();
-			throw std::exception();
-			return 0; // FIXME
+		res = SEV_ConcurrentFunctorQueue_pushFunctorUnboundedEx(elp->Queue.get(), vt, vt->Size, ptr, vt->MoveConstructor); // Already accepted, not held to the capacity
+	}
+	catch (...)
+	{
+		res = EOTHER;
+	}
+	if (res)
+	{
+		// Run it here rather than lose it
+		res = runLocal(elp, worker, eh);
+		if (!*eh && res) *eh = SEV_Exception_capture(res);
+		return;
+	}
+	worker.LocalVt = null;
+	--elp->LocalItems; // Stays counted in QueueItems, now in the shared queue
+	vt->Destroy(ptr);
+	wakeOne(elp);
+}
+
+// Wake the most recently parked worker, unless a worker is spinning and will pick up the work anyway
+void wakeOne(EventLoopBase *elp)
+{
+	checkBacklog(elp);
+	if (elp->Spinning)
+		return;
+	if (elp->ParkedCount)
+	{
+		std::unique_lock<std::mutex> lock(elp->ParkedMutex);
+		if (!elp->Parked.empty())
+		{
+			Worker *worker = elp->Parked.back();
+			elp->Parked.pop_back();
+			--elp->ParkedCount;
+			worker->Flag.set(); // Under lock, the worker can't leave park before this returns
+			if (tr::enabled()) SEV_Trace_instant("unpark", null);
+			return;
+		}
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	wakePoller(elp);
+#endif
+}
+
+// Wake as many workers as there are new functors, with a single lock
+void wakeMany(EventLoopBase *elp, ptrdiff_t count)
+{
+	if (count <= 1)
+	{
+		wakeOne(elp);
+		return;
+	}
+	checkBacklog(elp);
+	count -= elp->Spinning; // Each spinning worker picks up one
+	if (count <= 0)
+		return;
+	if (elp->ParkedCount)
+	{
+		std::unique_lock<std::mutex> lock(elp->ParkedMutex);
+		ptrdiff_t woken = 0;
+		while (woken < count && !elp->Parked.empty())
+		{
+			elp->Parked.back()->Flag.set();
+			elp->Parked.pop_back();
+			++woken;
+		}
+		elp->ParkedCount -= (int)woken;
+		if (tr::enabled() && woken) SEV_Trace_instant("unpark", null);
+		count -= woken;
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	if (count > 0)
+		wakePoller(elp);
+#endif
+}
+
+void wakeAll(EventLoopBase *elp)
+{
+	{
+		std::unique_lock<std::mutex> lock(elp->ParkedMutex);
+		for (Worker *worker : elp->Parked)
+			worker->Flag.set();
+		if (tr::enabled() && !elp->Parked.empty()) SEV_Trace_instant("unpark", null);
+		elp->ParkedCount -= (int)elp->Parked.size();
+		elp->Parked.clear();
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	wakePoller(elp);
+#endif
+}
+
+// Block the worker until woken, or until the timeout expires. Timeout in milliseconds, negative for infinite
+void park(EventLoopBase *elp, Worker &worker, int64_t timeoutMs)
+{
+	{
+		std::unique_lock<std::mutex> lock(elp->ParkedMutex);
+		elp->Parked.push_back(&worker);
+		++elp->ParkedCount;
+	}
+	if (!sharedItems(elp) && elp->Running && elp->TimerSeq == worker.TimerSeq && !worker.covered()) // Re-check after publishing, any later post, timer or release of a replacement will find this worker
+	{
+		const int64_t parked = tr::enabled() ? SEV_Clock_ticks() : 0;
+		if (timeoutMs < 0) worker.Flag.wait();
+		else worker.Flag.wait((int)std::min(timeoutMs, (int64_t)0xFFFF)); // Limit to 65 seconds, it's fine to break out earlier, the loop re-checks
+		if (parked) SEV_Trace_complete("park", null, parked, SEV_Clock_ticks());
+	}
+	{
+		std::unique_lock<std::mutex> lock(elp->ParkedMutex);
+		std::vector<Worker *>::iterator it = std::find(elp->Parked.begin(), elp->Parked.end(), &worker);
+		if (it != elp->Parked.end())
+		{
+			// Not woken by a post
+			elp->Parked.erase(it);
+			--elp->ParkedCount;
+		}
+	}
+	if (sharedItems(elp) > 1)
+		wakeOne(elp); // Wake up more threads if there's more than one item in the queue
+}
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+
+// Re-arm the oneshot registration with the events that have a callback, called under the watch mutex
+errno_t arm(EventLoopBase *elp, Watch &watch, int op)
+{
+	epoll_event ev = {};
+	ev.events = (watch.Read ? (uint32_t)EPOLLIN : 0) | (watch.Write ? (uint32_t)EPOLLOUT : 0) | EPOLLONESHOT;
+	ev.data.u64 = (uint64_t)watch.Fd;
+	if (epoll_ctl(elp->EpollFd, op, watch.Fd, &ev))
+		return errno;
+	return 0;
+}
+
+// Run the callbacks for one epoll event. Callbacks are taken out of the watch while they run, so they may unwatch, or watch again
+errno_t dispatch(EventLoopBase *elp, int fd, uint32_t events)
+{
+	std::shared_ptr<Watch> watch;
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		std::map<int, std::shared_ptr<Watch>>::iterator it = elp->Watches.find(fd);
+		if (it == elp->Watches.end())
+			return 0;
+		watch = it->second;
+	}
+	std::optional<EventFunctor> read;
+	std::optional<EventFunctor> write;
+	{
+		std::unique_lock<std::mutex> lock(watch->Mutex);
+		if (watch->Removed)
+			return 0;
+		if (watch->Read && (events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+		{
+			read.emplace(std::move(*watch->Read));
+			watch->Read.reset();
+		}
+		if (watch->Write && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)))
+		{
+			write.emplace(std::move(*watch->Write));
+			watch->Write.reset();
+		}
+		watch->Dispatching = true;
+	}
+	errno_t readRes = 0;
+	errno_t writeRes = 0;
+	auto rearm = gsl::finally([&]() -> void {
+		std::unique_lock<std::mutex> lock(watch->Mutex);
+		watch->Dispatching = false;
+		if (watch->Removed)
+			return;
+		if (read && readRes != ECANCELED && !watch->Read)
+			watch->Read.emplace(std::move(*read));
+		if (write && writeRes != ECANCELED && !watch->Write)
+			watch->Write.emplace(std::move(*write));
+		if (watch->Read || watch->Write)
+			arm(elp, *watch, EPOLL_CTL_MOD); // Fails if the descriptor was closed without unwatch, nothing to do then
+	});
+	if (read)
+		readRes = (*read)(*elp);
+	if (readRes && readRes != ECANCELED)
+		return readRes; // Write stays armed, level-triggered so it comes back
+	if (write)
+		writeRes = (*write)(*elp);
+	if (writeRes && writeRes != ECANCELED)
+		return writeRes;
+	return 0;
+}
+
+// Block in epoll_wait until there's I/O, posted work, or the timeout expires. Only the worker holding the Polling role calls this
+void poll(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, int64_t timeoutMs)
+{
+	epoll_event events[64];
+	elp->PollerWoken = false;
+	elp->PollerBlocked = true;
+	const bool block = !sharedItems(elp) && elp->Running && elp->TimerSeq == worker.TimerSeq && !worker.covered(); // Re-check after publishing, any later post, timer or release of a replacement will write the eventfd
+	const int64_t polled = block && tr::enabled() ? SEV_Clock_ticks() : 0;
+	const int n = epoll_wait(elp->EpollFd, events, 64, !block ? 0 : timeoutMs < 0 ? -1 : (int)std::min(timeoutMs, (int64_t)INT_MAX));
+	const errno_t waitErr = n < 0 ? errno : 0;
+	if (polled) SEV_Trace_complete("poll", null, polled, SEV_Clock_ticks());
+	elp->PollerBlocked = false;
+	elp->Polling = false; // Another idle worker can poll while these callbacks run
+	if (n < 0)
+	{
+		if (waitErr != EINTR)
+			*eh = SEV_Exception_capture(waitErr);
+		return;
+	}
+	int first = -1;
+	for (int i = 0; i < n; ++i)
+	{
+		const int fd = (int)events[i].data.u64;
+		if (fd == elp->WakeFd)
+		{
+			uint64_t value;
+			ssize_t res = read(elp->WakeFd, &value, sizeof(value));
+			(void)res;
+			continue;
+		}
+#ifdef SEV_EVENT_LOOP_IO_URING
+		if (elp->Ring && fd == elp->Ring->Fd)
+		{
+			ioReap(elp, eh);
+			continue;
+		}
+#endif
+		if (first < 0)
+		{
+			first = i; // Run on this thread, without a hop through the queue
+			continue;
+		}
+		// Hand the rest to other workers
+		const uint32_t ev = events[i].events;
+		++elp->QueueItems;
+		errno_t eno = elp->Queue.pushUnbounded(std::nothrow, [fd, ev](sev::EventLoop &el) -> errno_t {
+			return dispatch((EventLoopBase *)&el, fd, ev);
+		});
+		if (eno)
+		{
+			--elp->QueueItems;
+			((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
+				errno_t res = dispatch(elp, fd, ev);
+				if (!*eh && res) *eh = SEV_Exception_capture(res);
 			});
-		const sev::EventFunctorVt *vt;
-		void *ptr;
-		bool movable;
-		fv.extract(vt, ptr, movable, true);
-		SEV_ASSERT(movable);
-		return el->Vt->PostFunctor(el, vt->get(), ptr, vt->get()->MoveConstructor);
+		}
+		else
+		{
+			wakeOne(elp);
+		}
+	}
+	if (first >= 0)
+	{
+		((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
+			errno_t res = dispatch(elp, (int)events[first].data.u64, events[first].events);
+			if (!*eh && res) *eh = SEV_Exception_capture(res);
+		});
 	}
-	catch (std::bad_alloc)
+}
+
+#endif
+
+// Spin, then yield, then park, until there's work, the loop stops, or the timeout expires. With epoll, one idle worker polls instead of parking
+void idle(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, int64_t timeoutMs)
+{
+	const int64_t spinNs = elp->IdleSpinNs;
+	const int64_t yieldNs = elp->IdleYieldNs;
+	const int maxSpinning = elp->IdleMaxSpinning;
+	if ((spinNs || yieldNs) && (!maxSpinning || elp->Spinning < maxSpinning))
+	{
+		++elp->Spinning;
+		const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		int64_t limitNs = spinNs + yieldNs;
+		if (timeoutMs >= 0) limitNs = std::min(limitNs, timeoutMs * 1000000);
+		bool yielding = !spinNs;
+		for (int i = 1; !sharedItems(elp) && elp->Running && elp->TimerSeq == worker.TimerSeq; ++i)
+		{
+			if (!(i & 63))
+			{
+				const int64_t elapsedNs = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+				if (elapsedNs >= limitNs)
+					break;
+				yielding = elapsedNs >= spinNs;
+			}
+			if (yielding) SEV_Thread_yield();
+			else SEV_Thread_pause();
+		}
+		--elp->Spinning; // Posts that saw this worker spinning are visible now
+		if (sharedItems(elp) || !elp->Running || elp->TimerSeq != worker.TimerSeq)
+			return;
+		if (timeoutMs >= 0)
+		{
+			timeoutMs -= std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+			if (timeoutMs <= 0)
+				return;
+		}
+	}
+#ifdef SEV_EVENT_LOOP_EPOLL
+	if (!elp->Polling.exchange(true))
+	{
+		poll(elp, worker, eh, timeoutMs);
+		return;
+	}
+#endif
+	park(elp, worker, timeoutMs);
+}
+
+#if defined(_WIN32)
+
+errno_t ManagedThread::p_start(void(*f)(void *ptr), void *ptr, ptrdiff_t stackSize) noexcept
+{
+	struct StartData
+	{
+		void(*F)(void *ptr);
+		void *Ptr;
+	};
+	StartData *data = new (std::nothrow) StartData{ f, ptr };
+	if (!data) return ENOMEM;
+	DWORD_PTR mask = 0;
+	if (!Cpus.empty())
+	{
+		errno_t eno = toCpuMask(mask, Cpus);
+		if (eno)
+		{
+			delete data;
+			return eno;
+		}
+	}
+	// Start suspended, so the affinity is in place before the thread runs
+	Handle = CreateThread(null, stackSize, [](LPVOID param) -> DWORD {
+		StartData d = *(StartData *)param;
+		delete (StartData *)param;
+		d.F(d.Ptr);
+		return 0;
+	}, data, CREATE_SUSPENDED | (stackSize ? STACK_SIZE_PARAM_IS_A_RESERVATION : 0), null);
+	if (!Handle)
+	{
+		delete data;
+		return ENOMEM;
+	}
+	if (mask && !SetThreadAffinityMask(Handle, mask))
+	{
+		TerminateThread(Handle, 0); // Never ran
+		CloseHandle(Handle);
+		delete data;
+		return EINVAL;
+	}
+	ResumeThread(Handle);
+	Started = true;
+	return 0;
+}
+
+void ManagedThread::join() noexcept
+{
+	if (!Started)
+		return;
+	WaitForSingleObject(Handle, INFINITE);
+	CloseHandle(Handle);
+	Started = false;
+}
+
+#else
+
+errno_t ManagedThread::p_start(void(*f)(void *ptr), void *ptr, ptrdiff_t stackSize) noexcept
+{
+	struct StartData
+	{
+		void(*F)(void *ptr);
+		void *Ptr;
+	};
+	StartData *data = new (std::nothrow) StartData{ f, ptr };
+	if (!data) return ENOMEM;
+	pthread_attr_t attr;
+	errno_t eno = pthread_attr_init(&attr);
+	if (eno)
+	{
+		delete data;
+		return eno;
+	}
+	auto fin = gsl::finally([&]() -> void {
+		pthread_attr_destroy(&attr);
+		if (eno) delete data;
+	});
+	if (stackSize)
+	{
+		eno = pthread_attr_setstacksize(&attr, (size_t)stackSize);
+		if (eno) return eno;
+	}
+	if (!Cpus.empty())
+	{
+#ifdef __linux__
+		// Set at creation, so the thread never runs outside of its CPU set
+		cpu_set_t set;
+		eno = toCpuSet(set, Cpus);
+		if (eno) return eno;
+		eno = pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+		if (eno) return eno;
+#else
+		eno = ENOTSUP;
+		return eno;
+#endif
+	}
+	eno = pthread_create(&Handle, &attr, [](void *param) -> void * {
+		StartData d = *(StartData *)param;
+		delete (StartData *)param;
+		d.F(d.Ptr);
+		return null;
+	}, data);
+	if (eno) return eno;
+	Started = true;
+	return 0;
+}
+
+void ManagedThread::join() noexcept
+{
+	if (!Started)
+		return;
+	pthread_join(Handle, null);
+	Started = false;
+}
+
+#endif
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+
+EventLoop::EventLoop() : EventLoopBase(&EventLoopVt)
+{
+	EpollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (EpollFd < 0)
+		throw std::system_error(errno, std::generic_category());
+	WakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	epoll_event ev = {};
+	ev.events = EPOLLIN;
+	ev.data.u64 = (uint64_t)WakeFd;
+	if (WakeFd < 0 || epoll_ctl(EpollFd, EPOLL_CTL_ADD, WakeFd, &ev))
+	{
+		errno_t eno = errno;
+		if (WakeFd >= 0) close(WakeFd);
+		close(EpollFd);
+		throw std::system_error(eno, std::generic_category());
+	}
+}
+
+EventLoop::~EventLoop() noexcept
+{
+	Watches.clear();
+	close(WakeFd);
+	close(EpollFd);
+}
+
+#else
+
+EventLoop::EventLoop() : EventLoopBase(&EventLoopVt)
+{
+}
+
+EventLoop::~EventLoop() noexcept
+{
+}
+
+#endif
+
+}
+
+SEV_EventLoop *SEV_EventLoop_create()
+{
+	try
+	{
+		return new sev::impl::el::EventLoop();
+	}
+	catch (...)
+	{
+		return null;
+	}
+}
+
+void SEV_IMPL_EventLoop_destroy(SEV_EventLoop *el)
+{
+	sev::impl::el::stopWatchdog((sev::impl::el::EventLoopBase *)el);
+	el->Vt->Stop(el);
+	delete (sev::impl::el::EventLoop *)el;
+}
+
+errno_t SEV_IMPL_EventLoop_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size)
+{
+	if (!f || size < 0 || (size && !ptr))
+		return EINVAL;
+	if (size > sev::impl::el::c_CallDataMax)
+		return SEV_IMPL_EventLoopBase_post(el, f, ptr, size);
+	sev::impl::el::CallArgs args{ f, ptr, size };
+	return SEV_IMPL_EventLoop_postFunctor(el, sev::impl::el::callDataVt(size), &args, sev::impl::el::constructCallData);
+}
+
+errno_t SEV_IMPL_EventLoop_postBatch(SEV_EventLoop *el, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *posted)
+{
+	if (posted) *posted = 0;
+	if (count < 0 || (count && (!vts || !ptrs || !forwardConstructors)))
+		return EINVAL;
+	if (!count)
+		return 0;
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (sev::impl::tr::enabled()) SEV_Trace_instant("post batch", vts[0]);
+	elp->QueueItems += (int)count;
+	ptrdiff_t pushed;
+	errno_t res = SEV_ConcurrentFunctorQueue_pushFunctors(elp->Queue.get(), count, vts, ptrs, forwardConstructors, &pushed);
+	if (pushed != count) elp->QueueItems -= (int)(count - pushed);
+	if (pushed) sev::impl::el::wakeMany(elp, pushed);
+	if (posted) *posted = pushed;
+	return res;
+}
+
+errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (sev::impl::tr::enabled()) SEV_Trace_instant("post", vt);
+	errno_t res;
+	if (sev::impl::el::postLocal(elp, vt, ptr, forwardConstructor, res, true))
+		return res;
+	++elp->QueueItems;
+	res = SEV_ConcurrentFunctorQueue_pushFunctor(elp->Queue.get(), vt, ptr, forwardConstructor);
+	if (res) --elp->QueueItems;
+	else sev::impl::el::wakeOne(elp);
+	return res;
+}
+
+errno_t SEV_IMPL_EventLoop_postFunctorUnbounded(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (sev::impl::tr::enabled()) SEV_Trace_instant("post", vt);
+	errno_t res;
+	if (sev::impl::el::postLocal(elp, vt, ptr, forwardConstructor, res, false))
+		return res;
+	++elp->QueueItems;
+	try
 	{
-		return ENOMEM;
+		res = SEV_ConcurrentFunctorQueue_pushFunctorUnboundedEx(elp->Queue.get(), vt, vt->Size, ptr, forwardConstructor);
 	}
 	catch (...)
 	{
-		return EOTHER;
+		res = EOTHER;
 	}
-	return 0;
+	if (res) --elp->QueueItems;
+	else sev::impl::el::wakeOne(elp);
+	return res;
 }
 
-void SEV_IMPL_EventLoopBase_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr)
+errno_t SEV_IMPL_EventLoop_postFunctorWait(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs)
 {
-	((sev::ExceptionHandle *)eh)->capture<void>([=]() -> void {
-		sev::EventFunctorView fv = std::move([f, ptr](sev::EventLoop &el) -> errno_t {
-			errno_t err = f(ptr, &el);
-			if (!err) return 0;
-			if (err == ENOMEM) throw std::bad_alloc();
-			throw std::exception();
-			return 0; // FIXME
-			});
-		const sev::EventFunctorVt *vt;
-		void *ptr;
-		bool movable;
-		fv.extract(vt, ptr, movable, false);
-		SEV_ASSERT(!movable);
-		el->Vt->InvokeFunctor(el, eh, vt->get(), ptr);
-		});
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(max(timeoutMs, 0));
+	for (; ; )
+	{
+		errno_t eno = SEV_IMPL_EventLoop_postFunctor(el, vt, ptr, forwardConstructor);
+		if (eno != EAGAIN)
+			return eno;
+		int remainingMs = -1;
+		if (timeoutMs >= 0)
+		{
+			remainingMs = (int)std::chrono::ceil<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+			if (remainingMs <= 0)
+				return ETIMEDOUT;
+		}
+		if (errno_t res = SEV_ConcurrentFunctorQueue_waitSpace(elp->Queue.get(), remainingMs))
+			return res;
+	}
 }
 
-errno_t SEV_IMPL_EventLoopBase_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int timeoutMs)
+errno_t SEV_IMPL_EventLoop_notifySpaceFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
 {
-	// Generic unoptimized wrapper
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
 	try
 	{
-		std::vector<uint8_t> v(size);
-		memcpy(&v[0], ptr, size);
-		sev::EventFunctorView fv = std::move([f, v](sev::EventLoop &el) -> errno_t {
-			errno_t err = f((void *)&v[0], &el);
-			if (!err) return 0;
-			if (err == ENOMEM) throw std::bad_alloc();
-			throw std::exception();
-			return 0; // FIXME
-			});
-		const sev::EventFunctorVt *vt;
-		void *ptr;
-		bool movable;
-		fv.extract(vt, ptr, movable, true);
-		SEV_ASSERT(movable);
-		return el->Vt->TimeoutFunctor(el, vt->get(), ptr, vt->get()->MoveConstructor, timeoutMs);
+		// The queue calls back on the pop path, hand the callback to the loop instead of holding up the popped entry
+		auto notify = [elp, f = sev::Functor<void()>((const sev::FunctorVt<void()> *)vt, ptr, forwardConstructor)]() mutable -> void {
+			auto run = [f = std::move(f)](sev::EventLoop &) mutable -> errno_t {
+				f();
+				return SEV_ESUCCESS;
+			};
+			static const sev::EventFunctorVt runVt(run);
+			if (SEV_IMPL_EventLoop_postFunctorUnbounded(elp, runVt.get(), &run, runVt.get()->MoveConstructor))
+				run(*elp); // Out of memory, run it here rather than lose it
+		};
+		static const sev::FunctorVt<void()> notifyVt(notify);
+		return SEV_ConcurrentFunctorQueue_notifySpaceFunctor(elp->Queue.get(), notifyVt.get(), &notify, notifyVt.get()->MoveConstructor);
 	}
-	catch (std::bad_alloc)
+	catch (const std::bad_alloc &)
 	{
 		return ENOMEM;
 	}
@@ -175,106 +1331,287 @@ errno_t SEV_IMPL_EventLoopBase_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr,
 	{
 		return EOTHER;
 	}
-	return 0;
 }
 
-errno_t SEV_IMPL_EventLoopBase_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs)
+namespace sev::impl::el {
+namespace {
+
+// Functor posted with a deadline, constructed directly in queue memory. The header is followed by the functor, then by the expired functor, each at the functor alignment
+struct DeadlineEntry
 {
-	// Generic unoptimized wrapper
-	try
+	int64_t DeadlineNs;
+	const SEV_FunctorVt *Vt;
+	const SEV_FunctorVt *ExpiredVt; // Null to drop the functor once expired
+
+	static ptrdiff_t aligned(ptrdiff_t size) noexcept { return (size + SEV_FUNCTOR_ALIGN - 1) & ~(ptrdiff_t)(SEV_FUNCTOR_ALIGN - 1); }
+	void *ptr() noexcept { return (uint8_t *)this + aligned(sizeof(DeadlineEntry)); }
+	void *expiredPtr() noexcept { return (uint8_t *)ptr() + aligned(Vt->Size); }
+
+	// Relocate both functors with their own vtables
+	template<typename TConstruct>
+	static void construct(void *ptr, DeadlineEntry *other, TConstruct construct)
 	{
-		std::vector<uint8_t> v(size);
-		memcpy(&v[0], ptr, size);
-		sev::EventFunctorView fv = std::move([f, v](sev::EventLoop &el) -> errno_t {
-			errno_t err = f((void *)&v[0], &el);
-			if (!err) return 0;
-			if (err == ENOMEM) throw std::bad_alloc();
-			throw std::exception();
-			return 0; // FIXME
-			});
-		const sev::EventFunctorVt *vt;
-		void *ptr;
-		bool movable;
-		fv.extract(vt, ptr, movable, true);
-		SEV_ASSERT(movable);
-		return el->Vt->IntervalFunctor(el, vt->get(), ptr, vt->get()->MoveConstructor, intervalMs);
+		DeadlineEntry *entry = new (ptr) DeadlineEntry(*other);
+		construct(entry->Vt, entry->ptr(), other->ptr());
+		if (!entry->ExpiredVt)
+			return;
+		try
+		{
+			construct(entry->ExpiredVt, entry->expiredPtr(), other->expiredPtr());
+		}
+		catch (...)
+		{
+			entry->Vt->Destroy(entry->ptr());
+			throw;
+		}
 	}
-	catch (std::bad_alloc)
+
+	bool expired(sev::EventLoop &el) noexcept
 	{
-		return ENOMEM;
+		EventLoopBase *elp = (EventLoopBase *)&el;
+		if (loopNs(elp) <= DeadlineNs)
+			return false;
+		++elp->Shed;
+		return true;
+	}
+
+};
+
+struct DeadlineArgs
+{
+	DeadlineEntry Entry;
+	void *Ptr;
+	void(*ForwardConstructor)(void *ptr, void *other);
+	void *ExpiredPtr;
+	void(*ExpiredForwardConstructor)(void *ptr, void *other);
+
+};
+
+void constructDeadline(void *ptr, void *other)
+{
+	DeadlineArgs *args = (DeadlineArgs *)other;
+	DeadlineEntry *entry = new (ptr) DeadlineEntry(args->Entry);
+	args->ForwardConstructor(entry->ptr(), args->Ptr);
+	if (!entry->ExpiredVt)
+		return;
+	try
+	{
+		args->ExpiredForwardConstructor(entry->expiredPtr(), args->ExpiredPtr);
 	}
 	catch (...)
 	{
-		return EOTHER;
+		entry->Vt->Destroy(entry->ptr());
+		throw;
 	}
-	return 0;
 }
 
-namespace sev::impl::el {
-
-SEV_EventLoopVt EventLoopVt = {
-	SEV_IMPL_EventLoop_destroy,
-
-	SEV_IMPL_EventLoopBase_post,
-	SEV_IMPL_EventLoopBase_invoke,
-	SEV_IMPL_EventLoopBase_timeout,
-	SEV_IMPL_EventLoopBase_interval,
-
-	SEV_IMPL_EventLoop_postFunctor,
-	SEV_IMPL_EventLoop_invokeFunctor,
-	null, // TimeoutFunctor
-	null, // IntervalFunctor
+// Vtable for entries of the given size. Only the size and the name differ between pairs, the entry points go through the vtables in the entry
+SEV_FunctorVt makeDeadlineVt(ptrdiff_t size, const void *typeInfo) noexcept
+{
+	SEV_FunctorVt res;
+	res.Size = size;
+	res.ConstCopyConstructor = [](void *ptr, const void *other) -> void {
+		DeadlineEntry::construct(ptr, (DeadlineEntry *)other, [](const SEV_FunctorVt *vt, void *ptr, void *other) -> void { vt->ConstCopyConstructor(ptr, other); });
+	};
+	res.CopyConstructor = [](void *ptr, void *other) -> void {
+		DeadlineEntry::construct(ptr, (DeadlineEntry *)other, [](const SEV_FunctorVt *vt, void *ptr, void *other) -> void { vt->CopyConstructor(ptr, other); });
+	};
+	res.MoveConstructor = [](void *ptr, void *other) -> void {
+		DeadlineEntry::construct(ptr, (DeadlineEntry *)other, [](const SEV_FunctorVt *vt, void *ptr, void *other) -> void { vt->MoveConstructor(ptr, other); });
+	};
+	res.Destroy = [](void *ptr) -> void {
+		DeadlineEntry *entry = (DeadlineEntry *)ptr;
+		entry->Vt->Destroy(entry->ptr());
+		if (entry->ExpiredVt) entry->ExpiredVt->Destroy(entry->expiredPtr());
+	};
+	res.Invoke = (void *)(sev::EventFunctorVt::TInvoke)[](void *ptr, sev::EventLoop &el) -> errno_t {
+		DeadlineEntry *entry = (DeadlineEntry *)ptr;
+		if (!entry->expired(el))
+			return ((sev::EventFunctorVt::TInvoke)entry->Vt->Invoke)(entry->ptr(), el);
+		return entry->ExpiredVt ? ((sev::EventFunctorVt::TInvoke)entry->ExpiredVt->Invoke)(entry->expiredPtr(), el) : SEV_ESUCCESS;
+	};
+	res.TryInvoke = (void *)(sev::EventFunctorVt::TTryInvoke)[](void *ptr, sev::ExceptionHandle &eh, sev::EventLoop &el) -> errno_t {
+		DeadlineEntry *entry = (DeadlineEntry *)ptr;
+		if (!entry->expired(el))
+			return ((sev::EventFunctorVt::TTryInvoke)entry->Vt->TryInvoke)(entry->ptr(), eh, el);
+		return entry->ExpiredVt ? ((sev::EventFunctorVt::TTryInvoke)entry->ExpiredVt->TryInvoke)(entry->expiredPtr(), eh, el) : SEV_ESUCCESS;
+	};
+	res.TypeInfo = typeInfo;
+	return res;
+}
 
-	null, // Join
+ptrdiff_t deadlineSize(const SEV_FunctorVt *vt, const SEV_FunctorVt *expiredVt) noexcept
+{
+	return DeadlineEntry::aligned(sizeof(DeadlineEntry)) + DeadlineEntry::aligned(vt->Size) + (expiredVt ? expiredVt->Size : 0);
+}
 
-	SEV_IMPL_EventLoop_run, // Run
-	SEV_IMPL_EventLoop_loop, // Loop
-	SEV_IMPL_EventLoop_stop, // Stop
+// One vtable per functor and expired functor pair, sized to hold both and named after the functor, so stats, tracing and the watchdog see the functor rather than a wrapper
+struct DeadlineVtSlot
+{
+	std::atomic<int> State; // 0 free, 1 being filled, 2 ready
+	const SEV_FunctorVt *Vt;
+	const SEV_FunctorVt *ExpiredVt;
+	SEV_FunctorVt EntryVt;
 
 };
 
-}
+const int c_DeadlineVtSlots = 1024; // Functor vtables are static, so the pairs are few
 
-SEV_EventLoop *SEV_EventLoop_create()
+// Lock free open addressing table, slots are claimed once and never erased, entries in flight point at them. When full, falls back to unnamed vtables per size class
+const SEV_FunctorVt *deadlineVt(const SEV_FunctorVt *vt, const SEV_FunctorVt *expiredVt) noexcept
 {
-	try
+	thread_local const SEV_FunctorVt *t_Key[2] = { null, null };
+	thread_local const SEV_FunctorVt *t_Vt = null;
+	if (t_Vt && t_Key[0] == vt && t_Key[1] == expiredVt)
+		return t_Vt;
+	static DeadlineVtSlot s_Slots[c_DeadlineVtSlots];
+	const ptrdiff_t size = deadlineSize(vt, expiredVt);
+	const SEV_FunctorVt *res = null;
+	size_t i = (size_t)((((uintptr_t)vt >> 4) ^ ((uintptr_t)expiredVt >> 3)) * 0x9E3779B97F4A7C15ULL >> 32);
+	for (int n = 0; n < c_DeadlineVtSlots && !res; ++n, ++i)
 	{
-		return new sev::impl::el::EventLoop();
+		DeadlineVtSlot &slot = s_Slots[i % c_DeadlineVtSlots];
+		int state = slot.State.load(std::memory_order_acquire);
+		if (!state && slot.State.compare_exchange_strong(state, 1, std::memory_order_acquire))
+		{
+			slot.Vt = vt;
+			slot.ExpiredVt = expiredVt;
+			slot.EntryVt = makeDeadlineVt(size, vt->TypeInfo);
+			slot.State.store(2, std::memory_order_release);
+			res = &slot.EntryVt;
+			break;
+		}
+		while (state == 1)
+		{
+			std::this_thread::yield();
+			state = slot.State.load(std::memory_order_acquire);
+		}
+		if (slot.Vt == vt && slot.ExpiredVt == expiredVt)
+			res = &slot.EntryVt;
 	}
-	catch (...)
+	if (!res)
 	{
-		return null;
+		static const std::array<SEV_FunctorVt, c_SizeClasses> s_Vts = []() -> std::array<SEV_FunctorVt, c_SizeClasses> {
+			std::array<SEV_FunctorVt, c_SizeClasses> vts;
+			for (int i = 0; i < c_SizeClasses; ++i)
+				vts[i] = makeDeadlineVt(sizeClassBytes(i), null);
+			return vts;
+		}();
+		const int sc = sizeClass(size);
+		if (sc >= c_SizeClasses)
+			return null;
+		res = &s_Vts[sc];
 	}
+	t_Key[0] = vt;
+	t_Key[1] = expiredVt;
+	t_Vt = res;
+	return res;
 }
 
-void SEV_IMPL_EventLoop_destroy(SEV_EventLoop *el)
+}
+}
+
+errno_t SEV_IMPL_EventLoop_postWithDeadlineFunctor(SEV_EventLoop *el, int64_t deadlineNs, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *expiredVt, void *expiredPtr, void(*expiredForwardConstructor)(void *ptr, void *other))
 {
-	el->Vt->Stop(el);
-	delete el;
+	const SEV_FunctorVt *entryVt = sev::impl::el::deadlineVt(vt, expiredVt);
+	if (!entryVt)
+		return E2BIG;
+	sev::impl::el::DeadlineArgs args{ { deadlineNs, vt, expiredVt }, ptr, forwardConstructor, expiredPtr, expiredForwardConstructor };
+	return SEV_IMPL_EventLoop_postFunctor(el, entryVt, &args, sev::impl::el::constructDeadline);
 }
 
-errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+errno_t SEV_IMPL_EventLoop_setQueueCapacity(SEV_EventLoop *el, ptrdiff_t capacity, bool bytes)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	return SEV_ConcurrentFunctorQueue_setCapacity(elp->Queue.get(), capacity, bytes);
+}
+
+ptrdiff_t SEV_IMPL_EventLoop_queueUsed(SEV_EventLoop *el, bool bytes)
 {
 	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	return SEV_ConcurrentFunctorQueue_used(elp->Queue.get(), bytes);
+}
+
+errno_t SEV_IMPL_EventLoop_resume(SEV_EventLoop *el, void(*resume)(void *frame), void *frame)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	auto f = [resume, frame](sev::EventLoop &) -> errno_t {
+		resume(frame);
+		return SEV_ESUCCESS;
+	};
+	static const sev::EventFunctorVt vt(f);
+	errno_t res;
+	if (sev::impl::el::postLocal(elp, vt.get(), &f, vt.get()->CopyConstructor, res, false))
+		return res;
 	++elp->QueueItems;
-	errno_t res = SEV_ConcurrentFunctorQueue_pushFunctor(elp->Queue.get(), vt, ptr, forwardConstructor);
+	res = elp->Queue.pushUnbounded(std::nothrow, std::move(f)); // The frame is suspended already, refusing it would lose the coroutine
 	if (res) --elp->QueueItems;
-	else elp->Flag.set();
+	else sev::impl::el::wakeOne(elp);
 	return res;
 }
 
+namespace sev::impl::el {
+namespace {
+
+#ifdef __linux__
+
+// Completion of an invoke, a single word on the caller's stack
+struct InvokeDone
+{
+	static const int32_t c_Pending = 0;
+	static const int32_t c_Done = 1;
+	static const int32_t c_Sleeping = 2;
+
+	std::atomic<int32_t> State = c_Pending;
+
+	void set() noexcept
+	{
+		// Nothing on the caller's stack may be touched once the state is published, a stray wake is harmless
+		if (State.exchange(c_Done, std::memory_order_acq_rel) == c_Sleeping)
+			syscall(SYS_futex, (int32_t *)&State, FUTEX_WAKE_PRIVATE, 1, null, null, 0);
+	}
+
+	void wait() noexcept
+	{
+		int32_t state = c_Pending;
+		if (!State.compare_exchange_strong(state, c_Sleeping, std::memory_order_acquire))
+			return;
+		do syscall(SYS_futex, (int32_t *)&State, FUTEX_WAIT_PRIVATE, c_Sleeping, null, null, 0); // Returns early on EAGAIN and EINTR
+		while (State.load(std::memory_order_acquire) != c_Done);
+	}
+
+};
+
+static_assert(sizeof(std::atomic<int32_t>) == sizeof(int32_t));
+
+#else
+
+typedef sev::EventFlag InvokeDone;
+
+#endif
+
+}
+}
+
 void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr)
 {
 	// NOTE: Invoke catches any errors, and passes them down!
 	SEV_ASSERT(eh);
 	SEV_ASSERT(!*eh);
 	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
-	sev::EventFlag flag;
+	if (sev::impl::el::t_Loop == elp)
+	{
+		// Already on the loop, waiting for another worker would deadlock a single threaded loop
+		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, *elp);
+		if (!*eh && res) *eh = SEV_Exception_capture(res);
+		return;
+	}
+	sev::impl::el::InvokeDone done;
 	++elp->QueueItems;
-	errno_t eno = elp->Queue.push(std::nothrow, [=, &flag](sev::EventLoop &elref) -> errno_t {
+	errno_t eno = elp->Queue.push(std::nothrow, [=, &done](sev::EventLoop &elref) -> errno_t {
 		errno_t res = ((sev::EventFunctorVt *)vt)->invoke(ptr, *(sev::ExceptionHandle *)eh, elref);
 		if (!*eh && res) *eh = SEV_Exception_capture(res);
-		flag.set();
+		done.set();
 		return SEV_ESUCCESS;
 		});
 	if (eno)
@@ -284,28 +1621,122 @@ void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh
 	}
 	else
 	{
-		elp->Flag.set();
-		flag.wait();
+		sev::impl::el::wakeOne(elp);
+		done.wait();
+	}
+}
+
+namespace sev::impl::el {
+namespace {
+
+errno_t pushTimeout(EventLoop *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int ms, bool interval)
+{
+	if (!vt || ms < 0)
+		return EINVAL;
+	try
+	{
+		TimeoutFunctor tf{};
+		tf.Functor = EventFunctor((const EventFunctorVt *)vt, ptr, forwardConstructor);
+		tf.Interval = interval ? std::chrono::milliseconds(ms) : std::chrono::steady_clock::duration::zero();
+		tf.Time = loopTime(elp) + std::chrono::milliseconds(ms);
+		{
+#ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
+			elp->TimeoutConcurrent.push(std::move(tf));
+#else
+			std::unique_lock<std::mutex> lock(elp->TimeoutMutex);
+			elp->Timeout.push(std::move(tf));
+			elp->updateNextTimer();
+#endif
+		}
+		++elp->TimerSeq;
+		wakeOne(elp); // Recompute the wait
+		return 0;
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
 	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+}
+
+}
+}
+
+errno_t SEV_IMPL_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs)
+{
+	return sev::impl::el::pushTimeout((sev::impl::el::EventLoop *)el, vt, ptr, forwardConstructor, timeoutMs, false);
+}
+
+errno_t SEV_IMPL_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs)
+{
+	return sev::impl::el::pushTimeout((sev::impl::el::EventLoop *)el, vt, ptr, forwardConstructor, intervalMs, true);
 }
 
 errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
 {
+	return SEV_IMPL_EventLoop_runEx(el, onError, ptr, forwardConstructor, null);
+}
+
+errno_t SEV_IMPL_EventLoop_runEx(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_EventLoopRunOptions *options)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (options && (options->CpuCount < 0 || (options->CpuCount && !options->Cpus) || options->StackSize < 0))
+		return EINVAL;
+	const bool pinned = options && options->CpuCount;
+	const bool isolate = pinned && (options->Flags & SEV_EVENT_LOOP_RUN_ISOLATE);
+	if (options && (options->Flags & SEV_EVENT_LOOP_RUN_ISOLATE) && !pinned)
+		return EINVAL; // Isolation requires a CPU set
 	sev::ExceptionHandle ehr;
-	ehr.capture<void>([=]() -> void {
-		sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	errno_t eno = ehr.capture<errno_t>([=]() -> errno_t {
 		sev::Functor<void(SEV_ExceptionHandle *)> onErrorF((sev::FunctorVt<void(SEV_ExceptionHandle *)> *)onError, ptr, forwardConstructor == onError->MoveConstructor);
+		std::string name = (options && options->Name) ? options->Name : "";
 		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
-		elp->ManagedThreads.push_back(std::move(std::thread([=, onErrorMv = std::move(onErrorF)]() -> void { // FIXME: MOVE
+		if (elp->Stopping)
+			return ECANCELED;
+		elp->Running = true; // Before the thread starts, so it doesn't exit right away
+		sev::impl::el::ManagedThread thread;
+		std::vector<int> claimed;
+		auto releaseClaimed = gsl::finally([&]() -> void {
+			sev::impl::el::releaseCpus(elp, &claimed); // Cleared when the thread started successfully
+		});
+		if (pinned)
+		{
+			thread.Floating = false;
+			if (options->Flags & SEV_EVENT_LOOP_RUN_PIN)
+				thread.Cpus.push_back(options->Cpus[elp->ManagedThreads.size() % options->CpuCount]);
+			else
+				thread.Cpus.assign(options->Cpus, options->Cpus + options->CpuCount);
+			if (isolate)
+			{
+				errno_t eno = sev::impl::el::claimCpus(elp, thread.Cpus, claimed);
+				if (eno) return eno;
+			}
+		}
+		elp->ManagedThreads.reserve(elp->ManagedThreads.size() + 1); // Don't fail after the thread started
+		int64_t floatingSeq = 0;
+		if (thread.Floating)
+		{
+			// Take the placement and make room to register, but don't hold the lock while the thread is created
+			std::unique_lock<std::mutex> affinityLock(sev::impl::el::s_AffinityMutex);
+			sev::impl::el::s_FloatingThreads.reserve(sev::impl::el::s_FloatingThreads.size() + sev::impl::el::s_FloatingReserved + 1);
+			thread.Cpus = sev::impl::el::s_FloatingCpus;
+			floatingSeq = sev::impl::el::s_FloatingSeq;
+			++sev::impl::el::s_FloatingReserved;
+		}
+		errno_t eno = thread.start([=, onError = std::move(onErrorF), name = std::move(name)]() mutable -> void {
+			if (!name.empty())
+				sev::impl::el::setCurrentThreadName(name.c_str());
 			sev::ExceptionHandle eh;
-			sev::Functor<void(SEV_ExceptionHandle *)> onErr(onErrorMv); // FIXME: MOVE
 			while (elp->Running)
 			{
 				el->Vt->Loop(el, (SEV_ExceptionHandle *)(&eh));
 				if (eh.raised())
 				{
 					sev::ExceptionHandle ehc;
-					onErr(eh, (SEV_ExceptionHandle *)&eh);
+					onError(ehc, (SEV_ExceptionHandle *)&eh);
 					if (ehc.raised())
 					{
 						ehc.discard();
@@ -313,9 +1744,157 @@ errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError,
 					}
 				}
 			}
-		})));
+		}, options ? options->StackSize : 0);
+		if (thread.Floating)
+		{
+			std::unique_lock<std::mutex> affinityLock(sev::impl::el::s_AffinityMutex);
+			--sev::impl::el::s_FloatingReserved;
+			if (!eno)
+			{
+				sev::impl::el::s_FloatingThreads.push_back(thread.Handle);
+				if (floatingSeq != sev::impl::el::s_FloatingSeq)
+					sev::impl::el::setThreadCpus(thread.Handle, sev::impl::el::s_FloatingCpus); // Isolation changed while it started
+			}
+		}
+		if (eno) return eno;
+		elp->ManagedThreads.push_back(std::move(thread));
+		claimed.clear(); // Keep claims until stop
+		return 0;
 		});
-	return ehr.rethrow(std::nothrow);
+	if (ehr.raised())
+		return ehr.rethrow(std::nothrow);
+	return eno;
+}
+
+errno_t SEV_IMPL_EventLoop_threadAffinity(SEV_EventLoop *el, int thread, int *cpus, int *cpuCount)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	std::vector<int> res;
+	try
+	{
+		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+		if (thread < 0 || thread >= (int)elp->ManagedThreads.size())
+			return EINVAL;
+		const sev::impl::el::ManagedThread &t = elp->ManagedThreads[thread];
+#if defined(__linux__)
+		// Ask the system, so the result reflects the actual placement
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		errno_t eno = pthread_getaffinity_np(t.Handle, sizeof(set), &set);
+		if (eno) return eno;
+		for (int i = 0; i < CPU_SETSIZE; ++i)
+			if (CPU_ISSET(i, &set))
+				res.push_back(i);
+#else
+		// No query available, report what was applied
+		std::unique_lock<std::mutex> affinityLock(sev::impl::el::s_AffinityMutex);
+		res = t.Floating ? sev::impl::el::s_FloatingCpus : t.Cpus;
+		if (res.empty())
+		{
+			errno_t eno = sev::impl::el::getProcessCpus(res);
+			if (eno) return eno;
+		}
+#endif
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	int capacity = *cpuCount;
+	*cpuCount = (int)res.size();
+	if (capacity < (int)res.size())
+		return ERANGE;
+	std::copy(res.begin(), res.end(), cpus);
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_setIdlePolicy(SEV_EventLoop *el, const SEV_EventLoopIdlePolicy *policy)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (!policy || policy->SpinUs < 0 || policy->YieldUs < 0 || policy->MaxSpinning < 0)
+		return EINVAL;
+	elp->IdleSpinNs = (int64_t)policy->SpinUs * 1000;
+	elp->IdleYieldNs = (int64_t)policy->YieldUs * 1000;
+	elp->IdleMaxSpinning = policy->MaxSpinning;
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_setBudget(SEV_EventLoop *el, const SEV_EventLoopBudget *budget)
+{
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (!budget || budget->Tasks < 0 || budget->Timers < 0 || budget->LocalChain < 0)
+		return EINVAL;
+	elp->TaskBudget = budget->Tasks;
+	elp->TimerBudget = budget->Timers;
+	elp->LocalChain = budget->LocalChain;
+	return 0;
+}
+
+errno_t SEV_IMPL_EventLoop_watchFunctor(SEV_EventLoop *el, int fd, int events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+#ifdef SEV_EVENT_LOOP_EPOLL
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	if (fd < 0 || (events != SEV_EVENT_LOOP_READ && events != SEV_EVENT_LOOP_WRITE) || !vt)
+		return EINVAL;
+	try
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		std::map<int, std::shared_ptr<sev::impl::el::Watch>>::iterator it = elp->Watches.find(fd);
+		const bool added = it == elp->Watches.end();
+		std::shared_ptr<sev::impl::el::Watch> watch = added ? std::make_shared<sev::impl::el::Watch>() : it->second;
+		std::unique_lock<std::mutex> watchLock(watch->Mutex);
+		std::optional<sev::EventFunctor> &f = events == SEV_EVENT_LOOP_READ ? watch->Read : watch->Write;
+		if (f)
+			return EEXIST;
+		f.emplace((const sev::EventFunctorVt *)vt, ptr, forwardConstructor);
+		if (watch->Dispatching)
+			return 0; // Armed when the running callback returns
+		watch->Fd = fd;
+		errno_t eno = sev::impl::el::arm(elp, *watch, added ? EPOLL_CTL_ADD : EPOLL_CTL_MOD);
+		if (eno == ENOENT)
+			eno = sev::impl::el::arm(elp, *watch, EPOLL_CTL_ADD); // Descriptor was closed and reused since the last callback, without unwatch
+		if (eno)
+		{
+			f.reset();
+			return eno;
+		}
+		if (added)
+			elp->Watches[fd] = std::move(watch);
+		return 0;
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+#else
+	return ENOTSUP;
+#endif
+}
+
+errno_t SEV_IMPL_EventLoop_unwatch(SEV_EventLoop *el, int fd)
+{
+#ifdef SEV_EVENT_LOOP_EPOLL
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	std::shared_ptr<sev::impl::el::Watch> watch; // Callbacks are destroyed outside the locks
+	{
+		std::unique_lock<std::mutex> lock(elp->WatchMutex);
+		std::map<int, std::shared_ptr<sev::impl::el::Watch>>::iterator it = elp->Watches.find(fd);
+		if (it == elp->Watches.end())
+			return ENOENT;
+		watch = std::move(it->second);
+		elp->Watches.erase(it);
+		std::unique_lock<std::mutex> watchLock(watch->Mutex);
+		watch->Removed = true;
+		epoll_ctl(elp->EpollFd, EPOLL_CTL_DEL, fd, null); // Under lock, so a new watch on the same descriptor number is added after this
+	}
+	return 0;
+#else
+	return ENOTSUP;
+#endif
 }
 
 void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
@@ -329,33 +1908,110 @@ void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
 		elp->Running = false;
 		return;
 	}
+	sev::impl::el::Worker worker;
+	worker.Cover = sev::impl::el::t_Cover;
+	worker.Elastic = sev::impl::el::t_Elastic;
+	if (errno_t eno = sev::impl::el::addWorker(elp, worker))
+	{
+		*eh = SEV_Exception_capture(eno);
+		return;
+	}
 	++elp->Threads;
+	if (worker.Elastic)
+	{
+		elp->ElasticPending = false; // Counted now, the next one may start
+		sev::impl::el::checkBacklog(elp); // Ramp up one at a time while a burst is still queued
+	}
+	sev::impl::el::EventLoopBase *previousLoop = sev::impl::el::t_Loop;
+	sev::impl::el::Worker *previousWorker = sev::impl::el::t_Worker;
+	const int64_t previousNs = sev::impl::el::t_LoopNs;
+	sev::impl::el::t_Loop = elp;
+	sev::impl::el::t_Worker = &worker;
+	sev::impl::el::t_LoopNs = SEV_Clock_steadyNs();
+	auto restoreLoop = gsl::finally([&]() -> void {
+		sev::impl::el::t_Loop = previousLoop;
+		sev::impl::el::t_Worker = previousWorker;
+		sev::impl::el::t_LoopNs = previousNs;
+	});
 	while (elp->Running)
 	{
+		if (worker.covered())
+			break; // Stalled task returned, this replacement is no longer needed
+
 		// Check queue
-		if (elp->QueueItems)
+		bool taskBudgetHit = false;
+		if (sev::impl::el::sharedItems(elp) || worker.LocalVt)
 		{
+			if (sev::impl::el::instrumented(elp) != !!worker.Stats)
+				sev::impl::el::attachStats(elp, worker);
+			const int taskBudget = elp->TaskBudget.load(std::memory_order_relaxed);
+			const int localChain = elp->LocalChain.load(std::memory_order_relaxed);
+			int tasks = 0;
 			bool success;
 			do
 			{
-				errno_t eno = elp->Queue.tryCallAndPop(*(sev::ExceptionHandle *)eh, success, *elp);
-				if (success) --elp->QueueItems;
+				errno_t eno;
+				if (worker.LocalVt && worker.LocalChain < localChain)
+				{
+					// Follow-up posted by the previous task, still hot in cache
+					eno = sev::impl::el::runLocal(elp, worker, eh);
+					success = true;
+				}
+				else
+				{
+					if (worker.LocalVt) // Chain is too long, let the shared queue have a turn
+						sev::impl::el::flushLocal(elp, worker, eh);
+					worker.LocalChain = 0;
+					eno = sev::impl::el::callShared(elp, worker, eh, success);
+				}
 				if (!*eh && eno) *eh = SEV_Exception_capture(eno);
-			} while (success && !*eh); // Popped a function and no errors
+#ifdef SEV_EVENT_LOOP_IO_URING
+				if (elp->Ring) sev::impl::el::ioFlush(elp); // Enter what the task submitted as one batch
+#endif
+			} while (success && !*eh && ++tasks != taskBudget); // Popped a function and no errors
 			if (*eh) break; // Break out of loop due to error!
+			if (tasks) worker.IdleSinceNs = 0;
+			if (success && (sev::impl::el::sharedItems(elp) || worker.LocalVt))
+			{
+				// Give timers and I/O a turn
+				taskBudgetHit = true;
+				++elp->TaskBudgetHits;
+			}
 		}
 
 		// Check timer queue. Temporary, recycled code.
 		// TODO: It might be better (more generic) to put the timer queue onto a separate thread, and simply post to the event loop.
+		int64_t timeoutMs = -1; // Until the next timer, infinite when there's none
+		worker.TimerSeq = elp->TimerSeq;
+		sev::impl::el::t_LoopNs = SEV_Clock_steadyNs();
+		const int timerBudget = elp->TimerBudget.load(std::memory_order_relaxed);
+		int timers = 0;
 		((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
 			for (;;)
 			{
+				if (timers == timerBudget && timerBudget)
+				{
+					// Go back to the queue, come back right after
+					++elp->TimerBudgetHits;
+					timeoutMs = 0;
+					break;
+				}
 #ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
 				sev::impl::el::TimeoutFunctor tf;
 				if (!elp->TimeoutConcurrent.try_pop(tf))
 					break;
 				const sev::impl::el::TimeoutFunctor &tfr = tf;
 #else
+				const int64_t nextNs = elp->NextTimerNs.load(std::memory_order_relaxed);
+				if (nextNs == INT64_MAX)
+					break;
+				const int64_t nowNs = sev::impl::el::t_LoopNs;
+				if (nextNs > nowNs)
+				{
+					// Not due, skip the lock
+					timeoutMs = (nextNs - nowNs) / 1000000 + 1; // Round up
+					break;
+				}
 				elp->TimeoutMutex.lock();
 				if (!elp->Timeout.size())
 				{
@@ -364,31 +2020,36 @@ void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
 				}
 				const sev::impl::el::TimeoutFunctor &tfr = elp->Timeout.top();
 #endif
-				std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
-				int64_t wt = std::chrono::duration_cast<std::chrono::milliseconds>(tfr.Time - now).count();
+				std::chrono::steady_clock::time_point now = sev::impl::el::loopTime(elp);
 				if (tfr.Time > now) // Wait
 				{
+					timeoutMs = std::chrono::duration_cast<std::chrono::milliseconds>(tfr.Time - now).count() + 1; // Round up
 #ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
 					elp->TimeoutConcurrent.push(tf);
 #else
 					elp->TimeoutMutex.unlock();
 #endif
-					++elp->ThreadsWaiting;
-					elp->Flag.wait(wt & 0xFFFF); // Mask to 65 seconds, it's fine to break out earlier, the loop re-checks
-					--elp->ThreadsWaiting;
-					if (elp->QueueItems > 1 && elp->ThreadsWaiting > 1)
-						elp->Flag.set(); // Wake up more threads if there's more than one item in the queue
 					break;
 				}
 #ifndef SEV_EVENT_LOOP_MSVC_CONCURRENT
 				sev::impl::el::TimeoutFunctor tf = tfr;
 				elp->Timeout.pop();
+				elp->updateNextTimer();
 				elp->TimeoutMutex.unlock();
 #endif
+				++timers;
+				const bool watched = elp->WatchdogTicks.load(std::memory_order_relaxed);
+				const int64_t fired = watched || sev::impl::tr::enabled() ? SEV_Clock_ticks() : 0;
+				if (watched)
+				{
+					worker.TaskVt.store(tf.Functor.vt()->get(), std::memory_order_relaxed);
+					worker.TaskStart.store(fired, std::memory_order_release);
+				}
 				errno_t eno = tf.Functor(*(sev::ExceptionHandle *)eh, *elp);
+				if (watched) worker.TaskStart.store(0, std::memory_order_relaxed);
+				if (fired && sev::impl::tr::enabled()) SEV_Trace_complete("timer", tf.Functor.vt()->get(), fired, SEV_Clock_ticks());
 				bool cancel = eno == ECANCELED;
 				if (!*eh && eno && eno != ECANCELED) *eh = SEV_Exception_capture(eno);
-				--elp->QueueItems;
 				if (!cancel && (tf.Interval > std::chrono::nanoseconds::zero())) // repeat
 				{
 					tf.Time += tf.Interval;
@@ -396,10 +2057,10 @@ void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
 					{
 #ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
 						elp->TimeoutConcurrent.push(std::move(tf));
-						++elp->QueueItems;
 #else
 						std::unique_lock<std::mutex> lock(elp->TimeoutMutex);
 						elp->Timeout.push(std::move(tf));
+						elp->updateNextTimer();
 #endif
 					}
 				}
@@ -408,13 +2069,37 @@ void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh)
 		});
 		if (*eh) break; // Break out of loop due to error!
 
+#ifdef SEV_EVENT_LOOP_EPOLL
+		// Queue is still busy, check I/O without blocking, unless another worker is polling already
+		if (taskBudgetHit && !elp->Polling.exchange(true))
+			sev::impl::el::poll(elp, worker, eh, 0);
+		if (*eh) break; // Break out of loop due to I/O callback error!
+#endif
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+		if (elp->Ring) sev::impl::el::ioFlush(elp); // Submitted by timers
+#endif
+
 		// Wait
-		++elp->ThreadsWaiting;
-		elp->Flag.wait();
-		--elp->ThreadsWaiting;
-		if (elp->QueueItems > 1 && elp->ThreadsWaiting > 1)
-			elp->Flag.set(); // Wake up more threads if there's more than one item in the queue
+		if (!sev::impl::el::sharedItems(elp) && !worker.LocalVt && elp->Running)
+		{
+			if (worker.Elastic && sev::impl::el::retireElastic(elp, worker, timeoutMs))
+				break; // Idled past the grace period, the pool is above its minimum
+			sev::impl::el::idle(elp, worker, eh, timeoutMs);
+			sev::impl::el::t_LoopNs = SEV_Clock_steadyNs();
+		}
+		if (*eh) break; // Break out of loop due to I/O callback error!
+	}
+	if (worker.LocalVt)
+	{
+		// Leave it to the other workers
+		SEV_ExceptionHandle ehl = null;
+		sev::impl::el::flushLocal(elp, worker, &ehl);
+		if (!*eh) *eh = ehl;
+		else SEV_Exception_discardEx(ehl);
 	}
+	if (worker.Stats) sev::impl::el::detachStats(elp, worker);
+	sev::impl::el::removeWorker(elp, worker);
 	--elp->Threads;
 	elp->LoopEndedFlag.set();
 }
@@ -427,22 +2112,26 @@ void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el)
 		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
 		elp->Stopping = true; // Yes.
 		elp->Running = false;
+		sev::impl::el::wakeAll(elp);
 		// Wait for managed threads
-		for (std::thread &t : elp->ManagedThreads)
 		{
-			if (t.joinable())
+			std::unique_lock<std::mutex> affinityLock(sev::impl::el::s_AffinityMutex);
+			std::vector<sev::impl::el::ManagedThread::NativeHandle> &floating = sev::impl::el::s_FloatingThreads;
+			for (sev::impl::el::ManagedThread &t : elp->ManagedThreads)
 			{
-				try
-				{
-					t.join();
-				}
-				catch (...)
-				{
-					// ...
-				}
+				if (t.joinable() && t.Floating)
+					floating.erase(std::find(floating.begin(), floating.end(), t.Handle));
 			}
 		}
+		for (sev::impl::el::ManagedThread &t : elp->ManagedThreads)
+		{
+			if (t.joinable())
+				t.join();
+		}
 		elp->ManagedThreads.clear();
+		sev::impl::el::joinReplacements(elp);
+		sev::impl::el::joinElastic(elp);
+		sev::impl::el::releaseCpus(elp);
 		while (elp->Threads)
 		{
 			// Wait for other threads
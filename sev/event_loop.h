@@ -47,6 +47,214 @@ struct SEV_EventLoop
 
 };
 
+// Pin each worker to a single CPU from the CPU set, chosen round-robin by the index of the worker in the loop
+#define SEV_EVENT_LOOP_RUN_PIN 0x01
+// Claim the CPU set exclusively for this loop. Managed workers of other loops which don't specify a CPU set will be moved off these CPUs. Fails with EBUSY if the CPUs are already claimed
+#define SEV_EVENT_LOOP_RUN_ISOLATE 0x02
+
+struct SEV_EventLoopRunOptions
+{
+	const char *Name; // Thread name, null to leave unchanged. Truncated to 15 characters on Linux
+	ptrdiff_t StackSize; // Thread stack size in bytes, 0 for the platform default
+	const int *Cpus; // CPU indices which the worker may run on, null to float across all CPUs which are not isolated
+	int CpuCount;
+	int Flags; // SEV_EVENT_LOOP_RUN_*
+
+};
+
+// Idle workers busy-poll the queue, then yield, then park. Parked workers are woken in LIFO order, so the most recently active worker takes the next task
+struct SEV_EventLoopIdlePolicy
+{
+	int SpinUs; // Busy-poll with a pause instruction for this long, 0 to skip
+	int YieldUs; // Then yield the thread for this long before parking, 0 to skip
+	int MaxSpinning; // Limit on the number of workers spinning or yielding at the same time, 0 for no limit
+
+};
+
+// Readiness events for watch. Callbacks are level-triggered, and run on one loop thread at a time per descriptor. Return ECANCELED from a callback to stop watching that event
+#define SEV_EVENT_LOOP_READ 0x01
+#define SEV_EVENT_LOOP_WRITE 0x02
+
+// Asynchronous I/O operations. Completion callbacks receive the result of the system call, or a negative errno
+#define SEV_EVENT_LOOP_IO_READ 1 // Read Size bytes from Fd at Offset into Buffer
+#define SEV_EVENT_LOOP_IO_WRITE 2 // Write Size bytes from Buffer to Fd at Offset
+#define SEV_EVENT_LOOP_IO_ACCEPT 3 // Accept a connection on Fd, with SOCK_* Flags. Result is the new descriptor
+#define SEV_EVENT_LOOP_IO_RECV 4 // Receive up to Size bytes from Fd into Buffer, with MSG_* Flags
+#define SEV_EVENT_LOOP_IO_SEND 5 // Send Size bytes from Buffer to Fd, with MSG_* Flags
+#define SEV_EVENT_LOOP_IO_FSYNC 6 // Flush Fd to disk, Flags 1 to only flush data
+#define SEV_EVENT_LOOP_IO_TIMEOUT 7 // Complete with 0 after TimeoutMs
+
+struct SEV_EventLoopIo
+{
+	int Op; // SEV_EVENT_LOOP_IO_*
+	int Fd;
+	void *Buffer; // Must stay valid until the operation completes
+	ptrdiff_t Size;
+	int64_t Offset; // File offset for read and write, -1 to use the file position
+	int Flags;
+	int TimeoutMs;
+
+};
+
+// Percentiles of the time queued functors spent waiting in the queue, or running. Buckets are within 1/16 of the value
+struct SEV_EventLoopLatency
+{
+	int64_t Count;
+	int64_t P50Ns;
+	int64_t P99Ns;
+	int64_t P999Ns;
+	int64_t MaxNs;
+
+};
+
+// Sampled cost of one callable type, from SEV_EventLoop_profile
+struct SEV_EventLoopProfileEntry
+{
+	const SEV_FunctorVt *Vt; // Null for the types that didn't fit in the table
+	const char *Name; // Demangled type name of the callable, valid until the process exits
+	int64_t Samples;
+	int64_t Count; // Estimated calls, samples weighted by the sampling interval
+	int64_t CpuNs; // Estimated thread CPU time, weighted the same way
+	int64_t MaxNs; // Longest sampled call, wall clock
+
+};
+
+// Watchdog which reports queued functors and timers running longer than the threshold. Off when ThresholdMs is 0
+struct SEV_EventLoopWatchdog
+{
+	int ThresholdMs;
+	int IntervalMs; // How often the workers are checked, 0 for a quarter of the threshold
+	int MaxReplacements; // Start a replacement worker for each stalled one, up to this many at once, until the stalled task returns. 0 to only report
+
+};
+
+// Stalled task passed to the watchdog callback
+struct SEV_EventLoopStall
+{
+	int Worker; // Sequence number of the worker, in the order threads entered the loop
+	const SEV_FunctorVt *Vt;
+	const char *Name; // Demangled type name of the callable
+	int64_t ElapsedNs; // Running time when detected
+	bool Replaced; // A replacement worker was started
+
+};
+
+struct SEV_EventLoopCounters
+{
+	int64_t Stalls; // Tasks reported by the watchdog
+	int64_t Replacements; // Replacement workers started by the watchdog
+	int64_t TaskBudgetHits; // Times a worker left queued work for later to check timers and I/O
+	int64_t TimerBudgetHits; // Times a worker left due timers for later to go back to the queue
+	int64_t Workers; // Threads inside the loop right now
+	int64_t ElasticStarted; // Workers started by the elastic pool
+	int64_t ElasticRetired; // Elastic workers which left after idling
+	int64_t Shed; // Functors posted with a deadline which had passed when their turn came
+
+};
+
+// Extra workers started while the queue is backed up, on top of the threads started with run, and retired again once idle. Off when MaxWorkers is 0
+struct SEV_EventLoopElastic
+{
+	int MinWorkers; // Started right away, and kept while idle
+	int MaxWorkers;
+	int GrowDepth; // Start one when more functors than this are queued per thread in the loop, 0 to not look at the depth
+	int GrowWaitUs; // Start one when a functor waited longer than this in the queue, 0 to not look at the wait. Timestamps every push, like latency stats
+	int IdleMs; // Retire one after idling this long, 0 for 10 seconds
+
+};
+
+// Work a worker does from one source before taking a turn at the next, so none of the queue, timers, and I/O starve the others. 0 for no limit
+struct SEV_EventLoopBudget
+{
+	int Tasks; // Queued functors, 256 by default. With epoll, I/O is polled without blocking when this is hit
+	int Timers; // Due timer callbacks, 64 by default
+	int LocalChain; // Posts from a running task to its own loop are kept on the worker and run right after it, up to this many in a row before taking from the shared queue again. These aren't picked up by other workers, and bounded posts skip this while the queue has a capacity. 0 to always use the shared queue, the default
+
+};
+
+// Queue bounds and the ways to post around them, behind one slot of the event loop vtable
+struct SEV_EventLoopQueueVt
+{
+	errno_t(*SetCapacity)(SEV_EventLoop *el, ptrdiff_t capacity, bool bytes);
+	ptrdiff_t(*Used)(SEV_EventLoop *el, bool bytes);
+	errno_t(*PostFunctorWait)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
+	errno_t(*NotifySpaceFunctor)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // void()
+	errno_t(*PostFunctorUnbounded)(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+
+	ptrdiff_t Reserved[8 - 5];
+
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(SEV_EventLoopQueueVt) == 8 * sizeof(void *));
+#endif
+
+// Worker threads and how they schedule, behind one slot of the event loop vtable
+struct SEV_EventLoopThreadVt
+{
+	errno_t(*RunEx)(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_EventLoopRunOptions *options);
+	errno_t(*ThreadAffinity)(SEV_EventLoop *el, int thread, int *cpus, int *cpuCount);
+	errno_t(*SetIdlePolicy)(SEV_EventLoop *el, const SEV_EventLoopIdlePolicy *policy);
+	errno_t(*SetBudget)(SEV_EventLoop *el, const SEV_EventLoopBudget *budget);
+	errno_t(*SetElastic)(SEV_EventLoop *el, const SEV_EventLoopElastic *elastic, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // void(SEV_ExceptionHandle *eh)
+
+	ptrdiff_t Reserved[8 - 5];
+
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(SEV_EventLoopThreadVt) == 8 * sizeof(void *));
+#endif
+
+// Descriptor readiness and asynchronous I/O, behind one slot of the event loop vtable
+struct SEV_EventLoopIoVt
+{
+	errno_t(*WatchFunctor)(SEV_EventLoop *el, int fd, int events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+	errno_t(*Unwatch)(SEV_EventLoop *el, int fd);
+	errno_t(*IoFunctor)(SEV_EventLoop *el, const SEV_EventLoopIo *io, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el, ptrdiff_t result)
+
+	ptrdiff_t Reserved[8 - 3];
+
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(SEV_EventLoopIoVt) == 8 * sizeof(void *));
+#endif
+
+// Other ways to hand work to the loop, behind one slot of the event loop vtable
+struct SEV_EventLoopWorkVt
+{
+	void(*ParallelForFunctor)(SEV_EventLoop *el, SEV_ExceptionHandle *eh, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, const SEV_FunctorVt *vt, void *ptr); // errno_t(EventLoop &el, ptrdiff_t begin, ptrdiff_t end)
+	errno_t(*Resume)(SEV_EventLoop *el, void(*resume)(void *frame), void *frame);
+	errno_t(*PostBatch)(SEV_EventLoop *el, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *posted);
+	errno_t(*PostWithDeadlineFunctor)(SEV_EventLoop *el, int64_t deadlineNs, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *expiredVt, void *expiredPtr, void(*expiredForwardConstructor)(void *ptr, void *other));
+
+	ptrdiff_t Reserved[8 - 4];
+
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(SEV_EventLoopWorkVt) == 8 * sizeof(void *));
+#endif
+
+// Statistics, profiling and the watchdog, behind one slot of the event loop vtable
+struct SEV_EventLoopStatsVt
+{
+	errno_t(*SetLatencyStats)(SEV_EventLoop *el, bool enabled);
+	errno_t(*LatencyStats)(SEV_EventLoop *el, int worker, SEV_EventLoopLatency *wait, SEV_EventLoopLatency *run);
+	errno_t(*SetProfiling)(SEV_EventLoop *el, int sampleEvery);
+	errno_t(*Profile)(SEV_EventLoop *el, SEV_EventLoopProfileEntry *entries, int *count);
+	errno_t(*SetWatchdog)(SEV_EventLoop *el, const SEV_EventLoopWatchdog *watchdog, const SEV_FunctorVt *onStall, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // void(const SEV_EventLoopStall *stall)
+	errno_t(*Counters)(SEV_EventLoop *el, SEV_EventLoopCounters *counters);
+
+	ptrdiff_t Reserved[8 - 6];
+
+};
+
+#ifdef __cplusplus
+static_assert(sizeof(SEV_EventLoopStatsVt) == 8 * sizeof(void *));
+#endif
+
 struct SEV_EventLoopVt
 {
 	void(*Destroy)(SEV_EventLoop *el);
@@ -67,7 +275,13 @@ struct SEV_EventLoopVt
 	void(*Loop)(SEV_EventLoop *el, SEV_ExceptionHandle *eh);
 	void(*Stop)(SEV_EventLoop *el);
 
-	ptrdiff_t Reserved[32 - 13];
+	const SEV_EventLoopQueueVt *QueueVt; // Null when the loop has no bounded queue
+	const SEV_EventLoopThreadVt *ThreadVt;
+	const SEV_EventLoopIoVt *IoVt;
+	const SEV_EventLoopWorkVt *WorkVt;
+	const SEV_EventLoopStatsVt *StatsVt;
+
+	ptrdiff_t Reserved[32 - 18];
 
 };
 
@@ -78,13 +292,13 @@ static_assert(sizeof(SEV_EventLoopVt) == 32 * sizeof(void *));
 // Interface
 SEV_LIB void SEV_EventLoop_destroy(SEV_EventLoop *el);
 
-SEV_LIB errno_t SEV_EventLoop_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size); // Post functions failure is most likely ENOMEM, no other known errors. ptr is copied to the queue
+SEV_LIB errno_t SEV_EventLoop_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size); // Post functions failure is most likely ENOMEM, or EAGAIN when the queue is at its capacity. ptr is copied into the queue entry up to 32 KiB, to the heap beyond, aligned like malloc
 SEV_LIB void SEV_EventLoop_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr); // TODO: Cast down eh
-SEV_LIB errno_t SEV_EventLoop_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int timeoutMs);
+SEV_LIB errno_t SEV_EventLoop_timeout(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int timeoutMs); // ptr is copied into the timer up to 40 bytes, to the heap beyond
 SEV_LIB errno_t SEV_EventLoop_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs);
 
 SEV_LIB errno_t SEV_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
-SEV_LIB void SEV_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr); // TODO: Cast down eh
+SEV_LIB void SEV_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr); // TODO: Cast down eh. Runs inline, ahead of queued work, when called from a thread running this loop
 SEV_LIB errno_t SEV_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
 SEV_LIB errno_t SEV_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs);
 
@@ -94,6 +308,42 @@ SEV_LIB errno_t SEV_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onErro
 SEV_LIB void SEV_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh); // TODO: Cast down eh
 SEV_LIB void SEV_EventLoop_stop(SEV_EventLoop *el);
 
+SEV_LIB errno_t SEV_EventLoop_runEx(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_EventLoopRunOptions *options); // Options may be null, same as run
+SEV_LIB errno_t SEV_EventLoop_threadAffinity(SEV_EventLoop *el, int thread, int *cpus, int *cpuCount); // Query the CPUs a managed thread is currently allowed to run on. Pass the capacity of cpus in cpuCount, receives the number of CPUs. Returns EINVAL for an unknown thread index, ERANGE if cpus is too small
+
+SEV_LIB int SEV_Thread_currentCpu(); // CPU index the calling thread is running on, -1 if unknown
+
+SEV_LIB errno_t SEV_EventLoop_setIdlePolicy(SEV_EventLoop *el, const SEV_EventLoopIdlePolicy *policy); // Trade CPU for wake-up latency. Default parks immediately
+
+SEV_LIB errno_t SEV_EventLoop_watchReadFunctor(SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Call when fd is readable, or hung up. Returns EEXIST if already watched for reading, ENOTSUP on platforms without epoll
+SEV_LIB errno_t SEV_EventLoop_watchWriteFunctor(SEV_EventLoop *el, int fd, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Call when fd is writable. Returns EEXIST if already watched for writing
+SEV_LIB errno_t SEV_EventLoop_unwatch(SEV_EventLoop *el, int fd); // Remove all callbacks for fd, must be called before closing it. A callback that is already running finishes. Returns ENOENT if not watched
+
+SEV_LIB errno_t SEV_EventLoop_ioFunctor(SEV_EventLoop *el, const SEV_EventLoopIo *io, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Start an I/O operation, callback is errno_t(EventLoop &el, ptrdiff_t result). Submissions are batched, and flushed once per loop iteration
+
+SEV_LIB void SEV_EventLoop_parallelForFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, const SEV_FunctorVt *vt, void *ptr); // Call errno_t(EventLoop &el, ptrdiff_t begin, ptrdiff_t end) concurrently on the loop threads for subranges of [from, to), at least grain long except for the last, block until done. The calling thread takes part. The functor is shared, not copied. The first error stops handing out further ranges and is passed down through eh
+
+SEV_LIB errno_t SEV_EventLoop_resume(SEV_EventLoop *el, void(*resume)(void *frame), void *frame); // Queue resume(frame) to run on the loop, for coroutine frames. The entry is just the two pointers, no functor is constructed
+
+SEV_LIB errno_t SEV_EventLoop_setLatencyStats(SEV_EventLoop *el, bool enabled); // Record per worker histograms of how long queued functors wait and run. Costs a timestamp per push, and two per functor. Recorded samples are kept when disabled
+SEV_LIB errno_t SEV_EventLoop_latencyStats(SEV_EventLoop *el, int worker, SEV_EventLoopLatency *wait, SEV_EventLoopLatency *run); // Snapshot without blocking the workers. Worker is the index of a recording slot, slots are taken by threads as they enter the loop, -1 for all combined. Returns ERANGE for an unknown slot. Wait or run may be null
+SEV_LIB errno_t SEV_EventLoop_setProfiling(SEV_EventLoop *el, int sampleEvery); // Sample one in every sampleEvery queued functors per worker, and aggregate the samples by functor vtable. 0 to stop. Samples are kept when stopped
+SEV_LIB errno_t SEV_EventLoop_profile(SEV_EventLoop *el, SEV_EventLoopProfileEntry *entries, int *count); // Most expensive types by CPU time first, over all workers. Pass the capacity in count, receives the number of entries written
+SEV_LIB ptrdiff_t SEV_EventLoop_profileReport(SEV_EventLoop *el, int top, char *buffer, ptrdiff_t size); // Text table of the top entries. Returns the length of the full report like snprintf, buffer may be null to query it. Returns -1 when out of memory
+
+SEV_LIB errno_t SEV_EventLoop_setWatchdog(SEV_EventLoop *el, const SEV_EventLoopWatchdog *watchdog, const SEV_FunctorVt *onStall, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Replace the watchdog, null or a 0 threshold to stop it. Callback is void(const SEV_EventLoopStall *stall), called once per stalled task on the watchdog thread, and may be null to only count
+SEV_LIB errno_t SEV_EventLoop_counters(SEV_EventLoop *el, SEV_EventLoopCounters *counters);
+SEV_LIB errno_t SEV_EventLoop_setBudget(SEV_EventLoop *el, const SEV_EventLoopBudget *budget);
+SEV_LIB errno_t SEV_EventLoop_postBatch(SEV_EventLoop *el, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *posted); // Post count functors in order with a single wake. Stops at the first error, posted receives the number of functors posted, may be null
+SEV_LIB errno_t SEV_EventLoop_setElastic(SEV_EventLoop *el, const SEV_EventLoopElastic *elastic, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Replace the elastic pool settings, null or a 0 MaxWorkers to stop growing, the elastic workers then retire once idle. The error handler is copied into each elastic worker like with run, and required unless stopping
+SEV_LIB errno_t SEV_EventLoop_postWithDeadlineFunctor(SEV_EventLoop *el, int64_t deadlineNs, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *expiredVt, void *expiredPtr, void(*expiredForwardConstructor)(void *ptr, void *other)); // Post errno_t(EventLoop &el), unless the deadline on the loop clock has passed when its turn comes, then the expired functor of the same signature runs instead and the functor is counted as shed. The loop clock moves between iterations, so the task budget bounds how stale it is for entries behind a slow one. The expired functor may be null to drop it
+SEV_LIB errno_t SEV_EventLoop_setQueueCapacity(SEV_EventLoop *el, ptrdiff_t capacity, bool bytes); // Bound the shared queue, in functors or in bytes of queue storage, so overload pushes back on the posting side instead of growing memory. Posts past it return EAGAIN. I/O completions, watch callbacks, resumes and other continuations of work already accepted are counted but never refused. 0 for no limit, the default. Returns ENOTSUP if the loop has no bounded queue
+SEV_LIB ptrdiff_t SEV_EventLoop_queueUsed(SEV_EventLoop *el, bool bytes); // Functors or bytes counted against the capacity, 0 if none was ever set
+SEV_LIB errno_t SEV_EventLoop_postFunctorWait(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs); // Post, blocking up to timeoutMs while the queue is full, -1 to wait indefinitely. Returns ETIMEDOUT. Not from the loop's own threads, which are the ones making space
+SEV_LIB errno_t SEV_EventLoop_notifySpaceFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Call void() once the queue has space, to retry a post which returned EAGAIN. Posted to the loop past the capacity when a worker makes space, or right away if there is space already. Must not throw
+SEV_LIB errno_t SEV_EventLoop_postFunctorUnbounded(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Post past the capacity, still counted. For continuations of work which was already accepted, where refusing would lose it. Fails only when out of memory
+SEV_LIB int64_t SEV_EventLoop_now(SEV_EventLoop *el); // Steady clock in nanoseconds as cached by the loop for this iteration when called from one of its threads, otherwise read now. Same base as SEV_Clock_steadyNs, timers are measured against it
+
 // Generic implementations, work with all event loops
 SEV_LIB errno_t SEV_IMPL_EventLoopBase_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size);
 SEV_LIB void SEV_IMPL_EventLoopBase_invoke(SEV_EventLoop *el, SEV_ExceptionHandle *eh, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr);
@@ -101,17 +351,43 @@ SEV_LIB errno_t SEV_IMPL_EventLoopBase_timeout(SEV_EventLoop *el, errno_t(*f)(vo
 SEV_LIB errno_t SEV_IMPL_EventLoopBase_interval(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size, int intervalMs);
 
 SEV_LIB SEV_EventLoop *SEV_EventLoop_create();
+SEV_LIB SEV_EventLoop *SEV_EventLoop_createIoUring(int entries, bool *ioUring); // Loop which runs I/O operations on an io_uring with the given queue size. Falls back to the regular loop when io_uring is not available, ioUring receives which one was created, may be null
 SEV_LIB void SEV_IMPL_EventLoop_destroy(SEV_EventLoop *el);
 
+SEV_LIB errno_t SEV_IMPL_EventLoop_post(SEV_EventLoop *el, errno_t(*f)(void *ptr, SEV_EventLoop *el), void *ptr, ptrdiff_t size); // Copies the data straight into the queue
 SEV_LIB errno_t SEV_IMPL_EventLoop_postFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
 SEV_LIB void SEV_IMPL_EventLoop_invokeFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, const SEV_FunctorVt *vt, void *ptr);
-// SEV_LIB errno_t SEV_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
-// SEV_LIB errno_t SEV_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs);
+SEV_LIB errno_t SEV_IMPL_EventLoop_timeoutFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
+SEV_LIB errno_t SEV_IMPL_EventLoop_intervalFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int intervalMs);
 
 SEV_LIB errno_t SEV_IMPL_EventLoop_run(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
 SEV_LIB void SEV_IMPL_EventLoop_loop(SEV_EventLoop *el, SEV_ExceptionHandle *eh);
 SEV_LIB void SEV_IMPL_EventLoop_stop(SEV_EventLoop *el);
 
+SEV_LIB errno_t SEV_IMPL_EventLoop_runEx(SEV_EventLoop *el, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_EventLoopRunOptions *options);
+SEV_LIB errno_t SEV_IMPL_EventLoop_threadAffinity(SEV_EventLoop *el, int thread, int *cpus, int *cpuCount);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setIdlePolicy(SEV_EventLoop *el, const SEV_EventLoopIdlePolicy *policy);
+SEV_LIB errno_t SEV_IMPL_EventLoop_watchFunctor(SEV_EventLoop *el, int fd, int events, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_unwatch(SEV_EventLoop *el, int fd);
+SEV_LIB errno_t SEV_IMPL_EventLoop_ioFunctor(SEV_EventLoop *el, const SEV_EventLoopIo *io, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_resume(SEV_EventLoop *el, void(*resume)(void *frame), void *frame);
+SEV_LIB void SEV_IMPL_EventLoop_parallelForFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, const SEV_FunctorVt *vt, void *ptr);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setLatencyStats(SEV_EventLoop *el, bool enabled);
+SEV_LIB errno_t SEV_IMPL_EventLoop_latencyStats(SEV_EventLoop *el, int worker, SEV_EventLoopLatency *wait, SEV_EventLoopLatency *run);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setProfiling(SEV_EventLoop *el, int sampleEvery);
+SEV_LIB errno_t SEV_IMPL_EventLoop_profile(SEV_EventLoop *el, SEV_EventLoopProfileEntry *entries, int *count);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setWatchdog(SEV_EventLoop *el, const SEV_EventLoopWatchdog *watchdog, const SEV_FunctorVt *onStall, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_counters(SEV_EventLoop *el, SEV_EventLoopCounters *counters);
+SEV_LIB errno_t SEV_IMPL_EventLoop_setBudget(SEV_EventLoop *el, const SEV_EventLoopBudget *budget);
+SEV_LIB errno_t SEV_IMPL_EventLoop_postBatch(SEV_EventLoop *el, ptrdiff_t count, const SEV_FunctorVt *const *vts, void *const *ptrs, void(*const *forwardConstructors)(void *ptr, void *other), ptrdiff_t *posted);
+SEV_LIB errno_t SEV_IMPL_EventLoop_postWithDeadlineFunctor(SEV_EventLoop *el, int64_t deadlineNs, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), const SEV_FunctorVt *expiredVt, void *expiredPtr, void(*expiredForwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_setElastic(SEV_EventLoop *el, const SEV_EventLoopElastic *elastic, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_setQueueCapacity(SEV_EventLoop *el, ptrdiff_t capacity, bool bytes);
+SEV_LIB ptrdiff_t SEV_IMPL_EventLoop_queueUsed(SEV_EventLoop *el, bool bytes);
+SEV_LIB errno_t SEV_IMPL_EventLoop_postFunctorWait(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), int timeoutMs);
+SEV_LIB errno_t SEV_IMPL_EventLoop_notifySpaceFunctor(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+SEV_LIB errno_t SEV_IMPL_EventLoop_postFunctorUnbounded(SEV_EventLoop *el, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other));
+
 #ifdef __cplusplus
 }
 #endif
@@ -122,6 +398,19 @@ typedef SEV_EventLoop EventLoop;
 typedef FunctorVt<errno_t(EventLoop &el)> EventFunctorVt;
 typedef Functor<errno_t(EventLoop &el)> EventFunctor;
 typedef FunctorView<errno_t(EventLoop &el) > EventFunctorView;
+typedef SEV_EventLoopRunOptions EventLoopRunOptions;
+typedef SEV_EventLoopIdlePolicy EventLoopIdlePolicy;
+typedef SEV_EventLoopIo EventLoopIo;
+typedef FunctorVt<errno_t(EventLoop &el, ptrdiff_t result)> IoFunctorVt;
+typedef Functor<errno_t(EventLoop &el, ptrdiff_t result)> IoFunctor;
+typedef FunctorView<errno_t(EventLoop &el, ptrdiff_t result)> IoFunctorView;
+typedef FunctorVt<errno_t(EventLoop &el, ptrdiff_t begin, ptrdiff_t end)> ParallelFunctorVt;
+typedef FunctorView<errno_t(EventLoop &el, ptrdiff_t begin, ptrdiff_t end)> ParallelFunctorView;
+typedef SEV_EventLoopWatchdog EventLoopWatchdog;
+typedef SEV_EventLoopStall EventLoopStall;
+typedef SEV_EventLoopBudget EventLoopBudget;
+typedef SEV_EventLoopElastic EventLoopElastic;
+typedef FunctorVt<void(const EventLoopStall *stall)> StallFunctorVt;
 }
 #endif
 
@@ -230,146 +519,6 @@ public:
 
 #if 0
 
-class SEV_LIB IEventLoop
-{
-public:
-	//! Run a function on a thread, and proces a callback afterwards
-	template<typename T>
-	void thread(T &&f, T &&cb)
-	{
-		std::thread t([this, f = std::forward(f), cb = std::forward(cb)]() mutable -> void {
-			f();
-			post(std::forward(cb));
-		});
-		t.detach();
-	}
-
-	//! Post a kernel with signature `void(ptrdiff_t)`, return immediately. Calls callback when done. Involves one memory allocation. Option trickle posts each iteration, and the callback, separately to avoid blocking the event loop
-	template<typename TFunc, typename TCb>
-	void post(const TFunc &f, ptrdiff_t from, ptrdiff_t to, TCb &&cb = []() -> void {}, bool trickle = false)
-	{
-		struct TData
-		{
-			Functor<void(ptrdiff_t)> f;
-			EventFunctorView cb;
-			EventFunctorView ef;
-			std::atomic_ptrdiff_t counter;
-			ptrdiff_t to;
-			int tc;
-		};
-		std::shared_ptr<TData> d = std::make_shared<TData>();
-		int tc = (int)min((ptrdiff_t)threads(), to - from);
-		d->f = f;
-		d->cb = cb;
-		d->counter = from;
-		d->to = to;
-		d->tc = tc;
-		if (!trickle)
-		{
-			for (int t = 0; t < tc; ++tc)
-			{
-				post([d]() -> void {
-					Functor<void(ptrdiff_t)> &const f = d->f;
-					EventFunctorView &const cb = d->cb;
-					std::atomic_ptrdiff_t &const counter = d->counter;
-					const ptrdiff_t &const to = d->to;
-					const int &const tc = d->tc;
-
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-
-					if (k - to == tc - 1) // Last round exiting
-						cb();
-				});
-			}
-		}
-		else
-		{
-			d->ef = [d]() -> void {
-				Functor<void(ptrdiff_t)> &const f = d->f;
-				EventFunctorView &const cb = d->cb;
-				EventFunctorView &const ef = d->ef;
-				std::atomic_ptrdiff_t &const counter = d->counter;
-				const ptrdiff_t &const to = d->to;
-				const int &const tc = d->tc;
-
-				ptrdiff_t k = counter.fetch_add(1);
-				if (k < to)
-				{
-					f(k);
-					post(ef); // Next round
-				}
-				else if (k - to == tc - 1)
-				{
-					post(cb); // Last round exiting
-				}
-			};
-
-			for (int t = 0; t < tc; ++tc)
-				d->ef();
-		}
-	}
-
-
-	//! Post a kernel with signature `void(ptrdiff_t)`, block until done. This is ideal when the calling thread is running in the same eventloop
-	template<typename TFunc, typename TCb>
-	void invoke(const TFunc &f, ptrdiff_t from, ptrdiff_t to)
-	{
-		std::atomic_ptrdiff_t counter = from;
-		int tc = (int)min((ptrdiff_t)threads(), to - from);
-		if (l_EventLoop == this)
-		{
-			std::vector<EventFlag> flags(tc - 1);
-			for (int t = 1; t < tc; ++tc)
-			{
-				post([&f, &counter, &flag = flags[t - 1]]() -> void {
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-					flag.set();
-				});
-			}
-			ptrdiff_t k = counter.fetch_add(1);
-			while (k < counter)
-			{
-				f(k);
-				k = counter.fetch_add(1);
-			}
-			for (ptrdiff_t i = 0; i < (ptrdiff_t)flags.size(); ++i)
-				flags[i].wait();
-		}
-		else
-		{
-			std::vector<EventFlag> flags(tc);
-			for (int t = 1; t < tc; ++tc)
-			{
-				post([&f, &counter, &flag = flags[t]]() -> void {
-					ptrdiff_t k = counter.fetch_add(1);
-					while (k < to)
-					{
-						f(k);
-						k = counter.fetch_add(1);
-					}
-					flag.set();
-				});
-			}
-			for (ptrdiff_t i = 0; i < (ptrdiff_t)flags.size(); ++i)
-				flags[i].wait();
-		}
-	}
-};
-
-#endif
-
-#if 0
-
 class SEV_LIB EventLoop
 {
 public:
@@ -0,0 +1,209 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#include <algorithm>
+#include <vector>
+
+namespace sev::impl::el {
+
+namespace {
+
+void runElastic(EventLoopBase *elp, ElasticWorker &ew, sev::Functor<void(SEV_ExceptionHandle *)> &onErr) noexcept
+{
+	t_Elastic = &ew;
+	sev::ExceptionHandle eh;
+	while (elp->Running && !ew.Retired)
+	{
+		elp->Vt->Loop(elp, (SEV_ExceptionHandle *)&eh);
+		if (eh.raised())
+		{
+			sev::ExceptionHandle ehc;
+			onErr(ehc, (SEV_ExceptionHandle *)&eh);
+			if (ehc.raised())
+			{
+				ehc.discard();
+				SEV_terminate(); // Don't throw in the exception handler
+			}
+		}
+	}
+	ew.Done = true;
+}
+
+// Join the workers which retired, under ElasticMutex
+void reapElastic(EventLoopBase *elp) noexcept
+{
+	for (size_t i = 0; i < elp->ElasticWorkers.size();)
+	{
+		ElasticWorker &ew = *elp->ElasticWorkers[i];
+		if (ew.Done)
+		{
+			ew.Thread.join();
+			elp->ElasticWorkers.erase(elp->ElasticWorkers.begin() + i);
+			continue;
+		}
+		++i;
+	}
+}
+
+// Start one elastic worker, under ElasticMutex
+errno_t startElastic(EventLoopBase *elp) noexcept
+{
+	reapElastic(elp);
+	try
+	{
+		elp->ElasticWorkers.push_back(std::make_unique<ElasticWorker>());
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	ElasticWorker *ew = elp->ElasticWorkers.back().get();
+	errno_t eno = ew->Thread.start([elp, ew, onErrorCp = *elp->ElasticOnError]() -> void {
+		sev::Functor<void(SEV_ExceptionHandle *)> onErr(onErrorCp);
+		runElastic(elp, *ew, onErr);
+	}, 0);
+	if (eno)
+	{
+		elp->ElasticWorkers.pop_back();
+		return eno;
+	}
+	++elp->ElasticAlive;
+	++elp->ElasticStarted;
+	return SEV_ESUCCESS;
+}
+
+}
+
+void growElastic(EventLoopBase *elp) noexcept
+{
+	if (elp->ElasticAlive.load(std::memory_order_relaxed) >= elp->ElasticMax.load(std::memory_order_relaxed))
+		return;
+	if (elp->ElasticPending.exchange(true))
+		return; // Wait until the last one is in the loop
+	std::unique_lock<std::mutex> lock(elp->ElasticMutex);
+	if (!elp->Running || elp->Stopping || !elp->ElasticOnError
+		|| elp->ElasticAlive >= elp->ElasticMax
+		|| startElastic(elp))
+		elp->ElasticPending = false;
+}
+
+bool retireElastic(EventLoopBase *elp, Worker &worker, int64_t &timeoutMs) noexcept
+{
+	const int64_t idleNs = elp->ElasticIdleNs.load(std::memory_order_relaxed);
+	const int64_t now = t_LoopNs;
+	if (!worker.IdleSinceNs) worker.IdleSinceNs = now;
+	int64_t leftNs = worker.IdleSinceNs + idleNs - now;
+	if (leftNs <= 0)
+	{
+		std::unique_lock<std::mutex> lock(elp->ElasticMutex);
+		if (elp->ElasticAlive > elp->ElasticMin)
+		{
+			worker.Elastic->Retired = true;
+			--elp->ElasticAlive;
+			++elp->ElasticRetired;
+			return true;
+		}
+		worker.IdleSinceNs = now; // Needed to keep the minimum, check again after another period
+		leftNs = idleNs;
+	}
+	const int64_t leftMs = (leftNs + 999999) / 1000000;
+	if (timeoutMs < 0 || timeoutMs > leftMs)
+		timeoutMs = leftMs;
+	return false;
+}
+
+void joinElastic(EventLoopBase *elp) noexcept
+{
+	std::vector<std::unique_ptr<ElasticWorker>> workers;
+	{
+		std::unique_lock<std::mutex> lock(elp->ElasticMutex);
+		workers.swap(elp->ElasticWorkers);
+		elp->ElasticAlive = 0;
+		elp->ElasticPending = false;
+	}
+	for (std::unique_ptr<ElasticWorker> &ew : workers)
+		ew->Thread.join();
+}
+
+}
+
+errno_t SEV_IMPL_EventLoop_setElastic(SEV_EventLoop *el, const SEV_EventLoopElastic *elastic, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	const bool enable = elastic && elastic->MaxWorkers;
+	if (elastic && (elastic->MinWorkers < 0 || elastic->MaxWorkers < 0 || elastic->MinWorkers > elastic->MaxWorkers
+		|| elastic->GrowDepth < 0 || elastic->GrowWaitUs < 0 || elastic->IdleMs < 0))
+		return EINVAL;
+	if (enable && !onError)
+		return EINVAL;
+	std::unique_lock<std::mutex> managedLock(elp->ManagedThreadsMutex);
+	std::unique_lock<std::mutex> lock(elp->ElasticMutex);
+	if (!enable)
+	{
+		// Stop growing, the elastic workers leave once idle
+		elp->ElasticMax = 0;
+		elp->ElasticMin = 0;
+		elp->ElasticDepth = 0;
+		elp->ElasticWaitTicks = 0;
+		sev::impl::el::updateTimestamps(elp);
+		return SEV_ESUCCESS;
+	}
+	if (elp->Stopping)
+		return ECANCELED;
+	try
+	{
+		elp->ElasticOnError.emplace((const sev::FunctorVt<void(SEV_ExceptionHandle *)> *)onError, ptr, forwardConstructor);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+	elp->ElasticMin = elastic->MinWorkers;
+	elp->ElasticMax = elastic->MaxWorkers;
+	elp->ElasticDepth = elastic->GrowDepth;
+	elp->ElasticWaitTicks = elastic->GrowWaitUs ? std::max((int64_t)1, (int64_t)((double)elastic->GrowWaitUs * 1e3 / SEV_Clock_nsPerTick())) : 0;
+	elp->ElasticIdleNs = (elastic->IdleMs ? (int64_t)elastic->IdleMs : (int64_t)10000) * 1000000;
+	sev::impl::el::updateTimestamps(elp);
+	elp->Running = true; // Like run, the minimum workers keep the loop going by themselves
+	while (elp->ElasticAlive < elp->ElasticMin)
+	{
+		if (errno_t eno = sev::impl::el::startElastic(elp))
+			return eno;
+	}
+	return SEV_ESUCCESS;
+}
+
+/* end of file */
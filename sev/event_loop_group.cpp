@@ -0,0 +1,328 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop_group.h"
+#include "concurrent_functor_queue.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace sev::impl::gr {
+
+namespace {
+
+const int c_DrainBatch = 256; // Functors run per drain task, before yielding to other work on the shard
+const ptrdiff_t c_BlockSize = 4 * 1024; // One queue per ordered pair of shards, keep them small
+
+}
+
+typedef ConcurrentFunctorQueue<errno_t(EventLoop &)> PairQueue;
+
+// Functors sent from one shard to another. Only the sending shard pushes, and only the receiving shard pops
+struct alignas(SEV_FUNCTOR_ALIGN) Pair
+{
+	std::atomic<PairQueue *> Queue = null; // Created by the sender on first use
+	std::atomic_bool Scheduled = false; // A drain is posted to the receiving shard
+	bool Dirty = false; // Pushed since the last flush, only touched by the sender
+
+};
+
+struct Shard
+{
+	Group *Owner = null;
+	int Index = 0;
+	int Cpu = 0;
+	EventLoop *Loop = null;
+	std::vector<int> Dirty; // Receivers pushed to since the last flush, only touched by this shard
+	bool FlushPosted = false;
+	char Name[24]; // Room for any index, setCurrentThreadName shortens it where the system limits thread names
+
+};
+
+namespace {
+
+thread_local Shard *t_Shard = null; // Shard running on this thread, set by the first task of each shard
+
+}
+
+class Group
+{
+public:
+	~Group() noexcept
+	{
+		// Stop all shards before destroying any, a running shard may still post to the others
+		for (Shard &shard : Shards)
+			if (shard.Loop) SEV_EventLoop_stop(shard.Loop);
+		for (Shard &shard : Shards)
+			if (shard.Loop) SEV_EventLoop_destroy(shard.Loop);
+		if (Pairs)
+		{
+			for (ptrdiff_t i = 0; i < (ptrdiff_t)Shards.size() * (ptrdiff_t)Shards.size(); ++i)
+				delete Pairs[i].Queue.load();
+		}
+	}
+
+	errno_t init(const SEV_EventLoopGroupOptions *options)
+	{
+		int count = options ? options->Shards : 0;
+		if (count < 0 || (options && (options->Flags & ~SEV_EVENT_LOOP_RUN_ISOLATE)))
+			return EINVAL;
+		const int cpus = std::max(1, (int)std::thread::hardware_concurrency());
+		if (!count) count = cpus;
+		Flags = options ? options->Flags : 0;
+		try
+		{
+			Shards = std::vector<Shard>(count);
+			Pairs.reset(new Pair[(ptrdiff_t)count * count]);
+			for (int i = 0; i < count; ++i)
+			{
+				Shard &shard = Shards[i];
+				shard.Owner = this;
+				shard.Index = i;
+				shard.Cpu = options && options->Cpus ? options->Cpus[i] : i % cpus;
+				shard.Dirty.reserve(count); // Flushing must not allocate
+				snprintf(shard.Name, sizeof(shard.Name), "sev shard %i", i);
+				shard.Loop = SEV_EventLoop_create();
+				if (!shard.Loop)
+					return ENOMEM;
+
+				// Runs before anything posted later
+				Shard *shardPtr = &shard;
+				auto f = [shardPtr](sev::EventLoop &) -> errno_t {
+					t_Shard = shardPtr;
+					return SEV_ESUCCESS;
+				};
+				static const EventFunctorVt vt(f);
+				if (errno_t eno = SEV_EventLoop_postFunctor(shard.Loop, vt.get(), &f, vt.get()->CopyConstructor))
+					return eno;
+			}
+		}
+		catch (const std::bad_alloc &)
+		{
+			return ENOMEM;
+		}
+		return SEV_ESUCCESS;
+	}
+
+	errno_t run(const SEV_FunctorVt *onError, void *ptr)
+	{
+		for (Shard &shard : Shards)
+		{
+			SEV_EventLoopRunOptions options{ shard.Name, 0, &shard.Cpu, 1, SEV_EVENT_LOOP_RUN_PIN | Flags };
+			if (errno_t eno = SEV_EventLoop_runEx(shard.Loop, onError, ptr, onError->CopyConstructor, &options)) // Each shard gets a copy
+				return eno; // Shards already started keep running until the group is destroyed
+		}
+		return SEV_ESUCCESS;
+	}
+
+	errno_t submit(int to, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		if (to < 0 || to >= (int)Shards.size())
+			return EINVAL;
+		Shard *from = t_Shard;
+		if (!from || from->Owner != this || from->Index == to)
+			return SEV_EventLoop_postFunctor(Shards[to].Loop, vt, ptr, forwardConstructor); // Not from another shard, nothing to batch with
+		Pair &pair = this->pair(from->Index, to);
+		PairQueue *queue = pair.Queue.load(std::memory_order_relaxed);
+		if (!queue)
+		{
+			queue = new (std::nothrow) PairQueue(std::nothrow, c_BlockSize);
+			if (!queue || !queue->get()->WriteBlock)
+			{
+				delete queue;
+				return ENOMEM;
+			}
+			pair.Queue.store(queue, std::memory_order_release);
+		}
+		if (errno_t eno = SEV_ConcurrentFunctorQueue_pushFunctor(queue->get(), vt, ptr, forwardConstructor))
+			return eno;
+		if (!pair.Dirty)
+		{
+			pair.Dirty = true;
+			from->Dirty.push_back(to);
+		}
+		if (!from->FlushPosted)
+		{
+			// Wake the receivers after the tasks already queued on this shard, which may submit more
+			Shard *fromPtr = from;
+			auto f = [fromPtr](sev::EventLoop &) -> errno_t {
+				return fromPtr->Owner->flush(*fromPtr);
+			};
+			static const EventFunctorVt fvt(f);
+			if (errno_t eno = SEV_EventLoop_postFunctorUnbounded(from->Loop, fvt.get(), &f, fvt.get()->CopyConstructor))
+				return eno; // The functor stays queued, the next submit tries to flush again
+			from->FlushPosted = true;
+		}
+		return SEV_ESUCCESS;
+	}
+
+	int shardFor(uint64_t key) const noexcept
+	{
+		// Mix the bits so sequential keys spread, then map onto the shards without a division
+		key ^= key >> 33;
+		key *= 0xFF51AFD7ED558CCDull;
+		key ^= key >> 33;
+		return (int)(((key >> 32) * (uint64_t)Shards.size()) >> 32);
+	}
+
+	int currentShard() const noexcept
+	{
+		Shard *shard = t_Shard;
+		return shard && shard->Owner == this ? shard->Index : -1;
+	}
+
+	std::vector<Shard> Shards;
+
+private:
+	Pair &pair(int from, int to) noexcept
+	{
+		return Pairs[(ptrdiff_t)from * (ptrdiff_t)Shards.size() + to];
+	}
+
+	errno_t schedule(int from, int to) noexcept
+	{
+		auto f = [this, from, to](sev::EventLoop &el) -> errno_t {
+			drain(from, to, el);
+			return SEV_ESUCCESS;
+		};
+		static const EventFunctorVt vt(f);
+		return SEV_EventLoop_postFunctorUnbounded(Shards[to].Loop, vt.get(), &f, vt.get()->CopyConstructor); // The functors in the pair queue were accepted
+	}
+
+	errno_t flush(Shard &from) noexcept
+	{
+		from.FlushPosted = false;
+		errno_t res = SEV_ESUCCESS;
+		ptrdiff_t kept = 0;
+		for (int to : from.Dirty)
+		{
+			Pair &pair = this->pair(from.Index, to);
+			if (pair.Scheduled.exchange(true))
+			{
+				pair.Dirty = false; // The pending drain picks these up
+				continue;
+			}
+			if (errno_t eno = schedule(from.Index, to))
+			{
+				// Keep it for the next flush
+				pair.Scheduled = false;
+				from.Dirty[kept++] = to;
+				res = eno;
+				continue;
+			}
+			pair.Dirty = false;
+		}
+		from.Dirty.resize(kept);
+		return res;
+	}
+
+	// Only runs on the receiving shard, one at a time
+	void drain(int from, int to, EventLoop &el)
+	{
+		Pair &pair = this->pair(from, to);
+		pair.Scheduled = false; // Any later push schedules another drain
+		PairQueue *queue = pair.Queue.load(std::memory_order_acquire);
+		ExceptionHandle eh;
+		bool success = true;
+		for (int i = 0; i < c_DrainBatch && success && !eh.raised(); ++i)
+		{
+			errno_t eno = queue->tryCallAndPop(eh, success, el);
+			if (!eh.raised() && eno) eh.capture(eno);
+		}
+		if (success && !pair.Scheduled.exchange(true))
+		{
+			// More may remain, continue behind other work on this shard
+			if (errno_t eno = schedule(from, to))
+			{
+				pair.Scheduled = false;
+				if (!eh.raised()) eh.capture(eno);
+			}
+		}
+		eh.rethrow();
+	}
+
+	std::unique_ptr<Pair[]> Pairs;
+	int Flags = 0;
+
+};
+
+}
+
+SEV_EventLoopGroup *SEV_EventLoopGroup_create(const SEV_EventLoopGroupOptions *options)
+{
+	sev::impl::gr::Group *group = new (std::nothrow) sev::impl::gr::Group();
+	if (group && group->init(options))
+	{
+		delete group;
+		return null;
+	}
+	return group;
+}
+
+void SEV_EventLoopGroup_destroy(SEV_EventLoopGroup *group)
+{
+	delete group;
+}
+
+errno_t SEV_EventLoopGroup_run(SEV_EventLoopGroup *group, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	(void)forwardConstructor; // Copied once per shard
+	return group->run(onError, ptr);
+}
+
+errno_t SEV_EventLoopGroup_submitToFunctor(SEV_EventLoopGroup *group, int shard, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return group->submit(shard, vt, ptr, forwardConstructor);
+}
+
+int SEV_EventLoopGroup_shardFor(SEV_EventLoopGroup *group, uint64_t key)
+{
+	return group->shardFor(key);
+}
+
+int SEV_EventLoopGroup_shards(SEV_EventLoopGroup *group)
+{
+	return (int)group->Shards.size();
+}
+
+int SEV_EventLoopGroup_currentShard(SEV_EventLoopGroup *group)
+{
+	return group->currentShard();
+}
+
+SEV_EventLoop *SEV_EventLoopGroup_loop(SEV_EventLoopGroup *group, int shard)
+{
+	return group->Shards[shard].Loop;
+}
+
+/* end of file */
@@ -0,0 +1,162 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Event loop group. One single-threaded event loop per shard, each pinned to its own CPU, for shared-nothing services.
+State owned by a shard is only touched from that shard's thread, functors are sent to the owning shard with submitTo.
+Each ordered pair of shards has its own queue. Functors submitted from a shard are collected per destination,
+and each destination is woken once after the sending shard's current batch of tasks, not once per functor.
+
+*/
+
+#pragma once
+#ifndef SEV_EVENT_LOOP_GROUP_H
+#define SEV_EVENT_LOOP_GROUP_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+namespace sev::impl::gr {
+class Group;
+}
+typedef sev::impl::gr::Group SEV_EventLoopGroup;
+#else
+typedef struct SEV_EventLoopGroup SEV_EventLoopGroup;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct SEV_EventLoopGroupOptions
+{
+	int Shards; // Number of shards, 0 for one per CPU
+	const int *Cpus; // CPU for each shard, null to pin shard i to CPU i
+	int Flags; // SEV_EVENT_LOOP_RUN_ISOLATE to keep other loops off the shard CPUs
+
+};
+
+SEV_LIB SEV_EventLoopGroup *SEV_EventLoopGroup_create(const SEV_EventLoopGroupOptions *options); // Options may be null for the defaults. Returns null when out of memory
+SEV_LIB void SEV_EventLoopGroup_destroy(SEV_EventLoopGroup *group); // Stops and destroys the shard loops, functors not yet run are discarded
+
+SEV_LIB errno_t SEV_EventLoopGroup_run(SEV_EventLoopGroup *group, const SEV_FunctorVt *onError, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // Start the thread of each shard. void(SEV_ExceptionHandle *eh)
+
+SEV_LIB errno_t SEV_EventLoopGroup_submitToFunctor(SEV_EventLoopGroup *group, int shard, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el). Functors from one shard to another run in submission order
+SEV_LIB int SEV_EventLoopGroup_shardFor(SEV_EventLoopGroup *group, uint64_t key); // Shard which owns the key, spreads sequential keys
+SEV_LIB int SEV_EventLoopGroup_shards(SEV_EventLoopGroup *group);
+SEV_LIB int SEV_EventLoopGroup_currentShard(SEV_EventLoopGroup *group); // Shard running on the calling thread, -1 when not called from a shard of this group
+SEV_LIB SEV_EventLoop *SEV_EventLoopGroup_loop(SEV_EventLoopGroup *group, int shard);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+class EventLoopGroup
+{
+public:
+	explicit EventLoopGroup(int shards = 0, const int *cpus = null, int flags = 0)
+	{
+		SEV_EventLoopGroupOptions options{ shards, cpus, flags };
+		m = SEV_EventLoopGroup_create(&options);
+		if (!m) throw std::bad_alloc();
+	}
+
+	~EventLoopGroup() noexcept
+	{
+		SEV_EventLoopGroup_destroy(m);
+	}
+
+	template<typename TFn>
+	void run(TFn &&onError)
+	{
+		typedef std::decay_t<TFn> TFunc;
+		static const FunctorVt<void(SEV_ExceptionHandle *)> vt((const TFunc &)onError);
+		TFunc &fr = onError;
+		errno_t eno = SEV_EventLoopGroup_run(m, vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	template<typename TFn>
+	void submitTo(int shard, TFn &&f)
+	{
+		typedef std::decay_t<TFn> TFunc;
+		static const EventFunctorVt vt((const TFunc &)f);
+		TFunc &fr = f;
+		errno_t eno = SEV_EventLoopGroup_submitToFunctor(m, shard, vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	int shardFor(uint64_t key) const noexcept
+	{
+		return SEV_EventLoopGroup_shardFor(m, key);
+	}
+
+	int shards() const noexcept
+	{
+		return SEV_EventLoopGroup_shards(m);
+	}
+
+	int currentShard() const noexcept
+	{
+		return SEV_EventLoopGroup_currentShard(m);
+	}
+
+	EventLoop &loop(int shard) const noexcept
+	{
+		return *SEV_EventLoopGroup_loop(m, shard);
+	}
+
+	SEV_EventLoopGroup *get() const noexcept
+	{
+		return m;
+	}
+
+private:
+	EventLoopGroup(const EventLoopGroup &) = delete;
+	EventLoopGroup &operator=(const EventLoopGroup &) = delete;
+
+	SEV_EventLoopGroup *m;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_EVENT_LOOP_GROUP_H */
+
+/* end of file */
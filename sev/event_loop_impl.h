@@ -37,13 +37,35 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define SEV_EVENT_LOOP_MSVC_CONCURRENT
 #endif
 
+#if defined(__linux__) && !defined(SEV_EVENT_LOOP_NO_EPOLL)
+#define SEV_EVENT_LOOP_EPOLL
+#endif
+
+#if defined(SEV_EVENT_LOOP_EPOLL) && !defined(SEV_EVENT_LOOP_NO_IO_URING)
+#define SEV_EVENT_LOOP_IO_URING
+#endif
+
 #include "event_loop.h"
 #include "concurrent_functor_queue.h"
+#include "clock.h"
+#include "trace.h"
 
+#include <algorithm>
+#include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <vector>
 #include <map>
+#include <memory>
+#include <optional>
+
+#ifndef _WIN32
+#include <pthread.h>
+#endif
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+#include <linux/io_uring.h>
+#endif
 
 #ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
 #include <concurrent_priority_queue.h>
@@ -53,6 +75,11 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 namespace sev::impl::el {
 
+extern SEV_EventLoopQueueVt EventLoopQueueVt;
+extern SEV_EventLoopThreadVt EventLoopThreadVt;
+extern SEV_EventLoopIoVt EventLoopIoVt;
+extern SEV_EventLoopWorkVt EventLoopWorkVt;
+extern SEV_EventLoopStatsVt EventLoopStatsVt;
 extern SEV_EventLoopVt EventLoopVt;
 
 struct TimeoutFunctor
@@ -68,6 +95,50 @@ struct TimeoutFunctor
 
 };
 
+// Native thread, so the stack size can be chosen at creation
+class ManagedThread
+{
+public:
+#ifdef _WIN32
+	typedef HANDLE NativeHandle;
+#else
+	typedef pthread_t NativeHandle;
+#endif
+
+	ManagedThread() noexcept : Handle(), Started(false), Floating(true) { }
+	ManagedThread(ManagedThread &&other) noexcept : Handle(other.Handle), Started(other.Started), Floating(other.Floating), Cpus(std::move(other.Cpus)) { other.Started = false; }
+	~ManagedThread() noexcept { SEV_ASSERT(!Started); }
+
+	template<typename TFn>
+	errno_t start(TFn &&f, ptrdiff_t stackSize) noexcept
+	{
+		typedef std::decay_t<TFn> TData;
+		TData *data = new (std::nothrow) TData(std::forward<TFn>(f));
+		if (!data) return ENOMEM;
+		errno_t eno = p_start([](void *ptr) -> void {
+			std::unique_ptr<TData> d((TData *)ptr);
+			(*d)();
+		}, data, stackSize);
+		if (eno) delete data;
+		return eno;
+	}
+
+	void join() noexcept;
+	bool joinable() const noexcept { return Started; }
+
+	NativeHandle Handle;
+	bool Started;
+	bool Floating; // No explicit CPU set, affinity follows the isolated CPU set
+	std::vector<int> Cpus; // CPU set applied when the thread starts. Floating threads get the floating set of that moment, later changes are applied through s_FloatingThreads. Empty for no restriction
+
+private:
+	errno_t p_start(void(*f)(void *ptr), void *ptr, ptrdiff_t stackSize) noexcept;
+
+	ManagedThread(const ManagedThread &) = delete;
+	ManagedThread &operator=(const ManagedThread &) = delete;
+
+};
+
 #if 0 // TODO
 struct TimeoutFunctorWin32
 {
@@ -77,24 +148,277 @@ struct TimeoutFunctorWin32
 };
 #endif
 
+#ifdef SEV_EVENT_LOOP_EPOLL
+// Callbacks registered for one descriptor. Registered with EPOLLONESHOT, and only re-armed after the callback returns, so callbacks for one descriptor never run concurrently
+struct Watch
+{
+	int Fd;
+	std::mutex Mutex;
+	std::optional<EventFunctor> Read;
+	std::optional<EventFunctor> Write;
+	bool Dispatching = false; // Don't re-arm from watch while a callback is running, the dispatcher re-arms when done
+	bool Removed = false;
+
+};
+#endif
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+// Operation submitted to the ring, the completion carries a pointer to this
+struct IoOp
+{
+	IoFunctor Callback;
+	int Op;
+	ptrdiff_t Result;
+	__kernel_timespec Timeout;
+	IoOp *Prev; // In flight list, to clean up operations which never complete when the loop is destroyed
+	IoOp *Next;
+
+};
+
+// Submission and completion queues mapped from the kernel
+struct IoRing
+{
+	int Fd = -1;
+	unsigned SqEntries = 0;
+	unsigned *SqHead = null;
+	unsigned *SqTail = null;
+	unsigned *SqMask = null;
+	unsigned *SqArray = null;
+	io_uring_sqe *Sqes = null;
+	unsigned *CqHead = null;
+	unsigned *CqTail = null;
+	unsigned *CqMask = null;
+	io_uring_cqe *Cqes = null;
+	void *SqRing = null;
+	size_t SqRingSize = 0;
+	void *CqRing = null;
+	size_t CqRingSize = 0;
+	size_t SqesSize = 0;
+
+	std::mutex Mutex; // Submission queue and in flight list
+	std::atomic_int Pending = 0; // Prepared entries which have not been entered yet
+	IoOp *InFlight = null;
+	std::mutex CqMutex;
+
+	errno_t init(unsigned entries) noexcept;
+	~IoRing() noexcept;
+
+};
+#endif
+
+// Log-linear histogram of tick counts, exact below 16, then 16 buckets per power of two. Written by a single thread, read lock-free
+struct Histogram
+{
+	static constexpr int c_SubBits = 4;
+	static constexpr int c_Buckets = (64 - c_SubBits + 1) << c_SubBits;
+
+	std::atomic<uint64_t> Counts[c_Buckets] = {};
+	std::atomic<int64_t> Max = 0;
+
+	static SEV_FORCE_INLINE int bucket(uint64_t ticks) noexcept
+	{
+		if (ticks < (1 << c_SubBits))
+			return (int)ticks;
+#ifdef _MSC_VER
+		unsigned long msb;
+		_BitScanReverse64(&msb, ticks);
+		int e = (int)msb;
+#else
+		int e = 63 - __builtin_clzll(ticks);
+#endif
+		return ((e - c_SubBits + 1) << c_SubBits) + (int)((ticks >> (e - c_SubBits)) & ((1 << c_SubBits) - 1));
+	}
+
+	static uint64_t lowerBound(int bucket) noexcept;
+
+	SEV_FORCE_INLINE void record(int64_t ticks) noexcept
+	{
+		if (ticks < 0) ticks = 0; // Counters of different cores may be slightly apart
+		std::atomic<uint64_t> &c = Counts[bucket(ticks)];
+		c.store(c.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed); // Single writer, no need for a locked add
+		if (ticks > Max.load(std::memory_order_relaxed))
+			Max.store(ticks, std::memory_order_relaxed);
+	}
+
+};
+
+// Profile samples of one callable type, keyed by its vtable. Written by a single thread, read lock-free
+struct VtProfile
+{
+	std::atomic<const SEV_FunctorVt *> Vt = null; // Stored last when a new type is added
+	std::atomic<int64_t> Samples = 0;
+	std::atomic<int64_t> Count = 0; // Samples weighted by the sampling interval
+	std::atomic<int64_t> CpuNs = 0; // Weighted as well
+	std::atomic<int64_t> MaxTicks = 0;
+
+};
+
+// Latency histograms and profile of one worker slot, slots are reused by threads entering the loop later
+struct WorkerStats
+{
+	static constexpr int c_ProfileSlots = 256;
+
+	Histogram Wait; // Push to start
+	Histogram Run; // Start to return
+	VtProfile Profile[c_ProfileSlots]; // Open addressing on the vtable pointer
+	VtProfile ProfileOther; // Types which didn't fit in the table
+	int SampleCountdown = 0;
+	bool InUse = false;
+
+	SEV_FORCE_INLINE bool sample(int every) noexcept
+	{
+		if (!every || --SampleCountdown > 0) return false;
+		SampleCountdown = every;
+		return true;
+	}
+
+	void profile(const SEV_FunctorVt *vt, int every, int64_t cpuNs, int64_t ticks) noexcept;
+
+	SEV_FORCE_INLINE void record(int64_t pushed, int64_t started, int64_t ended) noexcept
+	{
+		if (pushed) Wait.record(started - pushed); // Not timestamped when pushed before stats were enabled
+		Run.record(ended - started);
+	}
+
+};
+
+// Worker started by the elastic pool while the queue is backed up, until it idles past the grace period
+struct ElasticWorker
+{
+	ManagedThread Thread;
+	bool Retired = false; // Under ElasticMutex
+	std::atomic_bool Done = false;
+
+};
+
+// State of a thread inside the loop, lives on the stack of the loop call
+struct Worker
+{
+	sev::EventFlag Flag; // Set to unpark
+	unsigned TimerSeq; // TimerSeq of the loop when the timers were last checked
+	WorkerStats *Stats = null; // Recording slot while latency stats are enabled
+	int Id;
+
+	std::atomic<int64_t> TaskStart = 0; // Ticks when the running task started, 0 between tasks. Only published while the watchdog is on
+	std::atomic<const SEV_FunctorVt *> TaskVt = null; // Stored before TaskStart
+	int64_t Reported = 0; // TaskStart of the last stall reported, under WorkersMutex
+	const std::atomic_bool *Cover = null; // Set on a replacement worker, leave the loop once it's set
+
+	static constexpr ptrdiff_t c_LocalCapacity = 2 * SEV_FUNCTOR_ALIGN;
+	alignas(SEV_FUNCTOR_ALIGN) uint8_t Local[2][c_LocalCapacity]; // Follow-up posted by the running task, two so the one running can post the next
+	const SEV_FunctorVt *LocalVt = null; // Set when Local[LocalIndex] holds a functor
+	int LocalIndex = 0;
+	int LocalChain = 0; // Local functors run in a row
+
+	ElasticWorker *Elastic = null; // Set on a worker of the elastic pool
+	int64_t IdleSinceNs = 0; // Start of the current idle stretch of an elastic worker, 0 while busy
+
+	bool covered() const noexcept { return Cover && Cover->load(std::memory_order_relaxed); } // Replacement no longer needed
+
+};
+
+// Worker started by the watchdog to stand in for a stalled one, until the stalled task returns
+struct Replacement
+{
+	ManagedThread Thread;
+	const Worker *Covers; // Only compared, the worker may be gone
+	int64_t TaskStart;
+	std::atomic_bool Over = false;
+	std::atomic_bool Done = false;
+
+};
+
+struct Watchdog
+{
+	std::thread Thread;
+	std::mutex Mutex;
+	std::condition_variable Condition;
+	bool Stop = false;
+	int64_t ThresholdTicks;
+	int IntervalMs;
+	int MaxReplacements;
+	std::optional<sev::Functor<void(const SEV_EventLoopStall *stall)>> OnStall;
+
+};
+
 class EventLoopBase : public SEV_EventLoop
 {
 public:
-	EventLoopBase(SEV_EventLoopVt *vt) : SEV_EventLoop{ vt }, QueueItems(0), Running(false), Threads(0), ThreadsWaiting(0), Stopping(false)
+	EventLoopBase(SEV_EventLoopVt *vt) : SEV_EventLoop{ vt }, QueueItems(0), LocalItems(0), Running(false), Threads(0), TimerSeq(0), Spinning(0), ParkedCount(0), IdleSpinNs(0), IdleYieldNs(0), IdleMaxSpinning(0), Stopping(false)
 	{
 
 	}
 
 	ConcurrentFunctorQueue<errno_t(EventLoop &)> Queue;
-	std::atomic_int QueueItems;
+	std::atomic_int QueueItems; // Accepted and not yet run, including the functors kept on workers
+	std::atomic_int LocalItems; // Kept on workers by postLocal, only their own worker runs these
 	std::atomic_bool Running;
 	std::atomic_int Threads;
-	std::atomic_int ThreadsWaiting;
+
+	std::atomic_uint TimerSeq; // Bumped when a timer is added, so a worker doesn't block on a stale timeout
+	std::atomic_int Spinning; // Workers busy-polling, these don't need a wake
+	std::atomic_int ParkedCount;
+	std::mutex ParkedMutex;
+	std::vector<Worker *> Parked; // Stack, most recently parked at the back
+
+	std::atomic<int64_t> IdleSpinNs;
+	std::atomic<int64_t> IdleYieldNs;
+	std::atomic_int IdleMaxSpinning;
 
 	std::mutex ManagedThreadsMutex;
-	std::vector<std::thread> ManagedThreads;
+	std::vector<ManagedThread> ManagedThreads;
+	std::vector<int> IsolatedCpus; // CPUs claimed by SEV_EVENT_LOOP_RUN_ISOLATE, released on stop
 	std::atomic_bool Stopping;
-	EventFlag LoopEndedFlag;
+	sev::EventFlag LoopEndedFlag;
+
+	std::atomic_bool LatencyStats = false;
+	std::atomic_int ProfileEvery = 0; // Sampling interval, 0 when not profiling
+	std::mutex StatsMutex; // Only guards the slot list, counters are read without it
+	std::vector<std::unique_ptr<WorkerStats>> Stats;
+
+	std::mutex WorkersMutex; // Never held while taking ManagedThreadsMutex
+	std::vector<Worker *> Workers; // Threads inside the loop
+	int WorkerIds = 0;
+	std::atomic<int64_t> WatchdogTicks = 0; // Threshold, 0 when the watchdog is off
+	std::mutex WatchdogMutex;
+	std::unique_ptr<Watchdog> Watching;
+	std::vector<std::unique_ptr<Replacement>> Replacements; // Under ManagedThreadsMutex
+	std::atomic<int64_t> Stalls = 0;
+	std::atomic<int64_t> Replaced = 0;
+
+	std::mutex ElasticMutex; // Taken by the workers, so never held while joining a loop thread that may still be running
+	std::vector<std::unique_ptr<ElasticWorker>> ElasticWorkers; // Under ElasticMutex
+	std::optional<sev::Functor<void(SEV_ExceptionHandle *)>> ElasticOnError; // Copied into each elastic worker, under ElasticMutex
+	int ElasticMin = 0; // Under ElasticMutex
+	std::atomic_int ElasticMax = 0;
+	std::atomic_int ElasticAlive = 0; // Elastic workers started and not retired, written under ElasticMutex
+	std::atomic_int ElasticDepth = 0; // Queued functors per thread to grow at, 0 when not looking at the depth
+	std::atomic<int64_t> ElasticWaitTicks = 0; // Queue wait to grow at, 0 when not looking at the wait
+	std::atomic<int64_t> ElasticIdleNs = 10000000000;
+	std::atomic_bool ElasticPending = false; // A start is in flight, cleared once the new worker is in the loop
+	std::atomic<int64_t> ElasticStarted = 0;
+	std::atomic<int64_t> ElasticRetired = 0;
+
+	std::atomic_int TaskBudget = 256;
+	std::atomic_int TimerBudget = 64;
+	std::atomic_int LocalChain = 0;
+	std::atomic<int64_t> TaskBudgetHits = 0;
+	std::atomic<int64_t> TimerBudgetHits = 0;
+	std::atomic<int64_t> Shed = 0;
+
+#ifdef SEV_EVENT_LOOP_EPOLL
+	int EpollFd = -1;
+	int WakeFd = -1; // eventfd, wakes the poller for posted work when no parked worker can take it
+	std::atomic_bool Polling = false; // One idle worker blocks in epoll_wait, the others park
+	std::atomic_bool PollerBlocked = false;
+	std::atomic_bool PollerWoken = false; // Only write the eventfd once per epoll_wait
+	std::mutex WatchMutex;
+	std::map<int, std::shared_ptr<Watch>> Watches;
+#endif
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+	std::unique_ptr<IoRing> Ring; // Null when I/O operations use the readiness fallback
+#endif
 
 	EventLoopBase(const EventLoop &) = delete;
 	EventLoopBase(EventLoop &&) = delete;
@@ -104,21 +428,111 @@ public:
 class EventLoop : public EventLoopBase
 {
 public:
-	EventLoop() : EventLoopBase(&EventLoopVt)
-	{
-	}
-
-	EventFlag Flag;
+	EventLoop();
+	~EventLoop() noexcept;
 
 #ifdef SEV_EVENT_LOOP_MSVC_CONCURRENT
 	concurrency::concurrent_priority_queue<TimeoutFunctor> TimeoutConcurrent;
 #else
 	std::mutex TimeoutMutex;
 	std::priority_queue<TimeoutFunctor> Timeout;
+	std::atomic<int64_t> NextTimerNs = INT64_MAX; // Due time of the first timer on the steady clock, so the loop only locks when one is due
+
+	void updateNextTimer() noexcept // Under TimeoutMutex
+	{
+		NextTimerNs.store(Timeout.empty() ? INT64_MAX : (int64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Timeout.top().Time.time_since_epoch()).count(), std::memory_order_relaxed);
+	}
 #endif
 
 };
 
+extern thread_local EventLoopBase *t_Loop; // Loop which the current thread is running
+extern thread_local Worker *t_Worker; // Worker of t_Loop on the current thread
+extern thread_local const std::atomic_bool *t_Cover; // Passed to the worker of a replacement thread
+extern thread_local ElasticWorker *t_Elastic; // Passed to the worker of an elastic thread
+extern thread_local int64_t t_LoopNs; // Steady clock cached by the loop in t_Loop, refreshed before the timers and after waiting
+
+inline int64_t loopNs(EventLoopBase *elp) noexcept
+{
+	return t_Loop == elp ? t_LoopNs : SEV_Clock_steadyNs();
+}
+
+inline std::chrono::steady_clock::time_point loopTime(EventLoopBase *elp) noexcept
+{
+	return std::chrono::steady_clock::time_point(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(loopNs(elp))));
+}
+
+void growElastic(EventLoopBase *elp) noexcept; // Start an elastic worker when there's room, one at a time
+
+// Items any worker can take, what idle checks look at
+inline int sharedItems(EventLoopBase *elp) noexcept
+{
+	return elp->QueueItems - elp->LocalItems;
+}
+
+// Grow the elastic pool when the queue is deeper than the threshold, a single load while it's off
+inline void checkBacklog(EventLoopBase *elp) noexcept
+{
+	const int depth = elp->ElasticDepth.load(std::memory_order_relaxed);
+	if (depth && sharedItems(elp) > (int64_t)depth * std::max(1, elp->Threads.load(std::memory_order_relaxed)))
+		growElastic(elp);
+}
+
+void wakeOne(EventLoopBase *elp);
+void wakeMany(EventLoopBase *elp, ptrdiff_t count);
+void wakeAll(EventLoopBase *elp);
+
+// Keep a post from a task running on the same loop on the worker, returns false to use the shared queue. Bounded posts only while the queue has no capacity, flushLocal moves the functor past it
+inline bool postLocal(EventLoopBase *elp, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other), errno_t &res, bool bounded) noexcept
+{
+	Worker *worker = t_Worker;
+	if (!worker || t_Loop != elp || worker->LocalVt || vt->Size > Worker::c_LocalCapacity || !elp->LocalChain.load(std::memory_order_relaxed))
+		return false;
+	if (bounded && SEV_AtomicPtr_load(&elp->Queue.get()->Capacity))
+		return false;
+	try
+	{
+		forwardConstructor(worker->Local[worker->LocalIndex], ptr);
+	}
+	catch (...)
+	{
+		res = EOTHER;
+		return true;
+	}
+	worker->LocalVt = vt;
+	++elp->LocalItems;
+	++elp->QueueItems;
+	res = SEV_ESUCCESS;
+	return true;
+}
+
+errno_t runLocal(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh) noexcept;
+void flushLocal(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh) noexcept; // Move the local functor to the shared queue
+errno_t callShared(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, bool &success) noexcept; // Pop and call one functor from the shared queue, with the stats, watchdog and trace of the loop. Also for a task which waits on the loop thread
+
+inline bool instrumented(EventLoopBase *elp) noexcept
+{
+	return elp->LatencyStats.load(std::memory_order_relaxed) || elp->ProfileEvery.load(std::memory_order_relaxed) || elp->WatchdogTicks.load(std::memory_order_relaxed) || elp->ElasticWaitTicks.load(std::memory_order_relaxed) || tr::enabled();
+}
+
+void updateTimestamps(EventLoopBase *elp) noexcept; // Timestamp pushes while latency stats or the elastic wait threshold need them
+
+void attachStats(EventLoopBase *elp, Worker &worker) noexcept; // Take or drop a stats slot to match instrumented
+void detachStats(EventLoopBase *elp, Worker &worker) noexcept;
+errno_t callAndRecord(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, bool &success) noexcept; // Pop and call one queued functor while instrumented
+errno_t addWorker(EventLoopBase *elp, Worker &worker) noexcept;
+void removeWorker(EventLoopBase *elp, Worker &worker) noexcept;
+void stopWatchdog(EventLoopBase *elp) noexcept;
+void joinReplacements(EventLoopBase *elp) noexcept; // Under ManagedThreadsMutex
+bool retireElastic(EventLoopBase *elp, Worker &worker, int64_t &timeoutMs) noexcept; // Before an elastic worker idles, true when it should leave, otherwise caps the timeout to the end of its grace period
+void joinElastic(EventLoopBase *elp) noexcept; // Under ManagedThreadsMutex, after Running is cleared
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+errno_t ioSetup(EventLoopBase *elp, unsigned entries) noexcept;
+void ioFlush(EventLoopBase *elp) noexcept;
+void ioReap(EventLoopBase *elp, SEV_ExceptionHandle *eh);
+#endif
+
 #if 0 // TODO
 class EventLoopWin32 : public EventLoopBase
 {
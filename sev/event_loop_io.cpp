@@ -0,0 +1,464 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+#include "blocking_pool.h"
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <climits>
+#endif
+
+namespace sev::impl::el {
+
+namespace {
+
+#ifndef _WIN32
+
+// Run the operation synchronously, returns the result or a negative errno
+ptrdiff_t ioCall(const SEV_EventLoopIo &io)
+{
+	ptrdiff_t res;
+	switch (io.Op)
+	{
+	case SEV_EVENT_LOOP_IO_READ:
+		res = io.Offset < 0 ? read(io.Fd, io.Buffer, io.Size) : pread(io.Fd, io.Buffer, io.Size, io.Offset);
+		break;
+	case SEV_EVENT_LOOP_IO_WRITE:
+		res = io.Offset < 0 ? write(io.Fd, io.Buffer, io.Size) : pwrite(io.Fd, io.Buffer, io.Size, io.Offset);
+		break;
+#ifdef __linux__
+	case SEV_EVENT_LOOP_IO_ACCEPT:
+		res = accept4(io.Fd, null, null, io.Flags);
+		break;
+	case SEV_EVENT_LOOP_IO_RECV:
+		res = recv(io.Fd, io.Buffer, io.Size, io.Flags | MSG_DONTWAIT);
+		break;
+	case SEV_EVENT_LOOP_IO_SEND:
+		res = send(io.Fd, io.Buffer, io.Size, io.Flags | MSG_DONTWAIT);
+		break;
+	case SEV_EVENT_LOOP_IO_FSYNC:
+		res = io.Flags ? fdatasync(io.Fd) : fsync(io.Fd);
+		break;
+#else
+	case SEV_EVENT_LOOP_IO_FSYNC:
+		res = fsync(io.Fd);
+		break;
+#endif
+	default:
+		return -EINVAL;
+	}
+	return res < 0 ? -(ptrdiff_t)errno : res;
+}
+
+#endif
+
+// Without a ring, timeouts go on the timer queue, socket operations wait for readiness, and file operations run on the default blocking pool
+errno_t ioFallback(SEV_EventLoop *el, const SEV_EventLoopIo &io, IoFunctor &&cb)
+{
+	switch (io.Op)
+	{
+	case SEV_EVENT_LOOP_IO_TIMEOUT:
+	{
+		auto f = [cb = std::move(cb)](sev::EventLoop &el) mutable -> errno_t {
+			return cb(el, 0);
+		};
+		static const EventFunctorVt vt(f);
+		return el->Vt->TimeoutFunctor(el, vt.get(), &f, vt.get()->MoveConstructor, io.TimeoutMs);
+	}
+#ifndef _WIN32
+	case SEV_EVENT_LOOP_IO_READ:
+	case SEV_EVENT_LOOP_IO_WRITE:
+	case SEV_EVENT_LOOP_IO_FSYNC:
+	{
+		SEV_BlockingPool *pool = SEV_BlockingPool_default();
+		if (!pool)
+			return ENOMEM;
+		return bp::offload(pool, *el, [io]() -> ptrdiff_t { return ioCall(io); }, std::move(cb));
+	}
+#endif
+#ifdef SEV_EVENT_LOOP_EPOLL
+	case SEV_EVENT_LOOP_IO_ACCEPT:
+	case SEV_EVENT_LOOP_IO_RECV:
+	case SEV_EVENT_LOOP_IO_SEND:
+	{
+		auto f = [cb = std::move(cb), io](sev::EventLoop &el) mutable -> errno_t {
+			ptrdiff_t res = ioCall(io);
+			if (res == -EAGAIN || res == -EWOULDBLOCK)
+				return 0; // Keep waiting
+			errno_t eno = cb(el, res);
+			if (eno)
+			{
+				// Raise the error on the loop, the watch is done either way
+				auto raise = [eno](sev::EventLoop &) -> errno_t { return eno; };
+				static const EventFunctorVt raiseVt(raise);
+				el.Vt->PostFunctor(&el, raiseVt.get(), &raise, raiseVt.get()->MoveConstructor);
+			}
+			return ECANCELED;
+		};
+		static const EventFunctorVt vt(f);
+		return el->Vt->IoVt->WatchFunctor(el, io.Fd, io.Op == SEV_EVENT_LOOP_IO_SEND ? SEV_EVENT_LOOP_WRITE : SEV_EVENT_LOOP_READ, vt.get(), &f, vt.get()->MoveConstructor);
+	}
+#endif
+	default:
+		return ENOTSUP;
+	}
+}
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+
+int ioUringSetup(unsigned entries, io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, null, 0);
+}
+
+// Ring indices are shared with the kernel
+inline unsigned loadAcquire(const unsigned *p)
+{
+	return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+inline void storeRelease(unsigned *p, unsigned v)
+{
+	__atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+
+// Enter everything between the kernel head and our tail, under the ring mutex
+errno_t submitLocked(IoRing *ring)
+{
+	ring->Pending = 0;
+	unsigned toSubmit = *ring->SqTail - loadAcquire(ring->SqHead);
+	while (toSubmit)
+	{
+		int res = ioUringEnter(ring->Fd, toSubmit, 0, 0);
+		if (res < 0 && errno == EINTR)
+			continue;
+		if (res <= 0)
+		{
+			ring->Pending = 1; // Retry on the next flush, the completion queue is likely backed up
+			return res < 0 ? errno : EAGAIN;
+		}
+		toSubmit -= (unsigned)res;
+	}
+	return 0;
+}
+
+errno_t ioComplete(sev::EventLoop &el, IoOp *op)
+{
+	std::unique_ptr<IoOp> o(op);
+	return o->Callback(el, o->Result);
+}
+
+errno_t ioSubmit(EventLoopBase *elp, const SEV_EventLoopIo &io, std::unique_ptr<IoOp> &&op)
+{
+	IoRing *ring = elp->Ring.get();
+	std::unique_lock<std::mutex> lock(ring->Mutex);
+	const unsigned tail = *ring->SqTail;
+	if (tail - loadAcquire(ring->SqHead) >= ring->SqEntries)
+	{
+		submitLocked(ring); // Full, enter the batch now
+		if (tail - loadAcquire(ring->SqHead) >= ring->SqEntries)
+			return EAGAIN;
+	}
+	const unsigned index = tail & *ring->SqMask;
+	io_uring_sqe *sqe = &ring->Sqes[index];
+	memset(sqe, 0, sizeof(io_uring_sqe));
+	sqe->fd = io.Fd;
+	sqe->addr = (uint64_t)(uintptr_t)io.Buffer;
+	sqe->len = (unsigned)std::min(io.Size, (ptrdiff_t)0x7FFFF000); // Same limit as a single read or write call
+	switch (io.Op)
+	{
+	case SEV_EVENT_LOOP_IO_READ:
+		sqe->opcode = IORING_OP_READ;
+		sqe->off = (uint64_t)io.Offset; // -1 uses the file position
+		break;
+	case SEV_EVENT_LOOP_IO_WRITE:
+		sqe->opcode = IORING_OP_WRITE;
+		sqe->off = (uint64_t)io.Offset;
+		break;
+	case SEV_EVENT_LOOP_IO_ACCEPT:
+		sqe->opcode = IORING_OP_ACCEPT;
+		sqe->addr = 0;
+		sqe->len = 0;
+		sqe->accept_flags = (unsigned)io.Flags;
+		break;
+	case SEV_EVENT_LOOP_IO_RECV:
+		sqe->opcode = IORING_OP_RECV;
+		sqe->msg_flags = (unsigned)io.Flags;
+		break;
+	case SEV_EVENT_LOOP_IO_SEND:
+		sqe->opcode = IORING_OP_SEND;
+		sqe->msg_flags = (unsigned)io.Flags;
+		break;
+	case SEV_EVENT_LOOP_IO_FSYNC:
+		sqe->opcode = IORING_OP_FSYNC;
+		sqe->addr = 0;
+		sqe->len = 0;
+		sqe->fsync_flags = io.Flags ? IORING_FSYNC_DATASYNC : 0;
+		break;
+	case SEV_EVENT_LOOP_IO_TIMEOUT:
+		sqe->opcode = IORING_OP_TIMEOUT;
+		sqe->fd = -1;
+		op->Timeout.tv_sec = io.TimeoutMs / 1000;
+		op->Timeout.tv_nsec = (io.TimeoutMs % 1000) * 1000000LL;
+		sqe->addr = (uint64_t)(uintptr_t)&op->Timeout;
+		sqe->len = 1;
+		break;
+	default:
+		return EINVAL;
+	}
+	op->Op = io.Op;
+	sqe->user_data = (uint64_t)(uintptr_t)op.get();
+	ring->SqArray[index] = index;
+	op->Prev = null;
+	op->Next = ring->InFlight;
+	if (ring->InFlight) ring->InFlight->Prev = op.get();
+	ring->InFlight = op.release();
+	storeRelease(ring->SqTail, tail + 1);
+	if (t_Loop == elp)
+		ring->Pending = 1; // Entered when the current task returns, together with whatever else it submits
+	else
+		submitLocked(ring); // Nothing on this thread will flush
+	return 0;
+}
+
+#endif
+
+}
+
+#ifdef SEV_EVENT_LOOP_IO_URING
+
+errno_t IoRing::init(unsigned entries) noexcept
+{
+	io_uring_params p = {};
+	Fd = ioUringSetup(entries, &p);
+	if (Fd < 0)
+	{
+		Fd = -1;
+		return errno;
+	}
+	if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL))
+		return ENOTSUP; // Completions must never be dropped, and accept, recv and send must be available, Linux 5.7
+	SqEntries = p.sq_entries;
+	SqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	CqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+	const bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+	if (single)
+		SqRingSize = CqRingSize = std::max(SqRingSize, CqRingSize);
+	SqRing = mmap(null, SqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQ_RING);
+	if (SqRing == MAP_FAILED)
+	{
+		SqRing = null;
+		return errno;
+	}
+	if (single)
+	{
+		CqRing = SqRing;
+	}
+	else
+	{
+		CqRing = mmap(null, CqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_CQ_RING);
+		if (CqRing == MAP_FAILED)
+		{
+			CqRing = null;
+			return errno;
+		}
+	}
+	SqesSize = p.sq_entries * sizeof(io_uring_sqe);
+	void *sqes = mmap(null, SqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, Fd, IORING_OFF_SQES);
+	if (sqes == MAP_FAILED)
+		return errno;
+	Sqes = (io_uring_sqe *)sqes;
+	uint8_t *sq = (uint8_t *)SqRing;
+	SqHead = (unsigned *)(sq + p.sq_off.head);
+	SqTail = (unsigned *)(sq + p.sq_off.tail);
+	SqMask = (unsigned *)(sq + p.sq_off.ring_mask);
+	SqArray = (unsigned *)(sq + p.sq_off.array);
+	uint8_t *cq = (uint8_t *)CqRing;
+	CqHead = (unsigned *)(cq + p.cq_off.head);
+	CqTail = (unsigned *)(cq + p.cq_off.tail);
+	CqMask = (unsigned *)(cq + p.cq_off.ring_mask);
+	Cqes = (io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 0;
+}
+
+IoRing::~IoRing() noexcept
+{
+	if (Sqes) munmap(Sqes, SqesSize);
+	if (CqRing && CqRing != SqRing) munmap(CqRing, CqRingSize);
+	if (SqRing) munmap(SqRing, SqRingSize);
+	if (Fd >= 0) close(Fd); // Cancels what's still in flight
+	while (InFlight)
+	{
+		IoOp *op = InFlight;
+		InFlight = op->Next;
+		delete op;
+	}
+}
+
+errno_t ioSetup(EventLoopBase *elp, unsigned entries) noexcept
+{
+	std::unique_ptr<IoRing> ring(new (std::nothrow) IoRing());
+	if (!ring) return ENOMEM;
+	errno_t eno = ring->init(entries);
+	if (eno) return eno;
+	epoll_event ev = {};
+	ev.events = EPOLLIN; // Readable when there are completions
+	ev.data.u64 = (uint64_t)ring->Fd;
+	if (epoll_ctl(elp->EpollFd, EPOLL_CTL_ADD, ring->Fd, &ev))
+		return errno;
+	elp->Ring = std::move(ring);
+	return 0;
+}
+
+// Enter the batch of operations submitted since the last flush
+void ioFlush(EventLoopBase *elp) noexcept
+{
+	IoRing *ring = elp->Ring.get();
+	if (!ring->Pending)
+		return;
+	std::unique_lock<std::mutex> lock(ring->Mutex);
+	submitLocked(ring);
+}
+
+// Take all completions off the ring. The first callback runs on this thread, the rest are spread over the queue
+void ioReap(EventLoopBase *elp, SEV_ExceptionHandle *eh)
+{
+	IoRing *ring = elp->Ring.get();
+	IoOp *completed = null;
+	{
+		std::unique_lock<std::mutex> cqLock(ring->CqMutex);
+		unsigned head = *ring->CqHead;
+		const unsigned tail = loadAcquire(ring->CqTail);
+		if (head == tail)
+			return;
+		std::unique_lock<std::mutex> lock(ring->Mutex);
+		for (; head != tail; ++head)
+		{
+			const io_uring_cqe &cqe = ring->Cqes[head & *ring->CqMask];
+			IoOp *op = (IoOp *)(uintptr_t)cqe.user_data;
+			op->Result = (op->Op == SEV_EVENT_LOOP_IO_TIMEOUT && cqe.res == -ETIME) ? 0 : cqe.res;
+			if (op->Prev) op->Prev->Next = op->Next;
+			else ring->InFlight = op->Next;
+			if (op->Next) op->Next->Prev = op->Prev;
+			op->Next = completed;
+			completed = op;
+		}
+		storeRelease(ring->CqHead, tail);
+	}
+	IoOp *first = *eh ? null : completed; // Don't run callbacks here while an error is being raised
+	if (first)
+		completed = completed->Next;
+	while (completed)
+	{
+		IoOp *op = completed;
+		completed = op->Next;
+		++elp->QueueItems;
+		errno_t eno = elp->Queue.pushUnbounded(std::nothrow, [op](sev::EventLoop &el) -> errno_t {
+			return ioComplete(el, op);
+		});
+		if (eno)
+		{
+			// Out of memory, complete here instead
+			--elp->QueueItems;
+			((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
+				errno_t res = ioComplete(*elp, op);
+				if (!*eh && res) *eh = SEV_Exception_capture(res);
+			});
+		}
+		else
+		{
+			wakeOne(elp);
+		}
+	}
+	if (first)
+	{
+		((sev::ExceptionHandle *)eh)->capture<void>([&]() -> void {
+			errno_t res = ioComplete(*elp, first);
+			if (!*eh && res) *eh = SEV_Exception_capture(res);
+		});
+	}
+}
+
+#endif
+
+}
+
+SEV_EventLoop *SEV_EventLoop_createIoUring(int entries, bool *ioUring)
+{
+	if (ioUring) *ioUring = false;
+	SEV_EventLoop *el = SEV_EventLoop_create();
+#ifdef SEV_EVENT_LOOP_IO_URING
+	if (el && entries > 0 && !sev::impl::el::ioSetup((sev::impl::el::EventLoop *)el, (unsigned)entries) && ioUring)
+		*ioUring = true;
+#endif
+	return el;
+}
+
+errno_t SEV_IMPL_EventLoop_ioFunctor(SEV_EventLoop *el, const SEV_EventLoopIo *io, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	if (!io || !vt || io->Size < 0 || (io->Op == SEV_EVENT_LOOP_IO_TIMEOUT && io->TimeoutMs < 0))
+		return EINVAL;
+	try
+	{
+#ifdef SEV_EVENT_LOOP_IO_URING
+		sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+		if (elp->Ring)
+		{
+			std::unique_ptr<sev::impl::el::IoOp> op(new sev::impl::el::IoOp{});
+			op->Callback = sev::IoFunctor((const sev::IoFunctorVt *)vt, ptr, forwardConstructor);
+			return sev::impl::el::ioSubmit(elp, *io, std::move(op));
+		}
+#endif
+		return sev::impl::el::ioFallback(el, *io, sev::IoFunctor((const sev::IoFunctorVt *)vt, ptr, forwardConstructor));
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	catch (...)
+	{
+		return EOTHER;
+	}
+}
+
+/* end of file */
@@ -0,0 +1,198 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#include <algorithm>
+
+namespace sev::impl::el {
+
+namespace {
+
+const int c_MaxParallel = 64; // Participants per call, the ranges live on the stack of the caller
+
+// Range owned by one participant. The owner claims from the front, others steal from the front as well once their own range is empty
+struct alignas(64) ParallelRange
+{
+	std::atomic<ptrdiff_t> Next;
+	ptrdiff_t End;
+
+};
+
+// Shared by the caller and the helper tasks, lives on the stack of the caller until the last helper is done
+struct ParallelFor
+{
+	EventLoopBase *Loop;
+	const sev::ParallelFunctorVt *Vt;
+	void *Ptr;
+	ptrdiff_t Grain;
+	int Count;
+	std::atomic_bool Cancel;
+	std::atomic<SEV_ExceptionHandle> Error; // First error
+	std::atomic_int Pending; // Helper tasks which have not finished
+	sev::EventFlag Done; // Set by the last helper
+	ParallelRange Ranges[c_MaxParallel];
+
+};
+
+// Claim a chunk from a range, returns false if the range is exhausted. The owner takes an eighth of what's left, so chunks shrink as the range runs out, a thief takes half
+bool claim(ParallelFor &pf, ParallelRange &range, bool own, ptrdiff_t &begin, ptrdiff_t &end)
+{
+	ptrdiff_t next = range.Next.load(std::memory_order_relaxed);
+	ptrdiff_t left = range.End - next;
+	if (left <= 0)
+		return false;
+	ptrdiff_t chunk = std::max(pf.Grain, own ? left / 8 : left / 2);
+	begin = range.Next.fetch_add(chunk);
+	if (begin >= range.End)
+		return false;
+	end = std::min(begin + chunk, range.End);
+	return true;
+}
+
+void fail(ParallelFor &pf, SEV_ExceptionHandle eh)
+{
+	pf.Cancel = true;
+	SEV_ExceptionHandle expected = null;
+	if (!pf.Error.compare_exchange_strong(expected, eh))
+		SEV_Exception_discardEx(eh);
+}
+
+// Raise the error of a task run while waiting on the loop, like an exception from a task, rather than as the result of the call
+void raise(EventLoopBase *elp, SEV_ExceptionHandle eh)
+{
+	auto raise = [eh](sev::EventLoop &) -> errno_t {
+		sev::ExceptionHandle e(eh);
+		e.rethrow();
+		return SEV_ESUCCESS;
+	};
+	static const EventFunctorVt raiseVt(raise);
+	if (SEV_EventLoop_postFunctorUnbounded((SEV_EventLoop *)elp, raiseVt.get(), &raise, raiseVt.get()->MoveConstructor))
+		SEV_Exception_discardEx(eh); // Out of memory, nowhere to put it
+}
+
+// Work through the own range, then steal from the others, starting at the neighbour
+void participate(ParallelFor &pf, int index)
+{
+	for (int i = 0; i < pf.Count; ++i)
+	{
+		ParallelRange &range = pf.Ranges[(index + i) % pf.Count];
+		ptrdiff_t begin, end;
+		while (!pf.Cancel && claim(pf, range, !i, begin, end))
+		{
+			SEV_ExceptionHandle eh = null;
+			errno_t eno = pf.Vt->invoke(pf.Ptr, *(sev::ExceptionHandle *)&eh, *pf.Loop, begin, end);
+			if (!eh && eno) eh = SEV_Exception_capture(eno);
+			if (eh)
+			{
+				fail(pf, eh);
+				return;
+			}
+		}
+	}
+}
+
+}
+
+}
+
+void SEV_IMPL_EventLoop_parallelForFunctor(SEV_EventLoop *el, SEV_ExceptionHandle *eh, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, const SEV_FunctorVt *vt, void *ptr)
+{
+	SEV_ASSERT(eh);
+	SEV_ASSERT(!*eh);
+	if (to <= from)
+		return;
+	sev::impl::el::EventLoop *elp = (sev::impl::el::EventLoop *)el;
+	bool onLoop = sev::impl::el::t_Loop == elp;
+	if (grain < 1) grain = 1;
+
+	// One participant per loop thread, the caller included, but no more than there are grains
+	ptrdiff_t grains = (to - from + grain - 1) / grain;
+	ptrdiff_t helpers = std::max<ptrdiff_t>(elp->Threads - (onLoop ? 1 : 0), 0);
+	int count = (int)std::min({ helpers + 1, grains, (ptrdiff_t)sev::impl::el::c_MaxParallel });
+
+	sev::impl::el::ParallelFor pf;
+	pf.Loop = elp;
+	pf.Vt = (const sev::ParallelFunctorVt *)vt;
+	pf.Ptr = ptr;
+	pf.Grain = grain;
+	pf.Count = count;
+	pf.Cancel = false;
+	pf.Error = null;
+	pf.Pending = 0;
+	ptrdiff_t size = (to - from) / count;
+	for (int i = 0; i < count; ++i)
+	{
+		pf.Ranges[i].Next = from + size * i;
+		pf.Ranges[i].End = i == count - 1 ? to : from + size * (i + 1);
+	}
+
+	// Helpers only carry a pointer, the queue holds them without allocating
+	int posted = 0;
+	for (int i = 1; i < count; ++i)
+	{
+		++pf.Pending;
+		++elp->QueueItems;
+		errno_t eno = elp->Queue.pushUnbounded(std::nothrow, [pfp = &pf, i](sev::EventLoop &) -> errno_t {
+			sev::impl::el::participate(*pfp, i);
+			if (!--pfp->Pending)
+				pfp->Done.set();
+			return SEV_ESUCCESS;
+		});
+		if (eno)
+		{
+			--elp->QueueItems;
+			--pf.Pending;
+			break; // The caller steals the range instead
+		}
+		++posted;
+		sev::impl::el::wakeOne(elp);
+	}
+
+	sev::impl::el::participate(pf, 0);
+
+	if (posted)
+	{
+		// On a loop thread, help the queue along until every helper has started, so the helpers don't wait behind this task
+		while (onLoop && pf.Pending && sev::impl::el::sharedItems(elp))
+		{
+			bool success;
+			SEV_ExceptionHandle teh = null;
+			errno_t eno = sev::impl::el::callShared(elp, *sev::impl::el::t_Worker, &teh, success);
+			if (!teh && eno) teh = SEV_Exception_capture(eno);
+			if (teh) sev::impl::el::raise(elp, teh); // Not an error of this call, the task may be unrelated
+			if (!success) SEV_Thread_yield();
+		}
+		pf.Done.wait();
+	}
+	*eh = pf.Error;
+}
+
+/* end of file */
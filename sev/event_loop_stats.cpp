@@ -0,0 +1,337 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <string>
+
+namespace sev::impl::el {
+
+namespace {
+
+void percentiles(const uint64_t *counts, int64_t max, SEV_EventLoopLatency *latency) noexcept
+{
+	uint64_t total = 0;
+	for (int i = 0; i < Histogram::c_Buckets; ++i)
+		total += counts[i];
+	const double nsPerTick = SEV_Clock_nsPerTick();
+	auto at = [&](double q) -> int64_t {
+		if (!total) return 0;
+		uint64_t rank = std::max((uint64_t)1, (uint64_t)std::ceil(q * (double)total));
+		uint64_t seen = 0;
+		for (int i = 0; i < Histogram::c_Buckets; ++i)
+		{
+			seen += counts[i];
+			if (seen >= rank)
+			{
+				// Highest value in the bucket, but no more than what was seen
+				uint64_t upper = i + 1 < Histogram::c_Buckets ? Histogram::lowerBound(i + 1) - 1 : UINT64_MAX;
+				return (int64_t)((double)std::min(upper, (uint64_t)max) * nsPerTick);
+			}
+		}
+		return (int64_t)((double)max * nsPerTick);
+	};
+	latency->Count = total;
+	latency->P50Ns = at(0.50);
+	latency->P99Ns = at(0.99);
+	latency->P999Ns = at(0.999);
+	latency->MaxNs = (int64_t)((double)max * nsPerTick);
+}
+
+void accumulate(const Histogram &h, uint64_t *counts, int64_t &max) noexcept
+{
+	for (int i = 0; i < Histogram::c_Buckets; ++i)
+		counts[i] += h.Counts[i].load(std::memory_order_relaxed);
+	max = std::max(max, h.Max.load(std::memory_order_relaxed));
+}
+
+void accumulate(const VtProfile &p, const SEV_FunctorVt *vt, std::map<const SEV_FunctorVt *, SEV_EventLoopProfileEntry> &merged)
+{
+	SEV_EventLoopProfileEntry &e = merged[vt];
+	e.Vt = vt;
+	e.Samples += p.Samples.load(std::memory_order_relaxed);
+	e.Count += p.Count.load(std::memory_order_relaxed);
+	e.CpuNs += p.CpuNs.load(std::memory_order_relaxed);
+	e.MaxNs = std::max(e.MaxNs, p.MaxTicks.load(std::memory_order_relaxed)); // Converted when done
+}
+
+}
+
+void WorkerStats::profile(const SEV_FunctorVt *vt, int every, int64_t cpuNs, int64_t ticks) noexcept
+{
+	VtProfile *p = &ProfileOther;
+	size_t h = (size_t)(((uint64_t)(ptrdiff_t)vt >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+	for (int i = 0; i < c_ProfileSlots; ++i)
+	{
+		VtProfile &slot = Profile[(h + i) & (c_ProfileSlots - 1)];
+		const SEV_FunctorVt *key = slot.Vt.load(std::memory_order_relaxed);
+		if (key == vt)
+		{
+			p = &slot;
+			break;
+		}
+		if (!key)
+		{
+			slot.Vt.store(vt, std::memory_order_release); // Counters are still zero, only this thread writes them
+			p = &slot;
+			break;
+		}
+	}
+	p->Samples.store(p->Samples.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	p->Count.store(p->Count.load(std::memory_order_relaxed) + every, std::memory_order_relaxed);
+	p->CpuNs.store(p->CpuNs.load(std::memory_order_relaxed) + cpuNs * every, std::memory_order_relaxed);
+	if (ticks > p->MaxTicks.load(std::memory_order_relaxed))
+		p->MaxTicks.store(ticks, std::memory_order_relaxed);
+}
+
+errno_t callAndRecord(EventLoopBase *elp, Worker &worker, SEV_ExceptionHandle *eh, bool &success) noexcept
+{
+	WorkerStats &stats = *worker.Stats;
+	const int every = elp->ProfileEvery.load(std::memory_order_relaxed);
+	const bool sample = stats.sample(every);
+	const int64_t cpuNs = sample ? SEV_Clock_threadCpuNs() : 0;
+	const SEV_FunctorVt *vt;
+	int64_t pushed, started;
+	const bool watched = elp->WatchdogTicks.load(std::memory_order_relaxed);
+	auto onStart = [&](const SEV_FunctorVt *vt, int64_t started) -> void {
+		if (!watched) return;
+		worker.TaskVt.store(vt, std::memory_order_relaxed);
+		worker.TaskStart.store(started, std::memory_order_release);
+	};
+	errno_t eno = elp->Queue.tryCallAndPop(*(sev::ExceptionHandle *)eh, success, vt, pushed, started, onStart, *elp);
+	if (watched) worker.TaskStart.store(0, std::memory_order_relaxed);
+	if (!success)
+	{
+		if (sample) stats.SampleCountdown = 1; // Take the next one instead
+		return eno;
+	}
+	const int64_t waitTicks = elp->ElasticWaitTicks.load(std::memory_order_relaxed);
+	if (waitTicks && pushed && started - pushed > waitTicks)
+		growElastic(elp);
+	int64_t ended = SEV_Clock_ticks();
+	if (elp->LatencyStats.load(std::memory_order_relaxed))
+		stats.record(pushed, started, ended);
+	if (sample)
+		stats.profile(vt, every, SEV_Clock_threadCpuNs() - cpuNs, ended - started);
+	if (tr::enabled())
+		SEV_Trace_complete("task", vt, started, ended);
+	return eno;
+}
+
+void updateTimestamps(EventLoopBase *elp) noexcept
+{
+	const bool timestamp = elp->LatencyStats.load(std::memory_order_relaxed) || elp->ElasticWaitTicks.load(std::memory_order_relaxed);
+	SEV_ConcurrentFunctorQueue_setFlags(elp->Queue.get(), timestamp ? SEV_CONCURRENT_FUNCTOR_QUEUE_TIMESTAMP : 0);
+}
+
+uint64_t Histogram::lowerBound(int bucket) noexcept
+{
+	if (bucket < (1 << c_SubBits))
+		return bucket;
+	int e = (bucket >> c_SubBits) + c_SubBits - 1;
+	return ((uint64_t)(1 << c_SubBits) + (bucket & ((1 << c_SubBits) - 1))) << (e - c_SubBits);
+}
+
+void attachStats(EventLoopBase *elp, Worker &worker) noexcept
+{
+	if (!instrumented(elp))
+	{
+		detachStats(elp, worker);
+		return;
+	}
+	std::unique_lock<std::mutex> lock(elp->StatsMutex);
+	for (std::unique_ptr<WorkerStats> &stats : elp->Stats)
+	{
+		if (!stats->InUse)
+		{
+			stats->InUse = true;
+			worker.Stats = stats.get();
+			return;
+		}
+	}
+	try
+	{
+		elp->Stats.push_back(std::make_unique<WorkerStats>());
+	}
+	catch (...)
+	{
+		return; // Out of memory, this worker doesn't record
+	}
+	worker.Stats = elp->Stats.back().get();
+	worker.Stats->InUse = true;
+}
+
+void detachStats(EventLoopBase *elp, Worker &worker) noexcept
+{
+	if (!worker.Stats) return;
+	std::unique_lock<std::mutex> lock(elp->StatsMutex);
+	worker.Stats->InUse = false;
+	worker.Stats = null;
+}
+
+}
+
+errno_t SEV_IMPL_EventLoop_setLatencyStats(SEV_EventLoop *el, bool enabled)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	elp->LatencyStats = enabled;
+	sev::impl::el::updateTimestamps(elp);
+	if (enabled) SEV_Clock_nsPerTick(); // Calibrate now rather than on the first snapshot
+	return SEV_ESUCCESS;
+}
+
+errno_t SEV_IMPL_EventLoop_latencyStats(SEV_EventLoop *el, int worker, SEV_EventLoopLatency *wait, SEV_EventLoopLatency *run)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	std::unique_ptr<uint64_t[]> waitCounts(new (std::nothrow) uint64_t[sev::impl::el::Histogram::c_Buckets * 2]());
+	if (!waitCounts) return ENOMEM;
+	uint64_t *runCounts = &waitCounts[sev::impl::el::Histogram::c_Buckets];
+	int64_t waitMax = 0, runMax = 0;
+	{
+		std::unique_lock<std::mutex> lock(elp->StatsMutex); // Keeps the slot list from growing underneath, the workers never take this while running functors
+		if (worker >= (int)elp->Stats.size() || worker < -1)
+			return ERANGE;
+		for (int i = 0; i < (int)elp->Stats.size(); ++i)
+		{
+			if (worker != -1 && worker != i)
+				continue;
+			sev::impl::el::accumulate(elp->Stats[i]->Wait, waitCounts.get(), waitMax);
+			sev::impl::el::accumulate(elp->Stats[i]->Run, runCounts, runMax);
+		}
+	}
+	if (wait) sev::impl::el::percentiles(waitCounts.get(), waitMax, wait);
+	if (run) sev::impl::el::percentiles(runCounts, runMax, run);
+	return SEV_ESUCCESS;
+}
+
+errno_t SEV_IMPL_EventLoop_setProfiling(SEV_EventLoop *el, int sampleEvery)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (sampleEvery < 0) return EINVAL;
+	elp->ProfileEvery = sampleEvery;
+	if (sampleEvery) SEV_Clock_nsPerTick();
+	return SEV_ESUCCESS;
+}
+
+errno_t SEV_IMPL_EventLoop_profile(SEV_EventLoop *el, SEV_EventLoopProfileEntry *entries, int *count)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	try
+	{
+		std::map<const SEV_FunctorVt *, SEV_EventLoopProfileEntry> merged;
+		{
+			std::unique_lock<std::mutex> lock(elp->StatsMutex);
+			for (std::unique_ptr<sev::impl::el::WorkerStats> &stats : elp->Stats)
+			{
+				for (sev::impl::el::VtProfile &p : stats->Profile)
+				{
+					const SEV_FunctorVt *vt = p.Vt.load(std::memory_order_acquire);
+					if (vt) sev::impl::el::accumulate(p, vt, merged);
+				}
+				if (stats->ProfileOther.Samples.load(std::memory_order_relaxed))
+					sev::impl::el::accumulate(stats->ProfileOther, null, merged);
+			}
+		}
+		std::vector<SEV_EventLoopProfileEntry> sorted;
+		sorted.reserve(merged.size());
+		for (auto &kv : merged)
+			sorted.push_back(kv.second);
+		std::sort(sorted.begin(), sorted.end(), [](const SEV_EventLoopProfileEntry &a, const SEV_EventLoopProfileEntry &b) -> bool {
+			return a.CpuNs > b.CpuNs;
+		});
+		const double nsPerTick = SEV_Clock_nsPerTick();
+		int n = std::max(0, std::min(*count, (int)sorted.size()));
+		for (int i = 0; i < n; ++i)
+		{
+			entries[i] = sorted[i];
+			entries[i].Name = sorted[i].Vt ? SEV_FunctorVt_name(sorted[i].Vt) : "(other)";
+			entries[i].MaxNs = (int64_t)((double)sorted[i].MaxNs * nsPerTick);
+		}
+		*count = n;
+		return SEV_ESUCCESS;
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+}
+
+ptrdiff_t SEV_EventLoop_profileReport(SEV_EventLoop *el, int top, char *buffer, ptrdiff_t size)
+{
+	try
+	{
+		std::vector<SEV_EventLoopProfileEntry> entries(std::max(top, 0));
+		int count = (int)entries.size();
+		if (SEV_EventLoop_profile(el, entries.data(), &count))
+			count = 0;
+		std::string report = "      cpu ms       calls     avg us     max us  type\n";
+		for (int i = 0; i < count; ++i)
+		{
+			const SEV_EventLoopProfileEntry &e = entries[i];
+			char line[96];
+			snprintf(line, sizeof(line), "%12.3f %11lld %10.3f %10.3f  ", (double)e.CpuNs / 1e6, (long long)e.Count, e.Count ? (double)e.CpuNs / (double)e.Count / 1e3 : 0.0, (double)e.MaxNs / 1e3);
+			report += line;
+			report += e.Name;
+			report += '\n';
+		}
+		if (buffer && size > 0)
+		{
+			ptrdiff_t n = std::min((ptrdiff_t)report.size(), size - 1);
+			memcpy(buffer, report.c_str(), n);
+			buffer[n] = '\0';
+		}
+		return (ptrdiff_t)report.size();
+	}
+	catch (const std::bad_alloc &)
+	{
+		return -1; // ENOMEM
+	}
+}
+
+errno_t SEV_IMPL_EventLoop_counters(SEV_EventLoop *el, SEV_EventLoopCounters *counters)
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (!counters) return EINVAL;
+	counters->Stalls = elp->Stalls.load(std::memory_order_relaxed);
+	counters->Replacements = elp->Replaced.load(std::memory_order_relaxed);
+	counters->TaskBudgetHits = elp->TaskBudgetHits.load(std::memory_order_relaxed);
+	counters->TimerBudgetHits = elp->TimerBudgetHits.load(std::memory_order_relaxed);
+	counters->Workers = elp->Threads.load(std::memory_order_relaxed);
+	counters->ElasticStarted = elp->ElasticStarted.load(std::memory_order_relaxed);
+	counters->ElasticRetired = elp->ElasticRetired.load(std::memory_order_relaxed);
+	counters->Shed = elp->Shed.load(std::memory_order_relaxed);
+	return SEV_ESUCCESS;
+}
+
+/* end of file */
@@ -0,0 +1,289 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "event_loop.h"
+#include "event_loop_impl.h"
+
+#include <algorithm>
+#include <chrono>
+#include <system_error>
+#include <vector>
+
+namespace sev::impl::el {
+
+namespace {
+
+struct Stalled
+{
+	const Worker *Target; // Worker running the stalled task
+	int64_t TaskStart;
+	SEV_EventLoopStall Stall;
+};
+
+// Hand an error from a replacement worker to a regular one, a replacement has no error handler of its own
+void forwardError(EventLoopBase *elp, SEV_ExceptionHandle e) noexcept
+{
+	++elp->QueueItems;
+	errno_t res = elp->Queue.pushUnbounded(std::nothrow, [e](sev::EventLoop &) -> errno_t {
+		sev::ExceptionHandle eh(e);
+		eh.rethrow();
+		return SEV_ESUCCESS;
+	});
+	if (res)
+	{
+		--elp->QueueItems;
+		SEV_Exception_discardEx(e); // Out of memory, nowhere to put it
+		return;
+	}
+	wakeOne(elp);
+}
+
+void replace(EventLoopBase *elp, Replacement &r) noexcept
+{
+	t_Cover = &r.Over;
+	std::vector<SEV_ExceptionHandle> errors; // Posted once leaving, so this thread doesn't pick them up again
+	sev::ExceptionHandle eh;
+	while (elp->Running && !r.Over)
+	{
+		elp->Vt->Loop(elp, (SEV_ExceptionHandle *)&eh);
+		if (eh.raised())
+		{
+			SEV_ExceptionHandle e = *(SEV_ExceptionHandle *)&eh;
+			*(SEV_ExceptionHandle *)&eh = null;
+			try
+			{
+				errors.push_back(e);
+			}
+			catch (const std::bad_alloc &)
+			{
+				forwardError(elp, e);
+			}
+		}
+	}
+	for (SEV_ExceptionHandle e : errors)
+		forwardError(elp, e);
+	r.Done = true;
+}
+
+// Start a replacement for a stalled worker, under ManagedThreadsMutex
+bool startReplacement(EventLoopBase *elp, const Stalled &stalled) noexcept
+{
+	if (!elp->Running || elp->Stopping)
+		return false;
+	try
+	{
+		elp->Replacements.push_back(std::make_unique<Replacement>());
+	}
+	catch (const std::bad_alloc &)
+	{
+		return false;
+	}
+	Replacement *r = elp->Replacements.back().get();
+	r->Covers = stalled.Target;
+	r->TaskStart = stalled.TaskStart;
+	if (r->Thread.start([elp, r]() -> void { replace(elp, *r); }, 0))
+	{
+		elp->Replacements.pop_back();
+		return false;
+	}
+	return true;
+}
+
+void check(EventLoopBase *elp, Watchdog &wd)
+{
+	std::vector<Stalled> stalled;
+	std::vector<std::pair<const Worker *, int64_t>> running;
+	const int64_t now = SEV_Clock_ticks();
+	const double nsPerTick = SEV_Clock_nsPerTick();
+	{
+		std::unique_lock<std::mutex> lock(elp->WorkersMutex);
+		for (Worker *worker : elp->Workers)
+		{
+			const int64_t start = worker->TaskStart.load(std::memory_order_acquire);
+			if (!start)
+				continue;
+			running.emplace_back(worker, start);
+			if (now - start < wd.ThresholdTicks || worker->Reported == start)
+				continue;
+			const SEV_FunctorVt *vt = worker->TaskVt.load(std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (worker->TaskStart.load(std::memory_order_relaxed) != start)
+				continue; // Returned meanwhile, vt may belong to the next task
+			worker->Reported = start;
+			stalled.push_back({ worker, start, { worker->Id, vt, SEV_FunctorVt_name(vt), (int64_t)((double)(now - start) * nsPerTick), false } });
+		}
+	}
+	bool over = false;
+	{
+		std::unique_lock<std::mutex> lock(elp->ManagedThreadsMutex);
+		for (size_t i = 0; i < elp->Replacements.size();)
+		{
+			Replacement &r = *elp->Replacements[i];
+			if (r.Done)
+			{
+				r.Thread.join();
+				elp->Replacements.erase(elp->Replacements.begin() + i);
+				continue;
+			}
+			if (!r.Over && std::find(running.begin(), running.end(), std::make_pair(r.Covers, r.TaskStart)) == running.end())
+			{
+				r.Over = true;
+				over = true;
+			}
+			++i;
+		}
+		for (Stalled &s : stalled)
+		{
+			if ((int)elp->Replacements.size() >= wd.MaxReplacements)
+				break;
+			if (startReplacement(elp, s))
+			{
+				s.Stall.Replaced = true;
+				++elp->Replaced;
+			}
+		}
+	}
+	if (over)
+		wakeAll(elp); // Parked replacements leave
+	for (Stalled &s : stalled)
+	{
+		++elp->Stalls;
+		if (!wd.OnStall)
+			continue;
+		sev::ExceptionHandle ehc;
+		(*wd.OnStall)(ehc, &s.Stall);
+		if (ehc.raised())
+		{
+			ehc.discard();
+			SEV_terminate(); // Don't throw in the stall handler
+		}
+	}
+}
+
+void watch(EventLoopBase *elp, Watchdog *wd) noexcept
+{
+	std::unique_lock<std::mutex> lock(wd->Mutex);
+	while (!wd->Stop)
+	{
+		wd->Condition.wait_for(lock, std::chrono::milliseconds(wd->IntervalMs));
+		if (wd->Stop)
+			break;
+		lock.unlock();
+		try
+		{
+			check(elp, *wd);
+		}
+		catch (const std::bad_alloc &)
+		{
+			// Try again next round
+		}
+		lock.lock();
+	}
+}
+
+}
+
+errno_t addWorker(EventLoopBase *elp, Worker &worker) noexcept
+{
+	std::unique_lock<std::mutex> lock(elp->WorkersMutex);
+	try
+	{
+		elp->Workers.push_back(&worker);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	worker.Id = elp->WorkerIds++;
+	return SEV_ESUCCESS;
+}
+
+void removeWorker(EventLoopBase *elp, Worker &worker) noexcept
+{
+	std::unique_lock<std::mutex> lock(elp->WorkersMutex);
+	elp->Workers.erase(std::find(elp->Workers.begin(), elp->Workers.end(), &worker));
+}
+
+void stopWatchdog(EventLoopBase *elp) noexcept
+{
+	std::unique_lock<std::mutex> lock(elp->WatchdogMutex);
+	elp->WatchdogTicks = 0;
+	if (!elp->Watching)
+		return;
+	{
+		std::unique_lock<std::mutex> watchLock(elp->Watching->Mutex);
+		elp->Watching->Stop = true;
+		elp->Watching->Condition.notify_one();
+	}
+	elp->Watching->Thread.join();
+	elp->Watching.reset();
+}
+
+void joinReplacements(EventLoopBase *elp) noexcept
+{
+	for (std::unique_ptr<Replacement> &r : elp->Replacements)
+		r->Thread.join();
+	elp->Replacements.clear();
+}
+
+}
+
+errno_t SEV_IMPL_EventLoop_setWatchdog(SEV_EventLoop *el, const SEV_EventLoopWatchdog *watchdog, const SEV_FunctorVt *onStall, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	sev::impl::el::EventLoopBase *elp = (sev::impl::el::EventLoopBase *)el;
+	if (watchdog && (watchdog->ThresholdMs < 0 || watchdog->IntervalMs < 0 || watchdog->MaxReplacements < 0))
+		return EINVAL;
+	sev::impl::el::stopWatchdog(elp);
+	if (!watchdog || !watchdog->ThresholdMs)
+		return SEV_ESUCCESS;
+	std::unique_lock<std::mutex> lock(elp->WatchdogMutex);
+	try
+	{
+		std::unique_ptr<sev::impl::el::Watchdog> wd = std::make_unique<sev::impl::el::Watchdog>();
+		wd->ThresholdTicks = std::max((int64_t)1, (int64_t)((double)watchdog->ThresholdMs * 1e6 / SEV_Clock_nsPerTick()));
+		wd->IntervalMs = watchdog->IntervalMs ? watchdog->IntervalMs : std::max(1, watchdog->ThresholdMs / 4);
+		wd->MaxReplacements = watchdog->MaxReplacements;
+		if (onStall)
+			wd->OnStall.emplace((const sev::StallFunctorVt *)onStall, ptr, forwardConstructor);
+		wd->Thread = std::thread(sev::impl::el::watch, elp, wd.get());
+		elp->WatchdogTicks = wd->ThresholdTicks;
+		elp->Watching = std::move(wd);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	catch (const std::system_error &)
+	{
+		return EAGAIN;
+	}
+	return SEV_ESUCCESS;
+}
+
+/* end of file */
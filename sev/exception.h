@@ -240,7 +240,7 @@ private:
 		}
 		SEV_ASSERT(*(std::exception_ptr *)exception);
 		auto destroy = [](void *exception) {
-			delete exception;
+			delete (std::exception_ptr *)exception;
 		};
 		eh = SEV_Exception_captureEx(exception, what, destroy, impl::ex::rethrower(), eno);
 	}
@@ -29,20 +29,70 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include "functor.h"
 
+#include <stdlib.h>
+
+#include <map>
+#include <mutex>
+#include <string>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#endif
+
 void *SEV_alignedMAlloc(ptrdiff_t size, size_t alignment)
 {
+#ifdef _WIN32
 	return _aligned_malloc(size, alignment);
+#else
+	void *ptr;
+	if (posix_memalign(&ptr, alignment, size))
+		return null;
+	return ptr;
+#endif
 }
 
 void SEV_alignedFree(void *ptr)
 {
+#ifdef _WIN32
 	return _aligned_free(ptr);
+#else
+	return free(ptr);
+#endif
 }
 
-namespace sev {
+namespace sev::impl {
+
+namespace {
 
+std::mutex s_NamesMutex;
+std::map<const void *, std::string> s_Names; // Demangled names by type_info, never erased so the strings stay valid
 
+}
+
+}
 
+const char *SEV_FunctorVt_name(const SEV_FunctorVt *vt)
+{
+	if (!vt || !vt->TypeInfo) return "(unknown)";
+	try
+	{
+		std::unique_lock<std::mutex> lock(sev::impl::s_NamesMutex);
+		auto it = sev::impl::s_Names.find(vt->TypeInfo);
+		if (it != sev::impl::s_Names.end())
+			return it->second.c_str();
+		const char *name = ((const std::type_info *)vt->TypeInfo)->name();
+#if defined(__GNUC__) || defined(__clang__)
+		int status;
+		char *demangled = abi::__cxa_demangle(name, null, null, &status);
+		auto fin = gsl::finally([&]() -> void { free(demangled); });
+		if (!status && demangled) name = demangled;
+#endif
+		return sev::impl::s_Names.emplace(vt->TypeInfo, name).first->second.c_str();
+	}
+	catch (...)
+	{
+		return ((const std::type_info *)vt->TypeInfo)->name(); // Mangled, but still something
+	}
 }
 
 /* end of file */
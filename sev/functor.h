@@ -95,8 +95,8 @@ public:
 	{
 		SEV_ASSERT(vt);
 		m_Vt = vt;
-		void *p = p_allocPtr(sizeof(vt->size())); // Allocate space
-		vt->copyConstructor(p, ptr);
+		void *p = p_allocPtr(vt->size()); // Allocate space
+		vt->constCopyConstructor(p, ptr);
 	}
 
 	// Construct from vtable and data pointer, use move constructor when movable is set
@@ -104,11 +104,20 @@ public:
 	{
 		SEV_ASSERT(vt);
 		m_Vt = vt;
-		void *p = p_allocPtr(sizeof(vt->size())); // Allocate space
+		void *p = p_allocPtr(vt->size()); // Allocate space
 		if (movable) vt->moveConstructor(p, ptr);
 		else vt->copyConstructor(p, ptr);
 	}
 
+	// Construct from vtable and data pointer, using the given copy or move constructor
+	inline Functor(const TVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+	{
+		SEV_ASSERT(vt);
+		m_Vt = vt;
+		void *p = p_allocPtr(vt->size()); // Allocate space
+		forwardConstructor(p, ptr);
+	}
+
 	inline ~Functor() noexcept
 	{
 		SEV_ASSERT(m_Vt);
@@ -194,7 +203,9 @@ private:
 	{
 		if (size > c_Capacity)
 		{
-			void *ptr = alignedMAlloc(size, SEV_FUNCTOR_ALIGN);
+			m_Storage.Ptr = alignedMAlloc(size, SEV_FUNCTOR_ALIGN);
+			if (!m_Storage.Ptr)
+				throw std::bad_alloc();
 			return m_Storage.Ptr;
 		}
 		else
@@ -34,6 +34,10 @@ OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "platform.h"
 #include "exception.h"
 
+#ifdef __cplusplus
+#include <typeinfo>
+#endif
+
 #define SEV_FUNCTOR_ALIGN 64
 
 #ifdef __cplusplus
@@ -51,8 +55,12 @@ struct SEV_FunctorVt
 	void *Invoke;
 	void *TryInvoke;
 
+	const void *TypeInfo; // std::type_info of the callable, null if unknown
+
 };
 
+SEV_LIB const char *SEV_FunctorVt_name(const SEV_FunctorVt *vt); // Demangled type name of the callable, "(unknown)" without type information. Valid until the process exits
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -83,7 +91,8 @@ public:
 		, /*MoveConstructor*/([](void *, void *) -> void {})
 		, /*Destroy*/([](void *) -> void {})
 		, /*Invoke*/((TInvoke)([](void *, TArgs...) -> TRes { throw std::bad_function_call(); }))
-		, /*TryInvoke*/((TTryInvoke)([](void *, ExceptionHandle &, TArgs...) -> TRes { throw std::bad_function_call(); })) }
+		, /*TryInvoke*/((TTryInvoke)([](void *, ExceptionHandle &, TArgs...) -> TRes { throw std::bad_function_call(); }))
+		, /*TypeInfo*/(null) }
 	{
 		static_assert(sizeof(FunctorVt) == sizeof(SEV_FunctorVt));
 	}
@@ -125,7 +134,8 @@ public:
 			return eh.capture<TRes>([&]() -> TRes {
 				return (*f)(args...);
 			});
-		})}
+		})
+		, /*TypeInfo*/(&typeid(TFunc)) }
 	{
 		static_assert(alignof(TFunc) <= SEV_FUNCTOR_ALIGN);
 		static_assert(sizeof(FunctorVt) == sizeof(SEV_FunctorVt));
@@ -160,7 +170,8 @@ public:
 		}), /*TryInvoke*/(TTryInvoke)([](void *ptr, ExceptionHandle &, TArgs... args) -> TRes {
 			TFunc *f = reinterpret_cast<TFunc *>(ptr);
 			return (*f)(args...);
-			})}
+			})
+		, /*TypeInfo*/(&typeid(TFunc)) }
 	{
 		static_assert(alignof(TFunc) <= SEV_FUNCTOR_ALIGN);
 		static_assert(sizeof(FunctorVt) == sizeof(SEV_FunctorVt));
@@ -173,6 +184,7 @@ public:
 	inline void copyConstructor(void *ptr, void *other) const { return m.CopyConstructor(ptr, other); }
 	inline void moveConstructor(void *ptr, void *other) const { return m.MoveConstructor(ptr, other); }
 	inline void destroy(void *ptr) const { return m.Destroy(ptr); }
+	inline const std::type_info *typeInfo() const { return (const std::type_info *)m.TypeInfo; }
 
 	inline TRes invoke(void *ptr, TArgs... value) const { return ((TInvoke)m.Invoke)(ptr, value...); }
 	inline TRes invoke(void *ptr, ExceptionHandle &eh, TArgs... value) const { return ((TTryInvoke)m.TryInvoke)(ptr, eh, value...); }
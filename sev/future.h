@@ -0,0 +1,607 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Non-blocking futures. The promise side sets a value or an exception once, the future side chains a continuation which is posted to a loop.
+Shared state comes from a per-thread pool, and continuations are stored inline in the state when their capture is small, so a chain link doesn't hit malloc.
+
+Example:
+	sev::Promise<int> p;
+	p.future().then(el, [](int v) { return v * 2; }).then(other, [](int v) { printf("%i\n", v); });
+	p.set(21);
+
+*/
+
+#pragma once
+#ifndef SEV_FUTURE_H
+#define SEV_FUTURE_H
+
+#include "platform.h"
+#include "event_loop.h"
+#include "pool.h"
+
+#ifdef __cplusplus
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace sev {
+
+template<typename T = void>
+class Future;
+template<typename T = void>
+class Promise;
+
+namespace impl::fu {
+
+struct Unit { };
+
+template<typename T>
+using ValueType = std::conditional_t<std::is_void_v<T>, Unit, T>;
+
+const int c_Empty = 0;
+const int c_Continued = 1; // Continuation stored, waiting for the value
+const int c_Done = 2; // Value or exception stored
+
+// Shared between one promise and one future
+template<typename T>
+class State
+{
+public:
+	static void *operator new(size_t)
+	{
+		static_assert(sizeof(State) >= sizeof(void *));
+		return Pool::allocate<alignof(State)>(sizeof(State));
+	}
+
+	static void operator delete(void *ptr) noexcept
+	{
+		Pool::deallocate<alignof(State)>(ptr, sizeof(State));
+	}
+
+	void addRef() noexcept
+	{
+		Refs.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	void release() noexcept
+	{
+		if (Refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			delete this;
+	}
+
+	bool ready() const noexcept
+	{
+		return Status.load(std::memory_order_acquire) == c_Done;
+	}
+
+	template<typename... TValue>
+	void set(TValue &&... value)
+	{
+		Value.emplace(std::forward<TValue>(value)...);
+		complete();
+	}
+
+	void fail(std::exception_ptr exception) noexcept
+	{
+		Exception = std::move(exception);
+		complete();
+	}
+
+	// Takes over the reference of the future. Loop null runs the continuation inline on the thread which completes the state. When posting to the loop fails it runs inline too, with the exception set, so it must not call anything that expects the loop when Exception is set
+	void continueWith(EventLoop *loop, Functor<void(State &)> &&continuation) noexcept
+	{
+		Loop = loop;
+		Continuation = std::move(continuation);
+		int expected = c_Empty;
+		if (!Status.compare_exchange_strong(expected, c_Continued, std::memory_order_acq_rel))
+			dispatch(); // Already done
+	}
+
+	ValueType<T> take()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+		return std::move(*Value);
+	}
+
+	std::atomic_int Refs = 1;
+	std::atomic_int Status = c_Empty;
+	std::optional<ValueType<T>> Value;
+	std::exception_ptr Exception;
+	EventLoop *Loop = null;
+	Functor<void(State &)> Continuation;
+
+private:
+	void complete() noexcept
+	{
+		if (Status.exchange(c_Done, std::memory_order_acq_rel) == c_Continued)
+			dispatch();
+	}
+
+	void run() noexcept
+	{
+		Continuation(*this);
+		release();
+	}
+
+	void dispatch() noexcept
+	{
+		if (Loop)
+		{
+			// Straight into the loop queue, the entry is just the state pointer
+			auto f = [this](EventLoop &) -> errno_t {
+				run();
+				return SEV_ESUCCESS;
+			};
+			static const EventFunctorVt vt(f);
+			errno_t eno = SEV_EventLoop_postFunctorUnbounded(Loop, vt.get(), &f, vt.get()->CopyConstructor);
+			if (!eno)
+				return;
+			// Runs here instead, with the exception set the continuation skips the callable and only fails the downstream future
+			Exception = exception(eno);
+		}
+		run();
+	}
+
+	static std::exception_ptr exception(errno_t eno) noexcept
+	{
+		try
+		{
+			if (eno == ENOMEM) throw std::bad_alloc();
+			ExceptionHandle::rethrow(eno);
+		}
+		catch (...)
+		{
+			return std::current_exception();
+		}
+		return null;
+	}
+
+};
+
+template<typename T, typename TFn>
+auto call(TFn &f, State<T> &s)
+{
+	if constexpr (std::is_void_v<T>)
+		return f();
+	else
+		return f(std::move(*s.Value));
+}
+
+template<typename T, typename TFn>
+struct ResultType
+{
+	typedef std::invoke_result_t<TFn &, T &&> type;
+};
+
+template<typename TFn>
+struct ResultType<void, TFn>
+{
+	typedef std::invoke_result_t<TFn &> type;
+};
+
+template<typename T>
+struct WhenAll
+{
+	static void *operator new(size_t)
+	{
+		return Pool::allocate<alignof(WhenAll)>(sizeof(WhenAll));
+	}
+
+	static void operator delete(void *ptr) noexcept
+	{
+		Pool::deallocate<alignof(WhenAll)>(ptr, sizeof(WhenAll));
+	}
+
+	std::atomic_size_t Remaining;
+	std::atomic_bool Failed = false;
+	std::exception_ptr Exception; // First failure, written once by whoever sets Failed
+	std::vector<std::optional<T>> Values;
+	State<std::vector<T>> *Result;
+
+};
+
+template<>
+struct WhenAll<void>
+{
+	static void *operator new(size_t)
+	{
+		return Pool::allocate<alignof(WhenAll)>(sizeof(WhenAll));
+	}
+
+	static void operator delete(void *ptr) noexcept
+	{
+		Pool::deallocate<alignof(WhenAll)>(ptr, sizeof(WhenAll));
+	}
+
+	std::atomic_size_t Remaining;
+	std::atomic_bool Failed = false;
+	std::exception_ptr Exception;
+	State<void> *Result;
+
+};
+
+template<typename T>
+struct WhenAny
+{
+	static void *operator new(size_t)
+	{
+		return Pool::allocate<alignof(WhenAny)>(sizeof(WhenAny));
+	}
+
+	static void operator delete(void *ptr) noexcept
+	{
+		Pool::deallocate<alignof(WhenAny)>(ptr, sizeof(WhenAny));
+	}
+
+	std::atomic_size_t Remaining; // The last one out frees this
+	std::atomic_bool Done = false;
+	State<std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>> *Result;
+
+};
+
+}
+
+// Producer side. Setting nothing before destruction fails the future with broken_promise
+template<typename T>
+class Promise
+{
+public:
+	Promise() : m(new impl::fu::State<T>()) { m->addRef(); } // One reference for each side
+	Promise(Promise &&other) noexcept : m(other.m), m_Retrieved(other.m_Retrieved) { other.m = null; }
+	Promise &operator=(Promise &&other) noexcept
+	{
+		if (this != &other)
+		{
+			p_abandon();
+			m = other.m;
+			m_Retrieved = other.m_Retrieved;
+			other.m = null;
+		}
+		return *this;
+	}
+	~Promise() noexcept { p_abandon(); }
+
+	Future<T> future()
+	{
+		if (m_Retrieved || !m)
+			throw std::future_error(std::future_errc::future_already_retrieved);
+		m_Retrieved = true;
+		return Future<T>(m);
+	}
+
+	template<typename... TValue>
+	void set(TValue &&... value)
+	{
+		impl::fu::State<T> *s = p_take();
+		s->set(std::forward<TValue>(value)...);
+		s->release();
+	}
+
+	void fail(std::exception_ptr exception) noexcept
+	{
+		impl::fu::State<T> *s = p_take();
+		s->fail(std::move(exception));
+		s->release();
+	}
+
+private:
+	template<typename>
+	friend class Future;
+	template<typename TAny>
+	friend Future<std::vector<TAny>> whenAll(std::vector<Future<TAny>> &&futures);
+
+	explicit Promise(impl::fu::State<T> *s) noexcept : m(s), m_Retrieved(true) { }
+
+	impl::fu::State<T> *p_take()
+	{
+		if (!m)
+			throw std::future_error(std::future_errc::promise_already_satisfied);
+		if (!m_Retrieved)
+			m->release(); // Nobody will ever look at it
+		impl::fu::State<T> *s = m;
+		m = null;
+		return s;
+	}
+
+	void p_abandon() noexcept
+	{
+		if (!m)
+			return;
+		if (!m_Retrieved)
+			m->release();
+		impl::fu::State<T> *s = m;
+		m = null;
+		s->fail(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+		s->release();
+	}
+
+	Promise(const Promise &) = delete;
+	Promise &operator=(const Promise &) = delete;
+
+	impl::fu::State<T> *m;
+	bool m_Retrieved = false;
+
+};
+
+// Consumer side. Either chain a continuation with then, or poll with ready and get
+template<typename T>
+class Future
+{
+public:
+	Future() noexcept : m(null) { }
+	Future(Future &&other) noexcept : m(other.m) { other.m = null; }
+	Future &operator=(Future &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m) m->release();
+			m = other.m;
+			other.m = null;
+		}
+		return *this;
+	}
+	~Future() noexcept
+	{
+		if (m) m->release();
+	}
+
+	bool valid() const noexcept { return m; }
+	bool ready() const noexcept { return m && m->ready(); }
+
+	// Value once ready, does not block. Rethrows the exception the promise failed with
+	T get()
+	{
+		if (!ready())
+			throw std::future_error(std::future_errc::no_state);
+		impl::fu::State<T> *s = m;
+		m = null;
+		auto fin = gsl::finally([&]() -> void { s->release(); });
+		if constexpr (std::is_void_v<T>)
+			s->take();
+		else
+			return s->take();
+	}
+
+	// Run f with the value on the loop once ready, returns a future for its result. An exception skips f and passes on to the returned future
+	template<typename TFn>
+	auto then(EventLoop &el, TFn &&f) -> Future<typename impl::fu::ResultType<T, std::decay_t<TFn>>::type>
+	{
+		typedef typename impl::fu::ResultType<T, std::decay_t<TFn>>::type R;
+		return p_then<R>(&el, [f = std::forward<TFn>(f)](impl::fu::State<T> &s, impl::fu::State<R> &r) mutable -> void {
+			if constexpr (std::is_void_v<R>)
+			{
+				impl::fu::call<T>(f, s);
+				r.set();
+			}
+			else
+			{
+				r.set(impl::fu::call<T>(f, s));
+			}
+		});
+	}
+
+private:
+	template<typename>
+	friend class Promise;
+	template<typename>
+	friend class Future;
+	template<typename TAny>
+	friend Future<std::vector<TAny>> whenAll(std::vector<Future<TAny>> &&futures);
+	friend Future<void> whenAll(std::vector<Future<void>> &&futures);
+	template<typename TAny>
+	friend Future<std::conditional_t<std::is_void_v<TAny>, size_t, std::pair<size_t, TAny>>> whenAny(std::vector<Future<TAny>> &&futures);
+
+	explicit Future(impl::fu::State<T> *s) noexcept : m(s) { }
+
+	template<typename R, typename TFn>
+	Future<R> p_then(EventLoop *el, TFn &&body)
+	{
+		if (!m)
+			throw std::future_error(std::future_errc::no_state);
+		impl::fu::State<R> *r = new impl::fu::State<R>(); // Reference held by the continuation until it completes r
+		Future<R> res(r);
+		r->addRef();
+		impl::fu::State<T> *s = m;
+		m = null;
+		s->continueWith(el, [r, body = std::forward<TFn>(body)](impl::fu::State<T> &s) mutable -> void {
+			if (s.Exception)
+				r->fail(s.Exception);
+			else
+			{
+				try
+				{
+					body(s, *r);
+				}
+				catch (...)
+				{
+					r->fail(std::current_exception());
+				}
+			}
+			r->release();
+		});
+		return res;
+	}
+
+	Future(const Future &) = delete;
+	Future &operator=(const Future &) = delete;
+
+	impl::fu::State<T> *m;
+
+};
+
+// Completes with all values in order once every future is ready, or with the first exception once every future is ready. Throws future_error when one of them is not valid
+template<typename T>
+Future<std::vector<T>> whenAll(std::vector<Future<T>> &&futures)
+{
+	for (const Future<T> &f : futures)
+		if (!f.valid())
+			throw std::future_error(std::future_errc::no_state); // Before taking any of them
+	typedef impl::fu::WhenAll<T> TAll;
+	impl::fu::State<std::vector<T>> *r = new impl::fu::State<std::vector<T>>();
+	Future<std::vector<T>> res(r);
+	if (futures.empty())
+	{
+		r->set();
+		return res;
+	}
+	r->addRef();
+	TAll *all = new TAll();
+	all->Remaining = futures.size();
+	all->Values.resize(futures.size());
+	all->Result = r;
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		// Aggregation is trivial, run it inline on whichever thread completes the input
+		impl::fu::State<T> *s = futures[i].m;
+		futures[i].m = null;
+		s->continueWith(null, [all, i](impl::fu::State<T> &s) -> void {
+			if (s.Exception)
+			{
+				if (!all->Failed.exchange(true))
+					all->Exception = s.Exception;
+			}
+			else
+			{
+				all->Values[i].emplace(std::move(*s.Value));
+			}
+			if (all->Remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			impl::fu::State<std::vector<T>> *r = all->Result;
+			if (all->Failed)
+			{
+				r->fail(all->Exception);
+			}
+			else
+			{
+				std::vector<T> values;
+				values.reserve(all->Values.size());
+				for (std::optional<T> &v : all->Values)
+					values.push_back(std::move(*v));
+				r->set(std::move(values));
+			}
+			r->release();
+			delete all;
+		});
+	}
+	return res;
+}
+
+inline Future<void> whenAll(std::vector<Future<void>> &&futures)
+{
+	for (const Future<void> &f : futures)
+		if (!f.valid())
+			throw std::future_error(std::future_errc::no_state); // Before taking any of them
+	typedef impl::fu::WhenAll<void> TAll;
+	impl::fu::State<void> *r = new impl::fu::State<void>();
+	Future<void> res(r);
+	if (futures.empty())
+	{
+		r->set();
+		return res;
+	}
+	r->addRef();
+	TAll *all = new TAll();
+	all->Remaining = futures.size();
+	all->Result = r;
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		impl::fu::State<void> *s = futures[i].m;
+		futures[i].m = null;
+		s->continueWith(null, [all](impl::fu::State<void> &s) -> void {
+			if (s.Exception && !all->Failed.exchange(true))
+				all->Exception = s.Exception;
+			if (all->Remaining.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+			if (all->Failed)
+				all->Result->fail(all->Exception);
+			else
+				all->Result->set();
+			all->Result->release();
+			delete all;
+		});
+	}
+	return res;
+}
+
+// Completes with the index and value of the first future to be ready, or its exception. Throws future_error when one of them is not valid
+template<typename T>
+Future<std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>> whenAny(std::vector<Future<T>> &&futures)
+{
+	typedef std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>> R;
+	typedef impl::fu::WhenAny<T> TAny;
+	if (futures.empty())
+		throw std::future_error(std::future_errc::no_state);
+	for (const Future<T> &f : futures)
+		if (!f.valid())
+			throw std::future_error(std::future_errc::no_state); // Before taking any of them
+	impl::fu::State<R> *r = new impl::fu::State<R>();
+	Future<R> res(r);
+	r->addRef();
+	TAny *any = new TAny();
+	any->Remaining = futures.size();
+	any->Result = r;
+	for (size_t i = 0; i < futures.size(); ++i)
+	{
+		impl::fu::State<T> *s = futures[i].m;
+		futures[i].m = null;
+		s->continueWith(null, [any, i](impl::fu::State<T> &s) -> void {
+			if (!any->Done.exchange(true))
+			{
+				if (s.Exception)
+					any->Result->fail(s.Exception);
+				else if constexpr (std::is_void_v<T>)
+					any->Result->set(i);
+				else
+					any->Result->set(i, std::move(*s.Value));
+				any->Result->release();
+			}
+			if (any->Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				delete any;
+		});
+	}
+	return res;
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_FUTURE_H */
+
+/* end of file */
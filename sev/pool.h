@@ -0,0 +1,139 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Per-thread free lists of small blocks, by 64 byte size class, shared by the future states and the coroutine frames.
+Blocks may be freed on another thread than they were allocated on, they then move to that thread's lists.
+
+*/
+
+#pragma once
+#ifndef SEV_POOL_H
+#define SEV_POOL_H
+
+#include "platform.h"
+
+#ifdef __cplusplus
+
+#include <cstddef>
+#include <new>
+
+namespace sev::impl {
+
+class Pool
+{
+public:
+	// Over-aligned blocks, and blocks past the largest class, go straight to the allocator
+	template<size_t Align = alignof(std::max_align_t)>
+	static void *allocate(size_t size)
+	{
+		if constexpr (Align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+			return ::operator new(size, std::align_val_t(Align));
+		const size_t cls = (size + c_Granularity - 1) / c_Granularity;
+		if (cls >= c_Classes)
+			return ::operator new(size);
+		Cache &c = cache();
+		Node *node = c.Head[cls];
+		if (!node)
+			return ::operator new(cls * c_Granularity);
+		c.Head[cls] = node->Next;
+		--c.Count[cls];
+		return node;
+	}
+
+	template<size_t Align = alignof(std::max_align_t)>
+	static void deallocate(void *ptr, size_t size) noexcept
+	{
+		if constexpr (Align > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+		{
+			::operator delete(ptr, std::align_val_t(Align));
+			return;
+		}
+		const size_t cls = (size + c_Granularity - 1) / c_Granularity;
+		if (cls >= c_Classes)
+		{
+			::operator delete(ptr);
+			return;
+		}
+		Cache &c = cache();
+		if (c.Count[cls] >= c_MaxCached)
+		{
+			::operator delete(ptr);
+			return;
+		}
+		Node *node = (Node *)ptr;
+		node->Next = c.Head[cls];
+		c.Head[cls] = node;
+		++c.Count[cls];
+	}
+
+private:
+	static constexpr size_t c_Granularity = 64;
+	static constexpr size_t c_Classes = 64; // Blocks up to 4 KiB
+	static constexpr int c_MaxCached = 256; // Per class and thread
+
+	struct Node
+	{
+		Node *Next;
+	};
+
+	struct Cache
+	{
+		Node *Head[c_Classes] = {};
+		int Count[c_Classes] = {};
+
+		~Cache()
+		{
+			for (size_t i = 0; i < c_Classes; ++i)
+			{
+				while (Node *node = Head[i])
+				{
+					Head[i] = node->Next;
+					::operator delete(node);
+				}
+			}
+		}
+	};
+
+	static Cache &cache() noexcept
+	{
+		thread_local Cache c;
+		return c;
+	}
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_POOL_H */
+
+/* end of file */
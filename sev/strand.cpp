@@ -0,0 +1,158 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "strand.h"
+#include "concurrent_functor_queue.h"
+
+#include <atomic>
+
+namespace sev::impl::st {
+
+namespace {
+
+const int c_DefaultBatch = 64;
+const ptrdiff_t c_BlockSize = 4 * 1024; // Strands are many and usually short, don't take the loop's block size
+const int c_Destroyed = 1 << 30; // Flag in Pending, the strand frees itself once the count drops to zero
+
+}
+
+class Strand
+{
+public:
+	Strand(EventLoop *el, int batch) : Loop(el), Queue(std::nothrow, c_BlockSize), Pending(0), Batch(batch > 0 ? batch : c_DefaultBatch)
+	{
+
+	}
+
+	errno_t post(const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)) noexcept
+	{
+		errno_t eno = SEV_ConcurrentFunctorQueue_pushFunctor(Queue.get(), vt, ptr, forwardConstructor);
+		if (eno) return eno;
+		if (Pending.fetch_add(1) & ~c_Destroyed)
+			return SEV_ESUCCESS; // Already scheduled, the running drain picks it up
+		if (schedule())
+		{
+			// The functor is queued already, run the strand here rather than leave it stranded
+			ExceptionHandle eh;
+			drain(*Loop, eh);
+			eh.discard(); // The post itself succeeded
+		}
+		return SEV_ESUCCESS;
+	}
+
+	bool valid() noexcept
+	{
+		return Queue.get()->WriteBlock; // Null when the first block could not be allocated
+	}
+
+	void destroy() noexcept
+	{
+		if (!Pending.fetch_or(c_Destroyed))
+			delete this; // Idle
+	}
+
+	EventLoop *Loop;
+
+private:
+	errno_t schedule() noexcept
+	{
+		auto f = [this](EventLoop &el) -> errno_t {
+			ExceptionHandle eh;
+			drain(el, eh);
+			eh.rethrow();
+			return SEV_ESUCCESS;
+		};
+		static const EventFunctorVt vt(f);
+		return SEV_EventLoop_postFunctorUnbounded(Loop, vt.get(), &f, vt.get()->CopyConstructor); // Functors already queued on the strand were accepted
+	}
+
+	// Only one drain runs at a time, a drain is scheduled only when Pending goes up from zero. When the loop refuses the next drain, this one keeps going
+	void drain(EventLoop &el, ExceptionHandle &eh) noexcept
+	{
+		for (;;)
+		{
+			for (int i = 0; i < Batch; ++i)
+			{
+				bool success;
+				ExceptionHandle more; // Only the first error is reported
+				errno_t eno = Queue.tryCallAndPop(eh.raised() ? more : eh, success, el);
+				SEV_ASSERT(success);
+				if (!eh.raised() && eno) eh.capture(eno);
+				more.discard();
+				int prev = Pending.fetch_sub(1);
+				if ((prev & ~c_Destroyed) == 1)
+				{
+					// Idle, don't touch anything after this
+					if (prev & c_Destroyed)
+						delete this;
+					return;
+				}
+				if (eh.raised())
+					break; // Let the loop see the error, continue in a fresh task
+			}
+			if (!schedule())
+				return; // Yield to other work on the loop
+		}
+	}
+
+	ConcurrentFunctorQueue<errno_t(EventLoop &)> Queue;
+	std::atomic_int Pending; // Functors posted but not yet run
+	int Batch;
+
+};
+
+}
+
+SEV_Strand *SEV_Strand_create(SEV_EventLoop *el, int batch)
+{
+	sev::impl::st::Strand *strand = new (std::nothrow) sev::impl::st::Strand(el, batch);
+	if (strand && !strand->valid())
+	{
+		delete strand;
+		return null;
+	}
+	return strand;
+}
+
+void SEV_Strand_destroy(SEV_Strand *strand)
+{
+	if (strand) strand->destroy();
+}
+
+errno_t SEV_Strand_postFunctor(SEV_Strand *strand, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other))
+{
+	return strand->post(vt, ptr, forwardConstructor);
+}
+
+SEV_EventLoop *SEV_Strand_loop(SEV_Strand *strand)
+{
+	return strand->Loop;
+}
+
+/* end of file */
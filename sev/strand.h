@@ -0,0 +1,120 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Strand. Functors posted to a strand run on its event loop one at a time, in the order they were posted.
+Different strands on the same loop run in parallel, so per-object state behind a strand needs no mutex.
+Posting is lock-free. A strand drains up to a batch of functors per loop task, then queues itself again behind other work.
+
+*/
+
+#pragma once
+#ifndef SEV_STRAND_H
+#define SEV_STRAND_H
+
+#include "platform.h"
+#include "event_loop.h"
+
+#ifdef __cplusplus
+namespace sev::impl::st {
+class Strand;
+}
+typedef sev::impl::st::Strand SEV_Strand;
+#else
+typedef struct SEV_Strand SEV_Strand;
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SEV_LIB SEV_Strand *SEV_Strand_create(SEV_EventLoop *el, int batch); // Batch is the number of functors run per loop task, 0 for the default. Returns null when out of memory
+SEV_LIB void SEV_Strand_destroy(SEV_Strand *strand); // Does not block. Functors already posted still run, the strand is freed after the last one
+
+SEV_LIB errno_t SEV_Strand_postFunctor(SEV_Strand *strand, const SEV_FunctorVt *vt, void *ptr, void(*forwardConstructor)(void *ptr, void *other)); // errno_t(EventLoop &el). Fails only when the functor could not be queued. When the loop refuses the strand, the queued functors run on the calling thread
+SEV_LIB SEV_EventLoop *SEV_Strand_loop(SEV_Strand *strand);
+
+#ifdef __cplusplus
+}
+#endif
+
+#ifdef __cplusplus
+
+namespace sev {
+
+class Strand
+{
+public:
+	explicit Strand(EventLoop &el, int batch = 0) : m(SEV_Strand_create(&el, batch))
+	{
+		if (!m) throw std::bad_alloc();
+	}
+
+	~Strand() noexcept
+	{
+		SEV_Strand_destroy(m);
+	}
+
+	template<typename TFn>
+	void post(TFn &&f)
+	{
+		typedef std::decay_t<TFn> TFunc;
+		static const EventFunctorVt vt((const TFunc &)f);
+		TFunc &fr = f;
+		errno_t eno = SEV_Strand_postFunctor(m, vt.get(), &fr, std::is_rvalue_reference_v<TFn &&> ? vt.get()->MoveConstructor : vt.get()->CopyConstructor);
+		if (eno == ENOMEM) throw std::bad_alloc();
+		ExceptionHandle::rethrow(eno);
+	}
+
+	EventLoop &loop() const noexcept
+	{
+		return *SEV_Strand_loop(m);
+	}
+
+	SEV_Strand *get() const noexcept
+	{
+		return m;
+	}
+
+private:
+	Strand(const Strand &) = delete;
+	Strand &operator=(const Strand &) = delete;
+
+	SEV_Strand *m;
+
+};
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_STRAND_H */
+
+/* end of file */
@@ -0,0 +1,429 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Coroutines on the event loop. Requires C++20, the header is empty otherwise.
+
+Task<T> is lazy, it starts when awaited, or when spawned onto a loop.
+Awaitables suspend the coroutine and resume it from a loop queue entry which holds only the frame pointer.
+Frames are allocated from a per-thread pool of size classes, so short-lived tasks don't hit malloc.
+
+Example:
+	sev::Task<int> readSome(sev::EventLoop &el, int fd, char *buf)
+	{
+		co_await sev::readable(el, fd);
+		co_return (int)read(fd, buf, 64);
+	}
+
+*/
+
+#pragma once
+#ifndef SEV_TASK_H
+#define SEV_TASK_H
+
+#include "platform.h"
+#include "event_loop.h"
+#include "pool.h"
+
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define SEV_TASK
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+
+namespace sev {
+
+template<typename T = void>
+class Task;
+
+namespace impl::co {
+
+inline void resume(void *frame)
+{
+	std::coroutine_handle<>::from_address(frame).resume();
+}
+
+struct PromiseBase
+{
+	std::coroutine_handle<> Continuation; // Resumed when the task is done
+	std::exception_ptr Exception;
+	bool Detached = false; // Spawned, the frame frees itself when done
+
+	static void *operator new(size_t size)
+	{
+		return Pool::allocate(size);
+	}
+
+	static void operator delete(void *ptr, size_t size) noexcept
+	{
+		Pool::deallocate(ptr, size);
+	}
+
+	struct FinalAwaiter
+	{
+		bool await_ready() const noexcept { return false; }
+
+		template<typename TPromise>
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<TPromise> h) noexcept
+		{
+			PromiseBase &p = h.promise();
+			if (p.Detached)
+			{
+				if (p.Exception)
+					std::terminate(); // Exceptions escaping a spawned task are unhandled, same as a thread
+				h.destroy();
+				return std::noop_coroutine();
+			}
+			return p.Continuation ? p.Continuation : std::noop_coroutine();
+		}
+
+		void await_resume() const noexcept { }
+	};
+
+	std::suspend_always initial_suspend() const noexcept { return { }; }
+	FinalAwaiter final_suspend() const noexcept { return { }; }
+	void unhandled_exception() noexcept { Exception = std::current_exception(); }
+
+};
+
+template<typename T>
+struct TaskPromise : PromiseBase
+{
+	std::optional<T> Value;
+
+	template<typename TValue>
+	void return_value(TValue &&value)
+	{
+		Value.emplace(std::forward<TValue>(value));
+	}
+
+	T result()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+		return std::move(*Value);
+	}
+
+};
+
+template<>
+struct TaskPromise<void> : PromiseBase
+{
+	void return_void() const noexcept { }
+
+	void result()
+	{
+		if (Exception)
+			std::rethrow_exception(Exception);
+	}
+
+};
+
+// Resume on a loop
+struct ResumeAwaiter
+{
+	EventLoop *Loop;
+	errno_t Eno = 0;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		errno_t eno = SEV_EventLoop_resume(Loop, resume, h.address());
+		if (!eno)
+			return true; // May already run on another thread, don't touch this anymore
+		Eno = eno;
+		return false; // Continue right away, await_resume throws
+	}
+
+	void await_resume() const
+	{
+		ExceptionHandle::rethrow(Eno);
+	}
+
+};
+
+struct SleepAwaiter
+{
+	EventLoop *Loop;
+	int TimeoutMs;
+	errno_t Eno = 0;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		auto f = [frame = h.address()](EventLoop &) -> errno_t {
+			resume(frame);
+			return SEV_ESUCCESS;
+		};
+		static const EventFunctorVt vt(f);
+		errno_t eno = SEV_EventLoop_timeoutFunctor(Loop, vt.get(), &f, vt.get()->CopyConstructor, TimeoutMs);
+		if (!eno)
+			return true;
+		Eno = eno;
+		return false;
+	}
+
+	void await_resume() const
+	{
+		ExceptionHandle::rethrow(Eno);
+	}
+
+};
+
+// One-shot readiness watch. The callback queues the resume, so the coroutine can watch the descriptor again once it runs.
+// When the resume can't be queued it runs inline with the error, a watch made from there replaces this one
+struct WatchAwaiter
+{
+	EventLoop *Loop;
+	int Fd;
+	int Events;
+	errno_t Eno = 0;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		auto f = [this, frame = h.address()](EventLoop &el) -> errno_t {
+			errno_t eno = SEV_EventLoop_resume(&el, resume, frame);
+			if (eno)
+			{
+				Eno = eno;
+				resume(frame); // Frame and awaiter may be gone after this
+			}
+			return ECANCELED;
+		};
+		static const EventFunctorVt vt(f);
+		errno_t eno = Events == SEV_EVENT_LOOP_READ
+			? SEV_EventLoop_watchReadFunctor(Loop, Fd, vt.get(), &f, vt.get()->CopyConstructor)
+			: SEV_EventLoop_watchWriteFunctor(Loop, Fd, vt.get(), &f, vt.get()->CopyConstructor);
+		if (!eno)
+			return true;
+		Eno = eno;
+		return false;
+	}
+
+	void await_resume() const
+	{
+		ExceptionHandle::rethrow(Eno);
+	}
+
+};
+
+// Completion callbacks already run on a loop thread, resume inline
+struct IoAwaiter
+{
+	EventLoop *Loop;
+	EventLoopIo Io;
+	ptrdiff_t Result = 0;
+	errno_t Eno = 0;
+
+	bool await_ready() const noexcept { return false; }
+
+	bool await_suspend(std::coroutine_handle<> h) noexcept
+	{
+		auto f = [this, frame = h.address()](EventLoop &, ptrdiff_t result) -> errno_t {
+			Result = result;
+			resume(frame);
+			return SEV_ESUCCESS;
+		};
+		static const IoFunctorVt vt(f);
+		errno_t eno = SEV_EventLoop_ioFunctor(Loop, &Io, vt.get(), &f, vt.get()->CopyConstructor);
+		if (!eno)
+			return true;
+		Eno = eno;
+		return false;
+	}
+
+	ptrdiff_t await_resume() const
+	{
+		ExceptionHandle::rethrow(Eno);
+		return Result;
+	}
+
+};
+
+template<typename T>
+struct SyncResult
+{
+	std::optional<T> Value;
+	std::exception_ptr Exception;
+};
+
+template<>
+struct SyncResult<void>
+{
+	std::exception_ptr Exception;
+};
+
+}
+
+// Coroutine with a result, runs when awaited. Awaiting a task resumes the awaiting coroutine on whichever thread the task finished
+template<typename T>
+class Task
+{
+public:
+	struct promise_type : impl::co::TaskPromise<T>
+	{
+		Task get_return_object() noexcept { return Task(std::coroutine_handle<promise_type>::from_promise(*this)); }
+	};
+
+	Task() noexcept = default;
+	Task(Task &&other) noexcept : m(other.m) { other.m = null; }
+	Task &operator=(Task &&other) noexcept
+	{
+		if (this != &other)
+		{
+			if (m) m.destroy();
+			m = other.m;
+			other.m = null;
+		}
+		return *this;
+	}
+	~Task() noexcept
+	{
+		if (m) m.destroy();
+	}
+
+	bool await_ready() const noexcept { return false; }
+
+	std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+	{
+		m.promise().Continuation = awaiting;
+		return m; // Symmetric transfer, no stack growth on long chains
+	}
+
+	T await_resume()
+	{
+		return m.promise().result();
+	}
+
+	std::coroutine_handle<promise_type> release() noexcept
+	{
+		std::coroutine_handle<promise_type> h = m;
+		m = null;
+		return h;
+	}
+
+	explicit operator bool() const noexcept { return (bool)m; }
+
+private:
+	explicit Task(std::coroutine_handle<promise_type> h) noexcept : m(h) { }
+
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+
+	std::coroutine_handle<promise_type> m;
+
+};
+
+// Continue on el behind what's already queued. Yields when already running on el, moves the coroutine over from another loop or thread
+inline impl::co::ResumeAwaiter post(EventLoop &el) noexcept
+{
+	return { &el };
+}
+
+// Continue on the loop after the timeout
+inline impl::co::SleepAwaiter sleep(EventLoop &el, int timeoutMs) noexcept
+{
+	return { &el, timeoutMs };
+}
+
+// Continue on the loop once fd is readable, or hung up. Fails with EEXIST if fd already has a read callback
+inline impl::co::WatchAwaiter readable(EventLoop &el, int fd) noexcept
+{
+	return { &el, fd, SEV_EVENT_LOOP_READ };
+}
+
+inline impl::co::WatchAwaiter writable(EventLoop &el, int fd) noexcept
+{
+	return { &el, fd, SEV_EVENT_LOOP_WRITE };
+}
+
+// Run an I/O operation, result is the system call result or a negative errno
+inline impl::co::IoAwaiter io(EventLoop &el, const EventLoopIo &io) noexcept
+{
+	return { &el, io };
+}
+
+// Start the task on the loop without waiting for it. The frame is freed when it finishes. Exceptions escaping the task terminate
+inline errno_t spawn(EventLoop &el, Task<void> &&task) noexcept
+{
+	std::coroutine_handle<Task<void>::promise_type> h = task.release();
+	h.promise().Detached = true;
+	errno_t eno = SEV_EventLoop_resume(&el, impl::co::resume, h.address());
+	if (eno) h.destroy();
+	return eno;
+}
+
+namespace impl::co {
+
+template<typename T>
+Task<void> syncWait(Task<T> task, SyncResult<T> &res, EventFlag &done)
+{
+	try
+	{
+		if constexpr (std::is_void_v<T>)
+			co_await std::move(task);
+		else
+			res.Value.emplace(co_await std::move(task));
+	}
+	catch (...)
+	{
+		res.Exception = std::current_exception();
+	}
+	done.set(); // The caller returns from here on, don't touch res or done anymore
+}
+
+}
+
+// Run the task on the loop and block until it's done. Don't call from a thread of the same loop, unless the loop has other threads to run it
+template<typename T>
+T syncWait(EventLoop &el, Task<T> &&task)
+{
+	impl::co::SyncResult<T> res;
+	EventFlag done;
+	ExceptionHandle::rethrow(spawn(el, impl::co::syncWait(std::move(task), res, done)));
+	done.wait();
+	if (res.Exception)
+		std::rethrow_exception(res.Exception);
+	if constexpr (!std::is_void_v<T>)
+		return std::move(*res.Value);
+}
+
+}
+
+#endif /* #if defined(__cpp_impl_coroutine) */
+
+#endif /* #ifndef SEV_TASK_H */
+
+/* end of file */
@@ -0,0 +1,395 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include "trace.h"
+#include "clock.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+namespace sev::impl::tr {
+
+std::atomic_bool Enabled;
+
+namespace {
+
+struct Event
+{
+	std::atomic<int64_t> Start;
+	std::atomic<int64_t> End; // INT64_MIN for an instant event
+	std::atomic<const char *> Name;
+	std::atomic<const SEV_FunctorVt *> Vt;
+};
+
+// Written only by the owning thread. Head is bumped before a slot is overwritten and Done after, so the reader can tell which copied slots are intact
+struct Ring
+{
+	static constexpr int64_t c_Capacity = 8192;
+	std::atomic<int64_t> Head;
+	std::atomic<int64_t> Done;
+	std::atomic_bool Retired; // Set when the thread exits, deleted by the next flush
+	int64_t Read; // Under s_RingsMutex
+	int Tid;
+	char ThreadName[32];
+	Event Events[c_Capacity];
+};
+
+struct Collected
+{
+	int64_t Start;
+	int64_t End;
+	const char *Name;
+	const SEV_FunctorVt *Vt;
+	int Tid;
+};
+
+struct RingHolder
+{
+	Ring *Current = null;
+	~RingHolder()
+	{
+		if (Current) Current->Retired.store(true, std::memory_order_release);
+	}
+};
+
+std::mutex s_RingsMutex;
+std::vector<Ring *> s_Rings;
+int s_NextTid;
+std::atomic<int64_t> s_BaseTicks;
+thread_local RingHolder t_Ring;
+
+std::mutex s_StreamMutex;
+std::condition_variable s_StreamCondition;
+std::thread s_StreamThread;
+FILE *s_StreamFile;
+bool s_StreamStop;
+bool s_StreamFirst;
+int s_StreamIntervalMs;
+
+Ring *ring() noexcept
+{
+	if (t_Ring.Current) return t_Ring.Current;
+	Ring *r = new (std::nothrow) Ring();
+	if (!r) return null;
+#if defined(__linux__)
+	if (pthread_getname_np(pthread_self(), r->ThreadName, sizeof(r->ThreadName)))
+		r->ThreadName[0] = 0;
+#endif
+	try
+	{
+		std::unique_lock<std::mutex> lock(s_RingsMutex);
+		r->Tid = ++s_NextTid;
+		s_Rings.push_back(r);
+	}
+	catch (const std::bad_alloc &)
+	{
+		delete r;
+		return null;
+	}
+	if (!r->ThreadName[0])
+		snprintf(r->ThreadName, sizeof(r->ThreadName), "thread %i", r->Tid);
+	t_Ring.Current = r;
+	return r;
+}
+
+void record(int64_t start, int64_t end, const char *name, const SEV_FunctorVt *vt) noexcept
+{
+	Ring *r = ring();
+	if (!r) return;
+	int64_t h = r->Head.load(std::memory_order_relaxed);
+	r->Head.store(h + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	Event &e = r->Events[h & (Ring::c_Capacity - 1)];
+	e.Start.store(start, std::memory_order_relaxed);
+	e.End.store(end, std::memory_order_relaxed);
+	e.Name.store(name, std::memory_order_relaxed);
+	e.Vt.store(vt, std::memory_order_relaxed);
+	r->Done.store(h + 1, std::memory_order_release);
+}
+
+// Take the unread events out of all rings, and emit the thread names of the rings that had any
+void collect(std::vector<Collected> &events, std::vector<std::pair<int, std::string>> &threads)
+{
+	std::unique_lock<std::mutex> lock(s_RingsMutex);
+	for (size_t i = 0; i < s_Rings.size();)
+	{
+		Ring *r = s_Rings[i];
+		bool retired = r->Retired.load(std::memory_order_acquire);
+		int64_t done = r->Done.load(std::memory_order_acquire);
+		int64_t from = std::max(r->Read, done - Ring::c_Capacity);
+		size_t first = events.size();
+		for (int64_t j = from; j < done; ++j)
+		{
+			const Event &e = r->Events[j & (Ring::c_Capacity - 1)];
+			events.push_back({ e.Start.load(std::memory_order_relaxed), e.End.load(std::memory_order_relaxed),
+			    e.Name.load(std::memory_order_relaxed), e.Vt.load(std::memory_order_relaxed), r->Tid });
+		}
+		std::atomic_thread_fence(std::memory_order_acquire);
+		int64_t intact = r->Head.load(std::memory_order_relaxed) - Ring::c_Capacity;
+		if (intact > from)
+		{
+			// Overwritten while copying
+			size_t drop = (size_t)std::min(intact - from, done - from);
+			events.erase(events.begin() + first, events.begin() + first + drop);
+		}
+		if (events.size() > first)
+			threads.emplace_back(r->Tid, r->ThreadName);
+		r->Read = done;
+		if (retired)
+		{
+			// Thread is gone, all its events were read
+			delete r;
+			s_Rings.erase(s_Rings.begin() + i);
+			continue;
+		}
+		++i;
+	}
+}
+
+void appendEscaped(std::string &out, const char *str)
+{
+	for (const char *c = str; *c; ++c)
+	{
+		if (*c == '"' || *c == '\\')
+		{
+			out += '\\';
+			out += *c;
+		}
+		else if ((unsigned char)*c < 0x20)
+		{
+			char buffer[8];
+			snprintf(buffer, sizeof(buffer), "\\u%04x", (unsigned)(unsigned char)*c);
+			out += buffer;
+		}
+		else
+		{
+			out += *c;
+		}
+	}
+}
+
+int processId()
+{
+#ifdef _WIN32
+	return (int)GetCurrentProcessId();
+#else
+	return (int)getpid();
+#endif
+}
+
+// Format as trace event objects, each one preceded by a separator unless it's the first in the file
+void format(std::string &out, const std::vector<Collected> &events, const std::vector<std::pair<int, std::string>> &threads, bool &first)
+{
+	const int pid = processId();
+	const double usPerTick = SEV_Clock_nsPerTick() * 0.001;
+	const int64_t base = s_BaseTicks.load(std::memory_order_relaxed);
+	char buffer[160];
+	auto separate = [&]() -> void {
+		if (!first) out += ",\n";
+		first = false;
+	};
+	for (const std::pair<int, std::string> &thread : threads)
+	{
+		separate();
+		out += "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":";
+		snprintf(buffer, sizeof(buffer), "%i,\"tid\":%i,\"args\":{\"name\":\"", pid, thread.first);
+		out += buffer;
+		appendEscaped(out, thread.second.c_str());
+		out += "\"}}";
+	}
+	for (const Collected &e : events)
+	{
+		separate();
+		out += "{\"name\":\"";
+		appendEscaped(out, e.Vt ? SEV_FunctorVt_name(e.Vt) : e.Name);
+		out += "\",\"cat\":\"";
+		appendEscaped(out, e.Name);
+		if (e.End == INT64_MIN)
+		{
+			snprintf(buffer, sizeof(buffer), "\",\"ph\":\"i\",\"s\":\"t\",\"ts\":%.3f,\"pid\":%i,\"tid\":%i}",
+			    (double)(e.Start - base) * usPerTick, pid, e.Tid);
+		}
+		else
+		{
+			snprintf(buffer, sizeof(buffer), "\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%i,\"tid\":%i}",
+			    (double)(e.Start - base) * usPerTick, (double)(e.End - e.Start) * usPerTick, pid, e.Tid);
+		}
+		out += buffer;
+	}
+}
+
+// Append the pending events to a file, under s_StreamMutex when streaming
+errno_t flush(FILE *file, bool &first)
+{
+	std::vector<Collected> events;
+	std::vector<std::pair<int, std::string>> threads;
+	std::string out;
+	try
+	{
+		collect(events, threads);
+		format(out, events, threads, first);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return ENOMEM;
+	}
+	if (out.size() && fwrite(out.data(), 1, out.size(), file) != out.size())
+		return EIO;
+	if (fflush(file))
+		return EIO;
+	return 0;
+}
+
+void streamThread()
+{
+	std::unique_lock<std::mutex> lock(s_StreamMutex);
+	while (!s_StreamStop)
+	{
+		s_StreamCondition.wait_for(lock, std::chrono::milliseconds(s_StreamIntervalMs));
+		flush(s_StreamFile, s_StreamFirst);
+	}
+}
+
+errno_t openFile(FILE *&file, const char *path)
+{
+#ifdef _WIN32
+	return fopen_s(&file, path, "wb");
+#else
+	file = fopen(path, "wb");
+	return file ? 0 : errno;
+#endif
+}
+
+}
+
+}
+
+void SEV_Trace_setEnabled(bool enabled)
+{
+	int64_t zero = 0;
+	if (enabled) sev::impl::tr::s_BaseTicks.compare_exchange_strong(zero, SEV_Clock_ticks());
+	sev::impl::tr::Enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool SEV_Trace_enabled()
+{
+	return sev::impl::tr::enabled();
+}
+
+void SEV_Trace_complete(const char *name, const SEV_FunctorVt *vt, int64_t startTicks, int64_t endTicks)
+{
+	if (!sev::impl::tr::enabled()) return;
+	sev::impl::tr::record(startTicks, endTicks, name, vt);
+}
+
+void SEV_Trace_instant(const char *name, const SEV_FunctorVt *vt)
+{
+	if (!sev::impl::tr::enabled()) return;
+	sev::impl::tr::record(SEV_Clock_ticks(), INT64_MIN, name, vt);
+}
+
+errno_t SEV_Trace_write(const char *path)
+{
+	using namespace sev::impl::tr;
+	std::unique_lock<std::mutex> lock(s_StreamMutex);
+	if (s_StreamFile) return EBUSY;
+	FILE *file;
+	errno_t eno = openFile(file, path);
+	if (eno) return eno;
+	bool first = true;
+	if (fputs("{\"traceEvents\":[\n", file) < 0) eno = EIO;
+	if (!eno) eno = flush(file, first);
+	if (!eno && fputs("\n]}\n", file) < 0) eno = EIO;
+	if (fclose(file) && !eno) eno = EIO;
+	return eno;
+}
+
+errno_t SEV_Trace_stream(const char *path, int intervalMs)
+{
+	using namespace sev::impl::tr;
+	std::unique_lock<std::mutex> lock(s_StreamMutex);
+	if (!path)
+	{
+		if (!s_StreamFile) return 0;
+		s_StreamStop = true;
+		s_StreamCondition.notify_one();
+		lock.unlock();
+		s_StreamThread.join();
+		lock.lock();
+		errno_t eno = flush(s_StreamFile, s_StreamFirst);
+		if (!eno && fputs("\n]\n", s_StreamFile) < 0) eno = EIO;
+		if (fclose(s_StreamFile) && !eno) eno = EIO;
+		s_StreamFile = null;
+		return eno;
+	}
+	if (s_StreamFile) return EBUSY;
+	FILE *file;
+	errno_t eno = openFile(file, path);
+	if (eno) return eno;
+	if (fputs("[\n", file) < 0)
+	{
+		fclose(file);
+		return EIO;
+	}
+	s_StreamFile = file;
+	s_StreamStop = false;
+	s_StreamFirst = true;
+	s_StreamIntervalMs = std::max(intervalMs, 1);
+	try
+	{
+		s_StreamThread = std::thread(streamThread);
+	}
+	catch (const std::bad_alloc &)
+	{
+		eno = ENOMEM;
+	}
+	catch (const std::system_error &)
+	{
+		eno = EAGAIN;
+	}
+	if (eno)
+	{
+		fclose(file);
+		s_StreamFile = null;
+	}
+	return eno;
+}
+
+/* end of file */
@@ -0,0 +1,83 @@
+/*
+
+Copyright (C) 2016-2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+   may be used to endorse or promote products derived from this software
+   without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+/*
+
+Event tracing in the Chrome trace event format, which chrome://tracing and Perfetto open.
+Each thread records into its own ring of recent events, without locks. Events which aren't written out before the ring wraps around are lost.
+The event loops record queued functors, posts, timers, block flips of the queue, and parking of workers while tracing is enabled.
+
+*/
+
+#pragma once
+#ifndef SEV_TRACE_H
+#define SEV_TRACE_H
+
+#include "platform.h"
+#include "functor_vt.h"
+
+#ifdef __cplusplus
+#include <atomic>
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+SEV_LIB void SEV_Trace_setEnabled(bool enabled);
+SEV_LIB bool SEV_Trace_enabled();
+
+SEV_LIB void SEV_Trace_complete(const char *name, const SEV_FunctorVt *vt, int64_t startTicks, int64_t endTicks); // Span between two SEV_Clock_ticks. Name must stay valid, it is the category when vt is given, and the type name of vt is shown instead
+SEV_LIB void SEV_Trace_instant(const char *name, const SEV_FunctorVt *vt);
+
+SEV_LIB errno_t SEV_Trace_write(const char *path); // Write the events in the rings as a JSON file, and remove them from the rings. Returns EBUSY while streaming
+SEV_LIB errno_t SEV_Trace_stream(const char *path, int intervalMs); // Keep appending the events to a JSON file from a background thread, null to stop and close the file
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#ifdef __cplusplus
+
+namespace sev::impl::tr {
+
+extern std::atomic_bool Enabled; // For checks inside the library, other code calls SEV_Trace_enabled
+
+inline bool enabled() noexcept
+{
+	return Enabled.load(std::memory_order_relaxed);
+}
+
+}
+
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef SEV_TRACE_H */
+
+/* end of file */
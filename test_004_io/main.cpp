@@ -0,0 +1,370 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/event_loop.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+/*
+
+Readiness callbacks on pipes and socketpairs, dispatched on the loop threads.
+Completion based operations, and their throughput on the io_uring loop and on the fallback path.
+
+*/
+
+namespace {
+
+template<typename TFn>
+errno_t watchRead(SEV_EventLoop *el, int fd, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_watchReadFunctor(el, fd, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+template<typename TFn>
+errno_t watchWrite(SEV_EventLoop *el, int fd, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_watchWriteFunctor(el, fd, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+template<typename TFn>
+errno_t submit(SEV_EventLoop *el, const sev::EventLoopIo &io, TFn &&f)
+{
+	static const sev::IoFunctorVt vt(f);
+	return SEV_EventLoop_ioFunctor(el, &io, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+void setNonBlocking(int fd)
+{
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+// Ping-pong a counter over a socketpair, each hop is a readiness callback
+void testPingPong(SEV_EventLoop *el)
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	setNonBlocking(sv[0]);
+	setNonBlocking(sv[1]);
+	const int rounds = 100000;
+	sev::EventFlag done;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int s = 0; s < 2; ++s)
+	{
+		int fd = sv[s];
+		watchRead(el, fd, [fd, rounds, &done](sev::EventLoop &) -> errno_t {
+			int v;
+			while (read(fd, &v, sizeof(v)) == sizeof(v))
+			{
+				if (v >= rounds)
+				{
+					done.set();
+					return ECANCELED;
+				}
+				++v;
+				write(fd, &v, sizeof(v));
+			}
+			return 0;
+		});
+	}
+	int v = 0;
+	write(sv[0], &v, sizeof(v));
+	done.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Ping-pong: " << rounds << " hops in " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us\n";
+	SEV_EventLoop_unwatch(el, sv[0]);
+	SEV_EventLoop_unwatch(el, sv[1]);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+// Fill a pipe until it would block, then drain it as it becomes writable again
+void testPipe(SEV_EventLoop *el)
+{
+	int p[2];
+	pipe(p);
+	setNonBlocking(p[0]);
+	setNonBlocking(p[1]);
+	const ptrdiff_t total = 64 * 1024 * 1024;
+	std::atomic_ptrdiff_t written = 0;
+	std::atomic_ptrdiff_t received = 0;
+	sev::EventFlag done;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	int rfd = p[0], wfd = p[1];
+	watchWrite(el, wfd, [wfd, total, &written](sev::EventLoop &) -> errno_t {
+		char buffer[16384] = { };
+		while (written < total)
+		{
+			ssize_t res = write(wfd, buffer, (size_t)std::min((ptrdiff_t)sizeof(buffer), total - written));
+			if (res < 0) return errno == EAGAIN ? 0 : errno;
+			written += res;
+		}
+		return ECANCELED;
+	});
+	watchRead(el, rfd, [rfd, total, &received, &done](sev::EventLoop &) -> errno_t {
+		char buffer[16384];
+		for (;;)
+		{
+			ssize_t res = read(rfd, buffer, sizeof(buffer));
+			if (res < 0) return errno == EAGAIN ? 0 : errno;
+			received += res;
+			if (received == total)
+			{
+				done.set();
+				return ECANCELED;
+			}
+		}
+	});
+	done.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Pipe: " << (total >> 20) << " MiB in " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count() << " us\n";
+	SEV_EventLoop_unwatch(el, rfd);
+	SEV_EventLoop_unwatch(el, wfd);
+	close(rfd);
+	close(wfd);
+}
+
+// Hang up is delivered to the read callback
+void testHangUp(SEV_EventLoop *el)
+{
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	setNonBlocking(sv[0]);
+	sev::EventFlag done;
+	int fd = sv[0];
+	watchRead(el, fd, [fd, &done](sev::EventLoop &) -> errno_t {
+		char c;
+		if (read(fd, &c, 1) == 0)
+		{
+			done.set();
+			return ECANCELED;
+		}
+		return 0;
+	});
+	close(sv[1]);
+	done.wait();
+	std::cout << "Hang up: ok\n";
+	SEV_EventLoop_unwatch(el, fd);
+	close(fd);
+}
+
+// Timer and timeout operation
+void testTimeout(SEV_EventLoop *el)
+{
+	sev::EventFlag done;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	sev::EventLoopIo io = { SEV_EVENT_LOOP_IO_TIMEOUT };
+	io.TimeoutMs = 20;
+	submit(el, io, [&done](sev::EventLoop &, ptrdiff_t res) -> errno_t {
+		if (res == 0) done.set();
+		return 0;
+	});
+	done.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	std::cout << "Timeout: 20 ms took " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms\n";
+}
+
+// Accept a connection on a local socket
+void testAccept(SEV_EventLoop *el)
+{
+	int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	sockaddr_un addr = { AF_UNIX };
+	snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "sev-test-004-%i", (int)getpid()); // Abstract namespace
+	socklen_t addrLen = (socklen_t)(offsetof(sockaddr_un, sun_path) + 1 + strlen(addr.sun_path + 1));
+	bind(listener, (sockaddr *)&addr, addrLen);
+	listen(listener, 4);
+	sev::EventFlag done;
+	int accepted = -1;
+	sev::EventLoopIo io = { SEV_EVENT_LOOP_IO_ACCEPT, listener };
+	io.Flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+	submit(el, io, [&done, &accepted](sev::EventLoop &, ptrdiff_t res) -> errno_t {
+		accepted = (int)res;
+		done.set();
+		return 0;
+	});
+	int client = socket(AF_UNIX, SOCK_STREAM, 0);
+	connect(client, (sockaddr *)&addr, addrLen);
+	done.wait();
+	std::cout << "Accept: " << (accepted >= 0 ? "ok" : "failed") << "\n";
+	if (accepted >= 0) close(accepted);
+	close(client);
+	SEV_EventLoop_unwatch(el, listener);
+	close(listener);
+}
+
+// Read a file with a number of reads in flight
+void benchFile(SEV_EventLoop *el)
+{
+	const ptrdiff_t total = 256 * 1024 * 1024;
+	const ptrdiff_t block = 64 * 1024;
+	const int depth = 8;
+	char path[] = "/tmp/sev-test-004-XXXXXX";
+	int fd = mkstemp(path);
+	unlink(path);
+	{
+		std::vector<char> data(1024 * 1024, 'x');
+		for (ptrdiff_t i = 0; i < total; i += (ptrdiff_t)data.size())
+			write(fd, &data[0], data.size());
+	}
+	std::vector<std::vector<char>> buffers(depth, std::vector<char>(block));
+	std::atomic_ptrdiff_t next = 0;
+	std::atomic_ptrdiff_t received = 0;
+	sev::EventFlag done;
+	struct Reader
+	{
+		SEV_EventLoop *El;
+		int Fd;
+		char *Buffer;
+		std::atomic_ptrdiff_t *Next;
+		std::atomic_ptrdiff_t *Received;
+		sev::EventFlag *Done;
+		ptrdiff_t Block;
+		ptrdiff_t Total;
+
+		void read()
+		{
+			ptrdiff_t offset = Next->fetch_add(Block);
+			if (offset >= Total) return;
+			sev::EventLoopIo io = { SEV_EVENT_LOOP_IO_READ, Fd, Buffer, Block, offset };
+			Reader self = *this;
+			submit(El, io, [self](sev::EventLoop &, ptrdiff_t res) mutable -> errno_t {
+				if (res <= 0) return res < 0 ? (errno_t)-res : EIO;
+				if ((*self.Received += res) == self.Total) self.Done->set();
+				self.read();
+				return 0;
+			});
+		}
+	};
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (int i = 0; i < depth; ++i)
+		Reader{ el, fd, &buffers[i][0], &next, &received, &done, block, total }.read();
+	done.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "File read: " << (total >> 20) << " MiB in " << us << " us, " << (total / std::max(us, (int64_t)1)) << " MB/s\n";
+	close(fd);
+}
+
+// Stream over a socketpair, one send and one receive in flight
+void benchSocket(SEV_EventLoop *el)
+{
+	const ptrdiff_t total = 256 * 1024 * 1024;
+	const ptrdiff_t block = 64 * 1024;
+	int sv[2];
+	socketpair(AF_UNIX, SOCK_STREAM, 0, sv);
+	setNonBlocking(sv[0]);
+	setNonBlocking(sv[1]);
+	std::vector<char> sendBuffer(block, 'x');
+	std::vector<char> recvBuffer(block);
+	sev::EventFlag done;
+	struct Stream
+	{
+		SEV_EventLoop *El;
+		int Fd;
+		int Op;
+		char *Buffer;
+		ptrdiff_t Block;
+		ptrdiff_t Remaining;
+		sev::EventFlag *Done;
+
+		void next()
+		{
+			sev::EventLoopIo io = { Op, Fd, Buffer, std::min(Block, Remaining) };
+			Stream self = *this;
+			submit(El, io, [self](sev::EventLoop &, ptrdiff_t res) mutable -> errno_t {
+				if (res <= 0) return res < 0 ? (errno_t)-res : EIO;
+				self.Remaining -= res;
+				if (self.Remaining) self.next();
+				else if (self.Done) self.Done->set();
+				return 0;
+			});
+		}
+	};
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	Stream{ el, sv[0], SEV_EVENT_LOOP_IO_SEND, &sendBuffer[0], block, total, null }.next();
+	Stream{ el, sv[1], SEV_EVENT_LOOP_IO_RECV, &recvBuffer[0], block, total, &done }.next();
+	done.wait();
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	const int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+	std::cout << "Socketpair: " << (total >> 20) << " MiB in " << us << " us, " << (total / std::max(us, (int64_t)1)) << " MB/s\n";
+	SEV_EventLoop_unwatch(el, sv[0]);
+	SEV_EventLoop_unwatch(el, sv[1]);
+	close(sv[0]);
+	close(sv[1]);
+}
+
+void runAll(SEV_EventLoop *el)
+{
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		std::cout << "Error: " << SEV_Exception_errNo(*eh) << "\n";
+	};
+	sev::FunctorVt<void(SEV_ExceptionHandle *)> onErrorVt(onError);
+	const int threads = std::max(2, (int)std::thread::hardware_concurrency());
+	for (int i = 0; i < threads; ++i)
+		SEV_EventLoop_run(el, onErrorVt.get(), &onError, onErrorVt.get()->CopyConstructor);
+	testPingPong(el);
+	testPipe(el);
+	testHangUp(el);
+	testTimeout(el);
+	testAccept(el);
+	benchFile(el);
+	benchSocket(el);
+	SEV_EventLoop_destroy(el);
+}
+
+}
+
+int main()
+{
+	std::cout << "Fallback\n";
+	runAll(SEV_EventLoop_create());
+	bool ioUring;
+	SEV_EventLoop *el = SEV_EventLoop_createIoUring(256, &ioUring);
+	if (ioUring)
+	{
+		std::cout << "io_uring\n";
+		runAll(el);
+	}
+	else
+	{
+		std::cout << "io_uring not available\n";
+		SEV_EventLoop_destroy(el);
+	}
+	return EXIT_SUCCESS;
+}
+
+/* end of file */
@@ -0,0 +1,369 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/concurrent_functor_queue.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <vector>
+#include <stdexcept>
+
+/*
+
+Regression tests for the concurrent functor queue.
+Capacity limits, and the blocking and callback push modes.
+Entry layout, push timestamps, and entries spanning several blocks.
+Batch pushes, and the entries skipped when a constructor throws.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+typedef sev::ConcurrentFunctorQueue<void()> Queue;
+
+template<typename TFn>
+errno_t pushWait(Queue &q, TFn &&f, int timeoutMs)
+{
+	static const sev::FunctorVt<void()> vt(f);
+	return SEV_ConcurrentFunctorQueue_pushFunctorWait(q.get(), vt.get(), &f, vt.get()->CopyConstructor, timeoutMs);
+}
+
+template<typename TFn>
+errno_t notifySpace(Queue &q, TFn &&f)
+{
+	static const sev::FunctorVt<void()> vt(f);
+	return SEV_ConcurrentFunctorQueue_notifySpaceFunctor(q.get(), vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+// Arguments for a batch of copies of entries, which must outlive it
+struct Batch
+{
+	std::vector<const SEV_FunctorVt *> Vts;
+	std::vector<void *> Ptrs;
+	std::vector<void(*)(void *ptr, void *other)> Ctors;
+
+	template<typename T>
+	Batch(std::vector<T> &entries, const SEV_FunctorVt *vt) : Vts(entries.size(), vt), Ctors(entries.size(), vt->CopyConstructor)
+	{
+		for (T &e : entries) Ptrs.push_back(&e);
+	}
+
+	errno_t push(Queue &q, ptrdiff_t count, ptrdiff_t *pushed)
+	{
+		return SEV_ConcurrentFunctorQueue_pushFunctors(q.get(), count, Vts.data(), Ptrs.data(), Ctors.data(), pushed);
+	}
+
+};
+
+bool popOne(Queue &q)
+{
+	bool success;
+	q.tryCallAndPop(success);
+	return success;
+}
+
+void testCapacityEntries()
+{
+	std::cout << "Capacity in entries\n";
+	Queue q;
+	int n = 0;
+	auto f = [&n]() { ++n; };
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 3, false);
+	check(!q.push(std::nothrow, f) && !q.push(std::nothrow, f) && !q.push(std::nothrow, f), "pushes up to the capacity succeed");
+	check(q.push(std::nothrow, f) == EAGAIN, "push past the capacity returns EAGAIN");
+	check(SEV_ConcurrentFunctorQueue_used(q.get(), false) == 3, "used counts the queued entries");
+	check(popOne(q) && n == 1, "pop runs the first entry");
+	check(!q.push(std::nothrow, f), "push succeeds again after a pop");
+	check(!q.pushUnbounded(std::nothrow, [&n]() { ++n; }), "unbounded push goes past the capacity");
+	check(SEV_ConcurrentFunctorQueue_used(q.get(), false) == 4, "unbounded push is still counted");
+	while (popOne(q));
+	check(n == 5, "all entries ran");
+	check(!SEV_ConcurrentFunctorQueue_used(q.get(), false) && !SEV_ConcurrentFunctorQueue_used(q.get(), true), "used drops back to zero");
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 0, false);
+	for (int i = 0; i < 100; ++i) q.push(std::nothrow, f);
+	check(!q.push(std::nothrow, f), "capacity 0 removes the limit");
+	while (popOne(q));
+
+	// Set on a non-empty queue, the entries queued before don't offset the ones counted after
+	Queue r;
+	for (int i = 0; i < 5; ++i) r.push(std::nothrow, f);
+	SEV_ConcurrentFunctorQueue_setCapacity(r.get(), 4, false);
+	check(!SEV_ConcurrentFunctorQueue_used(r.get(), false), "entries queued before the capacity aren't counted");
+	check(!r.push(std::nothrow, f) && !r.push(std::nothrow, f), "pushes after the capacity is set");
+	for (int i = 0; i < 5; ++i) popOne(r);
+	check(SEV_ConcurrentFunctorQueue_used(r.get(), false) == 2, "popping the earlier entries leaves the later ones counted");
+	check(!r.push(std::nothrow, f) && !r.push(std::nothrow, f) && r.push(std::nothrow, f) == EAGAIN, "the capacity still holds");
+	while (popOne(r));
+	check(!SEV_ConcurrentFunctorQueue_used(r.get(), false) && !SEV_ConcurrentFunctorQueue_used(r.get(), true), "used drops back to zero");
+}
+
+void testCapacityBytes()
+{
+	std::cout << "Capacity in bytes\n";
+	Queue q;
+	int n = 0;
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 256, true);
+	int pushed = 0;
+	while (!q.push(std::nothrow, [&n]() { ++n; }))
+		++pushed;
+	check(pushed > 0 && SEV_ConcurrentFunctorQueue_used(q.get(), true) <= 256, "bytes stay within the capacity");
+	while (popOne(q));
+	check(n == pushed, "all entries ran");
+
+	// A single entry larger than the capacity still goes into an empty queue, otherwise it could never be pushed
+	struct Large { char Data[512]; void operator()() { } } large = { };
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 64, true);
+	check(!q.push(std::nothrow, large), "oversize entry goes into an empty queue");
+	check(q.push(std::nothrow, large) == EAGAIN, "second oversize entry is refused");
+	check(q.push(std::nothrow, [&n]() { ++n; }) == EAGAIN, "small entry behind it is refused");
+	while (popOne(q));
+	check(!q.push(std::nothrow, large), "oversize entry goes in again once drained");
+	while (popOne(q));
+}
+
+void testPushWait()
+{
+	std::cout << "Blocking push\n";
+	Queue q;
+	std::atomic_int n = 0;
+	auto f = [&n]() { ++n; };
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 1, false);
+	q.push(std::nothrow, f);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	check(pushWait(q, f, 30) == ETIMEDOUT, "full queue times out");
+	check(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(30), "after the timeout");
+	std::thread popper([&q]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		popOne(q);
+	});
+	check(!pushWait(q, f, -1), "push waits until a pop makes space");
+	popper.join();
+	check(n == 1 && SEV_ConcurrentFunctorQueue_used(q.get(), false) == 1, "waiting entry was queued");
+	std::thread raiser([&q]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 2, false);
+	});
+	check(!pushWait(q, f, 1000), "raising the capacity wakes a waiting push");
+	raiser.join();
+	while (popOne(q));
+}
+
+void testNotifySpace()
+{
+	std::cout << "Callback on space\n";
+	Queue q;
+	int n = 0;
+	int notified = 0;
+	auto f = [&n]() { ++n; };
+	auto onSpace = [&notified]() { ++notified; };
+	check(!notifySpace(q, onSpace) && notified == 1, "unbounded queue calls right away");
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 2, false);
+	check(!notifySpace(q, onSpace) && notified == 2, "queue with space calls right away");
+	q.push(std::nothrow, f);
+	q.push(std::nothrow, f);
+	check(!notifySpace(q, onSpace) && notified == 2, "full queue registers the callback");
+	check(popOne(q) && notified == 3, "pop making space calls it");
+	check(popOne(q) && notified == 3, "called only once");
+}
+
+void testTimestamps()
+{
+	std::cout << "Push timestamps\n";
+	sev::ConcurrentFunctorQueue<int()> q;
+	sev::ExceptionHandle eh;
+	bool success;
+	const SEV_FunctorVt *vt;
+	int64_t pushed = -1, started = -1;
+	auto onStart = [](const SEV_FunctorVt *, int64_t) { };
+	struct Aligned { int Value; int operator()() { return ((uintptr_t)this % SEV_FUNCTOR_ALIGN) ? -1 : Value; } };
+	q.push(std::nothrow, Aligned{ 1 });
+	int res = q.tryCallAndPop(eh, success, vt, pushed, started, onStart);
+	check(success && res == 1 && !eh.raised(), "entry is aligned to SEV_FUNCTOR_ALIGN");
+	check(!pushed && started, "no push ticks without the flag");
+	SEV_ConcurrentFunctorQueue_setFlags(q.get(), SEV_CONCURRENT_FUNCTOR_QUEUE_TIMESTAMP);
+	int64_t before = SEV_Clock_ticks();
+	q.push(std::nothrow, Aligned{ 2 });
+	int64_t after = SEV_Clock_ticks();
+	res = q.tryCallAndPop(eh, success, vt, pushed, started, onStart);
+	check(success && res == 2, "timestamped entry is aligned too");
+	check(pushed >= before && pushed <= after, "push ticks are taken at the push");
+	check(started >= pushed, "start ticks follow the push ticks");
+	SEV_ConcurrentFunctorQueue_setFlags(q.get(), 0);
+	q.push(std::nothrow, Aligned{ 3 });
+	res = q.tryCallAndPop(eh, success, vt, pushed, started, onStart);
+	check(success && res == 3 && !pushed, "clearing the flag stops the ticks");
+	res = q.tryCallAndPop(eh, success, vt, pushed, started, onStart);
+	check(!success && !res && !eh.raised(), "empty queue pops nothing");
+}
+
+template<size_t TSize>
+struct Payload
+{
+	int Seq;
+	unsigned char Data[TSize];
+	int *Next;
+	int *Bad;
+
+	Payload(int seq, int *next, int *bad) : Seq(seq), Next(next), Bad(bad) { memset(Data, (unsigned char)seq, TSize); }
+
+	void operator()()
+	{
+		if (Seq != *Next) ++*Bad;
+		for (size_t i = 0; i < TSize; ++i)
+			if (Data[i] != (unsigned char)Seq) { ++*Bad; break; }
+		++*Next;
+	}
+};
+
+errno_t pushPayload(Queue &q, int seq, int *next, int *bad)
+{
+	switch (seq % 4)
+	{
+	case 0: return q.push(std::nothrow, Payload<8>(seq, next, bad));
+	case 1: return q.push(std::nothrow, Payload<200>(seq, next, bad));
+	case 2: return q.push(std::nothrow, Payload<1000>(seq, next, bad));
+	default: return q.push(std::nothrow, Payload<3000>(seq, next, bad));
+	}
+}
+
+void testBlockWrap()
+{
+	std::cout << "Entries spanning blocks\n";
+	Queue q(4096);
+	int next = 0, bad = 0, seq = 0;
+	bool pushOk = true;
+	for (; seq < 200; ++seq) pushOk = pushOk && !pushPayload(q, seq, &next, &bad);
+	check(pushOk, "pushes into small blocks succeed");
+	for (int i = 0; i < 150; ++i) popOne(q);
+	check(next == 150 && !bad, "pops run in order with the data intact");
+	for (; seq < 1000; ++seq)
+	{
+		pushOk = pushOk && !pushPayload(q, seq, &next, &bad);
+		if (seq % 3) popOne(q);
+	}
+	check(pushOk, "interleaved pushes reuse the drained blocks");
+	while (popOne(q));
+	check(next == 1000 && !bad, "all entries ran once in order");
+	check(!SEV_ConcurrentFunctorQueue_used(q.get(), false) && !SEV_ConcurrentFunctorQueue_used(q.get(), true), "used drops back to zero");
+}
+
+// Copy constructor throws for the entry with value Throw
+struct Throwing
+{
+	static int Throw;
+	int Value;
+	int *Sum;
+
+	Throwing(int value, int *sum) : Value(value), Sum(sum) { }
+	Throwing(const Throwing &other) : Value(other.Value), Sum(other.Sum) { if (Value == Throw) throw std::runtime_error("copy"); }
+	void operator()() { *Sum += Value; }
+};
+
+int Throwing::Throw = -1;
+
+void testPushFunctors()
+{
+	std::cout << "Batch push\n";
+	Queue q;
+	int sum = 0;
+	std::vector<Throwing> entries;
+	for (int i = 0; i < 20; ++i) entries.emplace_back(i, &sum);
+	static const sev::FunctorVt<void()> vt(entries[0]);
+	Batch batch(entries, vt.get());
+
+	ptrdiff_t pushed = -1;
+	check(!batch.push(q, 20, &pushed) && pushed == 20, "push a batch");
+	int popped = 0;
+	while (popOne(q)) ++popped;
+	check(popped == 20 && sum == 190, "batch pops in one go");
+
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 64, false);
+	Throwing::Throw = 13;
+	sum = 0;
+	errno_t res = batch.push(q, 20, &pushed);
+	Throwing::Throw = -1;
+	check(res == EOTHER && pushed == 13, "throwing constructor stops the batch");
+	check(SEV_ConcurrentFunctorQueue_used(q.get(), false) == 20, "skipped entries hold their capacity until popped");
+	check(!q.push(std::nothrow, entries[19]), "push after the skipped entries");
+	popped = 0;
+	while (popOne(q)) ++popped;
+	check(popped == 14 && sum == 78 + 19, "pops skip the entries which weren't constructed");
+	check(!SEV_ConcurrentFunctorQueue_used(q.get(), false) && !SEV_ConcurrentFunctorQueue_used(q.get(), true), "used drops back to zero");
+
+	SEV_ConcurrentFunctorQueue_setCapacity(q.get(), 16, false);
+	check(!batch.push(q, 10, &pushed) && pushed == 10, "batch within the capacity goes in");
+	check(batch.push(q, 10, &pushed) == EAGAIN && !pushed, "batch past the capacity is refused whole");
+	check(!batch.push(q, 6, &pushed) && pushed == 6, "batch up to the capacity goes in");
+	check(SEV_ConcurrentFunctorQueue_used(q.get(), false) == 16, "used counts the batches");
+	while (popOne(q));
+	check(!SEV_ConcurrentFunctorQueue_pushFunctors(q.get(), 0, null, null, null, &pushed) && !pushed, "empty batch does nothing");
+}
+
+void testPushFunctorsBlocks()
+{
+	std::cout << "Batch push spanning blocks\n";
+	Queue q(4096);
+	int next = 0, bad = 0;
+	std::vector<Payload<1000>> entries;
+	for (int i = 0; i < 100; ++i) entries.emplace_back(i, &next, &bad);
+	static const sev::FunctorVt<void()> vt(entries[0]);
+	Batch batch(entries, vt.get());
+	ptrdiff_t pushed = -1;
+	check(!batch.push(q, 100, &pushed) && pushed == 100, "batch larger than a block goes in");
+	while (popOne(q));
+	check(next == 100 && !bad, "entries run in order with the data intact");
+}
+
+}
+
+int main()
+{
+	testCapacityEntries();
+	testCapacityBytes();
+	testPushWait();
+	testNotifySpace();
+	testTimestamps();
+	testBlockWrap();
+	testPushFunctors();
+	testPushFunctorsBlocks();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
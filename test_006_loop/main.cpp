@@ -0,0 +1,1128 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/event_loop.h>
+#include <sev/clock.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <memory>
+#include <cstring>
+#include <cstddef>
+#include <stdexcept>
+
+/*
+
+Regression tests for the event loop.
+Each test creates its own loop, so the settings of one don't leak into the next.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+template<typename TFn>
+errno_t post(SEV_EventLoop *el, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_postFunctor(el, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+template<typename TFn>
+errno_t postWait(SEV_EventLoop *el, TFn &&f, int timeoutMs)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_postFunctorWait(el, vt.get(), &f, vt.get()->CopyConstructor, timeoutMs);
+}
+
+template<typename TFn>
+errno_t postUnbounded(SEV_EventLoop *el, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_postFunctorUnbounded(el, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+template<typename TFn, typename TExpired>
+errno_t postWithDeadline(SEV_EventLoop *el, int64_t deadlineNs, TFn &&f, TExpired &&expired)
+{
+	static const sev::EventFunctorVt vt(f);
+	static const sev::EventFunctorVt expiredVt(expired);
+	return SEV_EventLoop_postWithDeadlineFunctor(el, deadlineNs, vt.get(), &f, vt.get()->CopyConstructor, expiredVt.get(), &expired, expiredVt.get()->CopyConstructor);
+}
+
+template<typename TFn>
+errno_t postWithDeadline(SEV_EventLoop *el, int64_t deadlineNs, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_postWithDeadlineFunctor(el, deadlineNs, vt.get(), &f, vt.get()->CopyConstructor, null, null, null);
+}
+
+template<typename TFn>
+errno_t timeout(SEV_EventLoop *el, TFn &&f, int timeoutMs)
+{
+	static const sev::EventFunctorVt vt(f);
+	return SEV_EventLoop_timeoutFunctor(el, vt.get(), &f, vt.get()->CopyConstructor, timeoutMs);
+}
+
+// Run f on the loop and wait for it, returns the handle of what it raised
+template<typename TFn>
+SEV_ExceptionHandle invoke(SEV_EventLoop *el, TFn &&f)
+{
+	static const sev::EventFunctorVt vt(f);
+	SEV_ExceptionHandle eh = null;
+	SEV_EventLoop_invokeFunctor(el, &eh, vt.get(), &f);
+	return eh;
+}
+
+template<typename TFn>
+errno_t notifySpace(SEV_EventLoop *el, TFn &&f)
+{
+	static const sev::FunctorVt<void()> vt(f);
+	return SEV_EventLoop_notifySpaceFunctor(el, vt.get(), &f, vt.get()->CopyConstructor);
+}
+
+// Poll until done returns true, for up to two seconds
+template<typename TFn>
+bool waitFor(TFn &&done)
+{
+	for (int i = 0; i < 2000; ++i)
+	{
+		if (done()) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return done();
+}
+
+// Arguments for a batch of copies of entries, which must outlive it
+struct Batch
+{
+	std::vector<const SEV_FunctorVt *> Vts;
+	std::vector<void *> Ptrs;
+	std::vector<void(*)(void *ptr, void *other)> Ctors;
+
+	template<typename T>
+	Batch(std::vector<T> &entries, const SEV_FunctorVt *vt) : Vts(entries.size(), vt), Ctors(entries.size(), vt->CopyConstructor)
+	{
+		for (T &e : entries) Ptrs.push_back(&e);
+	}
+
+	errno_t post(SEV_EventLoop *el, ptrdiff_t count, ptrdiff_t *posted)
+	{
+		return SEV_EventLoop_postBatch(el, count, Vts.data(), Ptrs.data(), Ctors.data(), posted);
+	}
+
+};
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop(int threads = 1)
+	{
+		El = SEV_EventLoop_create();
+		for (int i = 0; i < threads; ++i)
+			run();
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	errno_t run(const SEV_EventLoopRunOptions *options = null)
+	{
+		auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+			++*errors;
+			SEV_Exception_discardEx(*eh);
+			*eh = null;
+		};
+		static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+		return SEV_EventLoop_runEx(El, vt.get(), &onError, vt.get()->CopyConstructor, options);
+	}
+
+	// Run f on the loop and wait for it, past any capacity set by the test
+	template<typename TFn>
+	void sync(TFn &&f)
+	{
+		sev::EventFlag done;
+		postUnbounded(El, [&](sev::EventLoop &el) -> errno_t {
+			f(el);
+			done.set();
+			return 0;
+		});
+		done.wait();
+	}
+
+	// Wait for everything posted before to run, on a single worker
+	void drain()
+	{
+		sync([](sev::EventLoop &) { });
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+void testQueueCapacity()
+{
+	std::cout << "Queue capacity\n";
+	Loop loop;
+	std::atomic_int ran = 0;
+	auto work = [&ran](sev::EventLoop &) -> errno_t { ++ran; return 0; };
+	check(!SEV_EventLoop_setQueueCapacity(loop.El, 4, false), "set capacity");
+	sev::EventFlag started, gate;
+	post(loop.El, [&](sev::EventLoop &) -> errno_t {
+		started.set();
+		gate.wait();
+		return 0;
+	});
+	started.wait(); // The only worker is blocked, nothing gets popped
+	int accepted = 0;
+	errno_t eno = 0;
+	while (!(eno = post(loop.El, work)))
+		++accepted;
+	check(accepted == 4 && eno == EAGAIN, "posts past the capacity return EAGAIN");
+	check(SEV_EventLoop_queueUsed(loop.El, false) == 4, "queue used counts the posts");
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	check(postWait(loop.El, work, 20) == ETIMEDOUT, "waiting post times out while full");
+	check(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20), "after the timeout");
+	std::atomic_int notified = 0;
+	std::thread::id notifiedOn;
+	check(!notifySpace(loop.El, [&]() { notifiedOn = std::this_thread::get_id(); ++notified; }) && !notified, "notify registers while full");
+	check(!postUnbounded(loop.El, work), "unbounded post goes past the capacity");
+	std::thread::id loopThread;
+	check(!SEV_EventLoop_resume(loop.El, [](void *) { }, null), "resume goes past the capacity");
+	std::thread producer([&]() {
+		for (int i = 0; i < 100; ++i)
+			if (postWait(loop.El, work, -1)) ++loop.Errors;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	gate.set();
+	producer.join();
+	loop.sync([&](sev::EventLoop &) { loopThread = std::this_thread::get_id(); });
+	check(ran == 105, "every accepted post ran");
+	check(notified == 1 && notifiedOn == loopThread, "notify ran once, on the loop thread");
+	check(!SEV_EventLoop_queueUsed(loop.El, false), "queue used drops back to zero");
+	check(!loop.Errors, "no errors");
+
+	// The callback is posted behind the queued entries, rather than run ahead of the entry whose pop made space
+	sev::EventFlag orderStarted, orderGate, notifiedFlag;
+	Loop order;
+	check(!SEV_EventLoop_setQueueCapacity(order.El, 3, false), "set capacity");
+	post(order.El, [&](sev::EventLoop &) -> errno_t {
+		orderStarted.set();
+		orderGate.wait();
+		return 0;
+	});
+	orderStarted.wait();
+	ran = 0;
+	while (!post(order.El, work));
+	int ranBefore = -1;
+	check(!notifySpace(order.El, [&]() { ranBefore = ran; notifiedFlag.set(); }), "notify registers while full");
+	orderGate.set();
+	notifiedFlag.wait();
+	check(ranBefore == 3, "notify ran after the entries queued ahead of it");
+	check(!order.Errors, "no errors");
+}
+
+void testDeadline()
+{
+	std::cout << "Post with a deadline\n";
+	Loop loop;
+	const SEV_EventLoopBudget budget{ 1, 0, 0 }; // Refresh the loop clock after the blocked task
+	check(!SEV_EventLoop_setBudget(loop.El, &budget), "set the task budget");
+	sev::EventFlag started, gate;
+	post(loop.El, [&](sev::EventLoop &) -> errno_t {
+		started.set();
+		gate.wait();
+		return 0;
+	});
+	started.wait(); // Entries wait behind the blocked worker
+	std::shared_ptr<int> tracked = std::make_shared<int>(0);
+	std::atomic_int handled = 0, expired = 0;
+	std::array<char, 200> large; // Larger than the inline functor storage
+	large.fill('x');
+	const int64_t now = SEV_Clock_steadyNs();
+	const int64_t late = now + 5 * 1000 * 1000;
+	const int64_t far = now + 60LL * 1000 * 1000 * 1000;
+	auto handler = [&handled, tracked](sev::EventLoop &) -> errno_t { ++handled; return 0; };
+	auto onExpired = [&expired, tracked](sev::EventLoop &) -> errno_t { ++expired; return 0; };
+	const long held = tracked.use_count();
+	bool intact = false;
+	check(!postWithDeadline(loop.El, late, handler, onExpired), "post expiring soon");
+	check(!postWithDeadline(loop.El, late, handler), "post expiring soon without expired functor");
+	check(!postWithDeadline(loop.El, far, [&, large, tracked](sev::EventLoop &) -> errno_t {
+		intact = std::all_of(large.begin(), large.end(), [](char c) -> bool { return c == 'x'; });
+		++handled;
+		return 0;
+	}, onExpired), "post with a large capture and a far deadline");
+	check(tracked.use_count() == held + 5, "captures are held by the queued entries");
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	gate.set();
+	loop.drain();
+	SEV_EventLoopCounters counters;
+	check(!SEV_EventLoop_counters(loop.El, &counters), "counters");
+	check(handled == 1 && intact, "the entry within its deadline ran its handler with its capture");
+	check(expired == 1, "the expired functor ran for the expired entry");
+	check(counters.Shed == 2, "both expired entries count as shed");
+	check(tracked.use_count() == held, "every entry was destroyed");
+	sev::EventFlag done;
+	intact = false;
+	loop.sync([&](sev::EventLoop &el) {
+		// From the loop thread, the entry is kept on the worker and relocated by the next post
+		postWithDeadline(&el, far, [&, large, tracked](sev::EventLoop &) -> errno_t {
+			intact = std::all_of(large.begin(), large.end(), [](char c) -> bool { return c == 'x'; });
+			return 0;
+		}, onExpired);
+		post(&el, [&](sev::EventLoop &) -> errno_t {
+			done.set();
+			return 0;
+		});
+	});
+	done.wait();
+	loop.drain();
+	check(intact && tracked.use_count() == held, "an entry relocated off the worker keeps its capture");
+	check(!loop.Errors, "no errors");
+}
+
+std::atomic_int s_CallsIntact = 0;
+
+// The data starts with its own size, the remainder is a pattern derived from it
+errno_t checkCallData(void *ptr, SEV_EventLoop *)
+{
+	if ((uintptr_t)ptr % alignof(std::max_align_t))
+		return 0; // Copies are aligned like malloc
+	ptrdiff_t size;
+	memcpy(&size, ptr, sizeof(size));
+	const unsigned char *data = (const unsigned char *)ptr;
+	for (ptrdiff_t i = sizeof(size); i < size; ++i)
+		if (data[i] != (unsigned char)(i * 7 + size))
+			return 0;
+	++s_CallsIntact;
+	return 0;
+}
+
+// Copy of the data where all but the first bytes have changed, a call which sees it wasn't given a copy
+template<typename TPost>
+errno_t postCallData(ptrdiff_t size, const TPost &post)
+{
+	std::vector<unsigned char> data(size);
+	memcpy(data.data(), &size, sizeof(size));
+	for (ptrdiff_t i = sizeof(size); i < size; ++i)
+		data[i] = (unsigned char)(i * 7 + size);
+	errno_t res = post(data.data(), size);
+	std::fill(data.begin() + sizeof(size), data.end(), 0);
+	return res;
+}
+
+errno_t postCallData(SEV_EventLoop *el, ptrdiff_t size)
+{
+	return postCallData(size, [el](void *ptr, ptrdiff_t size) -> errno_t { return SEV_EventLoop_post(el, checkCallData, ptr, size); });
+}
+
+void testCallData()
+{
+	std::cout << "Post with copied data\n";
+	Loop loop;
+	const ptrdiff_t sizes[] = { 8, 40, 41, 64, 100, 1000, 4096, 5000, 20000, 32 * 1024, 40000 };
+	const int count = (int)(sizeof(sizes) / sizeof(sizes[0]));
+	SEV_EventLoopBudget budget{ 256, 64, 16 };
+	check(!SEV_EventLoop_setBudget(loop.El, &budget), "set budget with local chain");
+	s_CallsIntact = 0;
+	for (ptrdiff_t size : sizes)
+		if (postCallData(loop.El, size)) ++loop.Errors;
+	loop.drain();
+	check(s_CallsIntact == count, "data posted from another thread arrives intact");
+	s_CallsIntact = 0;
+	loop.sync([&](sev::EventLoop &el) {
+		// From the loop thread, small entries are kept on the worker and relocated by the next post
+		for (ptrdiff_t size : sizes)
+			if (postCallData(&el, size)) ++loop.Errors;
+	});
+	loop.drain();
+	check(s_CallsIntact == count, "data kept on the worker or relocated arrives intact");
+	s_CallsIntact = 0;
+	for (ptrdiff_t size : sizes)
+	{
+		if (postCallData(size, [&loop](void *ptr, ptrdiff_t size) -> errno_t { return SEV_EventLoop_timeout(loop.El, checkCallData, ptr, size, 1); }))
+			++loop.Errors;
+	}
+	check(waitFor([count]() -> bool { return s_CallsIntact == count; }), "data copied into timers arrives intact");
+	check(!loop.Errors, "no errors");
+}
+
+struct Chain
+{
+	std::vector<int> *Order;
+	sev::EventFlag *Done;
+	int Next;
+	int Count;
+
+	errno_t operator()(sev::EventLoop &el)
+	{
+		Order->push_back(Next);
+		if (Next + 1 == Count)
+		{
+			Done->set();
+			return 0;
+		}
+		return post(&el, Chain{ Order, Done, Next + 1, Count });
+	}
+
+};
+
+void testLocalChain()
+{
+	std::cout << "Local chain\n";
+	Loop loop;
+	SEV_EventLoopBudget budget{ 256, 64, 8 };
+	check(!SEV_EventLoop_setBudget(loop.El, &budget), "set budget with local chain");
+	std::vector<int> order;
+	sev::EventFlag done;
+	std::atomic_int ran = 0;
+	auto work = [&ran](sev::EventLoop &) -> errno_t { ++ran; return 0; };
+	check(!post(loop.El, Chain{ &order, &done, 0, 1000 }), "post chain");
+	for (int i = 0; i < 100; ++i)
+		if (post(loop.El, work)) ++loop.Errors; // Interleaved through the shared queue as the chain flushes
+	done.wait();
+	loop.drain();
+	bool ordered = order.size() == 1000;
+	for (int i = 0; ordered && i < 1000; ++i)
+		ordered = order[i] == i;
+	check(ordered, "self-posts past the chain length run in order");
+	check(ran == 100, "shared posts ran alongside");
+	check(!SEV_EventLoop_queueUsed(loop.El, false), "nothing left queued");
+	check(!SEV_EventLoop_setQueueCapacity(loop.El, 2, false), "set capacity");
+	errno_t results[3] = { };
+	loop.sync([&](sev::EventLoop &el) {
+		// Bounded posts aren't kept on the worker while the queue has a capacity
+		for (errno_t &res : results)
+			res = post(&el, work);
+	});
+	loop.drain();
+	check(!results[0] && !results[1] && results[2] == EAGAIN, "posts from the loop thread are held to the capacity");
+	check(ran == 102, "accepted posts ran");
+	check(!loop.Errors, "no errors");
+}
+
+template<typename TFn>
+errno_t parallelFor(SEV_EventLoop *el, ptrdiff_t from, ptrdiff_t to, ptrdiff_t grain, TFn &&f)
+{
+	static const sev::ParallelFunctorVt vt(f);
+	SEV_ExceptionHandle eh = null;
+	SEV_EventLoop_parallelForFunctor(el, &eh, from, to, grain, vt.get(), &f);
+	if (!eh) return 0;
+	errno_t eno = SEV_Exception_errNo(eh);
+	SEV_Exception_discardEx(eh);
+	return eno;
+}
+
+void testParallelFor()
+{
+	std::cout << "Parallel for\n";
+	Loop loop(4);
+	const ptrdiff_t count = 100000;
+	std::vector<std::atomic_int> hits(count);
+	auto cover = [&hits](sev::EventLoop &, ptrdiff_t begin, ptrdiff_t end) -> errno_t {
+		for (ptrdiff_t i = begin; i < end; ++i)
+			++hits[i];
+		return 0;
+	};
+	auto coveredOnce = [&hits]() -> bool {
+		return std::all_of(hits.begin(), hits.end(), [](const std::atomic_int &h) -> bool { return h == 1; });
+	};
+	check(!parallelFor(loop.El, 0, count, 7, cover) && coveredOnce(), "from another thread, each index is covered exactly once");
+	for (std::atomic_int &h : hits) h = 0;
+	errno_t eno = -1;
+	loop.sync([&](sev::EventLoop &el) { eno = parallelFor(&el, 0, count, 7, cover); });
+	check(!eno && coveredOnce(), "from a loop thread, each index is covered exactly once");
+	std::atomic_int calls = 0;
+	eno = parallelFor(loop.El, 0, count, 10, [&calls](sev::EventLoop &, ptrdiff_t, ptrdiff_t) -> errno_t {
+		++calls;
+		return EDOM;
+	});
+	check(eno == EDOM, "the error is passed down");
+	check(calls <= 5, "no more ranges are handed out after the error");
+	std::atomic<ptrdiff_t> total = 0;
+	sev::EventFlag nested;
+	post(loop.El, [&](sev::EventLoop &el) -> errno_t {
+		errno_t res = parallelFor(&el, 0, 16, 1, [&total](sev::EventLoop &el, ptrdiff_t begin, ptrdiff_t end) -> errno_t {
+			for (ptrdiff_t i = begin; i < end; ++i)
+			{
+				errno_t res = parallelFor(&el, 0, 1000, 10, [&total](sev::EventLoop &, ptrdiff_t begin, ptrdiff_t end) -> errno_t {
+					total += end - begin;
+					return 0;
+				});
+				if (res) return res;
+			}
+			return 0;
+		});
+		if (!res) nested.set();
+		return res;
+	});
+	check(nested.wait(10000) && total == 16 * 1000, "nested parallel for completes without deadlock");
+	check(!loop.Errors, "no errors");
+
+	// An unrelated task queued ahead of the helpers fails while the caller waits on the loop thread
+	sev::EventFlag gate; // Outlives the loop, the worker may still be leaving the wait
+	Loop pair(2);
+	post(pair.El, [&gate](sev::EventLoop &) -> errno_t {
+		gate.wait(); // Keeps the second worker out of the way
+		return 0;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (std::atomic_int &h : hits) h = 0;
+	eno = -1;
+	pair.sync([&](sev::EventLoop &el) {
+		post(&el, [](sev::EventLoop &) -> errno_t { return EDOM; });
+		eno = parallelFor(&el, 0, count, 7, cover);
+	});
+	gate.set();
+	check(!eno && coveredOnce(), "an unrelated failure doesn't cancel the parallel for");
+	check(waitFor([&pair]() -> bool { return pair.Errors; }) && pair.Errors == 1, "the unrelated failure reaches the error handler of the loop");
+}
+
+// Poll the counters until done returns true or two seconds pass
+template<typename TFn>
+bool waitCounters(SEV_EventLoop *el, SEV_EventLoopCounters &counters, TFn &&done)
+{
+	return waitFor([&]() -> bool {
+		SEV_EventLoop_counters(el, &counters);
+		return done(counters);
+	});
+}
+
+void testElastic()
+{
+	std::cout << "Elastic workers\n";
+	Loop loop;
+	auto onError = [errors = &loop.Errors](SEV_ExceptionHandle *eh) -> void {
+		++*errors;
+		SEV_Exception_discardEx(*eh);
+		*eh = null;
+	};
+	static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+	SEV_EventLoopElastic elastic{ 0, 3, 2, 0, 50 };
+	check(SEV_EventLoop_setElastic(loop.El, &elastic, null, null, null) == EINVAL, "an error handler is required");
+	check(!SEV_EventLoop_setElastic(loop.El, &elastic, vt.get(), &onError, vt.get()->CopyConstructor), "set elastic");
+	sev::EventFlag gate(true);
+	std::atomic_int ran = 0;
+	for (int i = 0; i < 40; ++i)
+	{
+		post(loop.El, [&](sev::EventLoop &) -> errno_t {
+			gate.wait();
+			++ran;
+			return 0;
+		});
+	}
+	SEV_EventLoopCounters counters;
+	check(waitCounters(loop.El, counters, [](const SEV_EventLoopCounters &c) -> bool { return c.Workers == 4; }), "grows to the maximum on a backlog");
+	check(counters.ElasticStarted == 3, "started three elastic workers");
+	gate.set();
+	check(waitCounters(loop.El, counters, [](const SEV_EventLoopCounters &c) -> bool { return c.Workers == 1; }), "retires the elastic workers after idling");
+	check(ran == 40 && counters.ElasticRetired == 3, "every task ran and every elastic worker retired");
+	check(!SEV_EventLoop_setElastic(loop.El, null, null, null, null), "stop elastic");
+	check(!loop.Errors, "no errors");
+}
+
+void testWatchdog()
+{
+	std::cout << "Watchdog\n";
+	Loop loop;
+	std::atomic_int stalls = 0;
+	std::atomic_bool replaced = false;
+	std::atomic<int64_t> elapsedNs = 0;
+	auto onStall = [&](const SEV_EventLoopStall *stall) -> void {
+		elapsedNs = stall->ElapsedNs;
+		replaced = stall->Replaced;
+		++stalls;
+	};
+	static const sev::StallFunctorVt vt(onStall);
+	SEV_EventLoopWatchdog watchdog{ 20, 5, 1 };
+	check(!SEV_EventLoop_setWatchdog(loop.El, &watchdog, vt.get(), &onStall, vt.get()->CopyConstructor), "set watchdog");
+	sev::EventFlag gate, quick;
+	post(loop.El, [&](sev::EventLoop &) -> errno_t {
+		gate.wait(); // Sleeps past the threshold
+		return 0;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	post(loop.El, [&](sev::EventLoop &) -> errno_t {
+		quick.set();
+		return 0;
+	});
+	quick.wait(); // Only the replacement can run it
+	SEV_EventLoopCounters counters;
+	SEV_EventLoop_counters(loop.El, &counters);
+	check(stalls == 1 && replaced && elapsedNs >= 20 * 1000 * 1000, "the callback reports the stall once, with a replacement");
+	check(counters.Stalls == 1 && counters.Replacements == 1 && counters.Workers == 2, "counters include the stall and the replacement");
+	gate.set();
+	check(waitCounters(loop.El, counters, [](const SEV_EventLoopCounters &c) -> bool { return c.Workers == 1; }), "the replacement leaves once the stalled task returns");
+	check(!SEV_EventLoop_setWatchdog(loop.El, null, null, null, null), "stop watchdog");
+	check(!loop.Errors, "no errors");
+}
+
+void testLatencyStats()
+{
+	std::cout << "Latency stats\n";
+	Loop loop;
+	check(!SEV_EventLoop_setLatencyStats(loop.El, true), "enable latency stats");
+	loop.drain(); // Stats attach on the next iteration of the worker
+	std::atomic_int ran = 0;
+	for (int i = 0; i < 2000; ++i)
+	{
+		postUnbounded(loop.El, [&ran](sev::EventLoop &) -> errno_t {
+			++ran;
+			return 0;
+		});
+	}
+	for (int i = 0; i < 5; ++i)
+	{
+		postUnbounded(loop.El, [&ran](sev::EventLoop &) -> errno_t {
+			std::this_thread::sleep_for(std::chrono::milliseconds(20));
+			++ran;
+			return 0;
+		});
+	}
+	loop.drain();
+	SEV_EventLoopLatency wait, run;
+	check(!SEV_EventLoop_latencyStats(loop.El, -1, &wait, &run), "read the combined stats");
+	check(run.Count >= 2005 && wait.Count == run.Count, "every functor is counted once in both histograms");
+	check(run.P50Ns < 1000 * 1000 && run.P99Ns < 1000 * 1000, "quick functors set the median and the 99th percentile");
+	check(run.P999Ns >= 15 * 1000 * 1000 && run.MaxNs >= 20 * 1000 * 1000, "slow functors show in the tail");
+	check(run.P50Ns <= run.P99Ns && run.P99Ns <= run.P999Ns && run.P999Ns <= run.MaxNs, "percentiles are ordered");
+	check(wait.P50Ns <= wait.P99Ns && wait.P99Ns <= wait.P999Ns && wait.P999Ns <= wait.MaxNs, "wait percentiles are ordered");
+	SEV_EventLoopLatency slot;
+	check(!SEV_EventLoop_latencyStats(loop.El, 0, null, &slot) && slot.Count == run.Count, "single worker owns slot 0");
+	check(SEV_EventLoop_latencyStats(loop.El, 99, &wait, &run) == ERANGE, "unknown slot returns ERANGE");
+	check(ran == 2005 && !loop.Errors, "all functors ran");
+}
+
+struct Heavy
+{
+	std::atomic_int *Ran;
+
+	errno_t operator()(sev::EventLoop &)
+	{
+		volatile double x = 0;
+		for (int i = 0; i < 20000; ++i) x = x + i * 0.5;
+		++*Ran;
+		return 0;
+	}
+};
+
+struct Light
+{
+	std::atomic_int *Ran;
+
+	errno_t operator()(sev::EventLoop &)
+	{
+		++*Ran;
+		return 0;
+	}
+};
+
+const SEV_EventLoopProfileEntry *findProfile(const std::vector<SEV_EventLoopProfileEntry> &entries, const char *name)
+{
+	for (const SEV_EventLoopProfileEntry &e : entries)
+		if (e.Vt && strstr(e.Name, name))
+			return &e;
+	return null;
+}
+
+void testProfile()
+{
+	std::cout << "Profile\n";
+	Loop loop;
+	check(SEV_EventLoop_setProfiling(loop.El, -1) == EINVAL, "negative interval is refused");
+	check(!SEV_EventLoop_setProfiling(loop.El, 4), "sample one in four");
+	loop.drain();
+	std::atomic_int ran = 0;
+	for (int i = 0; i < 400; ++i) postUnbounded(loop.El, Heavy{ &ran });
+	for (int i = 0; i < 4000; ++i) postUnbounded(loop.El, Light{ &ran });
+	loop.drain();
+	check(ran == 4400, "all functors ran");
+	std::vector<SEV_EventLoopProfileEntry> entries(16);
+	int count = (int)entries.size();
+	check(!SEV_EventLoop_profile(loop.El, entries.data(), &count) && count >= 2, "read the profile");
+	entries.resize(count);
+	const SEV_EventLoopProfileEntry *heavy = findProfile(entries, "Heavy");
+	const SEV_EventLoopProfileEntry *light = findProfile(entries, "Light");
+	int64_t samples = heavy ? heavy->Samples : 0;
+	check(heavy && light, "entries are named by the callable type");
+	check(heavy == &entries[0], "most expensive type comes first");
+	check(heavy && heavy->Samples > 50 && heavy->Count >= 300 && heavy->Count <= 500, "calls are estimated from the samples");
+	check(light && light->Count >= 3500 && light->Count <= 4500, "cheap calls are estimated the same way");
+	check(heavy && light && heavy->CpuNs > light->CpuNs && heavy->MaxNs > 0, "cpu time follows the work");
+	count = 1;
+	check(!SEV_EventLoop_profile(loop.El, entries.data(), &count) && count == 1, "count caps the entries written");
+
+	ptrdiff_t len = SEV_EventLoop_profileReport(loop.El, 5, null, 0);
+	std::vector<char> report(len + 1);
+	check(SEV_EventLoop_profileReport(loop.El, 5, report.data(), len + 1) == len && (ptrdiff_t)strlen(report.data()) == len, "report fits in the queried length");
+	check(strstr(report.data(), "Heavy") && strstr(report.data(), "Light"), "report lists the types");
+	char small[16];
+	memset(small, 'x', sizeof(small));
+	check(SEV_EventLoop_profileReport(loop.El, 5, small, sizeof(small)) == len && strlen(small) == sizeof(small) - 1, "short buffer is truncated and terminated");
+	ptrdiff_t header = SEV_EventLoop_profileReport(loop.El, 0, null, 0);
+	check(header > 0 && header < len, "top 0 gives only the header");
+
+	check(!SEV_EventLoop_setProfiling(loop.El, 0), "stop profiling");
+	loop.drain();
+	for (int i = 0; i < 100; ++i) postUnbounded(loop.El, Heavy{ &ran });
+	loop.drain();
+	count = (int)entries.size();
+	SEV_EventLoop_profile(loop.El, entries.data(), &count);
+	heavy = findProfile(entries, "Heavy");
+	check(heavy && heavy->Samples == samples, "samples are kept and no longer taken");
+	check(!loop.Errors, "no errors");
+}
+
+// Hold the worker while the queue and the timers fill up, then let it take them in turns
+template<typename TWork, typename TTick>
+void queueBehindGate(Loop &loop, TWork &work, TTick &tick)
+{
+	sev::EventFlag gate;
+	post(loop.El, [&gate](sev::EventLoop &) -> errno_t {
+		gate.wait();
+		return 0;
+	});
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	for (int i = 0; i < 100; ++i) post(loop.El, work);
+	for (int i = 0; i < 20; ++i) timeout(loop.El, tick, 1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	gate.set();
+	loop.drain();
+}
+
+void testBudget()
+{
+	std::cout << "Budget\n";
+	std::atomic_int ran = 0, fired = 0;
+	auto work = [&ran](sev::EventLoop &) -> errno_t { ++ran; return 0; };
+	auto tick = [&fired](sev::EventLoop &) -> errno_t { ++fired; return 0; };
+	SEV_EventLoopCounters counters;
+	{
+		Loop loop;
+		SEV_EventLoopBudget invalid{ -1, 0, 0 };
+		check(SEV_EventLoop_setBudget(loop.El, null) == EINVAL && SEV_EventLoop_setBudget(loop.El, &invalid) == EINVAL, "invalid budgets are refused");
+		SEV_EventLoopBudget budget{ 4, 4, 0 };
+		check(!SEV_EventLoop_setBudget(loop.El, &budget), "set budget");
+		queueBehindGate(loop, work, tick);
+		waitFor([&fired]() -> bool { return fired == 20; });
+		SEV_EventLoop_counters(loop.El, &counters);
+		check(ran == 100 && fired == 20, "all functors and timers ran");
+		check(counters.TaskBudgetHits >= 20, "the queue gives way every few functors");
+		check(counters.TimerBudgetHits >= 4, "due timers give way every few callbacks");
+		check(!loop.Errors, "no errors");
+	}
+	{
+		// Without limits one turn takes everything that is due
+		Loop loop;
+		SEV_EventLoopBudget unlimited{ 0, 0, 0 };
+		check(!SEV_EventLoop_setBudget(loop.El, &unlimited), "remove the limits");
+		queueBehindGate(loop, work, tick);
+		waitFor([&fired]() -> bool { return fired == 40; });
+		SEV_EventLoop_counters(loop.El, &counters);
+		check(ran == 200 && fired == 40, "all functors and timers ran again");
+		check(!counters.TaskBudgetHits && !counters.TimerBudgetHits, "no budget hits without limits");
+		check(!loop.Errors, "no errors");
+	}
+}
+
+void spinNs(int64_t ns)
+{
+	const int64_t end = SEV_Clock_steadyNs() + ns;
+	while (SEV_Clock_steadyNs() < end);
+}
+
+void testNow()
+{
+	std::cout << "Loop time\n";
+	Loop loop, other;
+	int64_t before = SEV_Clock_steadyNs();
+	int64_t now = SEV_EventLoop_now(loop.El);
+	int64_t after = SEV_Clock_steadyNs();
+	check(before <= now && now <= after, "off the loop it reads the clock");
+	spinNs(2 * 1000 * 1000);
+	check(SEV_EventLoop_now(loop.El) >= now + 2 * 1000 * 1000, "off the loop it moves with the clock");
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Let the worker go idle
+	int64_t first = 0, second = 0, otherNow = 0, posted = SEV_Clock_steadyNs(), ranAt = 0;
+	loop.sync([&](sev::EventLoop &el) {
+		first = SEV_EventLoop_now(&el);
+		spinNs(2 * 1000 * 1000);
+		second = SEV_EventLoop_now(&el);
+		otherNow = SEV_EventLoop_now(other.El);
+		ranAt = SEV_Clock_steadyNs();
+	});
+	check(first >= posted && first <= ranAt, "the loop reads the clock again after waking up");
+	check(first == second, "on the loop it stays the same within an iteration");
+	check(otherNow > first, "another loop reads the clock");
+	int64_t next = 0;
+	std::this_thread::sleep_for(std::chrono::milliseconds(20)); // Otherwise it may be taken in the same iteration
+	loop.sync([&](sev::EventLoop &el) { next = SEV_EventLoop_now(&el); });
+	check(next > first, "the next iteration has a later time");
+	check(!loop.Errors && !other.Errors, "no errors");
+}
+
+// Reads the fast and coarse clocks for a while, each between two reads of the steady clock
+void sampleClocks(bool &monotonic, bool &fastNear, bool &coarseNear)
+{
+	const int64_t slack = 1000 * 1000; // Covers the drift over a test run, not a wrong base
+	const int64_t lag = 4 * SEV_Clock_coarseResolutionNs(); // Ticks can come late on an idle or virtual CPU
+	int64_t lastFast = SEV_Clock_fastNs(), lastCoarse = SEV_Clock_coarseNs();
+	const int64_t end = SEV_Clock_steadyNs() + 50 * 1000 * 1000;
+	monotonic = fastNear = coarseNear = true;
+	for (;;)
+	{
+		int64_t before = SEV_Clock_steadyNs();
+		int64_t fast = SEV_Clock_fastNs();
+		int64_t coarse = SEV_Clock_coarseNs();
+		int64_t after = SEV_Clock_steadyNs();
+		monotonic = monotonic && fast >= lastFast && coarse >= lastCoarse;
+		fastNear = fastNear && fast >= before - slack && fast <= after + slack;
+#ifdef __linux__
+		coarseNear = coarseNear && coarse >= before - lag - slack && coarse <= after + slack;
+#endif
+		lastFast = fast;
+		lastCoarse = coarse;
+		if (after >= end)
+			break;
+	}
+}
+
+void testClocks()
+{
+	std::cout << "Clocks\n";
+	SEV_Clock_nsPerTick(); // Calibrate before sampling
+	bool monotonic[4], fastNear[4], coarseNear[4];
+	std::vector<std::thread> threads;
+	for (int i = 1; i < 4; ++i)
+		threads.emplace_back([&, i] { sampleClocks(monotonic[i], fastNear[i], coarseNear[i]); });
+	sampleClocks(monotonic[0], fastNear[0], coarseNear[0]);
+	for (std::thread &t : threads)
+		t.join();
+	check(std::all_of(monotonic, monotonic + 4, [](bool b) { return b; }), "the fast and coarse clocks never go backwards");
+	check(std::all_of(fastNear, fastNear + 4, [](bool b) { return b; }), "the fast clock stays near the steady clock");
+	check(std::all_of(coarseNear, coarseNear + 4, [](bool b) { return b; }), "the coarse clock stays within a few ticks of the steady clock");
+}
+
+// Copy constructor throws for the entry with value Throw
+struct Step
+{
+	static int Throw;
+	int Value;
+	std::vector<int> *Order;
+
+	Step(int value, std::vector<int> *order) : Value(value), Order(order) { }
+	Step(const Step &other) : Value(other.Value), Order(other.Order) { if (Value == Throw) throw std::runtime_error("copy"); }
+
+	errno_t operator()(sev::EventLoop &)
+	{
+		Order->push_back(Value);
+		return 0;
+	}
+};
+
+int Step::Throw = -1;
+
+void testPostBatch()
+{
+	std::cout << "Post batch\n";
+	Loop loop;
+	std::vector<int> order;
+	std::vector<Step> steps;
+	for (int i = 0; i < 4000; ++i) steps.emplace_back(i, &order);
+	static const sev::EventFunctorVt vt(steps[0]);
+	Batch batch(steps, vt.get());
+	check(SEV_EventLoop_postBatch(loop.El, -1, null, null, null, null) == EINVAL, "negative count is refused");
+	check(!SEV_EventLoop_postBatch(loop.El, 0, null, null, null, null), "empty batch does nothing");
+
+	ptrdiff_t posted = -1;
+	check(!batch.post(loop.El, 4000, &posted) && posted == 4000, "post a batch spanning blocks");
+	loop.drain();
+	bool ordered = order.size() == 4000;
+	for (int i = 0; ordered && i < 4000; ++i)
+		ordered = order[i] == i;
+	check(ordered, "a single worker runs the batch in order");
+
+	order.clear();
+	check(!SEV_EventLoop_setQueueCapacity(loop.El, 1000, false), "set capacity");
+	Step::Throw = 13;
+	errno_t res = batch.post(loop.El, 20, &posted);
+	Step::Throw = -1;
+	check(res == EOTHER && posted == 13, "throwing constructor stops the batch");
+	check(!post(loop.El, Step(100, &order)), "post after the skipped entries");
+	loop.drain();
+	ordered = order.size() == 14 && order.back() == 100;
+	for (int i = 0; ordered && i < 13; ++i)
+		ordered = order[i] == i;
+	check(ordered, "entries before the throw run, the skipped ones don't");
+	check(!SEV_EventLoop_queueUsed(loop.El, false) && !SEV_EventLoop_queueUsed(loop.El, true), "skipped entries give back their capacity");
+	check(!loop.Errors, "no errors");
+}
+
+}
+
+// CPUs the first worker of the loop may run on
+std::vector<int> allowedCpus(SEV_EventLoop *el)
+{
+	std::vector<int> cpus(1024);
+	int count = (int)cpus.size();
+	if (SEV_EventLoop_threadAffinity(el, 0, cpus.data(), &count))
+		return std::vector<int>();
+	cpus.resize(count);
+	return cpus;
+}
+
+void testAffinity()
+{
+	std::cout << "Thread affinity\n";
+	std::vector<int> cpus;
+	{
+		Loop probe;
+		cpus = allowedCpus(probe.El);
+	}
+	if (cpus.empty() || SEV_Thread_currentCpu() < 0)
+	{
+		std::cout << "Affinity not supported, skipped\n";
+		return;
+	}
+	if (cpus.size() > 2)
+		cpus.resize(2);
+	Loop loop(0);
+	const SEV_EventLoopRunOptions options{ "pinned", 0, cpus.data(), (int)cpus.size(), SEV_EVENT_LOOP_RUN_PIN };
+	const int threads = 4;
+	for (int i = 0; i < threads; ++i)
+		check(!loop.run(&options), "run pinned");
+	for (int i = 0; i < threads; ++i)
+	{
+		int cpu = -1, count = 1;
+		check(!SEV_EventLoop_threadAffinity(loop.El, i, &cpu, &count) && count == 1 && cpu == cpus[i % cpus.size()], "each worker is pinned to one CPU round-robin");
+	}
+	std::atomic_int outside = 0, ran = 0;
+	std::vector<sev::EventFlag> done(100);
+	for (sev::EventFlag &flag : done)
+	{
+		post(loop.El, [&](sev::EventLoop &) -> errno_t {
+			spinNs(100 * 1000); // Long enough to spread over the workers
+			if (std::find(cpus.begin(), cpus.end(), SEV_Thread_currentCpu()) == cpus.end())
+				++outside;
+			++ran;
+			flag.set();
+			return 0;
+		});
+	}
+	for (sev::EventFlag &flag : done)
+		flag.wait();
+	check(ran == (int)done.size() && !outside, "posted tasks run on the pinned CPUs");
+	if (cpus.size() < 2)
+		return;
+	// Isolating a CPU moves floating workers started before and after off it
+	Loop before;
+	const SEV_EventLoopRunOptions isolate{ "isolated", 0, &cpus[0], 1, SEV_EVENT_LOOP_RUN_ISOLATE };
+	Loop isolated(0);
+	check(!isolated.run(&isolate), "run isolated");
+	Loop after;
+	for (SEV_EventLoop *el : { before.El, after.El })
+	{
+		const std::vector<int> floating = allowedCpus(el);
+		check(!floating.empty() && std::find(floating.begin(), floating.end(), cpus[0]) == floating.end(), "floating workers leave the isolated CPU");
+	}
+	check(!loop.Errors && !before.Errors && !isolated.Errors && !after.Errors, "no errors");
+}
+
+// Milliseconds from a post on this thread until the task starts on the loop
+int64_t wakeMs(SEV_EventLoop *el)
+{
+	sev::EventFlag ran;
+	std::chrono::steady_clock::time_point at;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	post(el, [&](sev::EventLoop &) -> errno_t {
+		at = std::chrono::steady_clock::now();
+		ran.set();
+		return 0;
+	});
+	ran.wait();
+	return std::chrono::duration_cast<std::chrono::milliseconds>(at - start).count();
+}
+
+void testIdlePolicy()
+{
+	std::cout << "Idle policy\n";
+	Loop loop(2);
+	const SEV_EventLoopIdlePolicy invalid[] = { { -1, 0, 0 }, { 0, -1, 0 }, { 0, 0, -1 } };
+	for (const SEV_EventLoopIdlePolicy &policy : invalid)
+		check(SEV_EventLoop_setIdlePolicy(loop.El, &policy) == EINVAL, "negative values are refused");
+	check(SEV_EventLoop_setIdlePolicy(loop.El, null) == EINVAL, "a null policy is refused");
+	const SEV_EventLoopIdlePolicy spin{ 200 * 1000, 0, 0 }, yield{ 0, 200 * 1000, 0 }, park{ 0, 0, 0 }, limited{ 100 * 1000, 100 * 1000, 1 };
+	for (const SEV_EventLoopIdlePolicy *policy : { &spin, &yield, &park, &limited })
+	{
+		check(!SEV_EventLoop_setIdlePolicy(loop.El, policy), "set the policy");
+		std::this_thread::sleep_for(std::chrono::milliseconds(5)); // Idle within the spin or yield window
+		int64_t worst = wakeMs(loop.El);
+		for (int i = 0; i < 20; ++i)
+			worst = std::max(worst, wakeMs(loop.El));
+		check(worst < 500, "posts reach the idle workers in time");
+	}
+
+	// Switch while the workers are parked, then while they spin
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &park), "park right away");
+	std::this_thread::sleep_for(std::chrono::milliseconds(20));
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &spin), "spin while parked");
+	check(wakeMs(loop.El) < 500, "a parked worker wakes after the switch");
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	const SEV_EventLoopIdlePolicy longSpin{ 2 * 1000 * 1000, 0, 0 };
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &longSpin), "spin for long");
+	check(wakeMs(loop.El) < 500, "post while spinning");
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &park), "park while spinning");
+	check(wakeMs(loop.El) < 500, "a spinning worker picks up the post after the switch");
+
+	// A timer due within the spin window ends the spin
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &longSpin), "spin for long");
+	sev::EventFlag fired;
+	const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	check(!timeout(loop.El, [&](sev::EventLoop &) -> errno_t { fired.set(); return 0; }, 20), "timeout while spinning");
+	fired.wait();
+	check(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500), "the timer fires on time while the workers spin");
+	check(!SEV_EventLoop_setIdlePolicy(loop.El, &park), "back to parking");
+	check(!loop.Errors, "no errors");
+}
+
+// True when the handle rethrows a runtime_error with the given message, the handle is released either way
+bool raisedRuntimeError(SEV_ExceptionHandle eh, const char *what)
+{
+	try
+	{
+		sev::ExceptionHandle e(eh);
+		e.rethrow();
+	}
+	catch (const std::runtime_error &ex)
+	{
+		return !strcmp(ex.what(), what);
+	}
+	catch (...)
+	{
+	}
+	return false;
+}
+
+void testInvoke()
+{
+	std::cout << "Invoke\n";
+	Loop loop(2);
+	std::thread::id ranOn;
+	SEV_ExceptionHandle eh = invoke(loop.El, [&](sev::EventLoop &) -> errno_t {
+		ranOn = std::this_thread::get_id();
+		return 0;
+	});
+	check(!eh && ranOn != std::thread::id() && ranOn != std::this_thread::get_id(), "from another thread, runs on the loop and returns once done");
+	eh = invoke(loop.El, [](sev::EventLoop &) -> errno_t { return EDOM; });
+	check(eh && SEV_Exception_rethrow(eh) == EDOM, "an error code comes back to the caller");
+	eh = invoke(loop.El, [](sev::EventLoop &) -> errno_t { throw std::runtime_error("invoke"); });
+	check(raisedRuntimeError(eh, "invoke"), "an exception comes back to the caller");
+
+	// Many callers at once, each waits for its own functor
+	std::atomic_int calls = 0, failures = 0;
+	std::vector<std::thread> callers;
+	for (int t = 0; t < 4; ++t)
+	{
+		callers.emplace_back([&]() {
+			for (int i = 0; i < 200; ++i)
+			{
+				int value = 0;
+				SEV_ExceptionHandle ceh = invoke(loop.El, [&value, &calls](sev::EventLoop &) -> errno_t {
+					value = ++calls;
+					return 0;
+				});
+				if (ceh || !value) ++failures;
+				if (ceh) SEV_Exception_discardEx(ceh);
+			}
+		});
+	}
+	for (std::thread &t : callers)
+		t.join();
+	check(calls == 800 && !failures, "concurrent callers each see their functor done");
+
+	// From the loop thread it runs inline, ahead of work queued before it, even with a single worker
+	Loop single;
+	std::vector<int> order;
+	SEV_ExceptionHandle inlineEh = null, throwEh = null;
+	bool sameThread = false;
+	single.sync([&](sev::EventLoop &el) {
+		post(&el, [&](sev::EventLoop &) -> errno_t { order.push_back(2); return 0; });
+		const std::thread::id self = std::this_thread::get_id();
+		inlineEh = invoke(&el, [&](sev::EventLoop &) -> errno_t {
+			sameThread = std::this_thread::get_id() == self;
+			order.push_back(1);
+			return 0;
+		});
+		throwEh = invoke(&el, [](sev::EventLoop &) -> errno_t { throw std::runtime_error("inline"); });
+	});
+	single.drain();
+	check(!inlineEh && sameThread, "from the loop thread, runs inline");
+	check(order == std::vector<int>({ 1, 2 }), "ahead of work queued before it");
+	check(raisedRuntimeError(throwEh, "inline"), "an inline exception comes back to the caller");
+	check(!loop.Errors && !single.Errors, "nothing reaches the error handler of the loop");
+}
+
+int main()
+{
+	testQueueCapacity();
+	testDeadline();
+	testCallData();
+	testLocalChain();
+	testParallelFor();
+	testElastic();
+	testWatchdog();
+	testLatencyStats();
+	testProfile();
+	testBudget();
+	testNow();
+	testClocks();
+	testPostBatch();
+	testAffinity();
+	testIdlePolicy();
+	testInvoke();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
@@ -0,0 +1,201 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <sev/async_sync.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <vector>
+
+/*
+
+Tests for the asynchronous semaphore, mutex and latch.
+Each test creates its own loop, waiters are counted down with a latch where the order doesn't matter.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop(int threads = 1)
+	{
+		El = SEV_EventLoop_create();
+		for (int i = 0; i < threads; ++i)
+		{
+			auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+				++*errors;
+				SEV_Exception_discardEx(*eh);
+				*eh = null;
+			};
+			static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+			SEV_EventLoop_run(El, vt.get(), &onError, vt.get()->CopyConstructor);
+		}
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+void testSemaphoreOrder()
+{
+	std::cout << "Semaphore grant order\n";
+	Loop loop;
+	sev::AsyncSemaphore sem(*loop.El, 0);
+	std::vector<int> order;
+	sev::EventFlag done;
+	const int count = 16;
+	for (int i = 0; i < count; ++i)
+	{
+		sem.acquire([&, i](sev::EventLoop &) -> errno_t {
+			order.push_back(i); // Single unit, never concurrent
+			sem.release();
+			if (i == count - 1) done.set();
+			return 0;
+		});
+	}
+	check(sem.waiters() == count && !sem.available(), "waiters queue while no unit is free");
+	check(!sem.tryAcquire(), "try acquire fails while waiters queue");
+	sem.release();
+	done.wait();
+	bool fifo = (int)order.size() == count;
+	for (int i = 0; fifo && i < count; ++i)
+		fifo = order[i] == i;
+	check(fifo, "waiters are granted in arrival order");
+	check(!sem.waiters(), "no waiters left");
+	check(sem.tryAcquire() && !sem.available(), "the unit is free again");
+	check(!loop.Errors, "no errors");
+}
+
+void testMutexExclusion()
+{
+	std::cout << "Mutex exclusion\n";
+	Loop loop(4);
+	sev::AsyncMutex mutex(*loop.El);
+	std::atomic_int inside = 0;
+	std::atomic_int overlaps = 0;
+	std::atomic_int ran = 0;
+	const int count = 400;
+	sev::EventFlag finished;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t)
+	{
+		threads.emplace_back([&]() {
+			for (int i = 0; i < count / 4; ++i)
+			{
+				mutex.lock([&](sev::EventLoop &) -> errno_t {
+					if (inside.fetch_add(1)) ++overlaps;
+					std::this_thread::yield();
+					inside.fetch_sub(1);
+					const bool last = ++ran == count;
+					mutex.unlock();
+					if (last) finished.set();
+					return 0;
+				});
+			}
+		});
+	}
+	for (std::thread &t : threads)
+		t.join();
+	finished.wait();
+	check(ran == count, "every lock ran");
+	check(!overlaps, "holders never overlap");
+	check(!mutex.locked(), "unlocked at the end");
+	check(!loop.Errors, "no errors");
+}
+
+void testLatch()
+{
+	std::cout << "Latch\n";
+	Loop loop(2);
+	sev::Latch latch(*loop.El, 3);
+	std::atomic_int ran = 0;
+	sev::EventFlag done;
+	for (int i = 0; i < 4; ++i)
+	{
+		latch.wait([&](sev::EventLoop &) -> errno_t {
+			if (++ran == 4) done.set();
+			return 0;
+		});
+	}
+	latch.countDown();
+	std::thread other([&]() { latch.countDown(); });
+	other.join();
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	check(!ran && latch.count() == 1, "waiters hold until the count is zero");
+	bool threw = false;
+	try
+	{
+		latch.countDown(2);
+	}
+	catch (...)
+	{
+		threw = true;
+	}
+	check(threw && latch.count() == 1, "counting past zero is refused");
+	latch.countDown();
+	done.wait();
+	check(ran == 4 && !latch.count(), "all waiters run at zero");
+	sev::EventFlag late;
+	latch.wait([&](sev::EventLoop &) -> errno_t {
+		late.set();
+		return 0;
+	});
+	late.wait();
+	check(true, "waiting on a zero latch runs right away");
+	check(!loop.Errors, "no errors");
+}
+
+}
+
+int main()
+{
+	testSemaphoreOrder();
+	testMutexExclusion();
+	testLatch();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
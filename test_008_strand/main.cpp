@@ -0,0 +1,203 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <sev/strand.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+/*
+
+Tests for strands on a loop with several workers.
+A small batch is used, so the strand goes through many follow-up drains.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop(int threads = 1)
+	{
+		El = SEV_EventLoop_create();
+		for (int i = 0; i < threads; ++i)
+		{
+			auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+				++*errors;
+				SEV_Exception_discardEx(*eh);
+				*eh = null;
+			};
+			static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+			SEV_EventLoop_run(El, vt.get(), &onError, vt.get()->CopyConstructor);
+		}
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+void testOrder()
+{
+	std::cout << "Strand order\n";
+	Loop loop(4);
+	sev::Strand strand(*loop.El, 3);
+	std::vector<int> order;
+	sev::EventFlag done;
+	const int count = 1000;
+	for (int i = 0; i < count; ++i)
+	{
+		strand.post([&, i](sev::EventLoop &) -> errno_t {
+			order.push_back(i); // Strand functors never overlap
+			if (i == count - 1) done.set();
+			return 0;
+		});
+	}
+	done.wait();
+	bool fifo = (int)order.size() == count;
+	for (int i = 0; fifo && i < count; ++i)
+		fifo = order[i] == i;
+	check(fifo, "functors run in posting order");
+	check(!loop.Errors, "no errors");
+}
+
+void testExclusion()
+{
+	std::cout << "Strand exclusion\n";
+	Loop loop(4);
+	sev::Strand strand(*loop.El, 2);
+	std::atomic_int inside = 0;
+	std::atomic_int overlaps = 0;
+	std::atomic_int ran = 0;
+	const int count = 2000;
+	sev::EventFlag done;
+	std::vector<std::thread> producers;
+	for (int t = 0; t < 4; ++t)
+	{
+		producers.emplace_back([&]() {
+			for (int i = 0; i < count / 4; ++i)
+			{
+				strand.post([&](sev::EventLoop &) -> errno_t {
+					if (inside.fetch_add(1)) ++overlaps;
+					std::this_thread::yield();
+					inside.fetch_sub(1);
+					if (++ran == count) done.set();
+					return 0;
+				});
+			}
+		});
+	}
+	for (std::thread &t : producers)
+		t.join();
+	done.wait();
+	check(ran == count, "every functor ran");
+	check(!overlaps, "functors never overlap across workers");
+	check(!loop.Errors, "no errors");
+}
+
+void testErrors()
+{
+	std::cout << "Strand errors\n";
+	Loop loop(2);
+	sev::Strand strand(*loop.El);
+	std::atomic_int ran = 0;
+	sev::EventFlag done;
+	for (int i = 0; i < 10; ++i)
+	{
+		strand.post([&, i](sev::EventLoop &) -> errno_t {
+			++ran;
+			if (i == 9) done.set();
+			return i == 3 ? EINVAL : 0;
+		});
+	}
+	done.wait();
+	check(ran == 10, "functors after an error still run");
+	for (int i = 0; i < 100 && loop.Errors != 1; ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	check(loop.Errors == 1, "the error reaches the loop");
+}
+
+void testDestroyPending()
+{
+	std::cout << "Strand destroyed while pending\n";
+	Loop loop(2);
+	std::unique_ptr<sev::Strand> strand = std::make_unique<sev::Strand>(*loop.El, 4);
+	sev::EventFlag started, gate, done;
+	std::atomic_int ran = 0;
+	const int count = 100;
+	strand->post([&](sev::EventLoop &) -> errno_t {
+		started.set();
+		gate.wait();
+		return 0;
+	});
+	for (int i = 0; i < count; ++i)
+	{
+		strand->post([&](sev::EventLoop &) -> errno_t {
+			if (++ran == count) done.set();
+			return 0;
+		});
+	}
+	started.wait();
+	strand.reset(); // Doesn't block, the strand frees itself after the last functor
+	check(!ran, "destroy returns while functors are pending");
+	gate.set();
+	done.wait();
+	check(ran == count, "pending functors still run after destroy");
+	check(!loop.Errors, "no errors");
+}
+
+}
+
+int main()
+{
+	testOrder();
+	testExclusion();
+	testErrors();
+	testDestroyPending();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
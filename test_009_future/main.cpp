@@ -0,0 +1,355 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <sev/future.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/*
+
+Tests for promises and futures chained across loops.
+Futures are polled from the main thread, get never blocks.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop(int threads = 1)
+	{
+		El = SEV_EventLoop_create();
+		for (int i = 0; i < threads; ++i)
+		{
+			auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+				++*errors;
+				SEV_Exception_discardEx(*eh);
+				*eh = null;
+			};
+			static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+			SEV_EventLoop_run(El, vt.get(), &onError, vt.get()->CopyConstructor);
+		}
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+template<typename T>
+bool waitReady(sev::Future<T> &f)
+{
+	for (int i = 0; i < 5000 && !f.ready(); ++i)
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	return f.ready();
+}
+
+void testChain()
+{
+	std::cout << "Chaining\n";
+	Loop a, b;
+	std::thread::id onA, onB;
+	sev::Promise<int> p;
+	sev::Future<std::string> f = p.future().then(*a.El, [&](int v) -> int {
+		onA = std::this_thread::get_id();
+		return v * 2;
+	}).then(*b.El, [&](int v) -> std::string {
+		onB = std::this_thread::get_id();
+		return std::to_string(v);
+	});
+	check(!f.ready(), "not ready before the promise is set");
+	p.set(21);
+	check(waitReady(f) && f.get() == "42", "value passes through the chain");
+	check(onA != onB && onA != std::thread::id() && onB != std::thread::id(), "each link ran on its own loop");
+	sev::Promise<void> pv;
+	std::atomic_int ran = 0;
+	sev::Future<void> fv = pv.future().then(*a.El, [&]() { ++ran; });
+	pv.set();
+	check(waitReady(fv) && ran == 1, "void chain runs");
+	fv.get();
+	check(!fv.valid(), "get takes the state");
+	check(!a.Errors && !b.Errors, "no errors");
+}
+
+void testException()
+{
+	std::cout << "Exception propagation\n";
+	Loop loop;
+	std::atomic_int skipped = 0;
+	sev::Promise<int> p;
+	sev::Future<int> f = p.future().then(*loop.El, [](int) -> int {
+		throw std::runtime_error("link");
+	}).then(*loop.El, [&](int v) -> int {
+		++skipped;
+		return v;
+	});
+	p.set(1);
+	bool caught = false;
+	if (waitReady(f))
+	{
+		try
+		{
+			f.get();
+		}
+		catch (const std::runtime_error &ex)
+		{
+			caught = std::string(ex.what()) == "link";
+		}
+	}
+	check(caught, "exception reaches the end of the chain");
+	check(!skipped, "continuations after the throw are skipped");
+	sev::Promise<int> pf;
+	sev::Future<int> ff = pf.future();
+	pf.fail(std::make_exception_ptr(std::invalid_argument("failed")));
+	caught = false;
+	try
+	{
+		ff.get();
+	}
+	catch (const std::invalid_argument &)
+	{
+		caught = true;
+	}
+	check(caught, "failed promise rethrows from get");
+	check(!loop.Errors, "exceptions stay in the futures");
+}
+
+void testBrokenPromise()
+{
+	std::cout << "Broken promise\n";
+	sev::Future<int> f;
+	{
+		sev::Promise<int> p;
+		f = p.future();
+	}
+	bool broken = false;
+	try
+	{
+		f.get();
+	}
+	catch (const std::future_error &ex)
+	{
+		broken = ex.code() == std::future_errc::broken_promise;
+	}
+	check(broken, "dropping the promise fails the future with broken_promise");
+	sev::Promise<int> p;
+	sev::Future<int> once = p.future();
+	bool retrieved = false;
+	try
+	{
+		p.future();
+	}
+	catch (const std::future_error &ex)
+	{
+		retrieved = ex.code() == std::future_errc::future_already_retrieved;
+	}
+	check(retrieved, "the future can only be retrieved once");
+	p.set(1);
+	bool satisfied = false;
+	try
+	{
+		p.set(2);
+	}
+	catch (const std::future_error &ex)
+	{
+		satisfied = ex.code() == std::future_errc::promise_already_satisfied;
+	}
+	check(satisfied && once.get() == 1, "setting twice throws, the first value stays");
+}
+
+void testWhenAll()
+{
+	std::cout << "whenAll and whenAny\n";
+	std::vector<sev::Promise<int>> promises(4);
+	std::vector<sev::Future<int>> futures;
+	for (sev::Promise<int> &p : promises)
+		futures.push_back(p.future());
+	sev::Future<std::vector<int>> all = sev::whenAll(std::move(futures));
+	std::vector<std::thread> setters;
+	for (int i = 3; i >= 0; --i)
+		setters.emplace_back([&promises, i]() { promises[i].set(i * 10); });
+	for (std::thread &t : setters)
+		t.join();
+	bool ordered = false;
+	if (waitReady(all))
+	{
+		std::vector<int> values = all.get();
+		ordered = values == std::vector<int>({ 0, 10, 20, 30 });
+	}
+	check(ordered, "whenAll keeps the input order");
+	std::vector<sev::Promise<void>> vpromises(3);
+	std::vector<sev::Future<void>> vfutures;
+	for (sev::Promise<void> &p : vpromises)
+		vfutures.push_back(p.future());
+	sev::Future<void> vall = sev::whenAll(std::move(vfutures));
+	vpromises[0].set();
+	vpromises[2].set();
+	check(!vall.ready(), "whenAll waits for every input");
+	vpromises[1].fail(std::make_exception_ptr(std::runtime_error("one")));
+	bool failed = false;
+	try
+	{
+		vall.get();
+	}
+	catch (const std::runtime_error &)
+	{
+		failed = true;
+	}
+	check(failed, "whenAll fails with the failed input");
+	std::vector<sev::Promise<int>> apromises(3);
+	std::vector<sev::Future<int>> afutures;
+	for (sev::Promise<int> &p : apromises)
+		afutures.push_back(p.future());
+	sev::Future<std::pair<size_t, int>> any = sev::whenAny(std::move(afutures));
+	apromises[1].set(7);
+	apromises[0].set(8);
+	check(any.ready() && any.get() == std::pair<size_t, int>(1, 7), "whenAny completes with the first input");
+	std::vector<sev::Future<int>> invalid;
+	sev::Promise<int> ip;
+	invalid.push_back(ip.future());
+	invalid.emplace_back();
+	bool rejected = false;
+	try
+	{
+		sev::whenAll(std::move(invalid));
+	}
+	catch (const std::future_error &ex)
+	{
+		rejected = ex.code() == std::future_errc::no_state;
+	}
+	check(rejected && invalid[0].valid(), "whenAll rejects an invalid future without taking the others");
+	rejected = false;
+	try
+	{
+		sev::whenAny(std::move(invalid));
+	}
+	catch (const std::future_error &ex)
+	{
+		rejected = ex.code() == std::future_errc::no_state;
+	}
+	check(rejected && invalid[0].valid(), "whenAny rejects an invalid future without taking the others");
+}
+
+struct alignas(64) Wide
+{
+	char Data[64];
+};
+
+void testAlignment()
+{
+	std::cout << "Over-aligned values\n";
+	Loop loop;
+	std::vector<sev::Future<bool>> futures;
+	std::vector<sev::Promise<Wide>> promises(16);
+	for (sev::Promise<Wide> &p : promises)
+	{
+		futures.push_back(p.future().then(*loop.El, [](Wide &&w) -> bool {
+			return !((uintptr_t)&w % alignof(Wide)); // The value as stored in the shared state
+		}));
+	}
+	for (sev::Promise<Wide> &p : promises)
+		p.set(Wide());
+	bool aligned = true;
+	for (sev::Future<bool> &f : futures)
+		aligned = aligned && waitReady(f) && f.get();
+	check(aligned, "values are stored at their alignment");
+}
+
+}
+
+errno_t refusePost(SEV_EventLoop *, const SEV_FunctorVt *, void *, void(*)(void *ptr, void *other))
+{
+	return ENOMEM;
+}
+
+void testPostFailure()
+{
+	std::cout << "Post failure\n";
+	SEV_EventLoopVt vt = { };
+	vt.PostFunctor = refusePost; // No queue table, so unbounded posts go here too
+	SEV_EventLoop refusing{ &vt };
+	std::atomic_int ran = 0;
+	auto body = [&](int v) -> int {
+		++ran;
+		return v;
+	};
+	sev::Promise<int> before;
+	sev::Future<int> ready = before.future();
+	before.set(1);
+	sev::Future<int> done = ready.then(refusing, body); // Dispatched from then
+	sev::Promise<int> after;
+	sev::Future<int> pending = after.future().then(refusing, body);
+	after.set(1); // Dispatched from set
+	for (sev::Future<int> *f : { &done, &pending })
+	{
+		bool outOfMemory = false;
+		try
+		{
+			f->get();
+		}
+		catch (const std::bad_alloc &)
+		{
+			outOfMemory = true;
+		}
+		check(outOfMemory, "the future fails with the post error");
+	}
+	check(!ran, "the callable is skipped, it never runs off its loop");
+}
+
+int main()
+{
+	testChain();
+	testException();
+	testBrokenPromise();
+	testWhenAll();
+	testAlignment();
+	testPostFailure();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
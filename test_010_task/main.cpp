@@ -0,0 +1,275 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+#include <sev/task.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <new>
+
+#ifdef __linux__
+#include <unistd.h>
+#endif
+
+/*
+
+Tests for coroutine tasks and their awaiters, built as C++20.
+Tasks are run with syncWait from the main thread.
+
+*/
+
+#ifndef SEV_TASK
+#error Coroutines are not available
+#endif
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop(int threads = 1)
+	{
+		El = SEV_EventLoop_create();
+		for (int i = 0; i < threads; ++i)
+		{
+			auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+				++*errors;
+				SEV_Exception_discardEx(*eh);
+				*eh = null;
+			};
+			static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+			SEV_EventLoop_run(El, vt.get(), &onError, vt.get()->CopyConstructor);
+		}
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+sev::Task<int> twice(sev::EventLoop &el, int v)
+{
+	co_await sev::post(el);
+	co_return v * 2;
+}
+
+sev::Task<int> sum(sev::EventLoop &el, int count)
+{
+	int res = 0;
+	for (int i = 0; i < count; ++i)
+		res += co_await twice(el, i);
+	co_return res;
+}
+
+sev::Task<void> fail(sev::EventLoop &el)
+{
+	co_await sev::post(el);
+	throw std::runtime_error("task");
+}
+
+sev::Task<bool> hop(sev::EventLoop &from, sev::EventLoop &to, std::thread::id toThread)
+{
+	co_await sev::post(from);
+	const bool before = std::this_thread::get_id() != toThread;
+	co_await sev::post(to);
+	co_return before && std::this_thread::get_id() == toThread;
+}
+
+sev::Task<int64_t> sleepFor(sev::EventLoop &el, int timeoutMs)
+{
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	co_await sev::sleep(el, timeoutMs);
+	co_return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+sev::Task<void> setFlag(sev::EventLoop &el, sev::EventFlag &flag)
+{
+	co_await sev::post(el);
+	flag.set();
+}
+
+void testChain()
+{
+	std::cout << "Task chain\n";
+	Loop loop(2);
+	check(sev::syncWait(*loop.El, sum(*loop.El, 100)) == 9900, "awaited tasks return their values");
+	check(sev::syncWait(*loop.El, sum(*loop.El, 10000)) == 99990000, "long chains don't grow the stack");
+	bool caught = false;
+	try
+	{
+		sev::syncWait(*loop.El, fail(*loop.El));
+	}
+	catch (const std::runtime_error &ex)
+	{
+		caught = std::string(ex.what()) == "task";
+	}
+	check(caught, "exceptions pass through syncWait");
+	sev::EventFlag flag;
+	check(!sev::spawn(*loop.El, setFlag(*loop.El, flag)), "spawn");
+	flag.wait();
+	check(true, "spawned task runs");
+	check(!loop.Errors, "no errors");
+}
+
+void testAwaiters()
+{
+	std::cout << "Awaiters\n";
+	Loop a, b;
+	std::thread::id bThread;
+	{
+		sev::EventFlag done;
+		auto f = [&](sev::EventLoop &) -> errno_t {
+			bThread = std::this_thread::get_id();
+			done.set();
+			return 0;
+		};
+		static const sev::EventFunctorVt vt(f);
+		SEV_EventLoop_postFunctor(b.El, vt.get(), &f, vt.get()->CopyConstructor);
+		done.wait();
+	}
+	check(sev::syncWait(*a.El, hop(*a.El, *b.El, bThread)), "post moves the coroutine to the other loop");
+	check(sev::syncWait(*a.El, sleepFor(*a.El, 20)) >= 20, "sleep resumes after the timeout");
+	check(!a.Errors && !b.Errors, "no errors");
+}
+
+#ifdef __linux__
+
+sev::Task<ptrdiff_t> readPipe(sev::EventLoop &el, int fd, char *buffer, size_t size)
+{
+	co_await sev::readable(el, fd);
+	SEV_EventLoop_unwatch(&el, fd);
+	sev::EventLoopIo io{};
+	io.Op = SEV_EVENT_LOOP_IO_READ;
+	io.Fd = fd;
+	io.Buffer = buffer;
+	io.Size = size;
+	io.Offset = -1;
+	co_return co_await sev::io(el, io);
+}
+
+sev::Task<bool> watchTwice(sev::EventLoop &el, int fd)
+{
+	bool refused = false;
+	try
+	{
+		co_await sev::readable(el, fd); // Watched already, fails without suspending
+	}
+	catch (...)
+	{
+		refused = true;
+	}
+	co_return refused;
+}
+
+errno_t refuseResume(SEV_EventLoop *, void(*)(void *frame), void *)
+{
+	return ENOMEM;
+}
+
+// Swaps in a table that refuses resume posts, only while this runs on the single thread of the loop
+sev::Task<bool> watchRefusedResume(sev::EventLoop &el, int fd)
+{
+	SEV_EventLoopVt *real = el.Vt;
+	SEV_EventLoopWorkVt work = *real->WorkVt;
+	work.Resume = refuseResume;
+	SEV_EventLoopVt vt = *real;
+	vt.WorkVt = &work;
+	el.Vt = &vt;
+	bool outOfMemory = false;
+	try
+	{
+		co_await sev::readable(el, fd); // Readable already, the callback can't queue the resume
+	}
+	catch (const std::bad_alloc &)
+	{
+		outOfMemory = true;
+	}
+	el.Vt = real;
+	SEV_EventLoop_unwatch(&el, fd);
+	co_return outOfMemory;
+}
+
+void testIo()
+{
+	std::cout << "I/O awaiters\n";
+	Loop loop;
+	int fds[2];
+	check(!pipe(fds), "pipe");
+	ssize_t written = 0;
+	std::thread writer([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		written = write(fds[1], "hello", 5);
+	});
+	char buffer[16] = {};
+	ptrdiff_t n = sev::syncWait(*loop.El, readPipe(*loop.El, fds[0], buffer, sizeof(buffer)));
+	writer.join();
+	check(written == 5 && n == 5 && std::string(buffer, 5) == "hello", "readable then io reads the pipe");
+	auto f = [](sev::EventLoop &) -> errno_t { return 0; };
+	static const sev::EventFunctorVt vt(f);
+	check(!SEV_EventLoop_watchReadFunctor(loop.El, fds[0], vt.get(), &f, vt.get()->CopyConstructor), "watch");
+	check(sev::syncWait(*loop.El, watchTwice(*loop.El, fds[0])), "a refused watch throws from the awaiter");
+	SEV_EventLoop_unwatch(loop.El, fds[0]);
+	check(write(fds[1], "x", 1) == 1, "write");
+	check(sev::syncWait(*loop.El, watchRefusedResume(*loop.El, fds[0])), "a refused resume from the watch resumes inline and throws");
+	close(fds[0]);
+	close(fds[1]);
+	check(!loop.Errors, "no errors");
+}
+
+#endif
+
+}
+
+int main()
+{
+	testChain();
+	testAwaiters();
+#ifdef __linux__
+	testIo();
+#endif
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
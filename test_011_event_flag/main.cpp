@@ -0,0 +1,139 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/event_flag.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#ifdef __linux__
+#include <poll.h>
+#endif
+
+/*
+
+Regression tests for the event flag.
+Built a second time with the eventfd backend on Linux, so the descriptor is covered as well.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+void testSetWithoutWaiter()
+{
+	std::cout << "Set without a waiter\n";
+	sev::EventFlag flag;
+	flag.set();
+	check(flag.wait(0), "auto reset flag stays set until a wait takes it");
+	check(!flag.wait(0), "the wait reset it");
+	sev::EventFlag manual(true);
+	manual.set();
+	manual.set();
+	check(manual.wait(0) && manual.wait(0), "manual reset flag stays set across waits");
+	manual.reset();
+	check(!manual.wait(0), "reset clears it");
+	sev::EventFlag initial(false, true);
+	check(initial.wait(0), "initial state is set");
+}
+
+void testTimeout()
+{
+	std::cout << "Wait with a timeout\n";
+	sev::EventFlag flag;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	check(!flag.wait(20), "wait times out while the flag is clear");
+	check(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20), "after the timeout");
+	std::thread setter([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		flag.set();
+	});
+	check(flag.wait(10000), "set from another thread wakes the waiter");
+	setter.join();
+	std::atomic_int woken = 0;
+	sev::EventFlag manual(true);
+	std::thread waiters[4];
+	for (std::thread &waiter : waiters)
+		waiter = std::thread([&]() { if (manual.wait(10000)) ++woken; });
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	manual.set();
+	for (std::thread &waiter : waiters)
+		waiter.join();
+	check(woken == 4, "manual reset flag wakes every waiter");
+}
+
+void testFd()
+{
+	std::cout << "Descriptor\n";
+	sev::EventFlag flag;
+	const int fd = flag.fd();
+	if (fd < 0)
+	{
+		std::cout << "  skipped: the backend has no descriptor\n";
+		return;
+	}
+#ifdef __linux__
+	pollfd pfd{ fd, POLLIN, 0 };
+	check(!poll(&pfd, 1, 0), "not readable while clear");
+	flag.set();
+	pfd.revents = 0;
+	check(poll(&pfd, 1, 0) == 1 && (pfd.revents & POLLIN), "readable once set");
+	check(flag.wait(0), "wait takes the flag");
+	pfd.revents = 0;
+	check(!poll(&pfd, 1, 0), "not readable after the wait");
+	std::thread setter([&]() {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		flag.set();
+	});
+	pfd.revents = 0;
+	check(poll(&pfd, 1, 10000) == 1 && (pfd.revents & POLLIN), "poll wakes on a set from another thread");
+	setter.join();
+	check(flag.wait(0), "wait takes the flag after polling");
+#endif
+}
+
+}
+
+int main()
+{
+	testSetWithoutWaiter();
+	testTimeout();
+	testFd();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
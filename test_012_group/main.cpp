@@ -0,0 +1,175 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/event_loop_group.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+/*
+
+Regression tests for the event loop group.
+Shards share CPU 0, so the tests don't depend on the machine size.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+const int c_Shards = 4;
+const int c_Cpus[c_Shards] = { 0, 0, 0, 0 };
+
+// Group with its own error counter, destroyed at the end of the scope
+struct Group
+{
+	Group() : G(c_Shards, c_Cpus)
+	{
+		G.run([errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+			++*errors;
+			SEV_Exception_discardEx(*eh);
+			*eh = null;
+		});
+	}
+
+	sev::EventLoopGroup G;
+	std::atomic_int Errors = 0;
+
+};
+
+void testShardFor()
+{
+	std::cout << "Shard for a key\n";
+	Group group;
+	check(group.G.shards() == c_Shards, "shard count");
+	int counts[c_Shards] = { };
+	bool inRange = true;
+	const int keys = 100000;
+	for (uint64_t key = 0; key < keys; ++key)
+	{
+		const int shard = group.G.shardFor(key);
+		if (shard < 0 || shard >= c_Shards) inRange = false;
+		else ++counts[shard];
+	}
+	check(inRange, "every key maps to a shard");
+	check(std::all_of(counts, counts + c_Shards, [](int count) -> bool { return count > keys / c_Shards * 9 / 10 && count < keys / c_Shards * 11 / 10; }), "sequential keys spread evenly");
+}
+
+void testCurrentShard()
+{
+	std::cout << "Current shard\n";
+	sev::EventLoopGroup other(1, c_Cpus);
+	Group group; // Destroyed first, its functors use the other group
+	check(group.G.currentShard() == -1, "-1 off the shard threads");
+	std::atomic_int matched = 0;
+	sev::EventFlag done;
+	for (int i = 0; i < c_Shards; ++i)
+	{
+		group.G.submitTo(i, [&, i](sev::EventLoop &) -> errno_t {
+			if (group.G.currentShard() == i) ++matched;
+			if (matched == c_Shards) done.set();
+			return 0;
+		});
+	}
+	check(done.wait(10000) && matched == c_Shards, "each shard reports itself");
+	std::atomic_int foreign = 0;
+	sev::EventFlag checked;
+	group.G.submitTo(0, [&](sev::EventLoop &) -> errno_t {
+		foreign = other.currentShard();
+		checked.set();
+		return 0;
+	});
+	check(checked.wait(10000) && foreign == -1, "-1 on a shard of another group");
+	check(!group.Errors, "no errors");
+}
+
+// Records its sequence number on the receiving shard
+struct Message
+{
+	std::vector<int> *Received;
+	sev::EventFlag *Done;
+	int Seq;
+	int Last;
+
+	errno_t operator()(sev::EventLoop &)
+	{
+		Received->push_back(Seq);
+		if (Seq == Last) Done->set();
+		return 0;
+	}
+
+};
+
+void testOrder()
+{
+	std::cout << "Submit order between shards\n";
+	const int count = 10000;
+	std::vector<int> received[2]; // On shard 1 from shard 0, on shard 0 from shard 1, each only touched by its receiver
+	sev::EventFlag done[2];
+	Group group; // Destroyed first, its functors use the vectors
+	for (int from = 0; from < 2; ++from)
+	{
+		group.G.submitTo(from, [&, from](sev::EventLoop &) -> errno_t {
+			for (int i = 0; i < count; ++i)
+				group.G.submitTo(1 - from, Message{ &received[from], &done[from], i, count - 1 });
+			return 0;
+		});
+	}
+	check(done[0].wait(10000) && done[1].wait(10000), "every functor arrived");
+	for (int from = 0; from < 2; ++from)
+	{
+		bool ordered = (int)received[from].size() == count;
+		for (int i = 0; ordered && i < count; ++i)
+			ordered = received[from][i] == i;
+		check(ordered, from ? "shard 1 to shard 0 runs in submission order" : "shard 0 to shard 1 runs in submission order");
+	}
+	check(SEV_EventLoopGroup_submitToFunctor(group.G.get(), c_Shards, null, null, null) == EINVAL, "submit to a shard out of range");
+	check(!group.Errors, "no errors");
+}
+
+}
+
+int main()
+{
+	testShardFor();
+	testCurrentShard();
+	testOrder();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
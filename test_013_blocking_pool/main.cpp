@@ -0,0 +1,231 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/blocking_pool.h>
+#include <iostream>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <stdexcept>
+
+/*
+
+Regression tests for the blocking pool.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Loop with its own error counter, destroyed at the end of the scope
+struct Loop
+{
+	Loop()
+	{
+		El = SEV_EventLoop_create();
+		auto onError = [errors = &Errors](SEV_ExceptionHandle *eh) -> void {
+			++*errors;
+			SEV_Exception_discardEx(*eh);
+			*eh = null;
+		};
+		static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+		SEV_EventLoop_run(El, vt.get(), &onError, vt.get()->CopyConstructor);
+	}
+
+	~Loop()
+	{
+		SEV_EventLoop_destroy(El);
+	}
+
+	// Wait for what was posted before, past any capacity set by the test. Returns the loop thread
+	std::thread::id sync()
+	{
+		sev::EventFlag done;
+		std::thread::id id;
+		auto f = [&done, &id](sev::EventLoop &) -> errno_t {
+			id = std::this_thread::get_id();
+			done.set();
+			return 0;
+		};
+		static const sev::EventFunctorVt vt(f);
+		SEV_EventLoop_postFunctorUnbounded(El, vt.get(), &f, vt.get()->CopyConstructor);
+		done.wait();
+		return id;
+	}
+
+	SEV_EventLoop *El;
+	std::atomic_int Errors = 0;
+
+};
+
+// Poll the stats until done returns true or two seconds pass
+template<typename TFn>
+bool waitStats(SEV_BlockingPool *pool, SEV_BlockingPoolStats &stats, TFn &&done)
+{
+	for (int i = 0; i < 2000; ++i)
+	{
+		SEV_BlockingPool_stats(pool, &stats);
+		if (done(stats)) return true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return false;
+}
+
+void testGrowAndRetire()
+{
+	std::cout << "Grow and retire\n";
+	Loop loop;
+	sev::BlockingPool pool(4, 0, 50);
+	sev::EventFlag gate(true);
+	std::atomic_int called = 0, completed = 0;
+	std::atomic_bool onLoop = true;
+	const std::thread::id loopThread = loop.sync();
+	for (int i = 0; i < 6; ++i)
+	{
+		pool.offload(*(sev::EventLoop *)loop.El, [&]() -> ptrdiff_t {
+			gate.wait();
+			++called;
+			return 1;
+		}, [&](sev::EventLoop &, ptrdiff_t res) -> errno_t {
+			if (std::this_thread::get_id() != loopThread) onLoop = false;
+			completed += (int)res;
+			return 0;
+		});
+	}
+	SEV_BlockingPoolStats stats;
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return s.Busy == 4; }), "grows to the thread limit on a backlog");
+	check(stats.Threads == 4 && stats.Queued == 2 && stats.PeakQueued >= 2, "the calls past the limit wait in the queue");
+	gate.set();
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return s.Completed == 6; }), "every call completed");
+	loop.sync();
+	check(called == 6 && completed == 6 && onLoop, "every completion was posted to the loop");
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return !s.Threads; }), "threads retire after idling");
+	check(!loop.Errors, "no errors");
+}
+
+void testMaxQueued()
+{
+	std::cout << "Queue limit\n";
+	Loop loop;
+	sev::BlockingPool pool(1, 2, 0);
+	sev::EventFlag started, gate(true);
+	auto block = [&]() -> ptrdiff_t {
+		started.set();
+		gate.wait();
+		return 0;
+	};
+	auto complete = [](sev::EventLoop &, ptrdiff_t) -> errno_t { return 0; };
+	sev::EventLoop &el = *(sev::EventLoop *)loop.El;
+	check(!sev::impl::bp::offload(pool.get(), el, block, complete), "offload the blocking call");
+	started.wait(); // The only thread is busy
+	check(!sev::impl::bp::offload(pool.get(), el, block, complete) && !sev::impl::bp::offload(pool.get(), el, block, complete), "two calls fit in the queue");
+	check(sev::impl::bp::offload(pool.get(), el, block, complete) == EAGAIN, "offloading past the limit returns EAGAIN");
+	SEV_BlockingPoolStats stats;
+	SEV_BlockingPool_stats(pool.get(), &stats);
+	check(stats.Queued == 2 && stats.Rejected == 1, "the refused call counts as rejected");
+	gate.set();
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return s.Completed == 3; }), "the accepted calls completed");
+	loop.sync();
+	check(!loop.Errors, "no errors");
+}
+
+void testCompletions()
+{
+	std::cout << "Completions\n";
+	Loop loop;
+	sev::BlockingPool pool(2, 0, 0);
+	sev::EventLoop &el = *(sev::EventLoop *)loop.El;
+	check(!SEV_EventLoop_setQueueCapacity(loop.El, 1, false), "set loop capacity");
+	sev::EventFlag started, gate;
+	auto block = [&](sev::EventLoop &) -> errno_t {
+		started.set();
+		gate.wait();
+		return 0;
+	};
+	static const sev::EventFunctorVt vt(block);
+	SEV_EventLoop_postFunctor(loop.El, vt.get(), &block, vt.get()->CopyConstructor);
+	started.wait(); // The loop is busy, and its queue fills up
+	std::atomic_int completed = 0;
+	for (int i = 0; i < 4; ++i)
+		pool.offload(el, []() -> ptrdiff_t { return 1; }, [&](sev::EventLoop &, ptrdiff_t res) -> errno_t { completed += (int)res; return 0; });
+	SEV_BlockingPoolStats stats;
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return s.Completed == 4 && !s.Busy; }), "completions go past a full loop queue without blocking the pool");
+	gate.set();
+	loop.sync();
+	check(completed == 4, "every completion ran");
+	pool.offload(el, []() -> ptrdiff_t { throw std::runtime_error("call failed"); }, [&](sev::EventLoop &, ptrdiff_t) -> errno_t { ++completed; return 0; });
+	check(waitStats(pool.get(), stats, [](const SEV_BlockingPoolStats &s) -> bool { return s.Completed == 5; }), "the throwing call finished");
+	loop.sync();
+	check(completed == 4 && loop.Errors == 1, "an exception from the call is raised on the loop instead of calling back");
+}
+
+void testDestroy()
+{
+	std::cout << "Destroy\n";
+	Loop loop;
+	SEV_BlockingPoolOptions options{ 1, 0, 0 };
+	SEV_BlockingPool *pool = SEV_BlockingPool_create(&options);
+	check(pool, "create");
+	std::atomic_int called = 0, completed = 0;
+	sev::EventLoop &el = *(sev::EventLoop *)loop.El;
+	for (int i = 0; i < 5; ++i)
+	{
+		sev::impl::bp::offload(pool, el, [&]() -> ptrdiff_t {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			++called;
+			return 1;
+		}, [&](sev::EventLoop &, ptrdiff_t res) -> errno_t { completed += (int)res; return 0; });
+	}
+	SEV_BlockingPool_destroy(pool);
+	check(called == 5, "destroy waits for the queued calls");
+	loop.sync();
+	check(completed == 5, "their completions are still posted");
+	check(!loop.Errors, "no errors");
+}
+
+}
+
+int main()
+{
+	testGrowAndRetire();
+	testMaxQueued();
+	testCompletions();
+	testDestroy();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */
@@ -0,0 +1,388 @@
+/*
+
+Copyright (C) 2020  Jan BOON (Kaetemi) <jan.boon@kaetemi.be>
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+1. Redistributions of source code must retain the above copyright notice, this
+list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+this list of conditions and the following disclaimer in the documentation
+and/or other materials provided with the distribution.
+3. Neither the name of the copyright holder nor the names of its contributors
+may be used to endorse or promote products derived from this software
+without specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+*/
+
+#include <sev/trace.h>
+#include <sev/event_loop.h>
+#include <sev/event_flag.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+
+/*
+
+Regression tests for event tracing.
+The files are read back with a strict JSON parser, so a formatting mistake fails here before a viewer rejects the trace.
+
+*/
+
+namespace {
+
+int s_Failures = 0;
+
+void check(bool ok, const char *what)
+{
+	std::cout << (ok ? "  ok: " : "FAIL: ") << what << "\n";
+	if (!ok) ++s_Failures;
+}
+
+// Just enough JSON for the trace files
+struct Json
+{
+	enum Kind { Null, Bool, Number, String, Array, Object } Type = Null;
+	double Num = 0;
+	std::string Str;
+	std::vector<Json> Items;
+	std::map<std::string, Json> Members;
+
+	const Json *member(const char *key) const
+	{
+		auto it = Members.find(key);
+		return it == Members.end() ? null : &it->second;
+	}
+};
+
+struct Parser
+{
+	const char *P;
+
+	void skip()
+	{
+		while (*P == ' ' || *P == '\n' || *P == '\r' || *P == '\t') ++P;
+	}
+
+	bool literal(const char *word)
+	{
+		size_t n = strlen(word);
+		if (strncmp(P, word, n)) return false;
+		P += n;
+		return true;
+	}
+
+	bool string(std::string &out)
+	{
+		if (*P++ != '"') return false;
+		for (;;)
+		{
+			unsigned char c = (unsigned char)*P++;
+			if (c == '"') return true;
+			if (c < 0x20) return false; // Control characters must be escaped
+			if (c != '\\')
+			{
+				out += (char)c;
+				continue;
+			}
+			switch (*P++)
+			{
+			case '"': out += '"'; break;
+			case '\\': out += '\\'; break;
+			case '/': out += '/'; break;
+			case 'b': out += '\b'; break;
+			case 'f': out += '\f'; break;
+			case 'n': out += '\n'; break;
+			case 'r': out += '\r'; break;
+			case 't': out += '\t'; break;
+			case 'u':
+			{
+				unsigned v = 0;
+				for (int i = 0; i < 4; ++i, ++P)
+				{
+					if (!isxdigit((unsigned char)*P)) return false;
+					v = v * 16 + (unsigned)(isdigit((unsigned char)*P) ? *P - '0' : (tolower((unsigned char)*P) - 'a' + 10));
+				}
+				if (v >= 0x80) return false; // The tracer only escapes control characters
+				out += (char)v;
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+	}
+
+	bool number(double &out)
+	{
+		const char *start = P;
+		if (*P == '-') ++P;
+		if (!isdigit((unsigned char)*P)) return false;
+		if (*P == '0' && isdigit((unsigned char)P[1])) return false; // No leading zeros
+		while (isdigit((unsigned char)*P)) ++P;
+		if (*P == '.')
+		{
+			++P;
+			if (!isdigit((unsigned char)*P)) return false;
+			while (isdigit((unsigned char)*P)) ++P;
+		}
+		if (*P == 'e' || *P == 'E')
+		{
+			++P;
+			if (*P == '+' || *P == '-') ++P;
+			if (!isdigit((unsigned char)*P)) return false;
+			while (isdigit((unsigned char)*P)) ++P;
+		}
+		out = strtod(std::string(start, P).c_str(), null);
+		return true;
+	}
+
+	bool value(Json &out)
+	{
+		skip();
+		if (*P == '{')
+		{
+			out.Type = Json::Object;
+			++P;
+			skip();
+			if (*P == '}') return ++P, true;
+			for (;;)
+			{
+				std::string key;
+				skip();
+				if (!string(key)) return false;
+				skip();
+				if (*P++ != ':') return false;
+				if (!value(out.Members[key])) return false;
+				skip();
+				if (*P == '}') return ++P, true;
+				if (*P++ != ',') return false;
+			}
+		}
+		if (*P == '[')
+		{
+			out.Type = Json::Array;
+			++P;
+			skip();
+			if (*P == ']') return ++P, true;
+			for (;;)
+			{
+				out.Items.emplace_back();
+				if (!value(out.Items.back())) return false;
+				skip();
+				if (*P == ']') return ++P, true;
+				if (*P++ != ',') return false;
+			}
+		}
+		if (*P == '"')
+		{
+			out.Type = Json::String;
+			return string(out.Str);
+		}
+		if (literal("true") || literal("false"))
+		{
+			out.Type = Json::Bool;
+			return true;
+		}
+		if (literal("null"))
+			return true;
+		out.Type = Json::Number;
+		return number(out.Num);
+	}
+};
+
+bool parseFile(const char *path, Json &out)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file) return false;
+	std::stringstream ss;
+	ss << file.rdbuf();
+	std::string text = ss.str();
+	Parser parser{ text.c_str() };
+	if (!parser.value(out)) return false;
+	parser.skip();
+	return !*parser.P; // Nothing after the value
+}
+
+struct Work
+{
+	std::atomic_int *Ran;
+
+	errno_t operator()(sev::EventLoop &)
+	{
+		++*Ran;
+		return 0;
+	}
+};
+
+// Run count functors on a fresh loop and wait for them
+void runWork(int count)
+{
+	SEV_EventLoop *el = SEV_EventLoop_create();
+	auto onError = [](SEV_ExceptionHandle *eh) -> void {
+		SEV_Exception_discardEx(*eh);
+		*eh = null;
+	};
+	static const sev::FunctorVt<void(SEV_ExceptionHandle *)> vt(onError);
+	SEV_EventLoop_run(el, vt.get(), &onError, vt.get()->CopyConstructor);
+	std::atomic_int ran = 0;
+	Work work{ &ran };
+	static const sev::EventFunctorVt workVt(work);
+	for (int i = 0; i < count; ++i)
+		SEV_EventLoop_postFunctorUnbounded(el, workVt.get(), &work, workVt.get()->CopyConstructor);
+	while (ran < count)
+		std::this_thread::yield();
+	SEV_EventLoop_destroy(el);
+}
+
+// Check every event has the fields of its phase, and count the ones matching
+struct EventCheck
+{
+	bool Valid = true;
+	int Work = 0;
+	int Instants = 0;
+	int ThreadNames = 0;
+	std::vector<std::string> InstantNames;
+
+	void add(const Json &e)
+	{
+		const Json *name = e.member("name"), *ph = e.member("ph"), *pid = e.member("pid"), *tid = e.member("tid");
+		if (e.Type != Json::Object || !name || name->Type != Json::String || !ph || ph->Type != Json::String
+		    || !pid || pid->Type != Json::Number || !tid || tid->Type != Json::Number)
+		{
+			Valid = false;
+			return;
+		}
+		if (ph->Str == "M")
+		{
+			const Json *args = e.member("args");
+			const Json *threadName = args ? args->member("name") : null;
+			if (name->Str != "thread_name" || !threadName || threadName->Type != Json::String) Valid = false;
+			++ThreadNames;
+			return;
+		}
+		const Json *cat = e.member("cat"), *ts = e.member("ts");
+		if (!cat || cat->Type != Json::String || !ts || ts->Type != Json::Number)
+		{
+			Valid = false;
+			return;
+		}
+		if (ph->Str == "X")
+		{
+			const Json *dur = e.member("dur");
+			if (!dur || dur->Type != Json::Number || dur->Num < 0) Valid = false;
+			if (cat->Str == "task" && name->Str.find("Work") != std::string::npos) ++Work;
+		}
+		else if (ph->Str == "i")
+		{
+			++Instants;
+			InstantNames.push_back(name->Str);
+		}
+		else
+		{
+			Valid = false;
+		}
+	}
+
+	void add(const std::vector<Json> &events)
+	{
+		for (const Json &e : events)
+			add(e);
+	}
+};
+
+const char *const c_TracePath = "test_014_trace.json";
+const char *const c_StreamPath = "test_014_trace_stream.json";
+const char *const c_OddName = "quote \" backslash \\ newline \n tab \t end";
+
+void testWrite()
+{
+	std::cout << "Write\n";
+	SEV_Trace_setEnabled(true);
+	check(SEV_Trace_enabled(), "enabled");
+	runWork(1000);
+	SEV_Trace_instant(c_OddName, null);
+	SEV_Trace_setEnabled(false);
+	SEV_Trace_instant("not recorded", null);
+	check(!SEV_Trace_write(c_TracePath), "write the file");
+	Json root;
+	check(parseFile(c_TracePath, root), "file is valid JSON");
+	const Json *events = root.member("traceEvents");
+	check(root.Type == Json::Object && events && events->Type == Json::Array, "events are under traceEvents");
+	EventCheck ec;
+	if (events) ec.add(events->Items);
+	check(ec.Valid, "every event has the fields of its phase");
+	check(ec.Work == 1000, "each functor is a complete event named by its type");
+	check(ec.ThreadNames >= 2, "threads are named");
+	check(std::count(ec.InstantNames.begin(), ec.InstantNames.end(), c_OddName) == 1, "names are escaped");
+	check(!std::count(ec.InstantNames.begin(), ec.InstantNames.end(), "not recorded"), "nothing is recorded when disabled");
+
+	check(!SEV_Trace_write(c_TracePath), "write again");
+	Json empty;
+	events = null;
+	check(parseFile(c_TracePath, empty) && (events = empty.member("traceEvents")) && events->Items.empty(), "written events are removed from the rings");
+	remove(c_TracePath);
+}
+
+void testStream()
+{
+	std::cout << "Stream\n";
+	check(!SEV_Trace_stream(c_StreamPath, 5), "start streaming");
+	check(SEV_Trace_stream(c_StreamPath, 5) == EBUSY, "second stream is refused");
+	check(SEV_Trace_write(c_TracePath) == EBUSY, "write is refused while streaming");
+	SEV_Trace_setEnabled(true);
+	for (int i = 0; i < 5; ++i)
+	{
+		runWork(1000);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10)); // Let the stream flush between the batches
+	}
+	SEV_Trace_setEnabled(false);
+	check(!SEV_Trace_stream(null, 0), "stop streaming");
+	check(!SEV_Trace_stream(null, 0), "stopping again does nothing");
+	Json root;
+	check(parseFile(c_StreamPath, root) && root.Type == Json::Array, "stream is a valid JSON array");
+	EventCheck ec;
+	ec.add(root.Items);
+	check(ec.Valid, "every streamed event has the fields of its phase");
+	check(ec.Work == 5000, "every functor was streamed once");
+
+	check(!SEV_Trace_stream(c_StreamPath, 5) && !SEV_Trace_stream(null, 0), "stream without events");
+	Json empty;
+	check(parseFile(c_StreamPath, empty) && empty.Type == Json::Array && empty.Items.empty(), "empty stream is valid JSON");
+	remove(c_StreamPath);
+}
+
+}
+
+int main()
+{
+	testWrite();
+	testStream();
+	std::cout << (s_Failures ? "FAILED\n" : "PASSED\n");
+	return s_Failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/* end of file */